@@ -604,6 +604,75 @@ function lfm.api.set_directory_tags(path, tags, cols) end
 ---@return string[]
 function lfm.api.get_cached_dirs() end
 
+---@class Lfm.AllocStats
+---@field arena_blocks integer Number of blocks allocated for files and their paths
+---@field arena_blocks_freed integer Number of blocks freed again
+---@field arena_allocs integer Number of allocations served from these blocks
+---@field arena_bytes integer Number of bytes served from these blocks
+
+---
+---Get counters of the memory allocated for loaded files, e.g. to compare the
+---number of heap allocations with the number of files loaded.
+---
+---Example:
+---```lua
+---  local stats = lfm.api.get_alloc_stats()
+---  print(stats.arena_allocs / stats.arena_blocks)
+---```
+---
+---@return Lfm.AllocStats
+function lfm.api.get_alloc_stats() end
+
+---@class Lfm.CacheStats
+---@field hits integer Number of lookups of entries already in the cache
+---@field misses integer Number of lookups that added a new entry
+---@field evictions integer Number of entries evicted to stay within the configured limits
+---@field entries integer Number of entries currently in the cache
+---@field bytes integer Approximate memory held by the cached entries
+
+---
+---Get counters of the directory cache.
+---
+---Example:
+---```lua
+---  local stats = lfm.api.get_dir_cache_stats()
+---  print(stats.hits / (stats.hits + stats.misses))
+---```
+---
+---@return Lfm.CacheStats
+function lfm.api.get_dir_cache_stats() end
+
+---
+---Get counters of the preview cache. Memory includes the decoded pixels of
+---image previews.
+---
+---Example:
+---```lua
+---  local stats = lfm.api.get_preview_cache_stats()
+---  print(stats.entries, stats.bytes)
+---```
+---
+---@return Lfm.CacheStats
+function lfm.api.get_preview_cache_stats() end
+
+---@class Lfm.AsyncStats
+---@field wakeups integer Number of times the main thread was woken up to process results of background work
+---@field results integer Number of results processed
+---@field max_batch integer Most results processed in a single wakeup
+---@field last_batch integer Results processed in the most recent wakeup
+
+---
+---Get counters of the results of background work processed on the main thread.
+---
+---Example:
+---```lua
+---  local stats = lfm.api.get_async_stats()
+---  print(stats.results / stats.wakeups)
+---```
+---
+---@return Lfm.AsyncStats
+function lfm.api.get_async_stats() end
+
 ---@class Lfm.ModeDef
 ---@field name string The name of the mode.
 ---@field is_input? boolean true, if the mode takes input via the command line
@@ -710,7 +779,7 @@ function lfm.api.get_modes() end
 ---| '"on_selection_change"'    # The selection changed
 ---| '"on_paste_buffer_change"' # The paste buffer changed
 ---| '"on_dir_loaded"'          # A new directory was loaded from disk, called with path
----| '"on_dir_updated"'         # A new directory was loaded from disk, called with path
+---| '"on_dir_updated"'         # A directory was reloaded from disk, called with path and the names of added and removed files (changed files appear in both, both are nil if all files were replaced)
 ---| '"on_mode_change"'         # Mode transition, called with mode name
 ---| '"on_focus_gained"'        # Terminal gained focus
 ---| '"on_focus_lost"'          # Terminal lost focus
@@ -5,6 +5,11 @@ lfm.fm = {}
 
 ---@alias Lfm.FilterFunction fun(name: string):any
 
+---@class Lfm.PasteOpts
+---@field dest? string Absolute path of the directory to paste into, `~` is expanded (default: the current directory)
+---@field jobs? integer Maximum number of threads used, at most a quarter of the thread pool (default: the maximum)
+---@field callback? fun(err?: string) Called when done, `err` is nil on success
+
 ---
 ---Set the filter string for the current directory. "" or nil clears the filter.
 ---
@@ -315,6 +320,34 @@ function lfm.fm.get_paste_mode() end
 ---@param mode Lfm.PasteMode (default: `"copy"`)
 function lfm.fm.set_paste_mode(mode) end
 
+---
+---Paste the load into a directory and clear it. Existing files are not
+---overwritten, the pasted file is named `name.~N~` instead. Runs on the thread
+---pool, the progress is shown in the statusline.
+---
+---Example:
+---```lua
+---  lfm.fm.paste({
+---    callback = function(err)
+---      print(err or "done")
+---    end,
+---  })
+---```
+---
+---@param opts? Lfm.PasteOpts
+function lfm.fm.paste(opts) end
+
+---
+---Cancel all running pastes. Files already pasted are kept, the callbacks are
+---called with the error `"cancelled"`.
+---
+---Example:
+---```lua
+---  lfm.fm.cancel_paste()
+---```
+---
+function lfm.fm.cancel_paste() end
+
 ---
 ---Add the current selection to the load and change mode to MODE_MOVE.
 ---
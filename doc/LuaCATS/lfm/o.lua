@@ -36,6 +36,12 @@
 ---@field histsize integer History size, must be non-negative (default: 100)
 ---@field infoline string|nil Infoline string
 ---@field threads integer Number of threads in the pool (at least 2, default: nprocs+1)
+---@field parallel_load_threshold integer Directories with at least this many entries are loaded by multiple threads, 0 disables (default: 5000)
+---@field dir_cache_entries integer Maximum number of directories kept in memory, least recently used ones that are not shown are evicted first, 0 disables (default: 1000)
+---@field dir_cache_bytes integer Memory budget in bytes for the directories kept in memory, 0 disables (default: 512 MiB)
+---@field preview_cache_bytes integer Memory budget in bytes for cached previews, counting text and decoded image pixels; least recently used previews that are not shown are evicted first, 0 disables (default: 256 MiB)
+---@field preview_disk_cache_bytes integer Size limit in bytes of the persistent cache of previews in the cache directory; previews are reused across sessions as long as the file and the size of the preview pane are unchanged, 0 disables (default: 128 MiB)
+---@field io_uring_depth integer Maximum number of concurrent stat requests per thread when loading directories on network filesystems via io_uring, 0 disables io_uring (default: 32)
 ---@field dir_settings table<string, Lfm.DirSetting>
 ---@field ratios integer[] assignable
 ---@field truncatechar string assignable, only the first character is used
@@ -44,14 +50,19 @@
 ---@field hidden boolean assignable (default: `false`)
 ---@field preview boolean assignable (default: `true`)
 ---@field preview_images boolean assignable (default: `false`)
+---@field preview_text boolean Preview files that look like text (no NUL bytes, valid UTF-8) by reading them directly instead of running the previewer. Only enable this if the previewer shows such files as they are, e.g. without syntax highlighting (default: `false`)
 ---@field previewer string assignable (default: "$datadir/preview.sh")
+---@field preview_servers integer Number of persistent previewer processes, started as `previewer --server`, that serve previews without forking for each file; the previewer has to support the protocol described in `runtime/preview.sh`. 0 forks the previewer for every preview (default: 0, at most 32)
 ---@field preview_delay integer delay in milliseconds after which previews are loaded (default: 0)
+---@field preview_prefetch integer Number of files in scroll direction whose previews are loaded in advance once the cursor rests, 0 disables (default: 2)
+---@field preview_prefetch_jobs integer Maximum number of previews prefetched at the same time, 0 disables prefetching (default: 2)
 ---@field icons boolean assignable (default: `false`)
 ---@field icon_map table<string, string> assignable
 ---@field colors Lfm.Colors
 ---@field inotify_blacklist string[] No inotify watchers will be installed if the path begins with any of these strings.
 ---@field inotify_timeout number Minimum time in milliseconds between reloads triggered by inotify. Must larger or equal to 100.
 ---@field inotify_delay number Small delay in milliseconds before reloads are triggered by inotify.
+---@field inotify_delta boolean Instead of reloading a directory when inotify reports changes, only stat the files that changed. Directories are reloaded completely only if events were lost. (default: `false`)
 ---@field tags boolean Enable directory tags.
 ---@field mapleader string Mapleader, first (multibyte) character only, use <leader> in mappings
 ---@field extra_env table<string, string> Extra environment variables, passed to processes in spawn and execute.
@@ -6,7 +6,6 @@ local api = lfm.api
 local fm = lfm.fm
 local util = lfm.util
 
-local stat = require("posix.sys.stat")
 local unistd = require("posix.unistd")
 local fs = require("lfm.fs")
 
@@ -198,37 +197,6 @@ function M.follow_link()
 	fm.select(fs.basename(target) --[[@as string]])
 end
 
--- TODO: this is useful, expose it somewhere (on 2022-03-11)
-local function chain(f, args, opts)
-	args = args or {}
-	opts = opts or {}
-	local co
-	local on_exit = opts.on_exit
-	opts.on_exit = function(r)
-		coroutine.resume(co, r)
-	end
-	co = coroutine.create(function()
-		local ret = 0
-		for _, arg in ipairs(args) do
-			local cmd = f(arg)
-			if cmd then
-				lfm.spawn(cmd, opts)
-				ret = coroutine.yield(co)
-				if ret ~= 0 and opts.errexit then
-					if on_exit then
-						on_exit(ret)
-					end
-					return
-				end
-			end
-		end
-		if on_exit then
-			on_exit(ret)
-		end
-	end)
-	coroutine.resume(co)
-end
-
 -- TODO: make a s mall module for ansi colors or put it in colors.lua
 local c27 = string.char(27)
 local green = c27 .. "[32m"
@@ -248,40 +216,34 @@ function M.paste()
 		return
 	end
 	local pwd = lfm.fm.getpwd()
-	--- spawning all these shells is fine with a sane amount of files
 	local reload_dirs = { [pwd] = true }
 	if mode == "move" then
 		for _, file in ipairs(files) do
 			reload_dirs[fs.dirname(file)] = true
 		end
 	end
-	local on_exit = function(ret)
-		for dir, _ in pairs(reload_dirs) do
-			fm.load(dir)
-		end
-		if ret ~= 0 then
-			return
-		end
-		local operation = mode == "move" and "moving" or "copying"
-		local msg =
-			string.format("%sfinished %s %d %s%s", green, operation, #files, #files == 1 and "file" or "files", clear)
-		print(msg)
-	end
-	chain(function(file)
-		local base = fs.basename(file)
-		local target = pwd .. "/" .. base
-		local num = 1
-		while stat.stat(target) do
-			target = string.format("%s/%s.~%d~", pwd, base, num)
-			num = num + 1
-		end
-		if mode == "move" then
-			return { "mv", "--", file, target }
-		else
-			return { "cp", "-r", "--", file, target }
-		end
-	end, files, { errexit = true, on_stderr = true, on_exit = on_exit })
-	fm.set_paste_buffer({})
+	fm.paste({
+		dest = pwd,
+		callback = function(err)
+			for dir, _ in pairs(reload_dirs) do
+				fm.load(dir)
+			end
+			if err then
+				lfm.error(err)
+				return
+			end
+			local operation = mode == "move" and "moving" or "copying"
+			local msg = string.format(
+				"%sfinished %s %d %s%s",
+				green,
+				operation,
+				#files,
+				#files == 1 and "file" or "files",
+				clear
+			)
+			print(msg)
+		end,
+	})
 end
 
 ---
@@ -55,6 +55,23 @@ local config
 ---@return Lfm.Rifle.Match[]
 function M.query(path, opts) end
 
+---
+---Query rifle for many files at once. Mime types are determined on the thread
+---pool, `callback` is called with a list of matches for each file, in order.
+---
+---```lua
+---  rifle.query_many(lfm.fm.get_selection(), { limit = 1 }, function(res)
+---    for i, matches in ipairs(res) do
+---      print(i, matches[1] and matches[1].command)
+---    end
+---  end)
+---```
+---
+---@param files string[]
+---@param opts? Lfm.Rifle.QueryOpts
+---@param callback fun(matches: Lfm.Rifle.Match[][])
+function M.query_many(files, opts, callback) end
+
 ---
 ---Query rifle for options how to run/open files with the given mimetype.
 ---
@@ -245,7 +262,7 @@ function M.setup(opts)
 end
 
 -- replace stubs with implementation to trick luals
-for _, v in ipairs({ "fileinfo", "nrules", "query", "query_mime" }) do
+for _, v in ipairs({ "fileinfo", "nrules", "query", "query_many", "query_mime" }) do
 	M[v] = M["_" .. v]
 end
 
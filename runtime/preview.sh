@@ -6,32 +6,61 @@
 set -o noclobber -o noglob -o pipefail
 IFS=$'\n'
 
-file_path=$1
-pv_width=$2
-pv_height=$3
-image_cache_path=$4
-pv_image_enabled=$5
+# Prints the preview of $file_path and exits with one of the codes lfm
+# understands.
+preview() {
+	mimetype=$(file --dereference --brief --mime-type -- "${file_path}")
 
-mimetype=$(file --dereference --brief --mime-type -- "${file_path}")
+	case $mimetype in
+	text/*)
+		head -"$PV_HEIGHT" "$file_path"
+		exit 2
+		;;
 
-case $mimetype in
-text/*)
-	head -"$PV_HEIGHT" "$file_path"
-	exit 2
-	;;
+	image/*)
+		exiftool "$file_path" && exit 3
+		exit 1
+		;;
 
-image/*)
-	exiftool "$file_path" && exit 3
-	exit 1
-	;;
+	video/* | audio/*)
+		mediainfo "$file_path" && exit 3
+		exiftool "$file_path" && exit 3
+		exit 1
+		;;
+	esac
 
-video/* | audio/*)
-	mediainfo "$file_path" && exit 3
-	exiftool "$file_path" && exit 3
+	# Fallback
+	echo '----- File Type Classification -----' && file --dereference --brief -- "$file_path" | fold -w "$pv_width" -s && exit 3
 	exit 1
-	;;
-esac
+}
+
+if [ "$1" = --server ]; then
+	# Persistent mode, see lfm.o.preview_servers. Requests are the usual
+	# arguments, each terminated by a NUL byte. The response is a line
+	# "<exit code> <size of the output>", followed by the output.
+	while IFS= read -r -d '' file_path &&
+		IFS= read -r -d '' pv_width &&
+		IFS= read -r -d '' pv_height &&
+		IFS= read -r -d '' image_cache_path &&
+		IFS= read -r -d '' pv_image_enabled; do
+		# the subshell catches the exit, the x keeps trailing newlines
+		output=$( (preview) </dev/null; printf 'x%d' "$?")
+		rc=${output##*x}
+		output=${output%x*}
+		# the size in bytes, not characters
+		lc_all=${LC_ALL-}
+		LC_ALL=C
+		size=${#output}
+		LC_ALL=$lc_all
+		printf '%d %d\n%s' "$rc" "$size" "$output"
+	done
+	exit 0
+fi
+
+file_path=$1
+pv_width=$2
+pv_height=$3
+image_cache_path=$4
+pv_image_enabled=$5
 
-# Fallback
-echo '----- File Type Classification -----' && file --dereference --brief -- "$file_path" | fold -w "$pv_width" -s && exit 3
-exit 1
+preview
@@ -0,0 +1,131 @@
+#include "arena.h"
+
+#include "memory.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <string.h>
+
+struct arena_block {
+  struct arena_block *prev;
+  usize size; // usable bytes in data
+  usize used;
+  alignas(max_align_t) char data[];
+};
+
+static struct {
+  atomic_uint_least64_t blocks;
+  atomic_uint_least64_t blocks_freed;
+  atomic_uint_least64_t allocs;
+  atomic_uint_least64_t bytes;
+} stats;
+
+#define STAT_ADD(field, n)                                                     \
+  atomic_fetch_add_explicit(&stats.field, (n), memory_order_relaxed)
+
+static inline usize align_up(usize n) {
+  return (n + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+}
+
+static struct arena_block *block_create(usize size) {
+  struct arena_block *b = xmalloc(sizeof *b + size);
+  if (unlikely(b == NULL))
+    return NULL;
+  b->prev = NULL;
+  b->size = size;
+  b->used = 0;
+  STAT_ADD(blocks, 1);
+  return b;
+}
+
+void *arena_alloc(struct arena *a, usize size) {
+  size = align_up(size);
+  struct arena_block *b = a->head;
+  if (unlikely(b == NULL || b->size - b->used < size)) {
+    if (size > ARENA_BLOCK_SIZE / 4) {
+      // oversized allocations get their own block behind the current one so
+      // that the remainder of the current block is not wasted
+      struct arena_block *big = block_create(size);
+      if (unlikely(big == NULL))
+        return NULL;
+      big->used = size;
+      if (b) {
+        big->prev = b->prev;
+        b->prev = big;
+      } else {
+        a->head = big;
+      }
+      a->bytes += size;
+      STAT_ADD(allocs, 1);
+      STAT_ADD(bytes, size);
+      return big->data;
+    }
+    b = block_create(ARENA_BLOCK_SIZE);
+    if (unlikely(b == NULL))
+      return NULL;
+    b->prev = a->head;
+    a->head = b;
+    a->bytes += ARENA_BLOCK_SIZE;
+  }
+  void *p = b->data + b->used;
+  b->used += size;
+  STAT_ADD(allocs, 1);
+  STAT_ADD(bytes, size);
+  return p;
+}
+
+void *arena_calloc(struct arena *a, usize size) {
+  void *p = arena_alloc(a, size);
+  if (likely(p != NULL))
+    memset(p, 0, size);
+  return p;
+}
+
+char *arena_strndup(struct arena *a, const char *str, usize len) {
+  char *p = arena_alloc(a, len + 1);
+  if (unlikely(p == NULL))
+    return NULL;
+  memcpy(p, str, len);
+  p[len] = 0;
+  return p;
+}
+
+void arena_merge(struct arena *dst, struct arena *src) {
+  if (src->head == NULL)
+    return;
+  if (dst->head == NULL) {
+    *dst = arena_move(src);
+    return;
+  }
+  // append the blocks of src behind the current block of dst
+  struct arena_block *last = src->head;
+  while (last->prev != NULL)
+    last = last->prev;
+  last->prev = dst->head->prev;
+  dst->head->prev = src->head;
+  dst->bytes += src->bytes;
+  *src = arena_init();
+}
+
+void arena_drop(struct arena *a) {
+  struct arena_block *b = a->head;
+  u64 n = 0;
+  while (b) {
+    struct arena_block *prev = b->prev;
+    xfree(b);
+    b = prev;
+    n++;
+  }
+  STAT_ADD(blocks_freed, n);
+  *a = arena_init();
+}
+
+struct arena_stats arena_get_stats(void) {
+  return (struct arena_stats){
+      .blocks = atomic_load_explicit(&stats.blocks, memory_order_relaxed),
+      .blocks_freed =
+          atomic_load_explicit(&stats.blocks_freed, memory_order_relaxed),
+      .allocs = atomic_load_explicit(&stats.allocs, memory_order_relaxed),
+      .bytes = atomic_load_explicit(&stats.bytes, memory_order_relaxed),
+  };
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// A simple bump allocator. Memory is handed out from large blocks and can only
+// be released all at once, by dropping the arena. Not thread safe, use one
+// arena per thread and merge them afterwards.
+
+#include "defs.h"
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block;
+
+struct arena {
+  struct arena_block *head; // current block, links to the previous ones
+  usize bytes;              // total size of all blocks
+};
+
+// Global counters over all arenas, updated with relaxed ordering.
+struct arena_stats {
+  u64 blocks;       // blocks allocated from the heap
+  u64 blocks_freed; // blocks returned to the heap
+  u64 allocs;       // allocations served from arenas
+  u64 bytes;        // bytes handed out by arenas
+};
+
+static inline struct arena arena_init(void) {
+  return (struct arena){0};
+}
+
+// Returns `size` bytes suitably aligned for any type. Returns NULL if out of
+// memory.
+void *arena_alloc(struct arena *a, usize size);
+
+// Like `arena_alloc`, but zeroes the memory.
+void *arena_calloc(struct arena *a, usize size);
+
+// Copies `len` bytes of `str` into the arena and NUL terminates them.
+char *arena_strndup(struct arena *a, const char *str, usize len);
+
+// Moves all blocks of `src` to `dst`, leaving `src` empty. Allocations from
+// `dst` continue in its current block.
+void arena_merge(struct arena *dst, struct arena *src);
+
+// Frees all memory of the arena, it can be reused afterwards.
+void arena_drop(struct arena *a);
+
+static inline struct arena arena_move(struct arena *a) {
+  struct arena res = *a;
+  *a = arena_init();
+  return res;
+}
+
+struct arena_stats arena_get_stats(void);
@@ -3,43 +3,48 @@
 #include "defs.h"
 #include "lfm.h" // to_lfm
 #include "loop.h"
+#include "preview_server.h"
 
 #include <ev.h>
 #include <stc/cstr.h>
 
 #include <stdatomic.h>
-#include <stdio.h>
 
-#include <pthread.h>
 #include <sys/sysinfo.h>
 
-static struct result *result_queue_get(struct result_queue *queue);
+static struct result *result_queue_take(struct result_queue *queue);
 
 static void async_result_cb(EV_P_ ev_async *w, int revents) {
   (void)revents;
   struct async_ctx *async = w->data;
 
-  struct result *res;
-  while ((res = result_queue_get(&async->queue))) {
+  // results submitted while we run the callbacks trigger another wakeup
+  u64 n = 0;
+  struct result *res = result_queue_take(&async->queue);
+  while (res) {
+    struct result *next = res->next;
+    res->next = NULL;
     if (!is_cancelled(res))
       res->callback(res, to_lfm(async));
     res->destroy(res);
+    res = next;
+    n++;
   }
+
+  async->stats.wakeups++;
+  async->stats.results += n;
+  async->stats.last_batch = n;
+  if (n > async->stats.max_batch)
+    async->stats.max_batch = n;
 }
 
 void async_ctx_init(struct async_ctx *async) {
   memset(async, 0, sizeof *async);
-
-  pthread_mutex_init(&async->queue.mutex, NULL);
+  atomic_init(&async->queue.head, NULL);
 
   ev_async_init(&async->result_watcher, async_result_cb);
   ev_async_start(event_loop, &async->result_watcher);
 
-  if (unlikely(pthread_mutex_init(&async->queue.mutex, NULL) != 0)) {
-    perror("pthread_mutex_init");
-    exit(EXIT_FAILURE);
-  }
-
   async->result_watcher.data = async;
 
   ev_async_send(EV_DEFAULT_ & async->result_watcher);
@@ -52,43 +57,52 @@ void async_ctx_deinit(struct async_ctx *async) {
   atomic_store_explicit(&async->stop, 1, memory_order_relaxed);
   async_preview_cancel(async);
   set_result_drop(&async->in_progress.lua_previews);
+  set_result_drop(&async->in_progress.cached_previews);
   set_result_drop(&async->in_progress.inotify);
   set_result_drop(&async->in_progress.dirs);
   set_ev_child_drop(&async->in_progress.previewer_children);
+  async_transfer_cancel(async);
+  set_result_drop(&async->in_progress.transfers);
+  ev_timer_stop(event_loop, &async->transfer_timer);
 
   tpool_wait(async->tpool);
   tpool_destroy(async->tpool);
+  preview_server_stop_all();
 
-  struct result *res;
-  while ((res = result_queue_get(&async->queue)))
+  struct result *res = result_queue_take(&async->queue);
+  while (res) {
+    struct result *next = res->next;
     res->destroy(res);
-  pthread_mutex_destroy(&async->queue.mutex);
+    res = next;
+  }
 }
 
+// Called from any thread.
 static inline void result_queue_put(struct result_queue *queue,
                                     struct result *res) {
-  pthread_mutex_lock(&queue->mutex);
-  if (!queue->head) {
-    queue->head = res;
-    queue->tail = res;
-  } else {
-    queue->tail->next = res;
-    queue->tail = res;
-  }
-  pthread_mutex_unlock(&queue->mutex);
+  struct result *head =
+      atomic_load_explicit(&queue->head, memory_order_relaxed);
+  do {
+    res->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &queue->head, &head, res, memory_order_release, memory_order_relaxed));
 }
 
-static inline struct result *result_queue_get(struct result_queue *queue) {
-  pthread_mutex_lock(&queue->mutex);
-  struct result *res = queue->head;
-  if (res) {
-    queue->head = res->next;
-    res->next = NULL;
-    if (queue->tail == res)
-      queue->tail = NULL;
+// Takes all queued results, in the order they were submitted. Only called
+// from the main thread. Since the consumer never takes single nodes off the
+// list, the push above does not suffer from ABA.
+static inline struct result *result_queue_take(struct result_queue *queue) {
+  struct result *res =
+      atomic_exchange_explicit(&queue->head, NULL, memory_order_acquire);
+  // the chain is newest first, reverse it
+  struct result *prev = NULL;
+  while (res) {
+    struct result *next = res->next;
+    res->next = prev;
+    prev = res;
+    res = next;
   }
-  pthread_mutex_unlock(&queue->mutex);
-  return res;
+  return prev;
 }
 
 void submit_async_result(struct async_ctx *async, struct result *res) {
@@ -1,9 +1,12 @@
 #pragma once
 
+#include "defs.h"
 #include "types/bytes.h"
 #include "types/vec_bytes.h"
+#include "types/vec_cstr.h"
 
 #include <ev.h>
+#include <stc/zsview.h>
 
 #include <pthread.h>
 #include <stdatomic.h>
@@ -12,20 +15,30 @@
 struct Dir;
 struct Preview;
 struct Lfm;
+struct cancel_token;
 
 #include <stc/types.h>
 declare_hset(set_ev_child, struct ev_child *);
 declare_hset(set_result, struct result *);
 
+// Intrusive multi-producer single-consumer queue of finished work. Workers
+// push onto `head`, the main thread takes the whole chain at once.
 struct result_queue {
-  struct result *head;
-  struct result *tail;
-  pthread_mutex_t mutex;
+  _Atomic(struct result *) head; // most recently submitted result
+};
+
+// Counters of the main thread processing results, only accessed from there.
+struct async_stats {
+  u64 wakeups;   // result watcher invocations
+  u64 results;   // results processed
+  u64 max_batch; // most results processed in a single wakeup
+  u64 last_batch;
 };
 
 struct async_ctx {
   struct tpool *tpool;
   struct result_queue queue;
+  struct async_stats stats;
   atomic_bool stop; // we store/load with relaxed
   ev_async result_watcher;
   struct { // Data we track for cancelling and quicker shutdown.
@@ -34,11 +47,14 @@ struct async_ctx {
     // not called, so it must be removed if needed.
     set_ev_child previewer_children;
     set_result lua_previews;
+    set_result cached_previews; // disk cache lookups
     set_result dirs;
     set_result inotify;
     struct result *inotify_preview;
     struct result *chdir;
+    set_result transfers; // cancelled via their tokens, see below
   } in_progress;
+  ev_timer transfer_timer; // redraws the progress while pasting
 };
 
 void async_ctx_init(struct async_ctx *async);
@@ -53,6 +69,11 @@ void async_dir_check(struct async_ctx *async, struct Dir *dir);
 void async_dir_load(struct async_ctx *async, struct Dir *dir,
                     bool load_fileinfo);
 
+// Stats the files in `dir->load.delta_names` and applies the result to `dir`,
+// unless `dir` is reloaded in the meantime. Only one update per directory is
+// in progress, names added meanwhile are handled afterwards.
+void async_dir_delta(struct async_ctx *async, struct Dir *dir);
+
 // Check the modification time of `pv` on disk. Possibly generates a `res_t` to
 // trigger reloading the preview.
 void async_preview_check(struct async_ctx *async, struct Preview *pv);
@@ -60,6 +81,16 @@ void async_preview_check(struct async_ctx *async, struct Preview *pv);
 // Reloads preview of the file at `path` with `nrow` lines from disk.
 void async_preview_load(struct async_ctx *async, struct Preview *pv);
 
+// Like `async_preview_load`, but with low priority, for a file the cursor is
+// likely to move to. The load is cancelled together with `cancel`, see
+// `async_preview_abort`.
+void async_preview_prefetch(struct async_ctx *async, struct Preview *pv,
+                            struct cancel_token *cancel);
+
+// Cancels the prefetches started with `cancel` and kills their previewers.
+// Their previews are not updated.
+void async_preview_abort(struct async_ctx *async, struct cancel_token *cancel);
+
 // change directory to the given path, optionally run on_chdir hook
 void async_chdir(struct async_ctx *async, const char *path, bool run_hook);
 
@@ -83,4 +114,42 @@ void async_preview_cancel(struct async_ctx *async);
 void async_lua(struct async_ctx *async, struct bytes chunk,
                struct vec_bytes args, int ref);
 
-void async_lua_preview(struct async_ctx *async, struct Preview *pv);
+// Copies or moves `files` into the directory `dest`, see transfer.h. Uses up
+// to `jobs` threads of the pool's transfer lane, as many as the lane allows if
+// 0. The callback `ref` is called with nil on success, otherwise with an error
+// message. Takes ownership of `files`.
+void async_transfer(struct async_ctx *async, vec_cstr files, zsview dest,
+                    bool move, u32 jobs, int ref);
+
+// Stops all transfers. Files already copied or moved stay in place, the
+// callbacks are still called.
+void async_transfer_cancel(struct async_ctx *async);
+
+// Sum of the progress of all running transfers.
+struct transfer_progress {
+  u32 transfers;
+  u32 files;        // pasted, not counting the contents of directories
+  u64 entries_done; // files, directories and links, including contents
+  u64 bytes_done;
+  bool move; // of the most recent transfer
+};
+
+// Returns false if no transfer is running.
+bool async_transfer_progress(struct async_ctx *async,
+                             struct transfer_progress *progress);
+
+// Files whose real paths and mime types are resolved by `async_mime_query`.
+// Usually embedded in a struct that carries what the callback needs.
+struct mime_query {
+  vec_cstr files;
+  vec_cstr paths; // real paths, empty if the file doesn't exist
+  vec_cstr mimes; // empty if unknown
+  // called on the main thread once all files are resolved
+  void (*callback)(struct mime_query *, struct Lfm *);
+  void (*destroy)(struct mime_query *);
+};
+
+// Resolves the files of `query` on the thread pool, spread over multiple
+// workers if there are many. Takes ownership of `query`.
+void async_mime_query(struct async_ctx *async, struct mime_query *query);
+
@@ -77,5 +77,5 @@ void async_chdir(struct async_ctx *async, const char *path, bool run_hook) {
   cancel(async->in_progress.chdir);
   async->in_progress.chdir = &work->super;
 
-  tpool_add_work(async->tpool, worker, work, true);
+  tpool_add_job(async->tpool, &work->super.job, worker, work, TPOOL_PROBE);
 }
@@ -66,5 +66,5 @@ void async_dir_check(struct async_ctx *async, Dir *dir) {
   set_result_insert(&async->in_progress.dirs, &work->super);
 
   log_trace("checking directory %s", dir_path_str(dir));
-  tpool_add_work(async->tpool, worker, work, true);
+  tpool_add_job(async->tpool, &work->super.job, worker, work, TPOOL_PROBE);
 }
@@ -0,0 +1,135 @@
+#include "private.h"
+
+#include "arena.h"
+#include "defs.h"
+#include "dir.h"
+#include "file.h"
+#include "fm.h"
+#include "hooks.h"
+#include "lfm.h"
+#include "log.h"
+#include "memory.h"
+#include "ui.h"
+
+#include <stc/cstr.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct dir_delta_work {
+  struct result super;
+  struct async_ctx *async;
+  Dir *dir; // only access constant properties, such as path
+  u32 cookie;
+  vec_cstr names;
+  // new version of each file in `names`, NULL if removed; NULL if the
+  // directory could not be opened
+  File **files;
+  struct arena arena;
+  struct stat stat; // of the directory itself
+  i32 stat_err; // -1 if the directory could not be stat'ed
+};
+
+static void destroy(void *p) {
+  struct dir_delta_work *work = p;
+  dir_dec_ref(work->dir);
+  vec_cstr_drop(&work->names);
+  xfree(work->files);
+  arena_drop(&work->arena);
+  xfree(work);
+}
+
+static void callback(void *p, Lfm *lfm) {
+  struct dir_delta_work *work = p;
+  Dir *dir = work->dir;
+  set_result_erase(&lfm->async.in_progress.dirs, &work->super);
+  dir->load.delta_active = false;
+
+  // discard if a full reload has been scheduled in the meantime, it includes
+  // the changes
+  if (work->files && dir->load.cookie == work->cookie &&
+      dir->status == DIR_LOADED && dir->view.flatten_level == 0) {
+    struct dir_delta delta;
+    dir_update_files(dir, work->names.data, work->files, work->names.size,
+                     &delta);
+    if (work->stat_err == 0)
+      dir->stat = work->stat;
+    if (delta.added.size + delta.removed.size > 0) {
+      LFM_RUN_HOOK(lfm, LFM_HOOK_DIRUPDATED, dir_path(dir), &delta.added,
+                   &delta.removed);
+      if (dir->ui.visible) {
+        if (fm_current_dir(&lfm->fm) == dir)
+          ui_on_cursor_moved(&lfm->ui, true);
+        else
+          ui_redraw(&lfm->ui, REDRAW_FM);
+      }
+    }
+    dir_delta_drop(&delta);
+  }
+
+  // names reported while we were busy
+  if (!vec_cstr_is_empty(&dir->load.delta_names))
+    async_dir_delta(&lfm->async, dir);
+}
+
+static int compare_names(const void *a, const void *b) {
+  return cstr_cmp((const cstr *)a, (const cstr *)b);
+}
+
+static void worker(void *arg) {
+  struct dir_delta_work *work = arg;
+
+  // the same file is usually reported multiple times
+  vec_cstr *names = &work->names;
+  qsort(names->data, names->size, sizeof *names->data, compare_names);
+  isize j = 0;
+  c_foreach(it, vec_cstr, *names) {
+    if (j > 0 && cstr_eq(&names->data[j - 1], it.ref))
+      cstr_drop(it.ref);
+    else
+      names->data[j++] = *it.ref;
+  }
+  names->size = j;
+
+  const char *path = dir_path_str(work->dir);
+  i32 fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (unlikely(fd < 0)) {
+    // nothing is applied, dir_check will pick this up
+    submit_async_result(work->async, (struct result *)work);
+    return;
+  }
+  work->files = xcalloc(names->size, sizeof *work->files);
+  for (isize i = 0; i < names->size; i++) {
+    File *file =
+        file_create(&work->arena, path, cstr_str(&names->data[i]), fd, true);
+    if (file && file_isdir(file))
+      file_load_dircount(file);
+    work->files[i] = file;
+  }
+  work->stat_err = fstat(fd, &work->stat);
+  close(fd);
+
+  submit_async_result(work->async, (struct result *)work);
+}
+
+void async_dir_delta(struct async_ctx *async, Dir *dir) {
+  if (dir->load.delta_active || vec_cstr_is_empty(&dir->load.delta_names))
+    return;
+
+  struct dir_delta_work *work = xcalloc(1, sizeof *work);
+  work->super.callback = &callback;
+  work->super.destroy = &destroy;
+
+  work->async = async;
+  work->dir = dir_inc_ref(dir);
+  work->cookie = dir->load.cookie;
+  work->names = vec_cstr_move(&dir->load.delta_names);
+  dir->load.delta_active = true;
+
+  set_result_insert(&async->in_progress.dirs, &work->super);
+
+  log_trace("updating %zu files in %s", (usize)work->names.size,
+            dir_path_str(dir));
+  tpool_add_job(async->tpool, &work->super.job, worker, work, TPOOL_BACKGROUND);
+}
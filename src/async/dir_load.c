@@ -1,5 +1,6 @@
 #include "private.h"
 
+#include "config.h"
 #include "defs.h"
 #include "dir.h"
 #include "file.h"
@@ -21,9 +22,9 @@
 
 struct fileinfo {
   File *file;
-  i32 count;        // number of files, if it is a directory, -1 if no result
-  struct stat stat; // stat of the link target, if it is a symlink
-  int ret;          // -1: stat failed, 0: stat success, >0 no stat result
+  i32 count;             // number of files, if it is a directory, -1 if none
+  struct file_stat stat; // stat of the link target, if it is a symlink
+  int ret;               // -1: stat failed, 0: stat success, >0 no stat result
 };
 
 struct file_path_tup {
@@ -59,7 +60,7 @@ static inline void set_dircount(Dir *dir, File *file, u32 count) {
   file_set_dircount(file, count);
   struct tuple_mtime_count tup = {
       .count = count,
-      .mtime = file->stat.st_mtim.tv_sec,
+      .mtime = file_stat(file)->mtime,
   };
   map_str_int_emplace(&dir->load.dircounts, file_name_str(file), tup);
 }
@@ -68,11 +69,16 @@ static void fileinfo_callback(void *p, Lfm *lfm) {
   struct fileinfo_result *res = p;
   // discard if any other update has been scheduled in the meantime
   if (res->cookie == res->dir->load.cookie) {
+    // only files with a new stat can change their position, dircounts don't
+    // affect the order
+    vec_file changed = vec_file_init();
     c_foreach(it, fileinfos, res->infos) {
       if (it.ref->ret == 0) {
-        it.ref->file->stat = it.ref->stat;
+        file_set_link_stat(it.ref->file, &res->dir->arena, &it.ref->stat);
+        vec_file_push(&changed, it.ref->file);
       } else if (it.ref->ret == -1) {
         it.ref->file->isbroken = true;
+        vec_file_push(&changed, it.ref->file);
       }
 
       if (it.ref->count >= 0) {
@@ -85,13 +91,14 @@ static void fileinfo_callback(void *p, Lfm *lfm) {
     if (res->dir->ui.ind != 0) {
       // if the cursor doesn't rest on the first file, try to reselect it
       File *file = dir_current_file(res->dir);
-      dir_sort(res->dir, false);
+      dir_resort_files(res->dir, changed.data, changed.size);
       if (file && dir_current_file(res->dir) != file) {
         dir_move_cursor_to_name(res->dir, file_name(file));
       }
     } else {
-      dir_sort(res->dir, false);
+      dir_resort_files(res->dir, changed.data, changed.size);
     }
+    vec_file_drop(&changed);
     ui_on_cursor_moved(&lfm->ui, true);
   }
 }
@@ -109,13 +116,14 @@ fileinfo_result_create(Dir *dir, u32 cookie, fileinfos infos, bool is_last) {
   return res;
 }
 
-// Not a worker function because we just call it from async_dir_load_worker
+// Queued as a background job by async_dir_load_worker
 // dircounts will be dropped and not returned to the original directory
 // TODO: this creates two fileinfo items for every symlink that points to a
 // directory
 static void async_load_fileinfo(struct async_ctx *async, Dir *dir, u32 cookie,
                                 u32 n, struct file_path_tup *files,
-                                map_str_int dircounts) {
+                                map_str_int dircounts,
+                                const cancel_token *cancel) {
   fileinfos infos = fileinfos_init();
 
   u64 latest = current_millis();
@@ -128,10 +136,12 @@ static void async_load_fileinfo(struct async_ctx *async, Dir *dir, u32 cookie,
     struct fileinfo *info =
         fileinfos_push(&infos, ((struct fileinfo){files[i].file, .count = -1}));
 
-    info->ret = stat(files[i].path, &info->stat);
+    struct stat st;
+    info->ret = stat(files[i].path, &st);
     if (info->ret == 0) {
+      file_stat_from_stat(&info->stat, &st);
       // make sure we load directory counts afterwards
-      files[i].mode = info->stat.st_mode;
+      files[i].mode = st.st_mode;
     }
 
     u64 now = current_millis();
@@ -142,9 +152,9 @@ static void async_load_fileinfo(struct async_ctx *async, Dir *dir, u32 cookie,
 
       infos = fileinfos_init();
       latest = now;
-      if (atomic_load_explicit(&async->stop, memory_order_relaxed))
-        goto finalize;
     }
+    if (cancel_token_is_cancelled(cancel))
+      goto finalize;
   }
 
   // load dircounts for directories
@@ -179,10 +189,9 @@ static void async_load_fileinfo(struct async_ctx *async, Dir *dir, u32 cookie,
 
       infos = fileinfos_init();
       latest = now;
-
-      if (atomic_load_explicit(&async->stop, memory_order_relaxed))
-        goto finalize;
     }
+    if (cancel_token_is_cancelled(cancel))
+      goto finalize;
   }
 
 finalize:
@@ -198,6 +207,24 @@ finalize:
   map_str_int_drop(&dircounts);
 }
 
+struct fileinfo_work {
+  struct async_ctx *async;
+  Dir *dir;
+  u32 cookie;
+  u32 n;
+  struct file_path_tup *files;
+  map_str_int dircounts;
+  cancel_token *cancel;
+};
+
+static void fileinfo_worker(void *arg) {
+  struct fileinfo_work *work = arg;
+  async_load_fileinfo(work->async, work->dir, work->cookie, work->n,
+                      work->files, work->dircounts, work->cancel);
+  cancel_token_unref(work->cancel);
+  xfree(work);
+}
+
 struct dir_update_work {
   struct result super;
   struct async_ctx *async;
@@ -207,10 +234,12 @@ struct dir_update_work {
   Dir *update;
   u32 level;
   map_str_int dircounts;
+  struct dir_load_parallel parallel;
 };
 
 static void dir_update_destroy(void *p) {
   struct dir_update_work *work = p;
+  cancel_token_unref(work->super.token);
   dir_dec_ref(work->dir);
   dir_destroy(work->update);
   map_str_int_drop(&work->dircounts);
@@ -221,6 +250,11 @@ static void dir_update_callback(void *p, Lfm *lfm) {
   struct dir_update_work *work = p;
   Dir *dir = work->dir;
   Dir *update = work->update;
+  set_result_erase(&lfm->async.in_progress.dirs, &work->super);
+  // the directory was dropped from the cache while loading, the partial result
+  // would show the files not read yet as removed
+  if (cancel_token_is_cancelled(work->super.token))
+    return;
   if (dir->load.cookie == work->cookie) {
     loader_callback(&lfm->loader, &dir->loadable);
     // apply any keyfuncs before sorting in dir_update_with
@@ -228,8 +262,13 @@ static void dir_update_callback(void *p, Lfm *lfm) {
       lfm_lua_apply_keyfunc(lfm, update, false);
     else if (dir->settings.sorttype == SORT_RAND)
       dir_apply_random_keys(update, dir->settings.salt);
-    dir_update_with(dir, update);
-    LFM_RUN_HOOK(lfm, LFM_HOOK_DIRUPDATED, dir_path(dir));
+    struct dir_delta delta;
+    dir_update_with(dir, update, &delta);
+    // added/removed are nil if all files were replaced
+    LFM_RUN_HOOK(lfm, LFM_HOOK_DIRUPDATED, dir_path(dir),
+                 delta.full ? NULL : &delta.added,
+                 delta.full ? NULL : &delta.removed);
+    dir_delta_drop(&delta);
     if (dir->ui.visible) {
       if (fm_current_dir(&lfm->fm) == dir)
         ui_on_cursor_moved(&lfm->ui, true);
@@ -238,41 +277,46 @@ static void dir_update_callback(void *p, Lfm *lfm) {
     }
     dir->ui.last_loading_action = 0;
     work->update = NULL;
+    // the directory might have grown
+    loader_dir_cache_trim(&lfm->loader);
   }
 }
 
 static void async_dir_load_worker(void *arg) {
   struct dir_update_work *work = arg;
   struct async_ctx *async = work->async;
+  const cancel_token *cancel = work->super.token;
 
   map_str_int dircounts = map_str_int_move(&work->dircounts);
 
   if (work->level == 0) {
     work->update = dir_load(dir_path(work->dir), map_str_int_move(&dircounts),
-                            work->load_fileinfo, &async->stop);
+                            work->load_fileinfo, work->parallel, cancel);
   } else {
     if (work->load_fileinfo) {
       // only pass dircounts if we use it now,
       // otherwise it will be passed to the function that loads
       // dircounts, and freed there
-      work->update = dir_load_flat(dir_path(work->dir), work->level,
-                                   map_str_int_move(&dircounts),
-                                   work->load_fileinfo, &async->stop);
+      work->update = dir_load_flat(
+          dir_path(work->dir), work->level, map_str_int_move(&dircounts),
+          work->load_fileinfo, work->parallel, cancel);
     } else {
-      work->update =
-          dir_load_flat(dir_path(work->dir), work->level, map_str_int_init(),
-                        work->load_fileinfo, &async->stop);
+      work->update = dir_load_flat(dir_path(work->dir), work->level,
+                                   map_str_int_init(), work->load_fileinfo,
+                                   work->parallel, cancel);
     }
   }
 
   u32 num_files = vec_file_size(&work->update->files_all);
 
   if (work->load_fileinfo || num_files == 0 ||
-      atomic_load_explicit(&async->stop, memory_order_relaxed)) {
-    submit_async_result(work->async, (struct result *)work);
+      cancel_token_is_cancelled(cancel)) {
+    Dir *dir = work->dir;
+    bool load_fileinfo = work->load_fileinfo;
+    submit_async_result(async, (struct result *)work);
     map_str_int_drop(&dircounts);
-    if (!work->load_fileinfo)
-      dir_dec_ref(work->dir); // release the extra ref
+    if (!load_fileinfo)
+      dir_dec_ref(dir); // release the extra ref
 
     return;
   }
@@ -282,25 +326,35 @@ static void async_dir_load_worker(void *arg) {
   int j = 0;
   c_foreach(it, vec_file, work->update->files_all) {
     File *file = *it.ref;
-    if (S_ISLNK(file->lstat.st_mode) || S_ISDIR(file->lstat.st_mode)) {
+    if (S_ISLNK(file->lstat.mode) || S_ISDIR(file->lstat.mode)) {
       files[j].file = file;
       files[j].path = zsview_strdup(file_path(file));
       // if the directory is flattened, this can contain leading path components
       files[j].name =
           files[j].path + (file_name_str(file) - file_path_str(file));
-      files[j].mode = file->lstat.st_mode;
-      files[j].mtime = file->stat.st_mtim.tv_sec;
+      files[j].mode = file->lstat.mode;
+      files[j].mtime = file_stat(file)->mtime;
       j++;
     }
   }
 
-  /* Copy these because the main thread can invalidate the work
-   * struct in rare cases before we can call async_load_fileinfo */
-  Dir *dir = work->dir;
+  // dircounts and link targets don't hold up other directories that are
+  // waiting to be displayed
+  struct fileinfo_work *fileinfo = xmalloc(sizeof *fileinfo);
+  *fileinfo = (struct fileinfo_work){
+      .async = async,
+      .dir = work->dir,
+      .cookie = work->cookie,
+      .n = j,
+      .files = files,
+      .dircounts = dircounts,
+      .cancel = cancel_token_ref(work->super.token),
+  };
 
+  // the main thread can invalidate the work struct once it is submitted
   submit_async_result(work->async, (struct result *)work);
 
-  async_load_fileinfo(async, dir, work->cookie, j, files, dircounts);
+  tpool_add_work(async->tpool, fileinfo_worker, fileinfo, TPOOL_BACKGROUND);
 }
 
 void async_dir_load(struct async_ctx *async, Dir *dir, bool load_fileinfo) {
@@ -330,17 +384,34 @@ void async_dir_load(struct async_ctx *async, Dir *dir, bool load_fileinfo) {
   work->load_fileinfo = load_fileinfo;
   work->level = dir->view.flatten_level;
   work->dircounts = map_str_int_move(&dir->load.dircounts);
+  // reloads of directories that are not shown can wait, everything else is
+  // displayed as soon as it is loaded
+  enum tpool_lane lane = dir->status == DIR_LOADED && !dir->ui.visible
+                             ? TPOOL_BACKGROUND
+                             : TPOOL_FOREGROUND;
+  work->parallel = (struct dir_load_parallel){
+      .tpool = async->tpool,
+      .threshold = cfg.parallel_load_threshold,
+      .lane = lane,
+  };
   // we simply discard the update in the callback if another reload is requested
   // before the previous one is applied.
   work->cookie = ++dir->load.cookie;
+  // the previous load is superseded, stop reading and stat'ing for it
+  cancel_token_cancel(dir->load.cancel);
+  cancel_token_unref(dir->load.cancel);
+  dir->load.cancel = cancel_token_create(&async->stop);
+  work->super.token = cancel_token_ref(dir->load.cancel);
+
+  set_result_insert(&async->in_progress.dirs, &work->super);
 
   log_trace("loading directory %s level=%d file_info=%d", dir_path_str(dir),
             dir->view.flatten_level, load_fileinfo);
-  tpool_add_work(async->tpool, async_dir_load_worker, work, true);
+  tpool_add_job(async->tpool, &work->super.job, async_dir_load_worker, work,
+                lane);
 }
 
 void async_dir_cancel(struct async_ctx *async) {
-  (void)async;
   c_foreach(it, set_result, async->in_progress.dirs) {
     cancel(*it.ref);
   }
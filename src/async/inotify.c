@@ -60,7 +60,7 @@ void async_inotify_add(struct async_ctx *async, Dir *dir) {
 
   log_trace("adding inotify watcher %s", dir_path_str(dir));
   set_result_insert(&async->in_progress.inotify, &work->super);
-  tpool_add_work(async->tpool, worker, work, true);
+  tpool_add_job(async->tpool, &work->super.job, worker, work, TPOOL_PROBE);
 }
 
 void async_inotify_add_previewed(struct async_ctx *async, Dir *dir) {
@@ -75,7 +75,7 @@ void async_inotify_add_previewed(struct async_ctx *async, Dir *dir) {
   async->in_progress.inotify_preview = &work->super;
 
   log_trace("adding inotify watcher %s", dir_path_str(dir));
-  tpool_add_work(async->tpool, worker, work, true);
+  tpool_add_job(async->tpool, &work->super.job, worker, work, TPOOL_PROBE);
 }
 
 void async_inotify_cancel(struct async_ctx *async) {
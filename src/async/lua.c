@@ -172,5 +172,5 @@ void async_lua(struct async_ctx *async, bytes chunk, vec_bytes args, int ref) {
   work->ref = ref;
 
   log_trace("async_lua");
-  tpool_add_work(async->tpool, worker, work, true);
+  tpool_add_job(async->tpool, &work->super.job, worker, work, TPOOL_LUA);
 }
@@ -2,6 +2,7 @@
 
 #include "config.h"
 #include "lfm.h"
+#include "loader.h"
 #include "log.h"
 #include "lua/thread.h"
 #include "lua/util.h"
@@ -24,6 +25,7 @@ struct lua_preview_work {
 static void destroy(void *p) {
   struct lua_preview_work *work = p;
   bytes_drop(&work->chunk);
+  cancel_token_unref(work->super.token);
   preview_destroy(work->update);
   preview_dec_ref(work->preview);
   free(work);
@@ -31,10 +33,14 @@ static void destroy(void *p) {
 
 static void callback(void *p, Lfm *lfm) {
   struct lua_preview_work *work = p;
-  preview_update(work->preview, work->update);
-  work->update = NULL;
-  ui_redraw(&lfm->ui, REDRAW_PREVIEW);
   set_result_erase(&lfm->async.in_progress.lua_previews, p);
+  if (!cancel_token_is_cancelled(work->super.token)) {
+    preview_update(work->preview, work->update);
+    work->update = NULL;
+    ui_redraw(&lfm->ui, REDRAW_PREVIEW);
+    loader_preview_cache_trim(&lfm->loader);
+  }
+  loader_preview_prefetch_continue(&lfm->loader);
 }
 
 static void worker(void *arg) {
@@ -44,6 +50,11 @@ static void worker(void *arg) {
                                         work->height, work->width);
   work->update = pv;
 
+  // the previewer can't be interrupted, but we can skip it if it is no longer
+  // needed by the time we get to it
+  if (cancel_token_is_cancelled(work->super.token))
+    goto end;
+
   if (unlikely(L_thread == NULL)) {
     if (L_thread_init()) {
       // [err]
@@ -119,10 +130,12 @@ err:
   goto end;
 }
 
-void async_lua_preview(struct async_ctx *async, struct Preview *pv) {
+void async_lua_preview(struct async_ctx *async, struct Preview *pv,
+                       cancel_token *token, enum tpool_lane lane) {
   struct lua_preview_work *work = xcalloc(1, sizeof *work);
   work->super.callback = &callback;
   work->super.destroy = &destroy;
+  work->super.token = token;
 
   pv->status = PV_LOADED;
   pv->is_loading = true;
@@ -136,5 +149,5 @@ void async_lua_preview(struct async_ctx *async, struct Preview *pv) {
   set_result_insert(&async->in_progress.lua_previews, &work->super);
 
   log_trace("async_lua_preview %s", preview_path(pv).str);
-  tpool_add_work(async->tpool, worker, work, true);
+  tpool_add_job(async->tpool, &work->super.job, worker, work, lane);
 }
@@ -0,0 +1,85 @@
+#include "private.h"
+
+#include "lfm.h"
+#include "memory.h"
+#include "mime.h"
+
+#include <stc/cstr.h>
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include <linux/limits.h>
+
+// each worker resolves at least this many files
+#define MIME_FILES_PER_WORKER 16
+
+struct mime_work {
+  struct result super;
+  struct async_ctx *async;
+  struct mime_query *query;
+  atomic_uint next;    // next file to claim
+  atomic_uint workers; // workers that haven't finished yet
+};
+
+static void destroy(void *p) {
+  struct mime_work *work = p;
+  work->query->destroy(work->query);
+  xfree(work);
+}
+
+static void callback(void *p, Lfm *lfm) {
+  struct mime_work *work = p;
+  work->query->callback(work->query, lfm);
+}
+
+// Resolves files until none are left, the last worker to finish submits the
+// result.
+static void worker(void *arg) {
+  struct mime_work *work = arg;
+  struct mime_query *query = work->query;
+  u32 num = vec_cstr_size(&query->files);
+  u32 i;
+  while ((i = atomic_fetch_add(&work->next, 1)) < num) {
+    char path[PATH_MAX + 1];
+    if (unlikely(realpath(cstr_str(&query->files.data[i]), path) == NULL))
+      path[0] = 0;
+    char mime[256];
+    get_mimetype(path, mime, sizeof mime);
+    cstr_assign(&query->paths.data[i], path);
+    cstr_assign(&query->mimes.data[i], mime);
+  }
+  if (atomic_fetch_sub(&work->workers, 1) == 1)
+    submit_async_result(work->async, &work->super);
+}
+
+void async_mime_query(struct async_ctx *async, struct mime_query *query) {
+  struct mime_work *work = xcalloc(1, sizeof *work);
+  work->super.callback = callback;
+  work->super.destroy = destroy;
+  work->async = async;
+  work->query = query;
+
+  u32 num = vec_cstr_size(&query->files);
+  vec_cstr_clear(&query->paths);
+  vec_cstr_clear(&query->mimes);
+  vec_cstr_reserve(&query->paths, num);
+  vec_cstr_reserve(&query->mimes, num);
+  for (u32 i = 0; i < num; i++) {
+    vec_cstr_push(&query->paths, cstr_init());
+    vec_cstr_push(&query->mimes, cstr_init());
+  }
+
+  u32 num_workers = (num + MIME_FILES_PER_WORKER - 1) / MIME_FILES_PER_WORKER;
+  if (num_workers > tpool_size(async->tpool))
+    num_workers = tpool_size(async->tpool);
+  if (num_workers == 0)
+    num_workers = 1;
+  atomic_init(&work->next, 0);
+  atomic_init(&work->workers, num_workers);
+  for (u32 i = 1; i < num_workers; i++) {
+    if (!tpool_add_work(async->tpool, worker, work, TPOOL_PROBE))
+      atomic_fetch_sub(&work->workers, 1);
+  }
+  tpool_add_job(async->tpool, &work->super.job, worker, work, TPOOL_PROBE);
+}
@@ -57,5 +57,5 @@ void async_preview_check(struct async_ctx *async, Preview *pv) {
   work->mtime = pv->mtime;
 
   log_trace("checking preview %s", preview_path_str(pv));
-  tpool_add_work(async->tpool, worker, work, true);
+  tpool_add_job(async->tpool, &work->super.job, worker, work, TPOOL_PREVIEW);
 }
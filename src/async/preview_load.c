@@ -18,6 +18,7 @@
 #include "loop.h"
 #include "memory.h"
 #include "preview.h"
+#include "preview_server.h"
 #include "ui.h"
 
 #include <ev.h>
@@ -25,14 +26,21 @@
 
 #include <semaphore.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
+// how long a previewer whose output is no longer read may take to exit before
+// it is killed, in milliseconds
+#define PREVIEWER_EXIT_GRACE 20
+
 struct preview_load_work {
   struct result super;
   struct async_ctx *async;
   Preview *preview;
   Preview *update;
   ev_child watcher;
+  // submitted by the worker to have the main thread kill the previewer
+  struct result kill;
   sem_t semaphore;
   int status;
   int fd[2]; // stdout pipe of the process
@@ -43,6 +51,7 @@ static void destroy(void *p) {
   if (likely(work->fd[0] > 0))
     close(work->fd[0]);
   sem_destroy(&work->semaphore);
+  cancel_token_unref(work->super.token);
   preview_destroy(work->update);
   ev_child_stop(EV_DEFAULT_ & work->watcher);
   set_ev_child_erase(&work->async->in_progress.previewer_children,
@@ -53,25 +62,68 @@ static void destroy(void *p) {
 
 static void callback(void *p, Lfm *lfm) {
   struct preview_load_work *work = p;
+  if (cancel_token_is_cancelled(work->super.token)) {
+    // an aborted prefetch, the output is incomplete
+    loader_preview_prefetch_continue(&lfm->loader);
+    return;
+  }
   loader_callback(&lfm->loader, &work->preview->loadable);
   preview_update(work->preview, work->update);
   work->update = NULL;
   if (work->preview == lfm->ui.preview.preview)
     ui_redraw(&lfm->ui, REDRAW_PREVIEW);
+  loader_preview_cache_trim(&lfm->loader);
+  loader_preview_prefetch_continue(&lfm->loader);
+}
+
+// Runs on the main thread, which reaps the children: if the watcher is
+// inactive the previewer has exited and its pid might already be reused.
+static void kill_callback(void *p, Lfm *lfm) {
+  (void)lfm;
+  struct preview_load_work *work =
+      container_of(p, struct preview_load_work, kill);
+  if (work->watcher.pid > 0 && ev_is_active(&work->watcher)) {
+    log_trace("killing previewer %d", work->watcher.pid);
+    kill(work->watcher.pid, SIGTERM);
+  }
+}
+
+// the work is destroyed with its own result, which is submitted after this one
+static void kill_destroy(void *p) {
+  (void)p;
 }
 
 static void worker(void *arg) {
   struct preview_load_work *work = arg;
 
   log_trace("reading preview output: %s", cstr_str(&work->update->path));
-  preview_read_output(work->update, work->fd);
+  bool truncated;
+  preview_read_output(work->update, work->fd, work->super.token, &truncated);
+
+  if (truncated) {
+    // Give the previewer a moment to notice the closed pipe and exit with a
+    // proper status, kill it instead of letting it produce output no one reads.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += PREVIEWER_EXIT_GRACE * 1000 * 1000;
+    if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+    if (sem_timedwait(&work->semaphore, &deadline) == 0) {
+      sem_post(&work->semaphore);
+    } else {
+      submit_async_result(work->async, &work->kill);
+    }
+  }
 
   log_trace("waiting for signal");
   sem_wait(&work->semaphore);
   // exit status stored in work->status
   log_trace("previewer status code after signal: %d", work->status);
 
-  preview_handle_exit_status(work->update, work->status);
+  preview_handle_exit_status(work->update, work->status, truncated,
+                             work->super.token);
   log_trace("finished preview: %s", cstr_str(&work->update->path));
 
   submit_async_result(work->async, (struct result *)work);
@@ -88,41 +140,159 @@ static void child_exit_cb(EV_P_ ev_child *w, int revents) {
   ev_child_stop(EV_A_ w);
 }
 
-void async_preview_load(struct async_ctx *async, Preview *pv) {
+// Takes ownership of `token`.
+static void load_with_previewer(struct async_ctx *async, Preview *pv,
+                                u32 width, u32 height, cancel_token *token,
+                                enum tpool_lane lane) {
+  struct preview_load_work *work = xcalloc(1, sizeof *work);
+  work->super.callback = callback;
+  work->super.destroy = destroy;
+  work->super.token = token;
+  work->kill.callback = kill_callback;
+  work->kill.destroy = kill_destroy;
+
+  work->async = async;
+  work->preview = preview_inc_ref(pv);
+
+  // first stage of loading the preview: fork the previewer process
+  pid_t pid = 0;
+  work->update = preview_fork_previewer(cstr_zv(&pv->path), width, height,
+                                        &pid, work->fd);
+  // TODO: we could handle some errors here
+
+  // install the child watcher and set up signal
+  ev_child_init(&work->watcher, child_exit_cb, pid, 0);
+  ev_child_start(event_loop, &work->watcher);
+  sem_init(&work->semaphore, 0, 0);
+  set_ev_child_push(&async->in_progress.previewer_children, &work->watcher);
+
+  log_trace("loading preview for %s", preview_path_str(pv));
+  tpool_add_job(async->tpool, &work->super.job, worker, work, lane);
+}
+
+// Previews text files natively, looks up the preview in the disk cache and
+// asks a persistent previewer for it, if there are any, before forking the
+// previewer.
+struct preview_cached_work {
+  struct result super;
+  struct async_ctx *async;
+  Preview *preview;
+  Preview *update; // NULL if the previewer has to be forked
+  u32 width;
+  u32 height;
+  enum tpool_lane lane;
+};
+
+static void cached_destroy(void *p) {
+  struct preview_cached_work *work = p;
+  cancel_token_unref(work->super.token);
+  preview_destroy(work->update);
+  preview_dec_ref(work->preview);
+  xfree(work);
+}
+
+static void cached_callback(void *p, Lfm *lfm) {
+  struct preview_cached_work *work = p;
+  set_result_erase(&lfm->async.in_progress.cached_previews, &work->super);
+  if (cancel_token_is_cancelled(work->super.token)) {
+    loader_preview_prefetch_continue(&lfm->loader);
+    return;
+  }
+  if (work->update == NULL) {
+    // the token is passed on to the previewer
+    load_with_previewer(&lfm->async, work->preview, work->width,
+                        work->height, work->super.token, work->lane);
+    work->super.token = NULL;
+    return;
+  }
+  log_trace("preview for %s loaded without forking",
+            preview_path_str(work->preview));
+  loader_callback(&lfm->loader, &work->preview->loadable);
+  preview_update(work->preview, work->update);
+  work->update = NULL;
+  if (work->preview == lfm->ui.preview.preview)
+    ui_redraw(&lfm->ui, REDRAW_PREVIEW);
+  loader_preview_cache_trim(&lfm->loader);
+  loader_preview_prefetch_continue(&lfm->loader);
+}
+
+static void cached_worker(void *arg) {
+  struct preview_cached_work *work = arg;
+  if (cancel_token_is_cancelled(work->super.token)) {
+    submit_async_result(work->async, (struct result *)work);
+    return;
+  }
+  work->update = preview_from_text_file(preview_path(work->preview),
+                                        work->width, work->height,
+                                        work->super.token);
+  if (work->update == NULL)
+    work->update = preview_from_disk_cache(preview_path(work->preview),
+                                           work->width, work->height);
+  if (work->update == NULL)
+    work->update = preview_from_server(preview_path(work->preview),
+                                       work->width, work->height,
+                                       work->super.token);
+  submit_async_result(work->async, (struct result *)work);
+}
+
+// Takes ownership of `token`.
+static void preview_load(struct async_ctx *async, Preview *pv,
+                         cancel_token *token, enum tpool_lane lane) {
   if (!bytes_is_empty(cfg.lua_previewer)) {
-    async_lua_preview(async, pv);
+    async_lua_preview(async, pv, token, lane);
   } else if (unlikely(cstr_is_empty(&cfg.previewer))) {
     log_error("no previewer configured");
+    cancel_token_unref(token);
   } else {
-    struct preview_load_work *work = xcalloc(1, sizeof *work);
-    work->super.callback = callback;
-    work->super.destroy = destroy;
-
     pv->status = PV_LOADED;
     pv->is_loading = true;
 
-    work->async = async;
-    work->preview = preview_inc_ref(pv);
-
     // we could modify these to load extra lines, but we would need to make
     // changes because we resize images to thexe exact dimensions
     u32 width = to_lfm(async)->ui.preview.x;
     u32 height = to_lfm(async)->ui.preview.y;
 
-    // first stage of loading the preview: fork the previewer process
-    pid_t pid = 0;
-    work->update = preview_fork_previewer(cstr_zv(&pv->path), width, height,
-                                          &pid, work->fd);
-    // TODO: we could handle some errors here
+    if (!cfg.preview_text && cfg.preview_disk_cache_bytes == 0 &&
+        preview_server_count() == 0) {
+      load_with_previewer(async, pv, width, height, token, lane);
+      return;
+    }
 
-    // install the child watcher and set up signal
-    ev_child_init(&work->watcher, child_exit_cb, pid, 0);
-    ev_child_start(event_loop, &work->watcher);
-    sem_init(&work->semaphore, 0, 0);
-    set_ev_child_push(&async->in_progress.previewer_children, &work->watcher);
+    struct preview_cached_work *work = xcalloc(1, sizeof *work);
+    work->super.callback = cached_callback;
+    work->super.destroy = cached_destroy;
+    work->super.token = token;
+    work->async = async;
+    work->preview = preview_inc_ref(pv);
+    work->width = width;
+    work->height = height;
+    work->lane = lane;
+    set_result_insert(&async->in_progress.cached_previews, &work->super);
+    tpool_add_job(async->tpool, &work->super.job, cached_worker, work, lane);
+  }
+}
 
-    log_trace("loading preview for %s", preview_path_str(pv));
-    tpool_add_work(async->tpool, worker, work, true);
+void async_preview_load(struct async_ctx *async, Preview *pv) {
+  preview_load(async, pv, cancel_token_create(&async->stop), TPOOL_PREVIEW);
+}
+
+void async_preview_prefetch(struct async_ctx *async, Preview *pv,
+                            cancel_token *cancel) {
+  preview_load(async, pv, cancel_token_ref(cancel), TPOOL_BACKGROUND);
+}
+
+void async_preview_abort(struct async_ctx *async, cancel_token *cancel) {
+  cancel_token_cancel(cancel);
+  // the worker stops reading once the previewer exits; the child watcher and
+  // the rest of the work are cleaned up as usual
+  c_foreach(it, set_ev_child, async->in_progress.previewer_children) {
+    struct preview_load_work *work =
+        container_of(*it.ref, struct preview_load_work, watcher);
+    // pid is 0 if the previewer could not be started, an inactive watcher
+    // means it was reaped and the pid might be reused
+    if (work->super.token == cancel && work->watcher.pid > 0 &&
+        ev_is_active(&work->watcher))
+      kill(work->watcher.pid, SIGTERM);
   }
 }
 
@@ -140,4 +310,9 @@ void async_preview_cancel(struct async_ctx *async) {
     cancel(*it.ref);
   }
   set_result_clear(&async->in_progress.lua_previews);
+
+  c_foreach(it, set_result, async->in_progress.cached_previews) {
+    cancel(*it.ref);
+  }
+  set_result_clear(&async->in_progress.cached_previews);
 }
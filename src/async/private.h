@@ -1,13 +1,17 @@
 #include "async.h"
+#include "cancel.h"
 #include "defs.h"
 #include "tpool.h"
 
 #include <stdatomic.h>
 
 struct result {
+  struct tpool_job job; // to run the worker on the thread pool
   struct result *next;
-  // atomic_bool cancelled;
-  bool cancelled;
+  bool cancelled; // only accessed from the main thread
+  // optional, cancelled together with the result so that the worker can stop
+  // early; owned by the result, i.e. released in `destroy`
+  cancel_token *token;
   void (*callback)(void *, struct Lfm *);
   void (*destroy)(void *);
 };
@@ -22,14 +26,18 @@ struct result {
 
 // we only cancel from the main thread
 static inline void cancel(struct result *res) {
-  if (res)
+  if (res) {
     res->cancelled = true;
-  // atomic_store_explicit(&res->cancelled, memory_order_relaxed, true);
+    cancel_token_cancel(res->token);
+  }
 }
 
 static inline bool is_cancelled(struct result *res) {
-  // return atomic_load_explicit(&res->cancelled, memory_order_relaxed);
   return res->cancelled;
 }
 
 void submit_async_result(struct async_ctx *async, struct result *res);
+
+// Runs the lua previewer for `pv`, takes ownership of `token`.
+void async_lua_preview(struct async_ctx *async, struct Preview *pv,
+                       cancel_token *token, enum tpool_lane lane);
@@ -0,0 +1,139 @@
+#include "private.h"
+
+#include "lfm.h"
+#include "loop.h"
+#include "lua/lfmlua.h"
+#include "lua/util.h"
+#include "memory.h"
+#include "transfer.h"
+#include "ui.h"
+
+#include <ev.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stc/cstr.h>
+
+// how often the progress in the statusline is updated, in seconds
+#define TRANSFER_PROGRESS_INTERVAL 0.25
+
+struct transfer_work {
+  struct result super;
+  struct async_ctx *async;
+  struct transfer transfer;
+  int ref; // callback, 0 if none
+};
+
+static void destroy(void *p) {
+  struct transfer_work *work = p;
+  transfer_deinit(&work->transfer);
+  cancel_token_unref(work->super.token);
+  xfree(work);
+}
+
+static void callback(void *p, Lfm *lfm) {
+  struct transfer_work *work = p;
+  struct transfer *t = &work->transfer;
+  set_result_erase(&lfm->async.in_progress.transfers, &work->super);
+  if (set_result_is_empty(&lfm->async.in_progress.transfers))
+    ev_timer_stop(event_loop, &lfm->async.transfer_timer);
+  ui_redraw(&lfm->ui, REDRAW_CMDLINE);
+
+  lua_State *L = lfm->L;
+  if (unlikely(L == NULL || work->ref == 0))
+    return;
+
+  lfm_lua_push_callback(L, work->ref, true); // [cb]
+  if (t->errors > 0) {
+    if (t->errors > 1) {
+      lua_pushfstring(L, "%s (and %d more errors)", cstr_str(&t->error),
+                      (int)t->errors - 1);
+    } else {
+      lua_pushcstr(L, &t->error);
+    }
+  } else if (cancel_token_is_cancelled(work->super.token)) {
+    lua_pushliteral(L, "cancelled");
+  } else {
+    lua_pushnil(L);
+  } // [cb, err]
+  if (unlikely(lfm_lua_pcall(L, 1, 0))) {
+    // [err]
+    lfm_errorf(lfm, "%s", lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+}
+
+static void worker(void *arg) {
+  struct transfer_work *work = arg;
+  transfer_work(&work->transfer);
+}
+
+static bool spawn(struct transfer *t) {
+  struct transfer_work *work = container_of(t, struct transfer_work, transfer);
+  return tpool_add_work(work->async->tpool, worker, work, TPOOL_TRANSFER);
+}
+
+static void done(struct transfer *t) {
+  struct transfer_work *work = container_of(t, struct transfer_work, transfer);
+  submit_async_result(work->async, &work->super);
+}
+
+static void transfer_timer_cb(EV_P_ ev_timer *w, int revents) {
+  (void)revents;
+  (void)EV_A;
+  struct async_ctx *async = w->data;
+  ui_redraw(&to_lfm(async)->ui, REDRAW_CMDLINE);
+}
+
+void async_transfer(struct async_ctx *async, vec_cstr files, zsview dest,
+                    bool move, u32 jobs, int ref) {
+  struct transfer_work *work = xcalloc(1, sizeof *work);
+  work->super.callback = callback;
+  work->super.destroy = destroy;
+  work->super.token = cancel_token_create(&async->stop);
+  work->async = async;
+  work->ref = ref;
+
+  // workers hold their slot until the transfer is done, more would only queue
+  u32 limit = tpool_lane_limit(async->tpool, TPOOL_TRANSFER);
+  if (jobs == 0 || jobs > limit)
+    jobs = limit;
+  transfer_init(&work->transfer, files, dest, move, jobs);
+  work->transfer.cancel = work->super.token;
+  work->transfer.spawn = spawn;
+  work->transfer.done = done;
+
+  set_result_insert(&async->in_progress.transfers, &work->super);
+  if (!ev_is_active(&async->transfer_timer)) {
+    async->transfer_timer.data = async;
+    ev_timer_init(&async->transfer_timer, transfer_timer_cb,
+                  TRANSFER_PROGRESS_INTERVAL, TRANSFER_PROGRESS_INTERVAL);
+    ev_timer_start(event_loop, &async->transfer_timer);
+  }
+
+  transfer_start(&work->transfer);
+}
+
+void async_transfer_cancel(struct async_ctx *async) {
+  // the callbacks still run, they report the cancellation
+  c_foreach(it, set_result, async->in_progress.transfers) {
+    cancel_token_cancel((*it.ref)->token);
+  }
+}
+
+bool async_transfer_progress(struct async_ctx *async,
+                             struct transfer_progress *progress) {
+  memset(progress, 0, sizeof *progress);
+  c_foreach(it, set_result, async->in_progress.transfers) {
+    const struct transfer_work *work =
+        container_of(*it.ref, struct transfer_work, super);
+    const struct transfer *t = &work->transfer;
+    progress->transfers++;
+    progress->files += vec_cstr_size(&t->files);
+    progress->entries_done +=
+        atomic_load_explicit(&t->entries_done, memory_order_relaxed);
+    progress->bytes_done +=
+        atomic_load_explicit(&t->bytes_done, memory_order_relaxed);
+    progress->move = t->move;
+  }
+  return progress->transfers > 0;
+}
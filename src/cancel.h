@@ -0,0 +1,54 @@
+#pragma once
+
+// Cooperative cancellation of work running on the thread pool. The main thread
+// cancels a token, workers poll it (relaxed) between units of work and return
+// early. Tokens are reference counted, since the work of e.g. a directory load
+// is split into jobs that outlive each other.
+
+#include "defs.h"
+#include "memory.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+typedef struct cancel_token {
+  atomic_bool cancelled;
+  atomic_uint refs;
+  const atomic_bool *parent; // e.g. a global shutdown flag, can be NULL
+} cancel_token;
+
+// Creates a token with a single reference. It counts as cancelled if `parent`
+// is set, too.
+static inline cancel_token *cancel_token_create(const atomic_bool *parent) {
+  cancel_token *token = xmalloc(sizeof *token);
+  atomic_init(&token->cancelled, false);
+  atomic_init(&token->refs, 1);
+  token->parent = parent;
+  return token;
+}
+
+static inline cancel_token *cancel_token_ref(cancel_token *token) {
+  if (token)
+    atomic_fetch_add_explicit(&token->refs, 1, memory_order_relaxed);
+  return token;
+}
+
+static inline void cancel_token_unref(cancel_token *token) {
+  if (token &&
+      atomic_fetch_sub_explicit(&token->refs, 1, memory_order_acq_rel) == 1)
+    xfree(token);
+}
+
+static inline void cancel_token_cancel(cancel_token *token) {
+  if (token)
+    atomic_store_explicit(&token->cancelled, true, memory_order_relaxed);
+}
+
+// `NULL` is never cancelled.
+static inline bool cancel_token_is_cancelled(const cancel_token *token) {
+  if (token == NULL)
+    return false;
+  return atomic_load_explicit(&token->cancelled, memory_order_relaxed) ||
+         (token->parent &&
+          atomic_load_explicit(token->parent, memory_order_relaxed));
+}
@@ -27,6 +27,13 @@ Config cfg = {
     .map_suggestion_delay = MAP_SUGGESTION_DELAY,
     .map_clear_delay = MAP_CLEAR_DELAY,
     .loading_indicator_delay = LOADING_INDICATOR_DELAY,
+    .parallel_load_threshold = PARALLEL_LOAD_THRESHOLD,
+    .dir_cache_entries = DIR_CACHE_ENTRIES,
+    .dir_cache_bytes = DIR_CACHE_BYTES,
+    .preview_cache_bytes = PREVIEW_CACHE_BYTES,
+    .preview_disk_cache_bytes = PREVIEW_DISK_CACHE_BYTES,
+    .preview_prefetch = PREVIEW_PREFETCH,
+    .preview_prefetch_jobs = PREVIEW_PREFETCH_JOBS,
     .mapleader = '\\',
     .colors = {
         .normal = NCCHANNELS_INITIALIZER_PALINDEX(-1, -1),
@@ -105,6 +112,7 @@ void config_init(void) {
 
   cstr_printf(&cfg.previewer, "%s/runtime/preview.sh", default_data_dir);
   cfg.preview = true;
+  cfg.preview_text = false;
   cfg.ratios = c_make(vec_int, {1, 2, 3});
 
   cfg.icon_map = c_make(hmap_icon, {
@@ -12,6 +12,13 @@
 #define MAP_SUGGESTION_DELAY 1000
 #define MAP_CLEAR_DELAY 10000
 #define LOADING_INDICATOR_DELAY 250
+#define PARALLEL_LOAD_THRESHOLD 5000
+#define DIR_CACHE_ENTRIES 1000
+#define DIR_CACHE_BYTES (512ull * 1024 * 1024)
+#define PREVIEW_CACHE_BYTES (256ull * 1024 * 1024)
+#define PREVIEW_DISK_CACHE_BYTES (128ull * 1024 * 1024)
+#define PREVIEW_PREFETCH 2
+#define PREVIEW_PREFETCH_JOBS 2
 
 // maps file extensions to fg/bg channel
 #define i_type hmap_channel
@@ -61,9 +68,12 @@ typedef struct config {
   cstr infoline;
   bool preview;
   bool preview_images;
+  bool preview_text; // preview text files without the previewer
   bytes lua_previewer;
   cstr previewer;
   u32 preview_delay;
+  u32 preview_prefetch;      // files next to the cursor to preview in advance
+  u32 preview_prefetch_jobs; // previews prefetched at the same time
   bool icons;
   bool tags;
   hmap_icon icon_map;
@@ -75,10 +85,19 @@ typedef struct config {
   vec_cstr inotify_blacklist;
   u32 inotify_timeout;
   u32 inotify_delay;
+  bool inotify_delta; // stat only changed files instead of reloading
 
   u32 map_suggestion_delay;
   u32 map_clear_delay;
   u32 loading_indicator_delay;
+  u32 parallel_load_threshold; // 0 disables
+
+  // limits of the directory cache, least recently used directories are
+  // evicted first; 0 disables the respective limit
+  u32 dir_cache_entries;
+  u64 dir_cache_bytes;
+  u64 preview_cache_bytes;
+  u64 preview_disk_cache_bytes; // persistent previews in cachedir/previews
 
   struct dir_settings dir_settings; // default dir_settings
   hmap_dirsetting dir_settings_map; // path -> dir_settings
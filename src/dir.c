@@ -3,18 +3,24 @@
 #include "defs.h"
 #include "file.h"
 #include "filter.h"
+#include "dirio.h"
 #include "log.h"
 #include "memory.h"
 #include "path.h"
 #include "sha256.h"
 #include "stcutil.h"
+#include "tpool.h"
+#include "types/vec_int.h"
 #include "util.h"
 
 #include <stc/cstr.h>
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <dirent.h>
 #include <fcntl.h>
@@ -109,9 +115,17 @@ static void apply_filters(Dir *d) {
   d->ui.ind = max(min(d->ui.ind, vec_file_size(&d->files) - 1), 0);
 }
 
-void dir_apply_random_keys(Dir *dir, u64 salt) {
+static i64 random_key(zsview name, u64 salt) {
   u8 hash[32];
   SHA256_CTX ctx;
+  sha256_init(&ctx);
+  sha256_update(&ctx, (u8 *)name.str, name.size);
+  sha256_update(&ctx, (u8 *)&salt, sizeof salt);
+  sha256_final(&ctx, hash);
+  return 0x7FFFFFFFFFFFFFFF & *(u64 *)hash; // null highest bit
+}
+
+void dir_apply_random_keys(Dir *dir, u64 salt) {
   if (salt)
     dir->settings.salt = salt;
   else
@@ -119,13 +133,47 @@ void dir_apply_random_keys(Dir *dir, u64 salt) {
 
   c_foreach(it, Dir, dir) {
     File *file = *it.ref;
-    zsview name = file_name(file);
+    file->key = random_key(file_name(file), salt);
+  }
+}
 
-    sha256_init(&ctx);
-    sha256_update(&ctx, (u8 *)name.str, name.size);
-    sha256_update(&ctx, (u8 *)&salt, sizeof salt);
-    sha256_final(&ctx, hash);
-    file->key = 0x7FFFFFFFFFFFFFFF & *(u64 *)hash; // null highest bit
+static i64 (*const sort_cmp[NUM_SORTTYPE])(const void *, const void *) = {
+    [SORT_NATURAL] = compare_natural, [SORT_NAME] = compare_name,
+    [SORT_SIZE] = compare_size,       [SORT_CTIME] = compare_ctime,
+    [SORT_ATIME] = compare_atime,     [SORT_MTIME] = compare_mtime,
+    [SORT_LUA] = compare_key,         [SORT_RAND] = compare_key,
+};
+
+static void sort_files(File **files, usize n, sorttype type) {
+  switch (type) {
+  case SORT_NATURAL:
+    files_natural_sort(files, n);
+    break;
+  case SORT_NAME:
+    files_name_sort(files, n);
+    break;
+  case SORT_SIZE:
+    if (!files_radix_sort(files, n, SORT_SIZE))
+      files_size_sort(files, n);
+    break;
+  case SORT_ATIME:
+    if (!files_radix_sort(files, n, SORT_ATIME))
+      files_atime_sort(files, n);
+    break;
+  case SORT_CTIME:
+    if (!files_radix_sort(files, n, SORT_CTIME))
+      files_ctime_sort(files, n);
+    break;
+  case SORT_MTIME:
+    if (!files_radix_sort(files, n, SORT_MTIME))
+      files_mtime_sort(files, n);
+    break;
+  case SORT_LUA:
+  case SORT_RAND:
+    if (!files_radix_sort(files, n, SORT_LUA))
+      files_key_sort(files, n);
+  default:
+    break;
   }
 }
 
@@ -136,31 +184,7 @@ void dir_sort(Dir *d, bool force) {
     return;
   }
   if (force || !d->view.sorted) {
-    switch (d->settings.sorttype) {
-    case SORT_NATURAL:
-      files_natural_sort(d->files_all.data, d->files_all.size);
-      break;
-    case SORT_NAME:
-      files_name_sort(d->files_all.data, d->files_all.size);
-      break;
-    case SORT_SIZE:
-      files_size_sort(d->files_all.data, d->files_all.size);
-      break;
-    case SORT_ATIME:
-      files_atime_sort(d->files_all.data, d->files_all.size);
-      break;
-    case SORT_CTIME:
-      files_ctime_sort(d->files_all.data, d->files_all.size);
-      break;
-    case SORT_MTIME:
-      files_mtime_sort(d->files_all.data, d->files_all.size);
-      break;
-    case SORT_LUA:
-    case SORT_RAND:
-      files_key_sort(d->files_all.data, d->files_all.size);
-    default:
-      break;
-    }
+    sort_files(d->files_all.data, d->files_all.size, d->settings.sorttype);
     d->view.sorted = true;
   }
   usize num_dirs = 0;
@@ -182,7 +206,7 @@ void dir_sort(Dir *d, bool force) {
       }
     } else {
       j = vec_file_size(&d->files_all);
-      memcpy(d->files_sorted.data, d->files.data, j * sizeof(File *));
+      memcpy(d->files_sorted.data, d->files_all.data, j * sizeof(File *));
     }
   } else {
     if (d->settings.dirfirst) {
@@ -215,6 +239,174 @@ void dir_sort(Dir *d, bool force) {
   apply_filters(d);
 }
 
+// The order of one of the file vectors of a directory.
+struct file_order {
+  i64 (*cmp)(const void *, const void *);
+  __compar_fn_t filter_cmp; // if set, used instead of all other fields
+  bool dirfirst;
+  bool reverse;
+};
+
+static inline i64 file_order_cmp(const struct file_order *o, File *a,
+                                 File *b) {
+  if (o->filter_cmp)
+    return o->filter_cmp(&a, &b);
+  if (o->dirfirst) {
+    bool isdir = file_isdir(a);
+    if (isdir != file_isdir(b))
+      return isdir ? -1 : 1;
+  }
+  i64 cmp = o->cmp(&a, &b);
+  return o->reverse ? -cmp : cmp;
+}
+
+static inline int compare_ptr(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)*(File **)a;
+  uintptr_t y = (uintptr_t)*(File **)b;
+  return (x > y) - (x < y);
+}
+
+// Removes the files contained in `set` (sorted by address) from `vec`.
+static void remove_files(vec_file *vec, File **set, usize n) {
+  if (n == 0)
+    return;
+  usize j = 0;
+  c_foreach(it, vec_file, *vec) {
+    if (!bsearch(it.ref, set, n, sizeof *set, compare_ptr))
+      vec->data[j++] = *it.ref;
+  }
+  vec->size = j;
+}
+
+// vec_file_reserve would shrink the vector if it is exactly large enough
+static inline void reserve_files(vec_file *vec, isize n) {
+  if (n > vec->capacity)
+    vec_file_reserve(vec, n);
+}
+
+// Inserts `files`, which are ordered by `o`, into `vec`, which is ordered by
+// `o` as well. Each file is placed by binary search, starting with the last
+// one, so that every element of `vec` is moved at most once.
+static void insert_files(vec_file *vec, File **files, usize n,
+                         const struct file_order *o) {
+  reserve_files(vec, vec->size + n);
+  usize end = vec->size; // [0, end) are still at their old position
+  for (usize j = n; j-- > 0;) {
+    usize lo = 0;
+    usize hi = end;
+    while (lo < hi) {
+      usize mid = lo + (hi - lo) / 2;
+      if (file_order_cmp(o, vec->data[mid], files[j]) <= 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    memmove(vec->data + lo + j + 1, vec->data + lo,
+            (end - lo) * sizeof *vec->data);
+    vec->data[lo + j] = files[j];
+    end = lo;
+  }
+  vec->size += n;
+}
+
+// Removes `removed` (sorted by address) from all file vectors of `d` and
+// inserts `added` at their positions, without touching the other files.
+static void splice_files(Dir *d, File **removed, usize num_removed,
+                         File *const *added, usize num_added) {
+  vec_file delta = vec_file_with_capacity(num_added);
+  vec_file view = vec_file_with_capacity(num_added);
+  if (num_added > 0)
+    memcpy(delta.data, added, num_added * sizeof *added);
+  delta.size = num_added;
+
+  // files_all: sorted by the comparator only
+  struct file_order order = {.cmp = sort_cmp[d->settings.sorttype]};
+  sort_files(delta.data, delta.size, d->settings.sorttype);
+  remove_files(&d->files_all, removed, num_removed);
+  insert_files(&d->files_all, delta.data, delta.size, &order);
+
+  // files_sorted: hidden files removed, partitioned and reversed like in
+  // dir_sort
+  usize num_dirs = 0;
+  if (d->settings.dirfirst) {
+    c_foreach(it, vec_file, delta) {
+      if ((d->settings.hidden || !file_hidden(*it.ref)) &&
+          file_isdir(*it.ref))
+        view.data[view.size++] = *it.ref;
+    }
+    num_dirs = view.size;
+  }
+  c_foreach(it, vec_file, delta) {
+    if ((d->settings.hidden || !file_hidden(*it.ref)) &&
+        !(d->settings.dirfirst && file_isdir(*it.ref)))
+      view.data[view.size++] = *it.ref;
+  }
+  if (d->settings.reverse) {
+    reverse(view.data, num_dirs);
+    reverse(view.data + num_dirs, view.size - num_dirs);
+  }
+
+  order.dirfirst = d->settings.dirfirst;
+  order.reverse = d->settings.reverse;
+  // dir_sort and apply_filters expect room for all files
+  reserve_files(&d->files_sorted, d->files_all.size);
+  reserve_files(&d->files, d->files_all.size);
+  remove_files(&d->files_sorted, removed, num_removed);
+  insert_files(&d->files_sorted, view.data, view.size, &order);
+
+  // files: the filtered view
+  if (d->view.filter) {
+    usize j = 0;
+    c_foreach(it, vec_file, view) {
+      if (filter_match(d->view.filter, *it.ref))
+        view.data[j++] = *it.ref;
+      else
+        (*it.ref)->score = 0;
+    }
+    view.size = j;
+    order.filter_cmp = filter_cmp(d->view.filter);
+    if (order.filter_cmp)
+      qsort(view.data, view.size, sizeof *view.data, order.filter_cmp);
+    remove_files(&d->files, removed, num_removed);
+    insert_files(&d->files, view.data, view.size, &order);
+  } else {
+    memcpy(d->files.data, d->files_sorted.data,
+           d->files_sorted.size * sizeof(File *));
+    d->files.size = d->files_sorted.size;
+  }
+  d->ui.ind = max(min(d->ui.ind, vec_file_size(&d->files) - 1), 0);
+
+  vec_file_drop(&delta);
+  vec_file_drop(&view);
+}
+
+// Don't bother with more than one in eight files changed, just sort again.
+#define RESORT_MAX_FRACTION 8
+
+void dir_resort_files(Dir *d, File *const *files, usize n) {
+  if (n == 0 && d->view.sorted)
+    return;
+  if (!d->view.sorted || n * RESORT_MAX_FRACTION > (usize)d->files_all.size) {
+    dir_sort(d, true);
+    return;
+  }
+
+  vec_file set = vec_file_with_capacity(n);
+  memcpy(set.data, files, n * sizeof *files);
+  set.size = n;
+  qsort(set.data, n, sizeof *set.data, compare_ptr);
+  usize j = 0;
+  c_foreach(it, vec_file, set) {
+    if (j == 0 || set.data[j - 1] != *it.ref)
+      set.data[j++] = *it.ref;
+  }
+  set.size = j;
+
+  splice_files(d, set.data, set.size, set.data, set.size);
+
+  vec_file_drop(&set);
+}
+
 File *dir_current_file(const Dir *dir) {
   if (unlikely(dir->ui.ind >= dir_length(dir)))
     return NULL;
@@ -259,18 +451,18 @@ static inline void load_dircount_cached(Dir *dir, File *file) {
   map_str_int_iter it = map_str_int_find(&dir->load.dircounts, file_name_str(file));
   if (it.ref) {
     struct tuple_mtime_count tup = it.ref->second;
-    if (tup.mtime == file->stat.st_mtim.tv_sec) {
+    if (tup.mtime == file_stat(file)->mtime) {
       // use cached data
       file_set_dircount(file, tup.count);
     } else {
       // update the cache
-      it.ref->second.mtime = file->stat.st_mtim.tv_sec;
+      it.ref->second.mtime = file_stat(file)->mtime;
       it.ref->second.count = file_load_dircount(file);
     }
   } else {
     // add new data to cache
     struct tuple_mtime_count tup = {
-        .mtime = file->stat.st_mtim.tv_sec,
+        .mtime = file_stat(file)->mtime,
         .count = file_load_dircount(file),
     };
     map_str_int_emplace(&dir->load.dircounts, file_name_str(file), tup);
@@ -285,7 +477,7 @@ static inline void trim_dircount_cache(Dir *dir, uint32 num_dirs) {
     c_foreach(it, vec_file, dir->files_all) {
       if (file_isdir(*it.ref)) {
         struct tuple_mtime_count tup = {
-            .mtime = (*it.ref)->stat.st_mtim.tv_sec,
+            .mtime = file_stat(*it.ref)->mtime,
             .count = file_dircount(*it.ref),
         };
         map_str_int_emplace(&dir->load.dircounts, file_name_str(*it.ref), tup);
@@ -297,13 +489,285 @@ static inline void trim_dircount_cache(Dir *dir, uint32 num_dirs) {
   }
 }
 
+// number of entries stat'ed in one go, also the unit of work when loading in
+// parallel
+#define LOAD_CHUNK_SIZE 1024
+
+// Entries of a directory, read ahead of stat'ing them.
+struct dirents {
+  char *names; // concatenated, NUL terminated
+  usize names_len;
+  usize names_cap;
+  u32 *offsets; // offset of each name in `names`
+  u8 *types;    // DT_* type of each entry
+  u32 num;
+  u32 cap;
+};
+
+static void dirents_push(struct dirents *d, const struct getdents_entry *e) {
+  usize len = strlen(e->name) + 1;
+  if (d->names_len + len > d->names_cap) {
+    d->names_cap = max(2 * d->names_cap, d->names_len + len + 4096);
+    d->names = xrealloc(d->names, d->names_cap);
+  }
+  if (d->num == d->cap) {
+    d->cap = d->cap ? 2 * d->cap : 256;
+    d->offsets = xrealloc(d->offsets, d->cap * sizeof *d->offsets);
+    d->types = xrealloc(d->types, d->cap * sizeof *d->types);
+  }
+  memcpy(d->names + d->names_len, e->name, len);
+  d->offsets[d->num] = d->names_len;
+  d->types[d->num] = e->type;
+  d->names_len += len;
+  d->num++;
+}
+
+static inline const char *dirents_name(const struct dirents *d, u32 i) {
+  return d->names + d->offsets[i];
+}
+
+static void dirents_drop(struct dirents *d) {
+  xfree(d->names);
+  xfree(d->offsets);
+  xfree(d->types);
+}
+
+// Reads all entries of the directory `dir_fd` via getdents64, stopping early
+// if `cancel` is cancelled. Returns 0 on success, -1 on error with errno set.
+static i32 read_dirents(i32 dir_fd, struct dirents *d,
+                        const cancel_token *cancel) {
+  struct getdents_reader *r = xmalloc(sizeof *r);
+  getdents_reader_init(r, dir_fd);
+  struct getdents_entry entry;
+  isize n;
+  while ((n = getdents_reader_fill(r)) > 0) {
+    while (getdents_reader_next(r, &entry)) {
+      dirents_push(d, &entry);
+    }
+    if (cancel_token_is_cancelled(cancel))
+      break;
+  }
+  xfree(r);
+  return n < 0 ? -1 : 0;
+}
+
+// Creates the files for the entries [begin, end) and stores them in `out`,
+// NULL for entries that vanished in the meantime. If `batch` is set, all
+// entries are stat'ed at once, see `statx_batch`.
+static void create_files(struct arena *arena, const char *path, i32 dir_fd,
+                         bool load_fileinfo, bool batch,
+                         const struct dirents *d, u32 begin, u32 end,
+                         File **out) {
+  if (!batch) {
+    for (u32 i = begin; i < end; i++) {
+      out[i - begin] = file_create_statx(arena, path, dirents_name(d, i),
+                                         d->types[i], dir_fd, load_fileinfo);
+    }
+    return;
+  }
+
+  u32 n = end - begin;
+  const char **names = xmalloc(n * sizeof *names);
+  struct stat *stats = xmalloc(n * sizeof *stats);
+  i32 *errs = xmalloc(n * sizeof *errs);
+  for (u32 i = 0; i < n; i++) {
+    names[i] = dirents_name(d, begin + i);
+  }
+  statx_batch(dir_fd, names, n, false, stats, errs);
+  for (u32 i = 0; i < n; i++) {
+    out[i] =
+        file_create_from_lstat(arena, path, names[i], d->types[begin + i],
+                               &stats[i], errs[i], dir_fd, load_fileinfo);
+  }
+  xfree(names);
+  xfree(stats);
+  xfree(errs);
+}
+
+// Shared between the loading thread and the helpers it spawns on the thread
+// pool. Chunks are claimed via `next`, so the loading thread never waits on
+// helpers that haven't started yet; late helpers simply find nothing to do.
+struct load_job {
+  const char *path;
+  i32 dir_fd;
+  bool load_fileinfo;
+  bool batch;
+  const struct dirents *dirents;
+  File **files; // result slot for each entry
+  struct arena arena; // arenas of the workers are merged into this one
+  u32 num_chunks;
+  atomic_uint next; // next chunk to claim
+  atomic_uint refs;
+  const cancel_token *cancel;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  u32 done; // number of processed chunks, protected by mutex
+};
+
+static void load_job_unref(struct load_job *job) {
+  if (atomic_fetch_sub(&job->refs, 1) == 1) {
+    pthread_mutex_destroy(&job->mutex);
+    pthread_cond_destroy(&job->cond);
+    xfree(job);
+  }
+}
+
+// Processes chunks until none are left.
+static void load_job_run(struct load_job *job) {
+  struct arena arena = arena_init();
+  u32 processed = 0;
+  u32 i;
+  while ((i = atomic_fetch_add(&job->next, 1)) < job->num_chunks) {
+    if (!cancel_token_is_cancelled(job->cancel)) {
+      u32 begin = i * LOAD_CHUNK_SIZE;
+      u32 end = min(begin + LOAD_CHUNK_SIZE, job->dirents->num);
+      create_files(&arena, job->path, job->dir_fd, job->load_fileinfo,
+                   job->batch, job->dirents, begin, end, job->files + begin);
+    }
+    processed++;
+  }
+  if (processed > 0) {
+    pthread_mutex_lock(&job->mutex);
+    arena_merge(&job->arena, &arena);
+    job->done += processed;
+    if (job->done == job->num_chunks)
+      pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->mutex);
+  }
+}
+
+static void load_job_helper(void *arg) {
+  struct load_job *job = arg;
+  load_job_run(job);
+  load_job_unref(job);
+}
+
+// Creates the files for all entries of `d`, fanning out to the workers of
+// `parallel.tpool`. The order of `d` is retained in `files`.
+static void create_files_parallel(struct arena *arena, const char *path,
+                                  i32 dir_fd, bool load_fileinfo, bool batch,
+                                  const struct dirents *d,
+                                  struct dir_load_parallel parallel,
+                                  vec_file *files,
+                                  const cancel_token *cancel) {
+  struct load_job *job = xcalloc(1, sizeof *job);
+  job->path = path;
+  job->dir_fd = dir_fd;
+  job->load_fileinfo = load_fileinfo;
+  job->batch = batch;
+  job->dirents = d;
+  job->files = xcalloc(d->num, sizeof *job->files);
+  job->num_chunks = (d->num + LOAD_CHUNK_SIZE - 1) / LOAD_CHUNK_SIZE;
+  job->cancel = cancel;
+  pthread_mutex_init(&job->mutex, NULL);
+  pthread_cond_init(&job->cond, NULL);
+
+  // we are one of the workers ourselves
+  usize num_helpers = tpool_size(parallel.tpool);
+  num_helpers = num_helpers > 1 ? num_helpers - 1 : 0;
+  num_helpers = min(num_helpers, job->num_chunks - 1);
+  atomic_init(&job->refs, num_helpers + 1);
+  for (usize i = 0; i < num_helpers; i++) {
+    if (!tpool_add_work(parallel.tpool, load_job_helper, job, parallel.lane))
+      load_job_unref(job);
+  }
+
+  load_job_run(job);
+
+  pthread_mutex_lock(&job->mutex);
+  while (job->done < job->num_chunks)
+    pthread_cond_wait(&job->cond, &job->mutex);
+  pthread_mutex_unlock(&job->mutex);
+
+  vec_file_reserve(files, vec_file_size(files) + d->num);
+  for (u32 i = 0; i < d->num; i++) {
+    if (job->files[i] != NULL)
+      vec_file_push(files, job->files[i]);
+  }
+  xfree(job->files);
+  arena_merge(arena, &job->arena);
+  load_job_unref(job);
+}
+
+// Appends the files in the directory `path` (opened as `dir_fd`) to `files`.
+// Entries are read via getdents64 and stat'ed with statx, in chunks, falling
+// back to readdir/fstatat if getdents64 is unavailable. `cancel` is checked
+// while reading and after every chunk. Directories with at least
+// `parallel.threshold` entries are stat'ed by multiple workers. Returns 0 on
+// success, -1 on error with errno set.
+static i32 read_files(struct arena *arena, const char *path, i32 dir_fd,
+                      bool load_fileinfo, struct dir_load_parallel parallel,
+                      vec_file *files, const cancel_token *cancel) {
+  if (likely(getdents_supported())) {
+    struct dirents d = {0};
+    if (unlikely(read_dirents(dir_fd, &d, cancel) == -1)) {
+      dirents_drop(&d);
+      if (getdents_supported())
+        return -1;
+      // getdents64 not available, nothing was read
+      lseek(dir_fd, 0, SEEK_SET);
+      goto fallback;
+    }
+
+    // stat'ing many files at once pays off on network filesystems
+    bool batch = statx_batch_preferred(dir_fd);
+
+    if (parallel.tpool && parallel.threshold > 0 &&
+        d.num >= parallel.threshold && d.num > LOAD_CHUNK_SIZE) {
+      create_files_parallel(arena, path, dir_fd, load_fileinfo, batch, &d,
+                            parallel, files, cancel);
+    } else {
+      File **chunk = xmalloc(min(d.num, LOAD_CHUNK_SIZE) * sizeof *chunk);
+      for (u32 begin = 0; begin < d.num; begin += LOAD_CHUNK_SIZE) {
+        u32 end = min(begin + LOAD_CHUNK_SIZE, d.num);
+        create_files(arena, path, dir_fd, load_fileinfo, batch, &d, begin, end,
+                     chunk);
+        for (u32 i = 0; i < end - begin; i++) {
+          if (chunk[i] != NULL)
+            vec_file_push(files, chunk[i]);
+        }
+        if (cancel_token_is_cancelled(cancel))
+          break;
+      }
+      xfree(chunk);
+    }
+    dirents_drop(&d);
+    return 0;
+  }
+
+fallback:;
+  i32 fd = dup(dir_fd);
+  if (unlikely(fd < 0))
+    return -1;
+  DIR *dirp = fdopendir(fd);
+  if (unlikely(dirp == NULL)) {
+    close(fd);
+    return -1;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dirp))) {
+    if (path_is_dot_or_dotdot(entry->d_name))
+      continue;
+
+    File *file =
+        file_create(arena, path, entry->d_name, dir_fd, load_fileinfo);
+    if (file != NULL)
+      vec_file_push(files, file);
+    if (cancel_token_is_cancelled(cancel))
+      break;
+  }
+  closedir(dirp);
+
+  return 0;
+}
+
 Dir *dir_load(zsview path, map_str_int dircounts, bool load_fileinfo,
-              atomic_bool *stop) {
+              struct dir_load_parallel parallel,
+              const cancel_token *cancel) {
   Dir *dir = dir_create(path, 0, 0);
   dir->load.has_fileinfo = load_fileinfo;
   dir->load.dircounts = dircounts;
-  if (!load_fileinfo)
-    stop = NULL;
 
   if (unlikely(stat(path.str, &dir->stat) == -1)) {
     log_perror("stat");
@@ -311,44 +775,37 @@ Dir *dir_load(zsview path, map_str_int dircounts, bool load_fileinfo,
     return dir;
   }
 
-  DIR *dirp = opendir(path.str);
-  if (unlikely(dirp == NULL)) {
-    log_perror("opendir");
-    dir->error = errno;
-    return dir;
-  }
-  i32 dir_fd = open(path.str, O_RDONLY);
+  i32 dir_fd = open(path.str, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
   if (unlikely(dir_fd < 0)) {
     log_perror("open");
     dir->error = errno;
-    closedir(dirp);
     return dir;
   }
 
   vec_file files = vec_file_init();
   usize num_dirs = 0;
 
-  struct dirent *entry;
-  while ((entry = readdir(dirp))) {
-    if (path_is_dot_or_dotdot(entry->d_name))
-      continue;
+  if (unlikely(read_files(&dir->arena, path.str, dir_fd, load_fileinfo,
+                          parallel, &files, cancel))) {
+    log_perror("getdents");
+    dir->error = errno;
+  }
+  close(dir_fd);
 
-    File *file = file_create(path.str, entry->d_name, dir_fd, load_fileinfo);
-    if (file != NULL) {
-      if (load_fileinfo && file_isdir(file)) {
+  if (load_fileinfo) {
+    c_foreach(it, vec_file, files) {
+      if (file_isdir(*it.ref)) {
         num_dirs++;
-        load_dircount_cached(dir, file);
+        load_dircount_cached(dir, *it.ref);
+      }
+      if (cancel_token_is_cancelled(cancel)) {
+        break;
       }
-      vec_file_push(&files, file);
-    }
-    if (stop && atomic_load_explicit(stop, memory_order_relaxed)) {
-      break;
     }
   }
-  closedir(dirp);
-  close(dir_fd);
 
   vec_file_shrink_to_fit(&files);
+  dir->files_loaded = vec_file_clone(files);
   dir->files_all = vec_file_clone(files);
   dir->files_sorted = vec_file_clone(files);
   dir->files = files;
@@ -364,7 +821,8 @@ Dir *dir_load(zsview path, map_str_int dircounts, bool load_fileinfo,
 }
 
 Dir *dir_load_flat(zsview path, i32 level, map_str_int dircounts,
-                   bool load_fileinfo, atomic_bool *stop) {
+                   bool load_fileinfo, struct dir_load_parallel parallel,
+                   const cancel_token *cancel) {
   Dir *dir = dir_create(path, 0, 0);
   dir->load.has_fileinfo = load_fileinfo;
   dir->load.dircounts = dircounts;
@@ -387,64 +845,55 @@ Dir *dir_load_flat(zsview path, i32 level, map_str_int dircounts,
   usize num_dirs = 0;
 
   while (!queue_dirs_is_empty(&queue)) {
-    if (atomic_load_explicit(stop, memory_order_relaxed))
+    if (cancel_token_is_cancelled(cancel))
       break;
 
     node head = *queue_dirs_front(&queue);
     queue_dirs_pop(&queue);
 
-    DIR *dirp = opendir(head.path);
-    if (unlikely(dirp == NULL))
+    i32 dir_fd = open(head.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (unlikely(dir_fd < 0))
       continue;
 
-    i32 dir_fd = open(head.path, O_RDONLY);
-    if (unlikely(dir_fd < 0)) {
-      closedir(dirp);
-      continue;
-    }
-
-    struct dirent *entry;
-    while ((entry = readdir(dirp)) != NULL) {
-      if (path_is_dot_or_dotdot(entry->d_name))
-        continue;
+    isize start = vec_file_size(&files);
+    read_files(&dir->arena, head.path, dir_fd, load_fileinfo, parallel, &files,
+               cancel);
+    close(dir_fd);
 
-      File *file = file_create(head.path, entry->d_name, dir_fd, load_fileinfo);
-      if (file != NULL) {
-        file->hidden |= head.hidden;
-        if (file_isdir(file)) {
-          if (head.level + 1 <= level) {
-            queue_dirs_push(&queue, (node){
-                                        file_path_str(file),
-                                        head.level + 1,
-                                        file_hidden(file),
-                                    });
-          }
+    for (isize i = start; i < vec_file_size(&files); i++) {
+      File *file = files.data[i];
+      file->hidden |= head.hidden;
+      if (file_isdir(file)) {
+        if (head.level + 1 <= level) {
+          queue_dirs_push(&queue, (node){
+                                      file_path_str(file),
+                                      head.level + 1,
+                                      file_hidden(file),
+                                  });
         }
-        // name is a pointer into path, we can simply move it back
-        i32 pos = 0;
-        for (i32 i = 0; i < head.level; i++) {
-          pos -= 2;
-          while (file->name.str[pos - 1] != '/') {
-            pos--;
-          }
-        }
-        file->name.str += pos;
-        file->name.size -= pos;
-
-        if (load_fileinfo && file_isdir(file)) {
-          num_dirs++;
-          load_dircount_cached(dir, file);
+      }
+      // name is a pointer into path, we can simply move it back
+      i32 pos = 0;
+      for (i32 i = 0; i < head.level; i++) {
+        pos -= 2;
+        while (file->name.str[pos - 1] != '/') {
+          pos--;
         }
+      }
+      file->name.str += pos;
+      file->name.size -= pos;
+      file_update_natural_key(file, &dir->arena);
 
-        vec_file_push(&files, file);
+      if (load_fileinfo && file_isdir(file)) {
+        num_dirs++;
+        load_dircount_cached(dir, file);
       }
     }
-    closedir(dirp);
-    close(dir_fd);
   }
   queue_dirs_drop(&queue);
 
   vec_file_shrink_to_fit(&files);
+  dir->files_loaded = vec_file_clone(files);
   dir->files_all = vec_file_clone(files);
   dir->files_sorted = vec_file_clone(files);
   dir->files = files;
@@ -492,7 +941,7 @@ static inline bool dir_cursor_move_to_sel(Dir *d) {
 static inline bool dir_cursor_move_to_ino(Dir *d, dev_t dev, ino_t ino) {
   i32 i = 0;
   c_foreach(it, vec_file, d->files) {
-    if ((*it.ref)->lstat.st_dev == dev && (*it.ref)->lstat.st_ino == ino) {
+    if ((*it.ref)->lstat.dev == dev && (*it.ref)->lstat.ino == ino) {
       dir_move_cursor(d, i - d->ui.ind);
       return true;
     }
@@ -546,7 +995,195 @@ static inline void apply_scroll(Dir *dir) {
   }
 }
 
-void dir_update_with(Dir *dir, Dir *update) {
+// Files are identified across reloads by (dev, ino, name).
+static inline bool same_file(const File *a, const File *b) {
+  return a->lstat.ino == b->lstat.ino && a->lstat.dev == b->lstat.dev &&
+         zsview_eq(&a->name, &b->name);
+}
+
+static inline usize file_id_hash(File *const *file) {
+  u64 h = (*file)->lstat.ino ^ ((*file)->lstat.dev << 40);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9u;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebu;
+  return h ^ (h >> 31);
+}
+
+static inline bool file_id_eq(File *const *a, File *const *b) {
+  return same_file(*a, *b);
+}
+
+// Stores only pointers to stay small, hard links to the same inode are told
+// apart by name on lookup.
+#define i_type set_file_id
+#define i_key File *
+#define i_hash file_id_hash
+#define i_eq file_id_eq
+#include <stc/hset.h>
+
+// Returns true if the new version `b` of the file `a` would be displayed and
+// sorted exactly like `a`.
+static inline bool file_unchanged(const File *a, const File *b) {
+  if (!file_stat_equal(&a->lstat, &b->lstat))
+    return false;
+  if ((a->link_stat == NULL) != (b->link_stat == NULL) ||
+      (a->link_stat && !file_stat_equal(a->link_stat, b->link_stat)))
+    return false;
+  return a->isbroken == b->isbroken && a->hidden == b->hidden &&
+         a->dircount == b->dircount && a->error == b->error &&
+         a->key == b->key && zsview_eq(&a->link_target, &b->link_target);
+}
+
+// How far to look ahead when the two loads get out of step.
+#define MERGE_WINDOW 8
+
+struct merge {
+  struct arena arena; // copies of new and changed files
+  vec_file loaded;    // files of the update, unchanged ones replaced by the old
+  vec_file added;
+  vec_file removed;
+  vec_file old; // files of the previous load that are not matched yet
+  vec_int new;  // indices in `loaded` of files that are not matched yet
+  bool failed;
+};
+
+// Copies the new file at `slot` of `loaded` and records it as added.
+static inline void merge_add(struct merge *m, i32 slot) {
+  File *file = file_clone(&m->arena, m->loaded.data[slot]);
+  if (unlikely(file == NULL)) {
+    m->failed = true;
+    return;
+  }
+  m->loaded.data[slot] = file;
+  vec_file_push(&m->added, file);
+}
+
+// `old` is the previous version of the new file at `slot` of `loaded`.
+static inline void merge_match(struct merge *m, File *old, i32 slot) {
+  if (file_unchanged(old, m->loaded.data[slot])) {
+    m->loaded.data[slot] = old;
+  } else {
+    merge_add(m, slot);
+    vec_file_push(&m->removed, old);
+  }
+}
+
+// Returns the index of `file` in `files[0, n)`, or -1.
+static inline isize find_file(File *const *files, isize n, const File *file) {
+  for (isize k = 0; k < n; k++) {
+    if (same_file(files[k], file))
+      return k;
+  }
+  return -1;
+}
+
+// Merges the files of `update` into `dir`, see `dir_update_with`. Returns
+// false without changing `dir` if all files should be replaced instead.
+//
+// Both loads list the files in the order the file system returned them, which
+// rarely changes between loads. They are walked side by side, and only files
+// that fall out of step are matched via a hash set.
+static bool merge_update(Dir *dir, Dir *update, struct dir_delta *delta) {
+  // fileinfo of an incomplete update is applied to its files later, and
+  // removed files are only freed when all files are replaced
+  if (!update->load.has_fileinfo || dir->status != DIR_LOADED ||
+      !dir->view.sorted ||
+      dir->view.flatten_level != update->view.flatten_level ||
+      dir->arena_dead > (usize)dir->files_all.size)
+    return false;
+
+  isize limit = max(dir->files_all.size, update->files_all.size) /
+                RESORT_MAX_FRACTION;
+
+  File *const *old = dir->files_loaded.data;
+  isize num_old = dir->files_loaded.size;
+  isize num_new = update->files_all.size;
+
+  struct merge m = {.loaded = vec_file_clone(update->files_all)};
+  isize i = 0;
+  isize j = 0;
+  while (j < num_new && !m.failed &&
+         m.added.size + m.removed.size <= limit) {
+    File *file = m.loaded.data[j];
+    if (i == num_old) {
+      vec_int_push(&m.new, j++);
+    } else if (same_file(old[i], file)) {
+      merge_match(&m, old[i++], j++);
+    } else {
+      isize k =
+          find_file(old + i + 1, min(MERGE_WINDOW, num_old - i - 1), file);
+      if (k >= 0) {
+        // old[i, i + k] were removed (or moved)
+        for (isize end = i + k + 1; i < end; i++)
+          vec_file_push(&m.old, old[i]);
+        continue;
+      }
+      k = find_file(m.loaded.data + j + 1, min(MERGE_WINDOW, num_new - j - 1),
+                    old[i]);
+      if (k >= 0) {
+        // loaded[j, j + k] were added (or moved)
+        for (isize end = j + k + 1; j < end; j++)
+          vec_int_push(&m.new, j);
+        continue;
+      }
+      vec_file_push(&m.old, old[i++]);
+      vec_int_push(&m.new, j++);
+    }
+  }
+  for (; i < num_old; i++)
+    vec_file_push(&m.old, old[i]);
+
+  // match the rest by id
+  set_file_id set = set_file_id_with_capacity(m.old.size);
+  c_foreach(it, vec_file, m.old) {
+    set_file_id_insert(&set, *it.ref);
+  }
+  c_foreach(it, vec_int, m.new) {
+    File *const *prev = set_file_id_get(&set, m.loaded.data[*it.ref]);
+    if (prev) {
+      File *file = *prev;
+      set_file_id_erase(&set, file);
+      merge_match(&m, file, *it.ref);
+    } else {
+      merge_add(&m, *it.ref);
+    }
+  }
+  c_foreach(it, set_file_id, set) {
+    vec_file_push(&m.removed, *it.ref);
+  }
+  set_file_id_drop(&set);
+  vec_file_drop(&m.old);
+  vec_int_drop(&m.new);
+
+  if (m.failed || j < num_new || m.added.size + m.removed.size > limit) {
+    arena_drop(&m.arena);
+    vec_file_drop(&m.loaded);
+    vec_file_drop(&m.added);
+    vec_file_drop(&m.removed);
+    return false;
+  }
+
+  if (m.added.size + m.removed.size > 0) {
+    qsort(m.removed.data, m.removed.size, sizeof *m.removed.data,
+          compare_ptr);
+    splice_files(dir, m.removed.data, m.removed.size, m.added.data,
+                 m.added.size);
+  }
+  arena_merge(&dir->arena, &m.arena);
+  dir->arena_dead += m.removed.size;
+  vec_file_drop(&dir->files_loaded);
+  dir->files_loaded = m.loaded;
+
+  if (delta) {
+    delta->added = m.added;
+    delta->removed = m.removed;
+  } else {
+    vec_file_drop(&m.added);
+    vec_file_drop(&m.removed);
+  }
+  return true;
+}
+
+void dir_update_with(Dir *dir, Dir *update, struct dir_delta *delta) {
   // will try to select the file the cursor is on, dev/inode take priority
   // in case of a rename. Otherwise, we use the name.
   // TODO: why do we store both ino and file name?
@@ -557,15 +1194,27 @@ void dir_update_with(Dir *dir, Dir *update) {
 
   if (cstr_is_empty(&dir->view.sel) && dir->ui.ind < dir_length(dir)) {
     File *file = dir_current_file(dir);
-    sel.dev = file->lstat.st_dev;
-    sel.ino = file->lstat.st_ino;
+    sel.dev = file->lstat.dev;
+    sel.ino = file->lstat.ino;
   }
 
-  drop_files(dir);
+  if (delta)
+    *delta = (struct dir_delta){0};
+
+  if (!merge_update(dir, update, delta)) {
+    drop_files(dir);
 
-  dir->files_all = vec_file_move(&update->files_all);
-  dir->files_sorted = vec_file_move(&update->files_sorted);
-  dir->files = vec_file_move(&update->files);
+    dir->files_loaded = vec_file_move(&update->files_loaded);
+    dir->files_all = vec_file_move(&update->files_all);
+    dir->files_sorted = vec_file_move(&update->files_sorted);
+    dir->files = vec_file_move(&update->files);
+    dir->arena = arena_move(&update->arena);
+    dir->arena_dead = 0;
+
+    dir_sort(dir, true);
+    if (delta)
+      delta->full = true;
+  }
 
   dir->load.dircounts = map_str_int_move(&update->load.dircounts);
 
@@ -575,8 +1224,6 @@ void dir_update_with(Dir *dir, Dir *update) {
   dir->status = DIR_LOADED;
   dir->load.active = false;
 
-  dir_sort(dir, true);
-
   // TODO: if the cursor rest in the middle of the viewport, and files are
   // inserted above, the cursor is moved down, instead we could keep the cursor
   // position and scroll
@@ -591,10 +1238,79 @@ void dir_update_with(Dir *dir, Dir *update) {
   dir_destroy(update);
 }
 
-static inline void drop_files(Dir *dir) {
+// key is a zsview of a name passed to dir_update_files
+#define i_type map_name_file
+#define i_key zsview
+#define i_val File *
+#define i_eq zsview_eq
+#define i_hash zsview_hash
+#define i_no_clone
+#include <stc/hmap.h>
+
+void dir_update_files(Dir *dir, const cstr *names, File *const *files,
+                      usize n, struct dir_delta *delta) {
+  *delta = (struct dir_delta){0};
+
+  // the previous versions of the files, found with a single pass
+  map_name_file prev = map_name_file_with_capacity(n);
+  for (usize i = 0; i < n; i++)
+    map_name_file_insert(&prev, cstr_zv(&names[i]), NULL);
   c_foreach(it, vec_file, dir->files_all) {
-    file_destroy(*it.ref);
+    map_name_file_value *v = map_name_file_get_mut(&prev, file_name(*it.ref));
+    if (v)
+      v->second = *it.ref;
   }
+
+  File *cur = dir_current_file(dir);
+  for (usize i = 0; i < n; i++) {
+    File *old = map_name_file_get(&prev, cstr_zv(&names[i]))->second;
+    File *file = files[i];
+    if (file) {
+      if (dir->settings.sorttype == SORT_RAND)
+        file->key = random_key(file_name(file), dir->settings.salt);
+      else if (old)
+        file->key = old->key;
+      if (old && file_unchanged(old, file))
+        continue;
+      file = file_clone(&dir->arena, file);
+      if (unlikely(file == NULL))
+        continue; // keep the old version
+      vec_file_push(&delta->added, file);
+    }
+    if (old) {
+      vec_file_push(&delta->removed, old);
+      if (old == cur)
+        cur = file;
+    }
+  }
+  map_name_file_drop(&prev);
+
+  if (delta->added.size + delta->removed.size == 0)
+    return;
+
+  if (!dir->view.sorted)
+    dir_sort(dir, true);
+  File **removed = delta->removed.data;
+  usize num_removed = delta->removed.size;
+  qsort(removed, num_removed, sizeof *removed, compare_ptr);
+  splice_files(dir, removed, num_removed, delta->added.data,
+               delta->added.size);
+
+  remove_files(&dir->files_loaded, removed, num_removed);
+  c_foreach(it, vec_file, delta->added) {
+    vec_file_push(&dir->files_loaded, *it.ref);
+  }
+  dir->arena_dead += num_removed;
+
+  if (cur)
+    dir_move_cursor_to_ptr(dir, cur);
+  apply_scroll(dir);
+}
+
+static inline void drop_files(Dir *dir) {
+  // releases the whole generation of files at once
+  arena_drop(&dir->arena);
+  vec_file_drop(&dir->files_loaded);
   vec_file_drop(&dir->files_all);
   vec_file_drop(&dir->files_sorted);
   vec_file_drop(&dir->files);
@@ -607,6 +1323,8 @@ static inline void drop_fields(Dir *dir) {
   cstr_drop(&dir->view.sel);
   hmap_cstr_drop(&dir->tags.map);
   map_str_int_drop(&dir->load.dircounts);
+  vec_cstr_drop(&dir->load.delta_names);
+  cancel_token_unref(dir->load.cancel);
 }
 
 void dir_destroy(Dir *dir) {
@@ -639,6 +1357,19 @@ void dir_unload(Dir *dir) {
   dir->name = basename_zv(cstr_zv(&dir->path));
 }
 
+usize dir_memory_usage(const Dir *dir) {
+  usize size = sizeof *dir + cstr_capacity(&dir->path);
+  size += dir->arena.bytes;
+  size += (vec_file_capacity(&dir->files) + vec_file_capacity(&dir->files_all) +
+           vec_file_capacity(&dir->files_loaded) +
+           vec_file_capacity(&dir->files_sorted)) *
+          sizeof(File *);
+  // keys are mostly short enough to be stored inline
+  size += dir->load.dircounts.bucket_count *
+          (sizeof(map_str_int_value) + sizeof(u8));
+  return size;
+}
+
 i32 fileinfo_from_str(const char *str) {
   for (i32 i = 0; i < NUM_FILEINFO; i++) {
     if (streq(str, fileinfo_str[i])) {
@@ -1,9 +1,12 @@
 #pragma once
 
+#include "arena.h"
+#include "cancel.h"
 #include "defs.h"
 #include "dir_settings.h"
 #include "loadable.h"
 #include "types/hmap_cstr.h"
+#include "types/vec_cstr.h"
 
 #include <stc/cstr.h>
 #include <stc/zsview.h>
@@ -48,7 +51,10 @@ typedef struct Dir {
 
   vec_file files;        // every visible file
   vec_file files_all;    // every file in the directory
+  vec_file files_loaded; // every file, in the order they were read
   vec_file files_sorted; // every file, but sorted
+  struct arena arena;    // owns the files and their paths
+  usize arena_dead;      // files in `arena` that were removed by updates
 
   dir_loading_status status;
   i32 error; // errno if an error occured during loading, 0 otherwise
@@ -84,6 +90,7 @@ typedef struct Dir {
 
   // loader
   struct loadable_data loadable;
+  u64 last_access; // loader tick of the latest lookup, for LRU eviction
 
   // async loading state
   struct {
@@ -94,6 +101,12 @@ typedef struct Dir {
     // and get it back in the update
     map_str_int dircounts;
     bool has_fileinfo;
+    // names of changed files reported by inotify, see async_dir_delta
+    vec_cstr delta_names;
+    bool delta_active; // are files being stat'ed
+    // cancels the load in progress, NULL if there is none; replaced when a
+    // newer load supersedes it
+    cancel_token *cancel;
   } load;
 } Dir;
 
@@ -109,19 +122,58 @@ void dir_dec_ref(Dir *dir);
 // Bring the directory back into its "unloaded" state.
 void dir_unload(Dir *dir);
 
+// Approximate number of heap bytes held by `dir`: its files and their strings
+// in the arena, plus the file lists and the dircount cache.
+usize dir_memory_usage(const Dir *dir);
+
+// The files that changed in an update, see `dir_update_with`.
+struct dir_delta {
+  vec_file added;   // new files and new versions of changed files
+  vec_file removed; // removed files and old versions of changed files, valid
+                    // until the next update of the directory
+  bool full;        // all files were replaced, `added` and `removed` are empty
+};
+
+static inline void dir_delta_drop(struct dir_delta *delta) {
+  vec_file_drop(&delta->added);
+  vec_file_drop(&delta->removed);
+}
+
 // Replace files and metadata of `dir` with those of `update`. Frees `update`.
-void dir_update_with(Dir *dir, Dir *update);
+// Files are matched by (dev, ino, name): unchanged files are kept along with
+// their position, only the difference is removed/inserted. If the difference
+// is large, all files are replaced and sorted again. The difference is
+// written to `delta`, if it is not NULL.
+void dir_update_with(Dir *dir, Dir *update, struct dir_delta *delta);
+
+// Replaces the files of `dir` named `names[i]` with `files[i]`, e.g. after
+// inotify reported changes to them. `names` must be unique. Files that don't
+// exist yet are added, a NULL file means it was removed. The files are copied
+// into the arena of `dir`. The difference is written to `delta`,
+// `delta->full` is never set.
+void dir_update_files(Dir *dir, const cstr *names, File *const *files,
+                      usize n, struct dir_delta *delta);
+
+// Directories with at least `threshold` entries are stat'ed by multiple
+// workers of `tpool`, in `lane` (enum tpool_lane). Zero-initialized to load
+// sequentially.
+struct dir_load_parallel {
+  struct tpool *tpool;
+  u32 threshold;
+  u8 lane;
+};
 
 // Loads the directory at `path` from disk. Additionally count the files in
-// each subdirectory if `load_fileinfo` is `true`. If `load_fileinfo` is
-// `true` and a `stop` signal is passed, it is read with relaxed ordering
-// after each file to possibly abort early.
+// each subdirectory if `load_fileinfo` is `true`. `cancel` is polled while
+// reading and stat'ing; once it is cancelled, the files read so far are
+// returned. Can be `NULL`.
 Dir *dir_load(zsview path, map_str_int dircounts, bool load_fileinfo,
-              atomic_bool *stop);
+              struct dir_load_parallel parallel, const cancel_token *cancel);
 
 // Load a flat directorie showing files up `level`s deep.
 Dir *dir_load_flat(zsview path, i32 level, map_str_int dircounts,
-                   bool load_dircount, atomic_bool *stop);
+                   bool load_dircount, struct dir_load_parallel parallel,
+                   const cancel_token *cancel);
 
 static inline usize dir_length(const Dir *dir) {
   return vec_file_size(&dir->files);
@@ -176,6 +228,13 @@ bool dir_scroll(Dir *dir, i32 ct);
 // `sorted` flag is false. Filters are always applied.
 void dir_sort(Dir *dir, bool force);
 
+// Repositions `files` after their sort key or type changed, e.g. once the
+// targets of symbolic links have been stat'ed. Each changed file is moved by
+// binary insertion, the rest of the directory is left as is. If many files
+// changed, the directory is sorted again instead. Filters are applied to the
+// changed files only.
+void dir_resort_files(Dir *dir, File *const *files, usize n);
+
 void dir_set_hidden(Dir *dir, bool hidden);
 
 // Returns true if `dir` is the root directory.
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE // getdents64, statx, syscall
+#include "dirio.h"
+
+#include "log.h"
+#include "memory.h"
+#include "path.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/magic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+// only request the fields we actually use, this can save work on network
+// filesystems
+#define STATX_MASK                                                             \
+  (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID |             \
+   STATX_ATIME | STATX_MTIME | STATX_CTIME | STATX_INO | STATX_SIZE)
+
+static atomic_bool unsupported = false;
+
+static atomic_uint uring_depth = STATX_QUEUE_DEPTH;
+static atomic_bool uring_unsupported = false;
+
+// Minimal io_uring setup, we don't depend on liburing for a single opcode.
+struct uring {
+  i32 fd;
+  u32 depth; // max number of requests in flight
+  u32 sq_entries;
+  u32 *sq_head;
+  u32 *sq_tail;
+  u32 *sq_mask;
+  u32 *sq_array;
+  u32 *cq_head;
+  u32 *cq_tail;
+  u32 *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  usize sq_ring_size;
+  void *cq_ring; // same as sq_ring with IORING_FEAT_SINGLE_MMAP
+  usize cq_ring_size;
+  usize sqes_size;
+};
+
+static _Thread_local struct uring *thread_ring = NULL;
+
+isize getdents_reader_fill(struct getdents_reader *r) {
+  isize n;
+  do {
+    n = getdents64(r->fd, r->buf, sizeof r->buf);
+  } while (unlikely(n == -1 && errno == EINTR));
+  if (unlikely(n == -1)) {
+    if (errno == ENOSYS)
+      atomic_store_explicit(&unsupported, true, memory_order_relaxed);
+    r->pos = r->len = 0;
+    return -1;
+  }
+  r->pos = 0;
+  r->len = n;
+  return n;
+}
+
+bool getdents_reader_next(struct getdents_reader *r,
+                          struct getdents_entry *entry) {
+  while (r->pos < r->len) {
+    struct dirent64 *d = (struct dirent64 *)(r->buf + r->pos);
+    r->pos += d->d_reclen;
+    if (path_is_dot_or_dotdot(d->d_name))
+      continue;
+    entry->name = d->d_name;
+    entry->ino = d->d_ino;
+    entry->type = d->d_type;
+    return true;
+  }
+  return false;
+}
+
+bool getdents_supported(void) {
+  return !atomic_load_explicit(&unsupported, memory_order_relaxed);
+}
+
+static inline i32 statx_flags(bool follow) {
+  return AT_STATX_DONT_SYNC | (follow ? 0 : AT_SYMLINK_NOFOLLOW);
+}
+
+static void stat_from_statx(struct stat *st, const struct statx *stx) {
+  st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+  st->st_ino = stx->stx_ino;
+  st->st_mode = stx->stx_mode;
+  st->st_nlink = stx->stx_nlink;
+  st->st_uid = stx->stx_uid;
+  st->st_gid = stx->stx_gid;
+  st->st_size = stx->stx_size;
+  st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+  st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+  st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+  st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+  st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+  st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+i32 statx_at(i32 fd, const char *name, bool follow, struct stat *st) {
+  struct statx stx;
+  if (unlikely(statx(fd, name, statx_flags(follow), STATX_MASK, &stx) == -1))
+    return -1;
+  stat_from_statx(st, &stx);
+  return 0;
+}
+
+static bool uring_probe_statx(i32 fd) {
+  const u32 num_ops = IORING_OP_LAST;
+  struct io_uring_probe *probe =
+      xcalloc(1, sizeof *probe + num_ops * sizeof(struct io_uring_probe_op));
+  bool res =
+      syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+              num_ops) == 0 &&
+      probe->last_op >= IORING_OP_STATX &&
+      (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+  xfree(probe);
+  return res;
+}
+
+static void uring_destroy(struct uring *ring) {
+  if (ring == NULL)
+    return;
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring)
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  close(ring->fd);
+  xfree(ring);
+}
+
+static struct uring *uring_create(u32 depth) {
+  struct io_uring_params p = {0};
+  i32 fd = syscall(__NR_io_uring_setup, depth, &p);
+  if (fd < 0) {
+    log_debug("io_uring_setup: %s", strerror(errno));
+    return NULL;
+  }
+
+  struct uring *ring = xcalloc(1, sizeof *ring);
+  ring->fd = fd;
+  ring->depth = depth;
+  ring->sq_entries = p.sq_entries;
+
+  if (!uring_probe_statx(fd)) {
+    log_debug("io_uring: IORING_OP_STATX not supported");
+    errno = EINVAL; // like io_uring_enter for an unknown opcode
+    goto err;
+  }
+
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+  ring->cq_ring_size =
+      p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size)
+      ring->sq_ring_size = ring->cq_ring_size;
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+
+  void *sq = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED)
+    goto err;
+  ring->sq_ring = sq;
+
+  void *cq = sq;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED)
+      goto err;
+  }
+  ring->cq_ring = cq;
+
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    goto err;
+  ring->sqes = sqes;
+
+  ring->sq_head = (u32 *)((char *)sq + p.sq_off.head);
+  ring->sq_tail = (u32 *)((char *)sq + p.sq_off.tail);
+  ring->sq_mask = (u32 *)((char *)sq + p.sq_off.ring_mask);
+  ring->sq_array = (u32 *)((char *)sq + p.sq_off.array);
+  ring->cq_head = (u32 *)((char *)cq + p.cq_off.head);
+  ring->cq_tail = (u32 *)((char *)cq + p.cq_off.tail);
+  ring->cq_mask = (u32 *)((char *)cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((char *)cq + p.cq_off.cqes);
+
+  return ring;
+
+err:;
+  i32 saved_errno = errno;
+  log_debug("io_uring: %s", strerror(errno));
+  uring_destroy(ring);
+  errno = saved_errno;
+  return NULL;
+}
+
+// Waits for the completion of `n` requests, discarding the results. Returns -1
+// if io_uring_enter fails.
+static i32 uring_drain(struct uring *ring, u32 n) {
+  while (n > 0) {
+    if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS,
+                NULL, 0) < 0 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      return -1;
+    }
+    u32 cq_head = *ring->cq_head;
+    u32 cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; cq_head != cq_tail && n > 0; cq_head++)
+      n--;
+    __atomic_store_n(ring->cq_head, cq_head, __ATOMIC_RELEASE);
+  }
+  return 0;
+}
+
+// Submits statx requests for all names, keeping at most ring->depth in
+// flight, and waits for their completion. Returns -1 if io_uring_enter fails,
+// after waiting for the requests already in flight. Returns -2 if that fails
+// too, the requests might then still write to `stx`.
+static i32 uring_statx(struct uring *ring, i32 fd, const char *const *names,
+                       u32 n, i32 flags, struct statx *stx, i32 *res) {
+  u32 submitted = 0;
+  u32 completed = 0;
+  while (completed < n) {
+    u32 tail = *ring->sq_tail; // we are the only producer
+    u32 head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    while (submitted < n && submitted - completed < ring->depth &&
+           tail - head < ring->sq_entries) {
+      u32 idx = tail & *ring->sq_mask;
+      struct io_uring_sqe *sqe = &ring->sqes[idx];
+      memset(sqe, 0, sizeof *sqe);
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = fd;
+      sqe->addr = (u64)(uintptr_t)names[submitted];
+      sqe->len = STATX_MASK;
+      sqe->off = (u64)(uintptr_t)&stx[submitted];
+      sqe->statx_flags = flags;
+      sqe->user_data = submitted;
+      ring->sq_array[idx] = idx;
+      tail++;
+      submitted++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    // entries not consumed by an interrupted call are picked up on retry
+    u32 to_submit = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      log_perror("io_uring_enter");
+      // requests the kernel has not consumed are never submitted, the ring
+      // is destroyed
+      u32 unconsumed = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+      return uring_drain(ring, submitted - unconsumed - completed) == 0 ? -1
+                                                                        : -2;
+    }
+
+    u32 cq_head = *ring->cq_head;
+    u32 cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; cq_head != cq_tail; cq_head++) {
+      struct io_uring_cqe *cqe = &ring->cqes[cq_head & *ring->cq_mask];
+      res[cqe->user_data] = cqe->res;
+      completed++;
+    }
+    __atomic_store_n(ring->cq_head, cq_head, __ATOMIC_RELEASE);
+  }
+  return 0;
+}
+
+// Returns the ring of the calling thread, creating it if needed, or NULL if
+// io_uring should not be used.
+static struct uring *get_thread_ring(void) {
+  u32 depth = atomic_load_explicit(&uring_depth, memory_order_relaxed);
+  if (thread_ring && thread_ring->depth != depth) {
+    uring_destroy(thread_ring);
+    thread_ring = NULL;
+  }
+  if (depth == 0 ||
+      atomic_load_explicit(&uring_unsupported, memory_order_relaxed))
+    return NULL;
+  if (thread_ring == NULL) {
+    thread_ring = uring_create(depth);
+    // only give up for good if io_uring is missing or forbidden, running out
+    // of file descriptors or memory is retried on the next batch
+    if (thread_ring == NULL &&
+        (errno == ENOSYS || errno == EPERM || errno == EINVAL)) {
+      log_info("io_uring unavailable, using synchronous statx");
+      atomic_store_explicit(&uring_unsupported, true, memory_order_relaxed);
+    }
+  }
+  return thread_ring;
+}
+
+void statx_batch(i32 fd, const char *const *names, u32 n, bool follow,
+                 struct stat *st, i32 *err) {
+  struct uring *ring = n > 1 ? get_thread_ring() : NULL;
+  if (ring) {
+    struct statx *stx = xmalloc(n * sizeof *stx);
+    i32 ret = uring_statx(ring, fd, names, n, statx_flags(follow), stx, err);
+    if (likely(ret == 0)) {
+      for (u32 i = 0; i < n; i++) {
+        if (likely(err[i] == 0))
+          stat_from_statx(&st[i], &stx[i]);
+        else
+          err[i] = -err[i];
+      }
+      xfree(stx);
+      return;
+    }
+    uring_destroy(ring);
+    thread_ring = NULL;
+    if (ret == -1) {
+      // all requests are done, the ring is recreated on the next batch
+      xfree(stx);
+    } else {
+      // Outstanding requests might still write to stx, so we leak it and
+      // stop using io_uring to leak it at most once per thread.
+      atomic_store_explicit(&uring_unsupported, true, memory_order_relaxed);
+    }
+  }
+
+  for (u32 i = 0; i < n; i++) {
+    err[i] = statx_at(fd, names[i], follow, &st[i]) == 0 ? 0 : errno;
+  }
+}
+
+bool statx_batch_preferred(i32 fd) {
+  struct statfs buf;
+  if (fstatfs(fd, &buf) == -1)
+    return false;
+  switch ((u32)buf.f_type) {
+  case NFS_SUPER_MAGIC:
+  case SMB_SUPER_MAGIC:
+  case CIFS_SUPER_MAGIC:
+  case SMB2_SUPER_MAGIC:
+  case CEPH_SUPER_MAGIC:
+  case CODA_SUPER_MAGIC:
+  case AFS_SUPER_MAGIC:
+  case AFS_FS_MAGIC:
+  case V9FS_MAGIC:
+  case FUSE_SUPER_MAGIC:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void statx_set_queue_depth(u32 depth) {
+  atomic_store_explicit(&uring_depth, depth, memory_order_relaxed);
+}
+
+u32 statx_queue_depth(void) {
+  return atomic_load_explicit(&uring_depth, memory_order_relaxed);
+}
+
+bool statx_uring_supported(void) {
+  return !atomic_load_explicit(&uring_unsupported, memory_order_relaxed);
+}
+
+void dirio_thread_destroy(void) {
+  uring_destroy(thread_ring);
+  thread_ring = NULL;
+}
+
+u32 dtype_to_mode(u8 type) {
+  return DTTOIF(type);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+/*
+ * Low level directory I/O used when loading directories: a buffered
+ * getdents64(2) reader and statx(2) wrappers.
+ *
+ * Compared to readdir, many entries are read per syscall and the entry type
+ * (`d_type`) is exposed so that callers can skip work where possible. statx
+ * lets us request only the fields we actually use.
+ *
+ * If the kernel supports it, the statx calls of a whole getdents batch are
+ * submitted to an io_uring(7) ring so that they can be serviced concurrently,
+ * which helps a lot on network filesystems. On local filesystems the inode
+ * cache usually answers synchronously and the round trip through the kernel's
+ * io workers is slower, so it is only used where it pays off. Each thread
+ * lazily creates its own ring. If io_uring is not available (old kernel,
+ * seccomp, disabled via sysctl) we fall back to synchronous statx calls.
+ */
+
+#include "defs.h"
+
+#include <stdbool.h>
+
+#include <sys/stat.h>
+
+// large enough for a couple of thousand entries per syscall
+#define GETDENTS_BUFSZ (64 * 1024)
+
+struct getdents_entry {
+  const char *name; // points into the reader's buffer
+  u64 ino;
+  u8 type; // DT_* constant, DT_UNKNOWN (0) if the filesystem doesn't say
+};
+
+struct getdents_reader {
+  i32 fd;
+  i32 pos;
+  i32 len;
+  _Alignas(u64) char buf[GETDENTS_BUFSZ]; // holds struct dirent64 records
+};
+
+// Initializes a reader on the (open) directory `fd`. The fd is not owned by
+// the reader.
+static inline void getdents_reader_init(struct getdents_reader *r, i32 fd) {
+  r->fd = fd;
+  r->pos = 0;
+  r->len = 0;
+}
+
+// Fetches the next buffer of entries. Returns the number of bytes read, 0 at
+// the end of the directory, and -1 on error with errno set. Entries of the
+// previous buffer are invalidated.
+isize getdents_reader_fill(struct getdents_reader *r);
+
+// Returns the next entry from the current buffer, skipping "." and "..".
+// Returns false if the buffer is exhausted, in which case
+// `getdents_reader_fill` must be called.
+bool getdents_reader_next(struct getdents_reader *r,
+                          struct getdents_entry *entry);
+
+// Returns false once getdents64 failed with ENOSYS, e.g. in a restrictive
+// seccomp sandbox.
+bool getdents_supported(void);
+
+// Stats `name` relative to the directory `fd` via statx(2), requesting only
+// the fields lfm uses. Does not follow symbolic links unless `follow` is set.
+// Unrequested fields of `st` are left untouched. Returns 0 on success, -1 on
+// error with errno set.
+i32 statx_at(i32 fd, const char *name, bool follow, struct stat *st);
+
+// Default number of statx requests in flight per thread.
+#define STATX_QUEUE_DEPTH 32
+
+// Stats the `n` names relative to the directory `fd` like `statx_at`, using
+// io_uring if available and enabled. `err[i]` is set to the errno of the i-th
+// call, 0 on success.
+void statx_batch(i32 fd, const char *const *names, u32 n, bool follow,
+                 struct stat *st, i32 *err);
+
+// Returns true if `statx_batch` is worth it for the directory `fd`, i.e. it is
+// on a network or FUSE filesystem where each stat can block for a while.
+bool statx_batch_preferred(i32 fd);
+
+// Sets the maximum number of statx requests in flight per thread, 0 disables
+// io_uring. Existing rings are recreated on their next use.
+void statx_set_queue_depth(u32 depth);
+
+u32 statx_queue_depth(void);
+
+// Returns false if io_uring turned out to be unusable for statx_batch.
+bool statx_uring_supported(void);
+
+// Frees the io_uring ring of the calling thread. Call this before thread exit.
+void dirio_thread_destroy(void);
+
+// Converts a DT_* constant to the corresponding S_IF* file type bits, 0 for
+// DT_UNKNOWN.
+u32 dtype_to_mode(u8 type);
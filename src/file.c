@@ -1,9 +1,12 @@
 #include "file.h"
 
+#include "arena.h"
 #include "defs.h"
+#include "dirio.h"
 #include "log.h"
 #include "memory.h"
 #include "path.h"
+#include "sort.h"
 
 #include <stc/cstr.h>
 #include <stc/zsview.h>
@@ -21,7 +24,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
-File *file_create(const char *dir, const char *name, i32 fd, bool load_info) {
+// The File struct and its path are allocated contiguously from the arena.
+static inline File *file_alloc(struct arena *arena, const char *dir,
+                               const char *name) {
   char buf[PATH_MAX + 1];
 
   i32 len = path_concat(zsview_from(dir), zsview_from(name), buf, sizeof buf);
@@ -30,40 +35,168 @@ File *file_create(const char *dir, const char *name, i32 fd, bool load_info) {
     return NULL;
   }
 
-  File *f = xcalloc(1, sizeof *f);
+  // the natural sort key follows the path
+  usize keylen = natural_sort_key(basename_zv((zsview){buf, len}).str, NULL);
 
-  f->path = cstr_with_n(buf, len);
-  f->name = basename_zv(cstr_zv(&f->path));
+  File *f = arena_alloc(arena, sizeof *f + len + 1 + keylen + 1);
+  if (unlikely(f == NULL))
+    return NULL;
+  memset(f, 0, sizeof *f);
+
+  char *path = (char *)(f + 1);
+  memcpy(path, buf, len + 1);
+  f->path = (zsview){path, len};
+  f->name = basename_zv(f->path);
+  f->natkey = path + len + 1;
+  natural_sort_key(f->name.str, (char *)f->natkey);
   f->ext = name_ext(&f->name);
   f->hidden = file_name(f).str[0] == '.';
   f->dircount = -1;
+  f->link_target = c_zv("");
 
-  if (unlikely(fstatat(fd, name, &f->lstat, AT_SYMLINK_NOFOLLOW) == -1)) {
-    if (errno == ENOENT) {
-      cstr_drop(&f->path);
-      xfree(f);
-      return NULL;
-    }
-    f->error = errno;
+  return f;
+}
+
+static inline void load_link_target(struct arena *arena, File *f,
+                                    const char *name, i32 fd) {
+  char buf[PATH_MAX + 1];
+  isize len = readlinkat(fd, name, buf, sizeof buf);
+  if (len == -1) {
+    f->isbroken = true;
+  } else {
+    char *target = arena_strndup(arena, buf, len);
+    if (likely(target != NULL))
+      f->link_target = (zsview){target, len};
+  }
+}
+
+static inline void set_link_stat(struct arena *arena, File *f,
+                                 const struct stat *st) {
+  struct file_stat fs;
+  file_stat_from_stat(&fs, st);
+  file_set_link_stat(f, arena, &fs);
+}
+
+File *file_clone(struct arena *arena, const File *file) {
+  usize len = file->path.size;
+  usize keylen = strlen(file->natkey);
+  File *f = arena_alloc(arena, sizeof *f + len + 1 + keylen + 1);
+  if (unlikely(f == NULL))
+    return NULL;
+  *f = *file;
+
+  char *path = (char *)(f + 1);
+  memcpy(path, file->path.str, len + 1);
+  memcpy(path + len + 1, file->natkey, keylen + 1);
+  f->path.str = path;
+  f->name.str = path + (file->name.str - file->path.str);
+  f->natkey = path + len + 1;
+  // the extension is a suffix of the path, or empty
+  f->ext.str = path + len - file->ext.size;
+
+  if (file->link_target.size > 0) {
+    char *target =
+        arena_strndup(arena, file->link_target.str, file->link_target.size);
+    f->link_target = target ? (zsview){target, file->link_target.size}
+                            : c_zv("");
+  }
+  if (file->link_stat) {
+    f->link_stat = NULL;
+    file_set_link_stat(f, arena, file->link_stat);
+  }
+  return f;
+}
+
+void file_update_natural_key(File *file, struct arena *arena) {
+  usize keylen = natural_sort_key(file_name_str(file), NULL);
+  char *key = arena_alloc(arena, keylen + 1);
+  if (unlikely(key == NULL))
+    return;
+  natural_sort_key(file_name_str(file), key);
+  file->natkey = key;
+}
+
+void file_set_link_stat(File *file, struct arena *arena,
+                        const struct file_stat *st) {
+  if (file->link_stat == NULL) {
+    file->link_stat = arena_alloc(arena, sizeof *file->link_stat);
+    if (unlikely(file->link_stat == NULL))
+      return;
+  }
+  *file->link_stat = *st;
+}
+
+File *file_create(struct arena *arena, const char *dir, const char *name,
+                  i32 fd, bool load_info) {
+  struct stat lstat;
+  i32 err = fstatat(fd, name, &lstat, AT_SYMLINK_NOFOLLOW) == -1 ? errno : 0;
+  if (unlikely(err == ENOENT))
+    return NULL;
+
+  File *f = file_alloc(arena, dir, name);
+  if (unlikely(f == NULL))
+    return NULL;
+
+  if (unlikely(err != 0)) {
+    f->error = err;
     return f;
   }
 
-  if (S_ISLNK(f->lstat.st_mode)) {
+  file_stat_from_stat(&f->lstat, &lstat);
+  if (S_ISLNK(f->lstat.mode)) {
     if (load_info) {
-      if (fstatat(fd, name, &f->stat, 0) == -1) {
+      struct stat st;
+      if (fstatat(fd, name, &st, 0) == -1)
         f->isbroken = true;
-        f->stat = f->lstat;
-      }
+      else
+        set_link_stat(arena, f, &st);
     }
-    isize len = readlinkat(fd, name, buf, sizeof buf);
-    if (len == -1) {
-      f->isbroken = true;
-    } else {
-      f->link_target = cstr_with_n(buf, len);
+    load_link_target(arena, f, name, fd);
+  }
+
+  if (file_isdir(f)) {
+    f->ext = c_zv("");
+  }
+
+  return f;
+}
+
+File *file_create_statx(struct arena *arena, const char *dir, const char *name,
+                        u8 d_type, i32 fd, bool load_info) {
+  struct stat lstat;
+  i32 err = statx_at(fd, name, false, &lstat) == -1 ? errno : 0;
+  return file_create_from_lstat(arena, dir, name, d_type, &lstat, err, fd,
+                                load_info);
+}
+
+File *file_create_from_lstat(struct arena *arena, const char *dir,
+                             const char *name, u8 d_type,
+                             const struct stat *lstat, i32 err, i32 fd,
+                             bool load_info) {
+  if (unlikely(err == ENOENT))
+    return NULL;
+
+  File *f = file_alloc(arena, dir, name);
+  if (unlikely(f == NULL))
+    return NULL;
+
+  if (unlikely(err != 0)) {
+    f->error = err;
+    // we can at least show the correct type
+    f->lstat.mode = dtype_to_mode(d_type);
+    return f;
+  }
+
+  file_stat_from_stat(&f->lstat, lstat);
+  if (S_ISLNK(f->lstat.mode)) {
+    if (load_info) {
+      struct stat st;
+      if (statx_at(fd, name, true, &st) == -1)
+        f->isbroken = true;
+      else
+        set_link_stat(arena, f, &st);
     }
-  } else {
-    // for non-symlinks stat == lstat
-    f->stat = f->lstat;
+    load_link_target(arena, f, name, fd);
   }
 
   if (file_isdir(f)) {
@@ -79,16 +212,25 @@ u32 file_load_dircount(File *file) {
   return file->dircount;
 }
 
-void file_destroy(File *f) {
-  if (unlikely(f == NULL))
-    return;
-
-  cstr_drop(&f->path);
-  cstr_drop(&f->link_target);
-  xfree(f);
-}
-
 u32 path_dircount(const char *path) {
+  if (likely(getdents_supported())) {
+    i32 fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (unlikely(fd < 0))
+      return 0;
+    struct getdents_reader r;
+    struct getdents_entry entry;
+    getdents_reader_init(&r, fd);
+    u32 c = 0;
+    isize n;
+    while ((n = getdents_reader_fill(&r)) > 0) {
+      while (getdents_reader_next(&r, &entry))
+        c++;
+    }
+    close(fd);
+    if (likely(n == 0 || getdents_supported()))
+      return c;
+  }
+
   DIR *dirp = opendir(path);
   u32 c = 0;
   if (likely(dirp)) {
@@ -145,7 +287,7 @@ const char *file_perms(const File *f) {
                               "r--", "r-x", "rw-", "rwx"};
   static char bits[11];
 
-  const i32 mode = f->stat.st_mode;
+  const i32 mode = file_stat(f)->mode;
   bits[0] = filetypeletter(mode);
   strcpy(&bits[1], rwx[(mode >> 6) & 7]);
   strcpy(&bits[4], rwx[(mode >> 3) & 7]);
@@ -167,7 +309,7 @@ const char *file_owner(const File *f) {
   static char name[32];
   static uid_t cached_uid = UINT_MAX;
 
-  u32 uid = f->lstat.st_uid;
+  u32 uid = f->lstat.uid;
   if (uid != cached_uid) {
     struct passwd *pwd = getpwuid(uid);
     if (pwd) {
@@ -176,7 +318,7 @@ const char *file_owner(const File *f) {
       snprintf(name, sizeof name, "%d/UNKNOWN", uid);
     }
     name[sizeof name - 1] = 0;
-    cached_uid = f->lstat.st_uid;
+    cached_uid = f->lstat.uid;
   }
   return name;
 }
@@ -186,7 +328,7 @@ const char *file_group(const File *f) {
   static char name[32];
   static gid_t cached_gid = UINT_MAX;
 
-  u32 gid = f->lstat.st_gid;
+  u32 gid = f->lstat.gid;
   if (gid != cached_gid) {
     struct group *grp = getgrgid(gid);
     if (grp) {
@@ -8,33 +8,123 @@
 
 #include <sys/stat.h>
 
+struct arena;
+
+// The fields of struct stat that lfm actually uses.
+struct file_stat {
+  u64 ino;
+  u64 dev;
+  i64 size;
+  i64 atime; // seconds
+  i64 mtime;
+  i64 ctime;
+  u32 atime_nsec;
+  u32 mtime_nsec;
+  u32 ctime_nsec;
+  u32 mode;
+  u32 nlink;
+  u32 uid;
+  u32 gid;
+};
+
+static inline void file_stat_from_stat(struct file_stat *fs,
+                                       const struct stat *st) {
+  *fs = (struct file_stat){
+      .ino = st->st_ino,
+      .dev = st->st_dev,
+      .size = st->st_size,
+      .atime = st->st_atim.tv_sec,
+      .mtime = st->st_mtim.tv_sec,
+      .ctime = st->st_ctim.tv_sec,
+      .atime_nsec = st->st_atim.tv_nsec,
+      .mtime_nsec = st->st_mtim.tv_nsec,
+      .ctime_nsec = st->st_ctim.tv_nsec,
+      .mode = st->st_mode,
+      .nlink = st->st_nlink,
+      .uid = st->st_uid,
+      .gid = st->st_gid,
+  };
+}
+
+static inline bool file_stat_equal(const struct file_stat *a,
+                                   const struct file_stat *b) {
+  return a->ino == b->ino && a->dev == b->dev && a->size == b->size &&
+         a->atime == b->atime && a->mtime == b->mtime &&
+         a->ctime == b->ctime && a->atime_nsec == b->atime_nsec &&
+         a->mtime_nsec == b->mtime_nsec && a->ctime_nsec == b->ctime_nsec &&
+         a->mode == b->mode && a->nlink == b->nlink && a->uid == b->uid &&
+         a->gid == b->gid;
+}
+
+// Files are allocated from the arena of the directory load that created them
+// and are freed all at once with it.
 typedef struct File {
-  cstr path;
+  zsview path; // stored directly behind the struct
   zsview name;
   zsview ext;
-  struct stat lstat;
-  struct stat stat;
-  cstr link_target; // symlink target
-  bool isbroken;    // broken symlink
-  bool hidden;      // name starts with a dot
-  i32 dircount;     // in case of a directory, < 0 if not loaded yet
-  i32 error;        // errorno of the error that prevented loading
-  score_t score;    // used for sorting in fzy
-  i64 key;          // used for sorting with lua and random ordering
+  const char *natkey; // natural sort key of the name, see natural_sort_key
+  struct file_stat lstat;
+  // stat of the link target, only allocated for symlinks once it is loaded,
+  // use `file_stat` to access it
+  struct file_stat *link_stat;
+  zsview link_target; // symlink target, empty if not a link
+  bool isbroken;      // broken symlink
+  bool hidden;        // name starts with a dot
+  i32 dircount;       // in case of a directory, < 0 if not loaded yet
+  i32 error;          // errorno of the error that prevented loading
+  score_t score;      // used for sorting in fzy
+  i64 key;            // used for sorting with lua and random ordering
 } File;
 
-File *file_create(const char *dir, const char *name, i32 fd, bool load_info);
-
-void file_destroy(File *file);
+// Returns the stat of the file, following symbolic links. For symbolic links
+// whose target has not been loaded (yet), all fields are zero. For broken
+// links the lstat is returned.
+static inline const struct file_stat *file_stat(const File *file) {
+  static const struct file_stat empty = {0};
+  if (likely(!S_ISLNK(file->lstat.mode)))
+    return &file->lstat;
+  if (file->link_stat)
+    return file->link_stat;
+  return file->isbroken ? &file->lstat : &empty;
+}
+
+// Sets the stat of the link target of a symbolic link, allocated from `arena`,
+// which must be the arena that holds `file`.
+void file_set_link_stat(File *file, struct arena *arena,
+                        const struct file_stat *st);
+
+// Copies `file` and everything it references into `arena`.
+File *file_clone(struct arena *arena, const File *file);
+
+// Recomputes the natural sort key after the name of the file has changed,
+// allocated from `arena`, which must be the arena that holds `file`.
+void file_update_natural_key(File *file, struct arena *arena);
+
+File *file_create(struct arena *arena, const char *dir, const char *name,
+                  i32 fd, bool load_info);
+
+// Like `file_create`, but uses statx(2), requesting only the fields we need.
+// `d_type` is the type reported by getdents, or DT_UNKNOWN, and only used if
+// statx fails.
+File *file_create_statx(struct arena *arena, const char *dir, const char *name,
+                        u8 d_type, i32 fd, bool load_info);
+
+// Creates a file from the result of an lstat-like call made by the caller,
+// e.g. batched via io_uring. `err` is the errno of that call, 0 on success.
+// Returns NULL if the file vanished in the meantime.
+File *file_create_from_lstat(struct arena *arena, const char *dir,
+                             const char *name, u8 d_type,
+                             const struct stat *lstat, i32 err, i32 fd,
+                             bool load_info);
 
 // Returns the full path of the file.
 static inline zsview file_path(const File *file) {
-  return cstr_zv(&file->path);
+  return file->path;
 }
 
 // Returns the full path of the file as const char*
 static inline const char *file_path_str(const File *file) {
-  return cstr_str(&file->path);
+  return file->path.str;
 }
 
 // Returns the name of the file.
@@ -52,26 +142,26 @@ static inline const char *file_ext(const File *file) {
   return file->ext.str;
 }
 
-// Returns the target of a (non-broken) symbolic link, `NULL` otherwise.
-static inline const cstr *file_link_target(const File *file) {
-  return &file->link_target;
+// Returns the target of a (non-broken) symbolic link, empty otherwise.
+static inline zsview file_link_target(const File *file) {
+  return file->link_target;
 }
 
 // Returns `true` if the file is a directory or, if it is a link, if the link
 // target is one.
 static inline bool file_isdir(const File *file) {
-  return S_ISDIR(file->stat.st_mode);
+  return S_ISDIR(file_stat(file)->mode);
 }
 
 // Returns `true` if the file is a executable or, if it is a link, if the link
 // target is.
 static inline bool file_isexec(const File *file) {
-  return file->stat.st_mode & (1 | 8 | 64);
+  return file_stat(file)->mode & (1 | 8 | 64);
 }
 
 // Returns `true` if the file is a symbolic link.
 static inline bool file_islink(const File *file) {
-  return S_ISLNK(file->lstat.st_mode);
+  return S_ISLNK(file->lstat.mode);
 }
 
 // Returns `true` if the file is a broken symbolic link.
@@ -97,27 +187,27 @@ u32 file_load_dircount(File *file);
 
 // Returns the modification time.
 static inline long file_mtime(const File *file) {
-  return file->lstat.st_mtime;
+  return file->lstat.mtime;
 }
 
 // Returns the creation time.
 static inline long file_ctime(const File *file) {
-  return file->lstat.st_ctime;
+  return file->lstat.ctime;
 }
 
 // Returns the last access time.
 static inline long file_atime(const File *file) {
-  return file->lstat.st_atime;
+  return file->lstat.atime;
 }
 
 // Returns `nlink` of `file`.
 static inline long file_nlink(const File *file) {
-  return file->lstat.st_nlink;
+  return file->lstat.nlink;
 }
 
 // Returns the filesize in bytes.
 static inline long file_size(const File *file) {
-  return file->stat.st_size;
+  return file_stat(file)->size;
 }
 
 // Writes a human readable representation of the filesize to buf. buf size of 8
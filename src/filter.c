@@ -89,15 +89,15 @@ static bool pred_substr(const struct filter_atom *atom, const File *file) {
 }
 
 static bool pred_size_lt(const struct filter_atom *atom, const File *file) {
-  return file->lstat.st_size < atom->size;
+  return file->lstat.size < atom->size;
 }
 
 static bool pred_size_gt(const struct filter_atom *atom, const File *file) {
-  return file->lstat.st_size > atom->size;
+  return file->lstat.size > atom->size;
 }
 
 static bool pred_size_eq(const struct filter_atom *atom, const File *file) {
-  return file->lstat.st_size == atom->size;
+  return file->lstat.size == atom->size;
 }
 
 static inline i32 size_atom(struct filter_atom *atom, const char *tok) {
@@ -18,6 +18,7 @@
       const cstr *: lua_pushcstr,                                              \
       cstr *: lua_pushcstr,                                                    \
       zsview: lua_pushzsview,                                                  \
+      struct vec_file *: lua_push_file_names,                                  \
       float: lua_pushnumber,                                                   \
       i32: lua_pushnumber)((L), (ARG))
 
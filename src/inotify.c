@@ -1,5 +1,6 @@
 #include "inotify.h"
 
+#include "async/async.h"
 #include "config.h"
 #include "defs.h"
 #include "dir.h"
@@ -42,6 +43,7 @@
   (IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB)
 
 static void inotify_cb(EV_P_ ev_io *w, i32 revents);
+static void delta_timer_cb(EV_P_ ev_timer *w, i32 revents);
 
 bool inotify_ctx_init(struct inotify_ctx *ctx) {
   ctx->fd = inotify_init1(IN_NONBLOCK);
@@ -54,6 +56,9 @@ bool inotify_ctx_init(struct inotify_ctx *ctx) {
   ctx->watcher.data = ctx;
   ev_io_start(event_loop, &ctx->watcher);
 
+  ev_timer_init(&ctx->delta_timer, delta_timer_cb, 0, 0);
+  ctx->delta_timer.data = ctx;
+
   return true;
 }
 
@@ -64,18 +69,32 @@ void inotify_ctx_deinit(struct inotify_ctx *ctx) {
   map_int_dir_drop(&ctx->dirs);
   map_dir_int_drop(&ctx->wds);
   set_int_drop(&ctx->wds_dedup);
+  set_int_drop(&ctx->wds_delta);
+  ev_timer_stop(event_loop, &ctx->delta_timer);
   close(ctx->fd);
   ctx->fd = -1;
 }
 
+// Can the files reported for `dir` be stat'ed individually instead of
+// reloading it? Incomplete loads and flattened directories are reloaded, as
+// well as directories with many files replaced since the last reload, which
+// frees their memory.
+static inline bool delta_possible(const Dir *dir) {
+  return dir->status == DIR_LOADED && dir->load.has_fileinfo &&
+         dir->view.flatten_level == 0 && dir->settings.sorttype != SORT_LUA &&
+         !dir->loadable.in_progress && !dir->loadable.is_scheduled &&
+         !dir->loadable.next_requested && !dir->loadable.is_disowned &&
+         dir->arena_dead <= (usize)dir->files_all.size;
+}
+
 /* TODO: we currently don't notice if the current directory is deleted while
  * empty (on 2021-11-18) */
 static void inotify_cb(EV_P_ ev_io *w, i32 revents) {
-  (void)loop;
   (void)revents;
 
   struct inotify_ctx *ctx = w->data;
 
+  bool overflow = false;
   char buf[EVENT_BUFZS];
   isize nread;
   while ((nread = read(w->fd, buf, sizeof buf)) > 0) {
@@ -83,6 +102,11 @@ static void inotify_cb(EV_P_ ev_io *w, i32 revents) {
     for (char *p = buf; p < buf + nread; p += sizeof *event + event->len) {
       event = (struct inotify_event *)p;
 
+      if (unlikely(event->mask & IN_Q_OVERFLOW)) {
+        overflow = true;
+        continue;
+      }
+
       // changes to the directory itself (e.g. from touch'ing it) result
       // in an event without name, we are currently not really interested in
       // those
@@ -90,9 +114,25 @@ static void inotify_cb(EV_P_ ev_io *w, i32 revents) {
       if (event->len == 0)
         continue;
 
+      if (cfg.inotify_delta) {
+        const map_int_dir_value *v = map_int_dir_get(&ctx->dirs, event->wd);
+        if (v && delta_possible(v->second)) {
+          vec_cstr_push(&v->second->load.delta_names, cstr_from(event->name));
+          set_int_insert(&ctx->wds_delta, event->wd);
+          continue;
+        }
+      }
+
       set_int_insert(&ctx->wds_dedup, event->wd);
     }
   }
+  if (unlikely(overflow)) {
+    // events were lost, nothing but a full reload helps
+    log_info("inotify queue overflow, reloading all watched directories");
+    c_foreach(it, map_int_dir, ctx->dirs) {
+      set_int_insert(&ctx->wds_dedup, it.ref->first);
+    }
+  }
   if (!set_int_is_empty(&ctx->wds_dedup)) {
     struct loader_ctx *loader = &to_lfm(ctx)->loader;
     c_foreach(it, set_int, ctx->wds_dedup) {
@@ -102,6 +142,35 @@ static void inotify_cb(EV_P_ ev_io *w, i32 revents) {
     }
     set_int_clear(&ctx->wds_dedup);
   }
+  if (!set_int_is_empty(&ctx->wds_delta) &&
+      !ev_is_active(&ctx->delta_timer)) {
+    // like reloads, delay a bit so we don't show files that exist only very
+    // briefly
+    ev_timer_set(&ctx->delta_timer, cfg.inotify_delay / 1000., 0);
+    ev_timer_start(EV_A_ & ctx->delta_timer);
+  }
+}
+
+static void delta_timer_cb(EV_P_ ev_timer *w, i32 revents) {
+  (void)loop;
+  (void)revents;
+
+  struct inotify_ctx *ctx = w->data;
+  Lfm *lfm = to_lfm(ctx);
+  c_foreach(it, set_int, ctx->wds_delta) {
+    const map_int_dir_value *v = map_int_dir_get(&ctx->dirs, *it.ref);
+    if (!v)
+      continue;
+    Dir *dir = v->second;
+    if (delta_possible(dir)) {
+      async_dir_delta(&lfm->async, dir);
+    } else {
+      // e.g. a reload started in the meantime
+      vec_cstr_clear(&dir->load.delta_names);
+      loader_dir_reload(&lfm->loader, dir);
+    }
+  }
+  set_int_clear(&ctx->wds_delta);
 }
 
 void inotify_add_watcher(struct inotify_ctx *ctx, Dir *dir) {
@@ -123,6 +192,10 @@ void inotify_add_watcher(struct inotify_ctx *ctx, Dir *dir) {
   map_dir_int_insert(&ctx->wds, dir, wd);
 }
 
+bool inotify_is_watched(const struct inotify_ctx *ctx, const Dir *dir) {
+  return map_dir_int_contains(&ctx->wds, (Dir *)dir);
+}
+
 bool inotify_remove_watcher(struct inotify_ctx *ctx, Dir *dir) {
   map_dir_int_iter it = map_dir_int_find(&ctx->wds, dir);
   if (!it.ref)
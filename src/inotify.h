@@ -1,7 +1,8 @@
 /*
  * Contains functionality to watch the filesystem via inotify.
  * Directories are added/removed, when changes are detected,
- * a reload is requested (via the directory loader).
+ * a reload is requested (via the directory loader). With `cfg.inotify_delta`,
+ * only the files named in the events are stat'ed again (see async_dir_delta).
  */
 
 #pragma once
@@ -29,6 +30,8 @@ struct inotify_ctx {
   map_int_dir dirs;  // map currently watched directories to their wds
   map_dir_int wds;   // and vice versa
   set_int wds_dedup; // dedup wds when we receive multiple events
+  set_int wds_delta; // wds with names collected for a delta update
+  ev_timer delta_timer; // delays delta updates by cfg.inotify_delay
 };
 
 // Initialize a Notify context. Returns false on failure.
@@ -48,6 +51,10 @@ void inotify_add_watcher(struct inotify_ctx *ctx, Dir *dir);
 __lfm_nonnull()
 bool inotify_remove_watcher(struct inotify_ctx *ctx, Dir *dir);
 
+// Returns `true` if `dir` is currently watched.
+__lfm_nonnull()
+bool inotify_is_watched(const struct inotify_ctx *ctx, const Dir *dir);
+
 // Replace the current set of watchers with `n` watchers for the directories
 // passed in `dirs`.
 __lfm_nonnull(1)
@@ -1,11 +1,15 @@
 #include "loader.h"
 #include "async/async.h"
+#include "cancel.h"
 #include "config.h"
 #include "defs.h"
 #include "dir.h"
+#include "file.h"
 #include "hooks.h"
+#include "inotify.h"
 #include "lfm.h"
 #include "loadable.h"
+#include "log.h"
 #include "loop.h"
 #include "memory.h"
 #include "preview.h"
@@ -18,6 +22,8 @@
 #include <stc/zsview.h>
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 // key is zsview of preview->path and owned by preview
 #define i_declared
@@ -42,6 +48,13 @@ struct load_timer {
 #define i_no_clone
 #include <stc/hmap.h>
 
+#define i_declared
+#define i_type vec_prefetch, struct prefetch
+#define i_keydrop(p)                                                           \
+  (preview_dec_ref((p)->preview), cancel_token_unref((p)->cancel))
+#define i_no_clone
+#include <stc/vec.h>
+
 static void load_timer_cb(EV_P_ ev_timer *w, i32 revents);
 static inline void apply_dir_settings(Dir *dir);
 
@@ -53,6 +66,8 @@ void loader_ctx_deinit(struct loader_ctx *ctx) {
   map_loadable_timer_drop(&ctx->timers);
   map_zsview_dir_drop(&ctx->dir_cache);
   map_zsview_preview_drop(&ctx->preview_cache);
+  vec_prefetch_drop(&ctx->prefetch.active);
+  vec_prefetch_drop(&ctx->prefetch.queue);
 }
 
 static inline void load(struct loader_ctx *ctx,
@@ -213,6 +228,8 @@ Dir *loader_dir_from_path(struct loader_ctx *ctx, zsview path, bool do_load) {
   map_zsview_dir_value *v = map_zsview_dir_get_mut(&ctx->dir_cache, path);
   Dir *dir = v ? v->second : NULL;
   if (dir) {
+    ctx->dir_cache_stats.hits++;
+    dir->last_access = ++ctx->tick;
     if (do_load) {
       if (dir->status == DIR_DELAYED) {
         // delayed loading
@@ -223,8 +240,10 @@ Dir *loader_dir_from_path(struct loader_ctx *ctx, zsview path, bool do_load) {
     }
     dir_set_hidden(dir, cfg.dir_settings.hidden);
   } else {
+    ctx->dir_cache_stats.misses++;
     dir = dir_create(path, to_lfm(ctx)->fm.height, cfg.scrolloff);
     dir->loadable.load = load_dir;
+    dir->last_access = ++ctx->tick;
     apply_dir_settings(dir);
 
     map_zsview_dir_insert(&ctx->dir_cache, dir_path(dir), dir_inc_ref(dir));
@@ -246,13 +265,16 @@ Preview *loader_preview_from_path(struct loader_ctx *ctx, zsview path,
   if (v) {
     // preview existing in cache
     preview = v->second;
+    ctx->preview_cache_stats.hits++;
+    preview->last_access = ++ctx->tick;
 
     if (do_load) {
       if (preview->status == PV_DELAYED) {
         async_preview_load(&to_lfm(ctx)->async, preview);
         return preview;
       }
-      if (preview->status == PV_LOADED) {
+      // if it is loading, e.g. prefetched, there is nothing to check yet
+      if (preview->status == PV_LOADED && !preview->is_loading) {
         if (preview->height < to_lfm(ctx)->ui.preview.y ||
             preview->width < to_lfm(ctx)->ui.preview.x) {
           async_preview_load(&to_lfm(ctx)->async, preview);
@@ -262,8 +284,10 @@ Preview *loader_preview_from_path(struct loader_ctx *ctx, zsview path,
       }
     }
   } else {
+    ctx->preview_cache_stats.misses++;
     preview =
         preview_create_loading(path, to_lfm(ctx)->ui.y, to_lfm(ctx)->ui.x);
+    preview->last_access = ++ctx->tick;
     preview_inc_ref(preview);
     map_zsview_preview_insert(&ctx->preview_cache, cstr_zv(&preview->path),
                               preview);
@@ -274,6 +298,7 @@ Preview *loader_preview_from_path(struct loader_ctx *ctx, zsview path,
 }
 
 void loader_drop_preview_cache(struct loader_ctx *ctx) {
+  loader_preview_prefetch_cancel(ctx);
   c_foreach(it, map_zsview_preview, ctx->preview_cache) {
     Preview *pv = (*it.ref).second;
     pv->loadable.is_disowned = true;
@@ -287,6 +312,8 @@ void loader_drop_dir_cache(struct loader_ctx *ctx) {
     Dir *dir = (*it.ref).second;
     dir->loadable.is_disowned = true;
     map_loadable_timer_erase(&ctx->timers, &dir->loadable);
+    // nobody is waiting for loads still in flight
+    cancel_token_cancel(dir->load.cancel);
   }
   map_zsview_dir_clear(&ctx->dir_cache);
 }
@@ -297,3 +324,242 @@ static inline void apply_dir_settings(Dir *dir) {
   struct dir_settings *s = v ? &v->second : &cfg.dir_settings;
   memcpy(&dir->settings, s, sizeof *s);
 }
+
+static inline void evict_dir(struct loader_ctx *ctx, Dir *dir) {
+  dir->loadable.is_disowned = true;
+  map_loadable_timer_erase(&ctx->timers, &dir->loadable);
+  cancel_token_cancel(dir->load.cancel);
+  map_zsview_dir_erase(&ctx->dir_cache, dir_path(dir));
+  ctx->dir_cache_stats.evictions++;
+}
+
+static int compare_dir_last_access(const void *a, const void *b) {
+  const Dir *x = *(const Dir **)a;
+  const Dir *y = *(const Dir **)b;
+  return (x->last_access > y->last_access) - (x->last_access < y->last_access);
+}
+
+u64 loader_dir_cache_bytes(const struct loader_ctx *ctx) {
+  u64 bytes = 0;
+  c_foreach(it, map_zsview_dir, ctx->dir_cache) {
+    bytes += dir_memory_usage(it.ref->second);
+  }
+  return bytes;
+}
+
+void loader_dir_cache_trim(struct loader_ctx *ctx) {
+  usize num_dirs = map_zsview_dir_size(&ctx->dir_cache);
+  usize max_dirs = cfg.dir_cache_entries > 0 ? cfg.dir_cache_entries : SIZE_MAX;
+  u64 max_bytes = cfg.dir_cache_bytes > 0 ? cfg.dir_cache_bytes : UINT64_MAX;
+
+  u64 bytes = loader_dir_cache_bytes(ctx);
+  if (num_dirs <= max_dirs && bytes <= max_bytes)
+    return;
+
+  const struct inotify_ctx *inotify = &to_lfm(ctx)->inotify;
+  Dir **candidates = xmalloc(num_dirs * sizeof *candidates);
+  usize n = 0;
+  c_foreach(it, map_zsview_dir, ctx->dir_cache) {
+    Dir *dir = it.ref->second;
+    // the cache holds one reference, anything else means it is in use
+    if (dir->ui.visible || dir->refcount > 1 ||
+        inotify_is_watched(inotify, dir) ||
+        dir->last_access == ctx->tick)
+      continue;
+    candidates[n++] = dir;
+  }
+  qsort(candidates, n, sizeof *candidates, compare_dir_last_access);
+
+  for (usize i = 0; i < n && (num_dirs > max_dirs || bytes > max_bytes); i++) {
+    log_trace("evicting %s from the dir cache", dir_path_str(candidates[i]));
+    bytes -= dir_memory_usage(candidates[i]);
+    num_dirs--;
+    evict_dir(ctx, candidates[i]);
+  }
+  xfree(candidates);
+}
+
+static int compare_preview_last_access(const void *a, const void *b) {
+  const Preview *x = *(const Preview **)a;
+  const Preview *y = *(const Preview **)b;
+  return (x->last_access > y->last_access) - (x->last_access < y->last_access);
+}
+
+usize loader_preview_cache_size(const struct loader_ctx *ctx) {
+  return map_zsview_preview_size(&ctx->preview_cache);
+}
+
+u64 loader_preview_cache_bytes(const struct loader_ctx *ctx) {
+  u64 bytes = 0;
+  c_foreach(it, map_zsview_preview, ctx->preview_cache) {
+    bytes += preview_memory_usage(it.ref->second);
+  }
+  return bytes;
+}
+
+void loader_preview_cache_trim(struct loader_ctx *ctx) {
+  if (cfg.preview_cache_bytes == 0)
+    return;
+
+  u64 bytes = loader_preview_cache_bytes(ctx);
+  if (bytes <= cfg.preview_cache_bytes)
+    return;
+
+  const Preview *shown = to_lfm(ctx)->ui.preview.preview;
+  usize num_previews = map_zsview_preview_size(&ctx->preview_cache);
+  Preview **candidates = xmalloc(num_previews * sizeof *candidates);
+  usize n = 0;
+  c_foreach(it, map_zsview_preview, ctx->preview_cache) {
+    Preview *pv = it.ref->second;
+    // the cache holds one reference, anything else means it is in use
+    if (pv == shown || pv->refcount > 1 || pv->last_access == ctx->tick)
+      continue;
+    candidates[n++] = pv;
+  }
+  qsort(candidates, n, sizeof *candidates, compare_preview_last_access);
+
+  for (usize i = 0; i < n && bytes > cfg.preview_cache_bytes; i++) {
+    Preview *pv = candidates[i];
+    log_trace("evicting preview %s", preview_path_str(pv));
+    bytes -= preview_memory_usage(pv);
+    pv->loadable.is_disowned = true;
+    map_loadable_timer_erase(&ctx->timers, &pv->loadable);
+    map_zsview_preview_erase(&ctx->preview_cache, preview_path(pv));
+    ctx->preview_cache_stats.evictions++;
+  }
+  xfree(candidates);
+}
+
+// Index of the `i`th file (starting at 0) to prefetch, going from the cursor
+// in `direction`, or alternating if it is unknown. -1 if it is out of bounds.
+static inline isize prefetch_index(const Dir *dir, i32 direction, u32 i) {
+  isize ind = dir->ui.ind;
+  if (direction > 0)
+    ind += i + 1;
+  else if (direction < 0)
+    ind -= i + 1;
+  else
+    ind += i % 2 == 0 ? (isize)i / 2 + 1 : -((isize)i / 2 + 1);
+  return ind >= 0 && ind < (isize)dir_length(dir) ? ind : -1;
+}
+
+// Is `pv` the preview of the file under the cursor of `dir` or one that
+// would be prefetched from there?
+static bool prefetch_is_wanted(const struct loader_ctx *ctx, const Dir *dir,
+                               const Preview *pv) {
+  zsview path = preview_path(pv);
+  const File *file = dir_current_file(dir);
+  if (file && zsview_eq2(file_path(file), path))
+    return true;
+  for (u32 i = 0; i < cfg.preview_prefetch; i++) {
+    isize ind = prefetch_index(dir, ctx->prefetch.direction, i);
+    if (ind >= 0 &&
+        zsview_eq2(file_path(*vec_file_at(&dir->files, ind)), path))
+      return true;
+  }
+  return false;
+}
+
+static inline bool prefetch_contains(const vec_prefetch *vec,
+                                     const Preview *pv) {
+  c_foreach(it, vec_prefetch, *vec) {
+    if (it.ref->preview == pv)
+      return true;
+  }
+  return false;
+}
+
+// Cancels the load, the preview will be loaded again when it is needed.
+static inline void prefetch_abort(struct loader_ctx *ctx,
+                                  struct prefetch *prefetch) {
+  if (prefetch->preview->is_loading) {
+    async_preview_abort(&to_lfm(ctx)->async, prefetch->cancel);
+    prefetch->preview->status = PV_DELAYED;
+  }
+}
+
+void loader_preview_prefetch(struct loader_ctx *ctx, const Dir *dir) {
+  vec_prefetch_clear(&ctx->prefetch.queue);
+  if (cfg.preview_prefetch == 0 || cfg.preview_prefetch_jobs == 0)
+    return;
+
+  // queued in reverse, so that the nearest file can be pulled from the back
+  for (u32 i = cfg.preview_prefetch; i-- > 0;) {
+    isize ind = prefetch_index(dir, ctx->prefetch.direction, i);
+    if (ind < 0)
+      continue;
+    const File *file = *vec_file_at(&dir->files, ind);
+    if (file_isdir(file))
+      continue;
+    Preview *pv = loader_preview_from_path(ctx, file_path(file), false);
+    if (pv->status != PV_DELAYED ||
+        prefetch_contains(&ctx->prefetch.active, pv))
+      continue;
+    vec_prefetch_push(&ctx->prefetch.queue,
+                      (struct prefetch){preview_inc_ref(pv), NULL});
+  }
+  loader_preview_prefetch_continue(ctx);
+}
+
+void loader_preview_prefetch_update(struct loader_ctx *ctx, const Dir *dir) {
+  if (dir == ctx->prefetch.dir) {
+    if (dir->ui.ind != ctx->prefetch.ind)
+      ctx->prefetch.direction = dir->ui.ind > ctx->prefetch.ind ? 1 : -1;
+  } else {
+    ctx->prefetch.dir = dir;
+    ctx->prefetch.direction = 0;
+  }
+  ctx->prefetch.ind = dir->ui.ind;
+
+  vec_prefetch_clear(&ctx->prefetch.queue);
+  for (isize i = 0; i < vec_prefetch_size(&ctx->prefetch.active);) {
+    struct prefetch *prefetch = vec_prefetch_at_mut(&ctx->prefetch.active, i);
+    if (prefetch->preview->is_loading &&
+        prefetch_is_wanted(ctx, dir, prefetch->preview)) {
+      i++;
+      continue;
+    }
+    prefetch_abort(ctx, prefetch);
+    vec_prefetch_erase_n(&ctx->prefetch.active, i, 1);
+  }
+}
+
+void loader_preview_prefetch_continue(struct loader_ctx *ctx) {
+  // drop finished prefetches to free their slots
+  for (isize i = 0; i < vec_prefetch_size(&ctx->prefetch.active);) {
+    if (vec_prefetch_at(&ctx->prefetch.active, i)->preview->is_loading)
+      i++;
+    else
+      vec_prefetch_erase_n(&ctx->prefetch.active, i, 1);
+  }
+
+  while (vec_prefetch_size(&ctx->prefetch.active) <
+             (isize)cfg.preview_prefetch_jobs &&
+         !vec_prefetch_is_empty(&ctx->prefetch.queue)) {
+    struct prefetch prefetch = vec_prefetch_pull(&ctx->prefetch.queue);
+    Preview *pv = prefetch.preview;
+    if (pv->status != PV_DELAYED || pv->loadable.is_disowned) {
+      // loaded in the meantime, e.g. because the cursor moved there
+      preview_dec_ref(pv);
+      continue;
+    }
+    log_trace("prefetching preview of %s", preview_path_str(pv));
+    prefetch.cancel = cancel_token_create(&to_lfm(ctx)->async.stop);
+    async_preview_prefetch(&to_lfm(ctx)->async, pv, prefetch.cancel);
+    if (pv->status == PV_DELAYED) {
+      // not started, e.g. there is no previewer
+      preview_dec_ref(pv);
+      cancel_token_unref(prefetch.cancel);
+      continue;
+    }
+    vec_prefetch_push(&ctx->prefetch.active, prefetch);
+  }
+}
+
+void loader_preview_prefetch_cancel(struct loader_ctx *ctx) {
+  vec_prefetch_clear(&ctx->prefetch.queue);
+  c_foreach(it, vec_prefetch, ctx->prefetch.active) {
+    prefetch_abort(ctx, it.ref);
+  }
+  vec_prefetch_clear(&ctx->prefetch.active);
+}
@@ -5,10 +5,18 @@
 struct load_timer;
 struct Preview;
 struct Dir;
+struct cancel_token;
+
+// a preview loaded speculatively, see loader_preview_prefetch
+struct prefetch {
+  struct Preview *preview;     // referenced
+  struct cancel_token *cancel; // NULL until the load is started
+};
 
 #include <stc/types.h>
 declare_hmap(map_loadable_timer, struct loadable_data *, struct load_timer *);
 declare_hmap(map_zsview_preview, zsview, struct Preview *);
+declare_vec(vec_prefetch, struct prefetch);
 
 #include "dir.h"
 // key is zsview of dir->path and owned by dir
@@ -21,6 +29,12 @@ declare_hmap(map_zsview_preview, zsview, struct Preview *);
 #define i_no_clone
 #include <stc/hmap.h>
 
+struct cache_stats {
+  u64 hits;      // lookups of cached entries
+  u64 misses;    // lookups that created a new entry
+  u64 evictions; // entries evicted to stay within the limits
+};
+
 struct loader_ctx {
   // maps loadables (directories, previews) to an internal struct holding a
   // timer and more (only for active timers)
@@ -31,9 +45,21 @@ struct loader_ctx {
   // from lua or an async worker reloading it. Those will be destroyed once
   // those reerences drop.
   map_zsview_dir dir_cache;
+  struct cache_stats dir_cache_stats;
+  u64 tick; // incremented on every lookup, to find least recently used entries
 
   // same as dir_cache, but for previews
   map_zsview_preview preview_cache;
+  struct cache_stats preview_cache_stats;
+
+  struct {
+    vec_prefetch active; // loading
+    vec_prefetch queue;  // waiting for a free slot, nearest file last
+    // cursor position of the latest update, to tell the scroll direction
+    const struct Dir *dir; // only compared, never dereferenced
+    u32 ind;
+    i32 direction; // -1 up, 1 down, 0 unknown
+  } prefetch;
 };
 
 void loader_ctx_init(struct loader_ctx *loader);
@@ -54,6 +80,14 @@ Dir *loader_dir_from_path(struct loader_ctx *loader, zsview path, bool do_load);
 void loader_dir_reload(struct loader_ctx *loader, Dir *dir);
 void loader_drop_dir_cache(struct loader_ctx *loader);
 
+// Approximate memory held by all cached directories, see `dir_memory_usage`.
+u64 loader_dir_cache_bytes(const struct loader_ctx *loader);
+
+// Evicts least recently used directories until the cache is within
+// `cfg.dir_cache_entries` and `cfg.dir_cache_bytes`. Directories that are
+// visible, watched, or referenced from elsewhere (lua, workers) are kept.
+void loader_dir_cache_trim(struct loader_ctx *loader);
+
 //
 // Previews
 //
@@ -63,3 +97,35 @@ struct Preview *loader_preview_from_path(struct loader_ctx *loader, zsview path,
 // Reload the given preview. Takes care of throttling.
 void loader_preview_reload(struct loader_ctx *loader, struct Preview *pv);
 void loader_drop_preview_cache(struct loader_ctx *loader);
+
+usize loader_preview_cache_size(const struct loader_ctx *loader);
+
+// Approximate memory held by all cached previews, see
+// `preview_memory_usage`.
+u64 loader_preview_cache_bytes(const struct loader_ctx *loader);
+
+// Evicts least recently used previews until the cache is within
+// `cfg.preview_cache_bytes`. The preview that is currently shown and
+// previews that are referenced by workers are kept.
+void loader_preview_cache_trim(struct loader_ctx *loader);
+
+//
+// Prefetching previews
+//
+
+// Queues low priority loads of the previews of the `cfg.preview_prefetch`
+// files following the cursor of `dir` in scroll direction. At most
+// `cfg.preview_prefetch_jobs` are loaded at the same time. Call once the
+// cursor rests.
+void loader_preview_prefetch(struct loader_ctx *loader, const Dir *dir);
+
+// Call whenever the cursor moves: tracks the scroll direction, drops the queue
+// and cancels prefetches of files that are no longer ahead of the cursor.
+void loader_preview_prefetch_update(struct loader_ctx *loader, const Dir *dir);
+
+// Starts queued prefetches if there are free slots. Call whenever a preview
+// load finishes.
+void loader_preview_prefetch_continue(struct loader_ctx *loader);
+
+// Cancels all prefetches.
+void loader_preview_prefetch_cancel(struct loader_ctx *loader);
@@ -1,3 +1,4 @@
+#include "arena.h"
 #include "cmdline.h"
 #include "history.h"
 #include "input.h"
@@ -689,16 +690,77 @@ int l_del_hook(lua_State *L) {
   return 0;
 }
 
+static void push_cache_stats(lua_State *L, const struct cache_stats *stats,
+                             usize entries, u64 bytes) {
+  lua_createtable(L, 0, 5);
+  lua_pushnumber(L, stats->hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, stats->misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushnumber(L, stats->evictions);
+  lua_setfield(L, -2, "evictions");
+  lua_pushnumber(L, entries);
+  lua_setfield(L, -2, "entries");
+  lua_pushnumber(L, bytes);
+  lua_setfield(L, -2, "bytes");
+}
+
+static int l_get_dir_cache_stats(lua_State *L) {
+  push_cache_stats(L, &lfm->loader.dir_cache_stats,
+                   map_zsview_dir_size(&lfm->loader.dir_cache),
+                   loader_dir_cache_bytes(&lfm->loader));
+  return 1;
+}
+
+static int l_get_preview_cache_stats(lua_State *L) {
+  push_cache_stats(L, &lfm->loader.preview_cache_stats,
+                   loader_preview_cache_size(&lfm->loader),
+                   loader_preview_cache_bytes(&lfm->loader));
+  return 1;
+}
+
+static int l_get_async_stats(lua_State *L) {
+  const struct async_stats *stats = &async->stats;
+  lua_createtable(L, 0, 4);
+  lua_pushnumber(L, stats->wakeups);
+  lua_setfield(L, -2, "wakeups");
+  lua_pushnumber(L, stats->results);
+  lua_setfield(L, -2, "results");
+  lua_pushnumber(L, stats->max_batch);
+  lua_setfield(L, -2, "max_batch");
+  lua_pushnumber(L, stats->last_batch);
+  lua_setfield(L, -2, "last_batch");
+  return 1;
+}
+
+static int l_get_alloc_stats(lua_State *L) {
+  struct arena_stats stats = arena_get_stats();
+  lua_createtable(L, 0, 4);
+  lua_pushnumber(L, stats.blocks);
+  lua_setfield(L, -2, "arena_blocks");
+  lua_pushnumber(L, stats.blocks_freed);
+  lua_setfield(L, -2, "arena_blocks_freed");
+  lua_pushnumber(L, stats.allocs);
+  lua_setfield(L, -2, "arena_allocs");
+  lua_pushnumber(L, stats.bytes);
+  lua_setfield(L, -2, "arena_bytes");
+  return 1;
+}
+
 static const struct luaL_Reg api_funcs[] = {
-    {"get_dir",      l_get_dir     },
-    {"add_hook",     l_add_hook    },
-    {"del_hook",     l_del_hook    },
-    {"mode",         l_mode        },
-    {"current_mode", l_current_mode},
-    {"get_modes",    l_get_modes   },
-    {"create_mode",  l_create_mode },
-    {"update_mode",  l_update_mode },
-    {NULL,           NULL          },
+    {"get_dir",                 l_get_dir                },
+    {"add_hook",                l_add_hook               },
+    {"del_hook",                l_del_hook               },
+    {"mode",                    l_mode                   },
+    {"current_mode",            l_current_mode           },
+    {"get_modes",               l_get_modes              },
+    {"create_mode",             l_create_mode            },
+    {"update_mode",             l_update_mode            },
+    {"get_dir_cache_stats",     l_get_dir_cache_stats    },
+    {"get_preview_cache_stats", l_get_preview_cache_stats},
+    {"get_async_stats",         l_get_async_stats        },
+    {"get_alloc_stats",         l_get_alloc_stats        },
+    {NULL,                      NULL                     },
 };
 
 int luaopen_api(lua_State *L) {
@@ -415,6 +415,59 @@ static int l_set_paste_buffer(lua_State *L) {
   return 0;
 }
 
+static int l_paste(lua_State *L) {
+  zsview dest = cstr_zv(fm_getpwd(fm));
+  u32 jobs = 0;
+  int ref = 0;
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_getfield(L, 1, "dest"); // [opts, opts.dest]
+    if (!lua_isnil(L, -1)) {
+      dest = luaL_checkzsview(L, -1);
+      if (dest.str[0] != '/' && !(dest.str[0] == '~' && dest.str[1] == '/'))
+        return luaL_error(L, "dest must be an absolute path: %s", dest.str);
+    }
+    // keep opts.dest on the stack, the string is used below
+
+    lua_getfield(L, 1, "jobs"); // [opts, opts.dest, opts.jobs]
+    i32 n = luaL_optinteger(L, -1, 0);
+    if (n > 0)
+      jobs = n;
+    lua_pop(L, 1); // [opts, opts.dest]
+
+    // last, nothing can fail after the callback is registered
+    lua_getfield(L, 1, "callback"); // [opts, opts.dest, opts.callback]
+    if (!lua_isnil(L, -1))
+      ref = lua_register_callback(L, -1);
+    lua_pop(L, 1); // [opts, opts.dest]
+  }
+
+  vec_cstr files = vec_cstr_init();
+  vec_cstr_reserve(&files, pathlist_size(&fm->paste.buffer));
+  c_foreach(it, pathlist, fm->paste.buffer) {
+    vec_cstr_push(&files, cstr_clone(*it.ref));
+  }
+  bool move = fm->paste.mode == PASTE_MODE_MOVE;
+
+  if (vec_cstr_size(&files) > 0) {
+    paste_buffer_clear(fm);
+    LFM_RUN_HOOK(lfm, LFM_HOOK_PASTEBUF);
+    ui_redraw(ui, REDRAW_FM);
+  }
+
+  cstr path = path_replace_tilde(dest);
+  async_transfer(async, files, cstr_zv(&path), move, jobs, ref);
+  cstr_drop(&path);
+
+  return 0;
+}
+
+static int l_cancel_paste(lua_State *L) {
+  (void)L;
+  async_transfer_cancel(async);
+  return 0;
+}
+
 static int l_copy(lua_State *L) {
   (void)L;
   lfm_mode_exit(lfm, c_zv("visual"));
@@ -544,6 +597,8 @@ static const struct luaL_Reg fm_funcs[] = {
     {"set_paste_buffer",  l_set_paste_buffer },
     {"get_paste_mode",    l_set_paste_mode   },
     {"set_paste_mode",    l_get_paste_mode   },
+    {"paste",             l_paste            },
+    {"cancel_paste",      l_cancel_paste     },
     {"cut",               l_cut              },
     {"copy",              l_copy             },
     {"check",             l_check            },
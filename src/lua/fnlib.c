@@ -1,5 +1,6 @@
 #include "../util.h"
 #include "getpwd.h"
+#include "mime.h"
 #include "path.h"
 #include "tokenize.h"
 #include "util.h"
@@ -23,7 +24,7 @@ static int l_fn_normalize(lua_State *L) {
 static int l_fn_mime(lua_State *L) {
   char mime[256];
   const char *path = luaL_checkstring(L, 1);
-  if (unlikely(get_mimetype(path, mime, sizeof mime)))
+  if (unlikely(!get_mimetype(path, mime, sizeof mime)))
     return 0;
   lua_pushstring(L, mime);
   return 1;
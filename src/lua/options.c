@@ -1,8 +1,10 @@
 #include "config.h"
+#include "dirio.h"
 #include "infoline.h"
 #include "lua.h"
 #include "ncutil.h"
 #include "path.h"
+#include "preview_server.h"
 #include "private.h"
 #include "tpool.h"
 #include "util.h"
@@ -132,6 +134,9 @@ static int l_config_index(lua_State *L) {
   } else if (streq(key, "inotify_delay")) {
     lua_pushinteger(L, cfg.inotify_delay);
     return 1;
+  } else if (streq(key, "inotify_delta")) {
+    lua_pushboolean(L, cfg.inotify_delta);
+    return 1;
   } else if (streq(key, "scrolloff")) {
     lua_pushinteger(L, cfg.scrolloff);
     return 1;
@@ -141,9 +146,15 @@ static int l_config_index(lua_State *L) {
   } else if (streq(key, "preview_images")) {
     lua_pushboolean(L, cfg.preview_images);
     return 1;
+  } else if (streq(key, "preview_text")) {
+    lua_pushboolean(L, cfg.preview_text);
+    return 1;
   } else if (streq(key, "previewer")) {
     lua_pushcstr(L, &cfg.previewer);
     return 1;
+  } else if (streq(key, "preview_servers")) {
+    lua_pushinteger(L, preview_server_count());
+    return 1;
   } else if (streq(key, "icons")) {
     lua_pushboolean(L, cfg.icons);
     return 1;
@@ -162,6 +173,9 @@ static int l_config_index(lua_State *L) {
   } else if (streq(key, "threads")) {
     lua_pushnumber(L, tpool_size(async->tpool));
     return 1;
+  } else if (streq(key, "io_uring_depth")) {
+    lua_pushinteger(L, statx_queue_depth());
+    return 1;
   } else if (streq(key, "infoline")) {
     lua_pushcstr(L, &cfg.infoline);
     return 1;
@@ -177,6 +191,21 @@ static int l_config_index(lua_State *L) {
   } else if (streq(key, "loading_indicator_delay")) {
     lua_pushnumber(L, cfg.loading_indicator_delay);
     return 1;
+  } else if (streq(key, "parallel_load_threshold")) {
+    lua_pushinteger(L, cfg.parallel_load_threshold);
+    return 1;
+  } else if (streq(key, "dir_cache_entries")) {
+    lua_pushinteger(L, cfg.dir_cache_entries);
+    return 1;
+  } else if (streq(key, "dir_cache_bytes")) {
+    lua_pushnumber(L, cfg.dir_cache_bytes);
+    return 1;
+  } else if (streq(key, "preview_cache_bytes")) {
+    lua_pushnumber(L, cfg.preview_cache_bytes);
+    return 1;
+  } else if (streq(key, "preview_disk_cache_bytes")) {
+    lua_pushnumber(L, cfg.preview_disk_cache_bytes);
+    return 1;
   } else if (streq(key, "linkchars")) {
     lua_pushstring(L, cfg.linkchars);
     return 1;
@@ -186,6 +215,12 @@ static int l_config_index(lua_State *L) {
   } else if (streq(key, "preview_delay")) {
     lua_pushnumber(L, cfg.preview_delay);
     return 1;
+  } else if (streq(key, "preview_prefetch")) {
+    lua_pushinteger(L, cfg.preview_prefetch);
+    return 1;
+  } else if (streq(key, "preview_prefetch_jobs")) {
+    lua_pushinteger(L, cfg.preview_prefetch_jobs);
+    return 1;
   } else if (streq(key, "tags")) {
     lua_pushboolean(L, cfg.tags);
     return 1;
@@ -257,6 +292,8 @@ static int l_config_newindex(lua_State *L) {
     luaL_argcheck(L, 3, n >= 0, "inotify_delay must be non-negative");
     cfg.inotify_delay = n;
     loader_reschedule(&lfm->loader);
+  } else if (streq(key, "inotify_delta")) {
+    cfg.inotify_delta = lua_toboolean(L, 3);
   } else if (streq(key, "scrolloff")) {
     long n = luaL_checkinteger(L, 3);
     luaL_argcheck(L, 3, n >= 0, "scrolloff must be non-negative");
@@ -278,6 +315,13 @@ static int l_config_newindex(lua_State *L) {
       ui_drop_cache(ui);
       ui_redraw(ui, REDRAW_PREVIEW);
     }
+  } else if (streq(key, "preview_text")) {
+    bool preview_text = lua_toboolean(L, 3);
+    if (preview_text != cfg.preview_text) {
+      cfg.preview_text = preview_text;
+      ui_drop_cache(ui);
+      ui_redraw(ui, REDRAW_PREVIEW);
+    }
   } else if (streq(key, "icons")) {
     cfg.icons = lua_toboolean(L, 3);
     ui_redraw(ui, REDRAW_FM);
@@ -311,7 +355,13 @@ static int l_config_newindex(lua_State *L) {
         cstr_take(&cfg.previewer, path);
       }
     }
+    preview_server_configure(cstr_str(&cfg.previewer), preview_server_count());
     ui_drop_cache(ui);
+  } else if (streq(key, "preview_servers")) {
+    long num = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, num >= 0 && num <= PREVIEW_SERVERS_MAX, 3,
+                  "preview_servers must be between 0 and 32");
+    preview_server_configure(cstr_str(&cfg.previewer), num);
   } else if (streq(key, "lua_previewer")) {
     bytes_drop(&cfg.lua_previewer);
     cfg.lua_previewer = bytes_init();
@@ -327,6 +377,11 @@ static int l_config_newindex(lua_State *L) {
     long num = luaL_checknumber(L, 3);
     luaL_argcheck(L, num >= 2, 3, "threads must be at least 2");
     tpool_resize(async->tpool, num);
+  } else if (streq(key, "io_uring_depth")) {
+    long depth = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, depth >= 0 && depth <= 4096, 3,
+                  "io_uring_depth must be between 0 and 4096");
+    statx_set_queue_depth(depth);
   } else if (streq(key, "infoline")) {
     zsview line = lua_tozsview(L, 3);
     cstr_assign_zv(&cfg.infoline, line);
@@ -352,6 +407,30 @@ static int l_config_newindex(lua_State *L) {
     luaL_argcheck(L, delay >= 0, 3,
                   "loading_indicator_delay must be non-negative");
     cfg.loading_indicator_delay = delay;
+  } else if (streq(key, "parallel_load_threshold")) {
+    long n = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, n >= 0, 3, "parallel_load_threshold must be non-negative");
+    cfg.parallel_load_threshold = n;
+  } else if (streq(key, "dir_cache_entries")) {
+    long n = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, n >= 0, 3, "dir_cache_entries must be non-negative");
+    cfg.dir_cache_entries = n;
+    loader_dir_cache_trim(&lfm->loader);
+  } else if (streq(key, "dir_cache_bytes")) {
+    lua_Number n = luaL_checknumber(L, 3);
+    luaL_argcheck(L, n >= 0, 3, "dir_cache_bytes must be non-negative");
+    cfg.dir_cache_bytes = n;
+    loader_dir_cache_trim(&lfm->loader);
+  } else if (streq(key, "preview_cache_bytes")) {
+    lua_Number n = luaL_checknumber(L, 3);
+    luaL_argcheck(L, n >= 0, 3, "preview_cache_bytes must be non-negative");
+    cfg.preview_cache_bytes = n;
+    loader_preview_cache_trim(&lfm->loader);
+  } else if (streq(key, "preview_disk_cache_bytes")) {
+    lua_Number n = luaL_checknumber(L, 3);
+    luaL_argcheck(L, n >= 0, 3,
+                  "preview_disk_cache_bytes must be non-negative");
+    cfg.preview_disk_cache_bytes = n;
   } else if (streq(key, "linkchars")) {
     usize len;
     const char *val = luaL_checklstring(L, 3, &len);
@@ -370,6 +449,14 @@ static int l_config_newindex(lua_State *L) {
     luaL_argcheck(L, delay >= 0, 3, "preview_delay must be non-negative");
     cfg.preview_delay = delay;
     lfm->ui.cursor_resting_timer.repeat = delay / 1000.0;
+  } else if (streq(key, "preview_prefetch")) {
+    long n = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, n >= 0, 3, "preview_prefetch must be non-negative");
+    cfg.preview_prefetch = n;
+  } else if (streq(key, "preview_prefetch_jobs")) {
+    long n = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, n >= 0, 3, "preview_prefetch_jobs must be non-negative");
+    cfg.preview_prefetch_jobs = n;
   } else if (streq(key, "tags")) {
     luaL_checktype(L, 3, LUA_TBOOLEAN);
     bool val = lua_toboolean(L, 3);
@@ -1,13 +1,17 @@
 #include "../util.h"
+#include "async/async.h"
+#include "lfmlua.h"
 #include "log.h"
+#include "memory.h"
+#include "mime.h"
 #include "path.h"
+#include "private.h"
+#include "rifle.h"
 #include "util.h"
 
 #include <lauxlib.h>
 #include <lua.h>
 #include <lualib.h>
-#define PCRE2_CODE_UNIT_WIDTH 8
-#include <pcre2.h>
 #include <stc/cstr.h>
 #include <stc/zsview.h>
 
@@ -24,336 +28,19 @@
 
 #define RIFLE_META "Lfm.Rifle.Meta"
 
-// arbitrary, max binary name length for `has`
-#define EXECUTABLE_MAX 256
-
 #define BUFSIZE 4096
-#define DELIM_CONDITION ","
-#define DELIM_COMMAND " = "
-
-struct FileInfo;
-struct Condition;
-
-typedef bool(check_fn)(struct Condition *, const struct FileInfo *);
-
-typedef struct Condition {
-  bool negate;
-  cstr arg;
-  pcre2_code *re;
-  check_fn *check;
-} Condition;
-
-static inline void condition_drop(Condition *self) {
-  if (self->re) {
-    pcre2_code_free(self->re);
-  } else {
-    cstr_drop(&self->arg);
-  }
-}
-
-#define i_TYPE conditions, Condition
-#define i_keydrop condition_drop
-#define i_no_clone
-#include <stc/vec.h>
-
-typedef struct Rule {
-  conditions conditions;
-  cstr command;
-  cstr label;
-  int number;
-  bool has_mime;
-  bool flag_fork;
-  bool flag_term;
-  bool flag_esc;
-  bool flag_lfm;
-} Rule;
-
-static inline void rule_drop(Rule *self) {
-  conditions_drop(&self->conditions);
-  cstr_drop(&self->label);
-  cstr_drop(&self->command);
-}
-
-#define i_TYPE rules, Rule
-#define i_keydrop rule_drop
-#define i_no_clone
-#include <stc/vec.h>
-
-typedef struct FileInfo {
-  zsview file;
-  zsview path;
-  zsview mime;
-} FileInfo;
 
 typedef struct {
   cstr config_file;
-  rules rules;
+  RifleRules rules;
 } Rifle;
 
-static inline Condition condition_create(check_fn *f, const char *arg,
-                                         bool negate) {
-  Condition cond = {0};
-  cond.check = f;
-  cond.arg = arg ? cstr_from(arg) : cstr_init();
-  cond.negate = negate;
-  return cond;
-}
-
-static inline void rule_set_flags(Rule *r, const char *flags) {
-  for (const char *f = flags; *f; f++) {
-    switch (*f) {
-    case 'f':
-      r->flag_fork = true;
-      break;
-    case 't':
-      r->flag_term = true;
-      break;
-    case 'e':
-      r->flag_esc = true;
-      break;
-    case 'l':
-      r->flag_lfm = true;
-      break;
-    }
-  }
-  for (const char *f = flags; *f; f++) {
-    switch (*f) {
-    case 'F':
-      r->flag_fork = false;
-      break;
-    case 'T':
-      r->flag_term = false;
-      break;
-    case 'E':
-      r->flag_esc = false;
-      break;
-    case 'L':
-      r->flag_lfm = false;
-      break;
-    }
-  }
-}
-
-static inline bool re_match(pcre2_code *re, zsview string) {
-  pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(re, NULL);
-  int rc = pcre2_match(re, (PCRE2_SPTR)string.str, string.size, 0, 0,
-                       match_data, NULL);
-  pcre2_match_data_free(match_data);
-  return rc >= 0;
-}
-
-static bool check_fn_file(Condition *cond, const FileInfo *info) {
-  struct stat path_stat;
-  if (stat(info->file.str, &path_stat) == -1) {
-    return cond->negate;
-  }
-  return S_ISREG(path_stat.st_mode) != cond->negate;
-}
-
-static bool check_fn_dir(Condition *cond, const FileInfo *info) {
-  struct stat statbuf;
-  if (stat(info->file.str, &statbuf) != 0) {
-    return cond->negate;
-  }
-  return S_ISDIR(statbuf.st_mode) != cond->negate;
-}
-
-// not sure if this even works from within lfm
-static bool check_fn_term(Condition *cond, const FileInfo *info) {
-  (void)info;
-  return (isatty(0) && isatty(1) && isatty(2)) != cond->negate;
-}
-
-static bool check_fn_env(Condition *cond, const FileInfo *info) {
-  (void)info;
-  const char *val = getenv(cstr_str(&cond->arg));
-  return (val && *val) != cond->negate;
-}
-
-static bool check_fn_else(Condition *cond, const FileInfo *info) {
-  (void)info;
-  return !cond->negate;
-}
-
-/* TODO: log errors (on 2022-10-15) */
-static inline Condition condition_create_re(check_fn *f, const char *pattern,
-                                            bool negate) {
-  int errornumber;
-  PCRE2_SIZE erroroffset;
-  Condition c = condition_create(f, NULL, negate);
-  c.re = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, 0,
-                       &errornumber, &erroroffset, NULL);
-  if (unlikely(!c.re)) {
-    return (Condition){0};
-  }
-  return c;
-}
-
-static bool check_fn_path(Condition *cond, const FileInfo *info) {
-  return re_match(cond->re, info->path) != cond->negate;
-}
-
-static bool check_fn_mime(Condition *cond, const FileInfo *info) {
-  return re_match(cond->re, info->mime) != cond->negate;
-}
-
-static bool check_fn_name(Condition *cond, const FileInfo *info) {
-  const char *ptr = strrchr(info->file.str, '/');
-  if (ptr) {
-    int pos = ptr - info->file.str;
-    return re_match(cond->re, zsview_from_pos(info->file, pos)) != cond->negate;
-  } else {
-    return re_match(cond->re, info->file) != cond->negate;
-  }
-}
-
-static bool check_fn_match(Condition *cond, const FileInfo *info) {
-  return re_match(cond->re, info->file) != cond->negate;
-}
-
-static bool check_fn_has(Condition *cond, const FileInfo *info) {
-  (void)info;
-  char cmd[EXECUTABLE_MAX];
-  snprintf(cmd, sizeof cmd, "command -v \"%s\" >/dev/null 2>&1",
-           cstr_str(&cond->arg));
-  return !system(cmd) != cond->negate;
-}
-
-static inline Condition condition_create_re_name(const char *arg, bool negate) {
-  return condition_create_re(check_fn_name, arg, negate);
-}
-
-static inline Condition condition_create_re_path(const char *arg, bool negate) {
-  return condition_create_re(check_fn_path, arg, negate);
-}
-
-static inline Condition condition_create_re_ext(const char *arg, bool negate) {
-  char buf[512];
-  snprintf(buf, sizeof buf - 1, "\\.(%s)$", arg);
-  Condition cond = condition_create_re(check_fn_name, buf, negate);
-  return cond;
-}
-
-static inline Condition condition_create_re_mime(const char *arg, bool negate) {
-  return condition_create_re(check_fn_mime, arg, negate);
-}
-
-static inline Condition condition_create_re_match(const char *arg,
-                                                  bool negate) {
-  return condition_create_re(check_fn_match, arg, negate);
-}
-
-static inline char *split_command(char *s) {
-  if (unlikely((s = strstr(s, DELIM_COMMAND)) == NULL))
-    return NULL;
-  *s = '\0';
-  return trim(s + 3);
-}
-
 static inline bool is_comment_or_whitespace(char *s) {
   while (isspace(*s))
     s++;
   return *s == '#' || *s == '\0';
 }
 
-static inline bool rule_add_condition(Rule *self, char *cond_str) {
-  if (unlikely(*cond_str == 0))
-    return true;
-
-  cond_str = rtrim(cond_str);
-
-  bool negate = false;
-  char *arg, *func = strtok_r(cond_str, " \t", &cond_str);
-  if (func[0] == '!') {
-    negate = true;
-    func++;
-  }
-
-  Condition cond = {0};
-
-  if (streq(func, "file")) {
-    cond = condition_create(check_fn_file, NULL, negate);
-  } else if (streq(func, "directory")) {
-    cond = condition_create(check_fn_dir, NULL, negate);
-  } else if (streq(func, "terminal")) {
-    cond = condition_create(check_fn_term, NULL, negate);
-  } else if (streq(func, "X")) {
-    cond = condition_create(check_fn_env, "DISPLAY", negate);
-  } else if (streq(func, "W")) {
-    cond = condition_create(check_fn_env, "WAYLAND_DISPLAY", negate);
-  } else if (streq(func, "else")) {
-    cond = condition_create(check_fn_else, NULL, negate);
-  } else {
-    if ((arg = strtok_r(cond_str, "\0", &cond_str)) == NULL) {
-      return false;
-    }
-
-    if (streq(func, "label")) {
-      self->label = cstr_from(arg);
-    } else if (streq(func, "number")) {
-      /* TODO: cant distringuish between 0 and invalid number
-       * (on 2021-07-27) */
-      self->number = atoi(arg);
-    } else if (streq(func, "flag")) {
-      rule_set_flags(self, arg);
-    } else if (streq(func, "ext")) {
-      cond = condition_create_re_ext(arg, negate);
-    } else if (streq(func, "path")) {
-      cond = condition_create_re_path(arg, negate);
-    } else if (streq(func, "mime")) {
-      cond = condition_create_re_mime(arg, negate);
-      if (!negate) {
-        self->has_mime = true;
-      }
-    } else if (streq(func, "name")) {
-      cond = condition_create_re_name(arg, negate);
-    } else if (streq(func, "match")) {
-      cond = condition_create_re_match(arg, negate);
-    } else if (streq(func, "env")) {
-      cond = condition_create(check_fn_env, arg, negate);
-    } else if (streq(func, "has")) {
-      /* could be checked here? some others too */
-      cond = condition_create(check_fn_has, arg, negate);
-    } else {
-      return false;
-    }
-  }
-
-  if (cond.check)
-    conditions_push(&self->conditions, cond);
-
-  return true;
-}
-
-static inline int rule_init(Rule *self, char *str, const char *command) {
-  if (unlikely(command == NULL)) {
-    rule_drop(self);
-    return -1;
-  }
-  memset(self, 0, sizeof *self);
-  self->command = cstr_from(command);
-  self->number = -1;
-
-  char *cond;
-  while ((cond = strtok_r(str, DELIM_CONDITION, &str))) {
-    if (!rule_add_condition(self, cond)) {
-      rule_drop(self);
-      return -1;
-    }
-  }
-
-  return 0;
-}
-
-static inline bool rule_check(Rule *self, const FileInfo *info) {
-  c_foreach(it, conditions, self->conditions) {
-    Condition *c = it.ref;
-    if (!c->check(c, info))
-      return false;
-  }
-  return true;
-}
-
 static int l_rifle_fileinfo(lua_State *L) {
   const char *file = luaL_checkstring(L, 1);
 
@@ -402,56 +89,75 @@ static inline int llua_push_rule(lua_State *L, const Rule *r, int num) {
   return 1;
 }
 
-static int l_rifle_query_mime(lua_State *L) {
-  Rifle *rifle = lua_touserdata(L, lua_upvalueindex(1));
-  const char *mime = luaL_checkstring(L, 1);
-
-  int limit = 0;
-  zsview pick = zsview_init();
+// Reads `limit` and `pick` from the options table at `idx`, if any.
+static inline void parse_query_opts(lua_State *L, int idx, int *limit,
+                                    zsview *pick) {
+  *limit = 0;
+  *pick = zsview_init();
 
-  if (lua_istable(L, 2)) {
-    lua_getfield(L, 2, "limit");
-    limit = luaL_optinteger(L, -1, 0);
+  if (lua_istable(L, idx)) {
+    lua_getfield(L, idx, "limit");
+    *limit = luaL_optinteger(L, -1, 0);
     lua_pop(L, 1);
 
-    lua_getfield(L, 2, "pick");
+    lua_getfield(L, idx, "pick");
     if (!lua_isnil(L, -1))
-      pick = lua_tozsview(L, -1);
+      *pick = lua_tozsview(L, -1);
     lua_pop(L, 1);
   }
+}
 
-  const FileInfo info = {
-      .file = c_zv(""), .path = c_zv(""), .mime = zsview_from(mime)};
-
-  lua_newtable(L);
+struct push_matches_ctx {
+  lua_State *L;
+  int limit;
+  zsview pick;
+  int i;
+  int ct_match;
+};
 
-  int i = 1;
-  int ct_match = 0;
-
-  c_foreach(it, rules, rifle->rules) {
-    Rule *r = it.ref;
-    if (r->has_mime && rule_check(r, &info)) {
-      if (r->number > 0)
-        ct_match = r->number;
-      ct_match++;
-
-      if (!zsview_is_empty(pick)) {
-        int ind = atoi(pick.str);
-        bool ok = (ind != 0 || pick.str[0] == '0');
-        if ((ok && ind != ct_match - 1) ||
-            (!ok && (!cstr_equals_zv(&r->label, pick)))) {
-          continue;
-        }
-      }
-
-      llua_push_rule(L, r, ct_match - 1);
-      lua_rawseti(L, -2, i++);
-
-      if (limit > 0 && i > limit)
-        break;
+static bool push_match(const Rule *r, void *arg) {
+  struct push_matches_ctx *ctx = arg;
+  if (r->number > 0)
+    ctx->ct_match = r->number;
+  ctx->ct_match++;
+
+  if (!zsview_is_empty(ctx->pick)) {
+    int ind = atoi(ctx->pick.str);
+    bool ok = (ind != 0 || ctx->pick.str[0] == '0');
+    if ((ok && ind != ctx->ct_match - 1) ||
+        (!ok && (!cstr_equals_zv(&r->label, ctx->pick)))) {
+      return true;
     }
   }
 
+  llua_push_rule(ctx->L, r, ctx->ct_match - 1);
+  lua_rawseti(ctx->L, -2, ctx->i++);
+
+  return ctx->limit <= 0 || ctx->i <= ctx->limit;
+}
+
+// Pushes a table of the rules matching `info`. Only rules with a mime
+// condition are considered if `mime_only` is set.
+static void push_matches(lua_State *L, Rifle *rifle, FileInfo *info,
+                         int limit, zsview pick, bool mime_only) {
+  lua_newtable(L); /* {} */
+
+  struct push_matches_ctx ctx = {L, limit, pick, 1, 0};
+  rifle_rules_match(&rifle->rules, info, mime_only, push_match, &ctx);
+}
+
+static int l_rifle_query_mime(lua_State *L) {
+  Rifle *rifle = lua_touserdata(L, lua_upvalueindex(1));
+  const char *mime = luaL_checkstring(L, 1);
+
+  int limit;
+  zsview pick;
+  parse_query_opts(L, 2, &limit, &pick);
+
+  FileInfo info = {
+      .file = c_zv(""), .path = c_zv(""), .mime = zsview_from(mime)};
+
+  push_matches(L, rifle, &info, limit, pick, true);
   return 1;
 }
 
@@ -461,20 +167,9 @@ static int l_rifle_query(lua_State *L) {
 
   zsview file = luaL_checkzsview(L, 1);
 
-  int limit = 0;
-  zsview pick = zsview_init();
-
-  if (lua_istable(L, 2)) {
-    lua_getfield(L, 2, "limit");
-    limit = luaL_optinteger(L, -1, 0);
-    lua_pop(L, 1);
-
-    lua_getfield(L, 2, "pick");
-    if (!lua_isnil(L, -1)) {
-      pick = lua_tozsview(L, -1);
-    }
-    lua_pop(L, 1);
-  }
+  int limit;
+  zsview pick;
+  parse_query_opts(L, 2, &limit, &pick);
 
   char path[PATH_MAX + 1];
   if (unlikely(realpath(file.str, path) == NULL))
@@ -483,39 +178,104 @@ static int l_rifle_query(lua_State *L) {
   char mime[256];
   get_mimetype(path, mime, sizeof mime);
 
-  const FileInfo info = {
+  FileInfo info = {
       .file = file, .path = zsview_from(path), .mime = zsview_from(mime)};
 
-  lua_newtable(L); /* {} */
+  push_matches(L, rifle, &info, limit, pick, false);
+  return 1;
+}
 
-  int i = 1;
-  int ct_match = 0;
-
-  c_foreach(it, rules, rifle->rules) {
-    Rule *r = it.ref;
-    if (rule_check(r, &info)) {
-      if (r->number > 0)
-        ct_match = r->number;
-      ct_match++;
-
-      if (!zsview_is_empty(pick)) {
-        int ind = atoi(pick.str);
-        bool ok = (ind != 0 || pick.str[0] == '0');
-        if ((ok && ind != ct_match - 1) ||
-            (!ok && (!cstr_equals_zv(&r->label, pick)))) {
-          continue;
-        }
-      }
-
-      llua_push_rule(L, r, ct_match - 1);
-      lua_rawseti(L, -2, i++);
-
-      if (limit > 0 && i > limit)
-        break;
+struct rifle_query {
+  struct mime_query super;
+  Rifle *rifle;
+  int rifle_ref; // keeps `rifle` alive, 0 once released
+  int ref;       // callback, 0 once released
+  int limit;
+  cstr pick;
+};
+
+static void rifle_query_destroy(struct mime_query *q) {
+  struct rifle_query *query = (struct rifle_query *)q;
+  // the callback didn't run, unless the lua state is already closed
+  lua_State *L = lfm->L;
+  if (L != NULL) {
+    if (query->ref > 0)
+      luaL_unref(L, LUA_REGISTRYINDEX, query->ref);
+    if (query->rifle_ref > 0)
+      luaL_unref(L, LUA_REGISTRYINDEX, query->rifle_ref);
+  }
+  vec_cstr_drop(&q->files);
+  vec_cstr_drop(&q->paths);
+  vec_cstr_drop(&q->mimes);
+  cstr_drop(&query->pick);
+  xfree(query);
+}
+
+static void rifle_query_callback(struct mime_query *q, Lfm *lfm) {
+  struct rifle_query *query = (struct rifle_query *)q;
+  lua_State *L = lfm->L;
+  if (unlikely(L == NULL))
+    return; // shutting down
+
+  lfm_lua_push_callback(L, query->ref, true); // [cb]
+  query->ref = 0;
+
+  u32 num = vec_cstr_size(&q->files);
+  lua_createtable(L, num, 0); // [cb, {}]
+  for (u32 i = 0; i < num; i++) {
+    FileInfo info = {
+        .file = cstr_zv(&q->files.data[i]),
+        .path = cstr_zv(&q->paths.data[i]),
+        .mime = cstr_zv(&q->mimes.data[i]),
+    };
+    push_matches(L, query->rifle, &info, query->limit, cstr_zv(&query->pick),
+                 false);
+    lua_rawseti(L, -2, i + 1);
+  }
+  // only now, the allocations above can collect the rifle and its rules
+  luaL_unref(L, LUA_REGISTRYINDEX, query->rifle_ref);
+  query->rifle_ref = 0;
+
+  if (unlikely(lfm_lua_pcall(L, 1, 0))) {
+    // [err]
+    lfm_errorf(lfm, "%s", lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+}
+
+static int l_rifle_query_many(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+
+  int limit;
+  zsview pick;
+  parse_query_opts(L, 2, &limit, &pick);
+
+  struct rifle_query *query = xcalloc(1, sizeof *query);
+  query->super.callback = rifle_query_callback;
+  query->super.destroy = rifle_query_destroy;
+  query->rifle = lua_touserdata(L, lua_upvalueindex(1));
+  query->limit = limit;
+  query->pick = cstr_from_zv(pick);
+
+  int num = lua_objlen(L, 1);
+  vec_cstr_reserve(&query->super.files, num);
+  for (int i = 1; i <= num; i++) {
+    lua_rawgeti(L, 1, i);
+    if (unlikely(!lua_isstring(L, -1))) {
+      rifle_query_destroy(&query->super);
+      return luaL_error(L, "files must be strings");
     }
+    vec_cstr_push(&query->super.files, lua_tocstr(L, -1));
+    lua_pop(L, 1);
   }
 
-  return 1;
+  query->ref = lua_register_callback(L, 3);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  query->rifle_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  async_mime_query(async, &query->super);
+  return 0;
 }
 
 // loads rules from the configuration file
@@ -535,13 +295,8 @@ static int load_rules(Rifle *rifle) {
     if (is_comment_or_whitespace(buf))
       continue;
 
-    char *command = split_command(buf);
-    if (!command)
-      continue;
-
-    Rule r;
-    if (likely(rule_init(&r, buf, command) == 0))
-      rules_push(&rifle->rules, r);
+    if (unlikely(!rifle_rules_add(&rifle->rules, buf)))
+      log_error("malformed rule: %s", buf);
   }
   if (ferror(fp)) {
     log_error("fgets: %s", strerror(errno));
@@ -556,25 +311,11 @@ static int load_rules(Rifle *rifle) {
 
 // loads rules from the table at the stack position idx
 static inline int llua_parse_rules(lua_State *L, int idx, Rifle *rifle) {
-  char buf[BUFSIZE];
   for (lua_pushnil(L); lua_next(L, idx - 1); lua_pop(L, 1)) {
     const char *str = lua_tostring(L, -1);
     log_trace("parsing: %s", str);
-    strncpy(buf, str, sizeof buf - 1);
-    buf[sizeof buf - 1] = 0;
-
-    char *command = split_command(buf);
-    if (unlikely(!command)) {
-      log_error("malformed rule: %s", str);
-      continue;
-    }
-
-    Rule r = {0};
-    if (unlikely(rule_init(&r, buf, command) != 0)) {
+    if (unlikely(!rifle_rules_add(&rifle->rules, str)))
       log_error("malformed rule: %s", str);
-      continue;
-    }
-    rules_push(&rifle->rules, r);
   }
   return 0;
 }
@@ -582,7 +323,7 @@ static inline int llua_parse_rules(lua_State *L, int idx, Rifle *rifle) {
 static int l_rifle_setup(lua_State *L) {
   Rifle *rifle = lua_touserdata(L, lua_upvalueindex(1));
 
-  rules_clear(&rifle->rules);
+  rifle_rules_clear(&rifle->rules);
 
   if (lua_istable(L, 1)) {
     lua_getfield(L, 1, "rules");
@@ -603,18 +344,20 @@ static int l_rifle_setup(lua_State *L) {
     return luaL_error(L, "error loading rules from %s: %s",
                       cstr_str(&rifle->config_file), strerror(errno));
 
+  rifle_rules_compile(&rifle->rules);
+
   return 0;
 }
 
 static int l_rifle_nrules(lua_State *L) {
   Rifle *rifle = lua_touserdata(L, lua_upvalueindex(1));
-  lua_pushinteger(L, rules_size(&rifle->rules));
+  lua_pushinteger(L, rifle_rules_size(&rifle->rules));
   return 1;
 }
 
 static int l_rifle_gc(lua_State *L) {
   Rifle *rifle = luaL_checkudata(L, 1, RIFLE_META);
-  rules_drop(&rifle->rules);
+  rifle_rules_drop(&rifle->rules);
   cstr_drop(&rifle->config_file);
   return 0;
 }
@@ -623,6 +366,7 @@ static const luaL_Reg rifle_lib[] = {
     {"_fileinfo",   l_rifle_fileinfo  },
     {"_nrules",     l_rifle_nrules    },
     {"_query",      l_rifle_query     },
+    {"_query_many", l_rifle_query_many},
     {"_query_mime", l_rifle_query_mime},
     {"_setup",      l_rifle_setup     },
     {NULL,          NULL              },
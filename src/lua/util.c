@@ -1,6 +1,8 @@
 #include "util.h"
 
 #include "config.h"
+#include "dir.h"
+#include "file.h"
 
 #include <lua.h>
 
@@ -243,6 +245,19 @@ void lua_push_vec_cstr(lua_State *L, const vec_cstr *vec) {
   }
 }
 
+void lua_push_file_names(lua_State *L, const vec_file *files) {
+  if (files == NULL) {
+    lua_pushnil(L);
+    return;
+  }
+  lua_createtable(L, vec_file_size(files), 0);
+  i32 i = 1;
+  c_foreach(it, vec_file, *files) {
+    lua_pushzsview(L, file_name(*it.ref));
+    lua_rawseti(L, -2, i++);
+  }
+}
+
 void lua_push_vec_bytes(lua_State *L, vec_bytes *vec) {
   lua_createtable(L, vec_bytes_size(vec), 0);
   i32 i = 1;
@@ -84,6 +84,11 @@ void lua_push_vec_cstr(lua_State *L, const vec_cstr *vec);
 
 void lua_push_vec_bytes(lua_State *L, vec_bytes *vec);
 
+struct vec_file;
+
+// Pushes a table with the names of `files`, nil if `files` is NULL.
+void lua_push_file_names(lua_State *L, const struct vec_file *files);
+
 void lua_read_vec_bytes(lua_State *L, int idx, vec_bytes *vec);
 
 // read string at index idx into a a vector of 4kB chunks. adds a newline
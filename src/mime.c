@@ -0,0 +1,159 @@
+#include "mime.h"
+
+#include "log.h"
+#include "memory.h"
+
+#include <magic.h>
+#include <stc/cstr.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+struct mime_key {
+  u64 dev;
+  u64 ino;
+  i64 mtime_sec;
+  i64 mtime_nsec;
+  i64 size;
+};
+
+struct mime_entry {
+  cstr mime;
+  u64 last_use; // value of `cache.tick` when it was last looked up
+};
+
+static inline usize mime_key_hash(const struct mime_key *key) {
+  u64 h = key->ino ^ (key->dev << 40) ^ (u64)key->mtime_nsec ^
+          ((u64)key->size << 20);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9u;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebu;
+  return h ^ (h >> 31);
+}
+
+static inline bool mime_key_eq(const struct mime_key *a,
+                               const struct mime_key *b) {
+  return a->ino == b->ino && a->dev == b->dev &&
+         a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec &&
+         a->size == b->size;
+}
+
+static inline void mime_entry_drop(struct mime_entry *self) {
+  cstr_drop(&self->mime);
+}
+
+#define i_type hmap_mime
+#define i_key struct mime_key
+#define i_val struct mime_entry
+#define i_hash mime_key_hash
+#define i_eq mime_key_eq
+#define i_valdrop mime_entry_drop
+#define i_no_clone
+#include <stc/hmap.h>
+
+static struct {
+  pthread_mutex_t mutex;
+  hmap_mime map;
+  u64 tick; // incremented on every lookup
+} cache = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_key_t cookie_key;
+static pthread_once_t cookie_once = PTHREAD_ONCE_INIT;
+
+static void cookie_destroy(void *cookie) {
+  magic_close(cookie);
+}
+
+static void cookie_key_create(void) {
+  pthread_key_create(&cookie_key, cookie_destroy);
+}
+
+// Returns the cookie of the calling thread, loading the database on first use.
+static magic_t get_cookie(void) {
+  pthread_once(&cookie_once, cookie_key_create);
+  magic_t magic = pthread_getspecific(cookie_key);
+  if (likely(magic != NULL))
+    return magic;
+
+  magic = magic_open(MAGIC_MIME_TYPE);
+  if (unlikely(magic == NULL)) {
+    log_perror("magic_open");
+    return NULL;
+  }
+  if (unlikely(magic_load(magic, NULL) != 0)) {
+    log_error("magic_load: %s", magic_error(magic));
+    magic_close(magic);
+    return NULL;
+  }
+  pthread_setspecific(cookie_key, magic);
+  return magic;
+}
+
+// Drops the entries that weren't used in the last MIME_CACHE_ENTRIES / 2
+// lookups, i.e. at least half of them. Call with the mutex held.
+static void cache_evict(void) {
+  u64 threshold = cache.tick - MIME_CACHE_ENTRIES / 2;
+  for (hmap_mime_iter it = hmap_mime_begin(&cache.map); it.ref;) {
+    if (it.ref->second.last_use < threshold)
+      it = hmap_mime_erase_at(&cache.map, it);
+    else
+      hmap_mime_next(&it);
+  }
+}
+
+// https://stackoverflow.com/questions/9152978/include-unix-utility-file-in-c-program
+bool get_mimetype(const char *path, char *dest, usize sz) {
+  // magic doesn't follow symlinks, neither do we
+  struct stat st;
+  bool cacheable = lstat(path, &st) == 0;
+  struct mime_key key = {
+      .dev = cacheable ? st.st_dev : 0,
+      .ino = cacheable ? st.st_ino : 0,
+      .mtime_sec = cacheable ? st.st_mtim.tv_sec : 0,
+      .mtime_nsec = cacheable ? st.st_mtim.tv_nsec : 0,
+      .size = cacheable ? st.st_size : 0,
+  };
+
+  if (cacheable) {
+    pthread_mutex_lock(&cache.mutex);
+    hmap_mime_value *v = hmap_mime_get_mut(&cache.map, key);
+    if (v) {
+      v->second.last_use = ++cache.tick;
+      xstrlcpy(dest, cstr_str(&v->second.mime), sz);
+      pthread_mutex_unlock(&cache.mutex);
+      return true;
+    }
+    pthread_mutex_unlock(&cache.mutex);
+  }
+
+  magic_t magic = get_cookie();
+  const char *mime = magic ? magic_file(magic, path) : NULL;
+  if (mime == NULL ||
+      strncmp(mime, "cannot open", sizeof "cannot open" - 1) == 0) {
+    *dest = 0;
+    return false;
+  }
+  xstrlcpy(dest, mime, sz);
+
+  if (cacheable) {
+    pthread_mutex_lock(&cache.mutex);
+    if (hmap_mime_size(&cache.map) >= MIME_CACHE_ENTRIES)
+      cache_evict();
+    struct mime_entry entry = {cstr_from(mime), ++cache.tick};
+    hmap_mime_result res = hmap_mime_insert(&cache.map, key, entry);
+    if (!res.inserted)
+      mime_entry_drop(&entry); // another thread was faster
+    pthread_mutex_unlock(&cache.mutex);
+  }
+  return true;
+}
+
+void mime_cache_clear(void) {
+  pthread_mutex_lock(&cache.mutex);
+  hmap_mime_clear(&cache.map);
+  pthread_mutex_unlock(&cache.mutex);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// Mime types of files, determined by libmagic. Every thread loads the magic
+// database once, into its own cookie, since cookies can't be shared between
+// threads. Results are cached by the identity of the file (device, inode,
+// mtime and size), a file is only examined again once it changes.
+
+#include "defs.h"
+
+#include <stdbool.h>
+
+// At most this many mime types are cached.
+#define MIME_CACHE_ENTRIES 4096
+
+// Writes the mimetype of the file at `path` into the buffer `dest` of length
+// `sz`. Returns true on success, false on failure with `*dest == '\0'`. Can be
+// called from any thread.
+bool get_mimetype(const char *path, char *dest, usize sz);
+
+// Drops all cached mime types.
+void mime_cache_clear(void);
@@ -6,6 +6,8 @@
 #include "log.h"
 #include "memory.h"
 #include "ncutil.h"
+#include "preview_cache.h"
+#include "preview_server.h"
 #include "sha256.h"
 #include "types/bytes.h"
 
@@ -14,6 +16,7 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -85,6 +88,20 @@ static void destroy_text_preview(Preview *p) {
   destroy_preview(p);
 }
 
+usize preview_memory_usage(const Preview *p) {
+  usize size = sizeof *p + cstr_capacity(&p->path);
+  if (p->draw == draw_image_preview) {
+    if (p->ncv) {
+      ncvgeom geom = {0};
+      ncvisual_geom(NULL, p->ncv, NULL, &geom);
+      size += (usize)geom.pixy * geom.pixx * 4; // RGBA
+    }
+  } else {
+    size += p->data.size;
+  }
+  return size;
+}
+
 Preview *preview_create_loading(zsview path, i32 height, i32 width) {
   Preview *p = preview_create(path, height, width);
   p->is_loading = true;
@@ -121,87 +138,77 @@ static void update_image_preview(Preview *p, Preview *u) {
   destroy_preview(u);
 }
 
-// returns 0 on success, -1 if fread fails
-static inline int data_from_stream(bytes *data, FILE *file, i32 max_lines) {
-  char static_buf[4096];
-
-  char *buf = static_buf;
-  usize buf_sz = sizeof static_buf;
-
-  usize size = fread(buf, 1, buf_sz, file);
-  if (ferror(file))
-    goto err;
-
-  if (size == 0) {
-    *data = bytes_init();
-    return 0;
-  }
-
+// Reads at most `max_lines` lines and PREVIEW_MAX_BYTES bytes from `fd`
+// directly into `data`. Returns 1 if it stopped before the end of the input,
+// 0 if it read everything, -1 if read fails. Stops early, keeping what has been
+// read, if `cancel` is cancelled.
+static inline int data_from_fd(bytes *data, i32 fd, i32 max_lines,
+                               const cancel_token *cancel) {
+  char *buf = NULL;
+  usize capacity = 0;
+  usize size = 0;
   i32 num_lines = 0;
-  const char *last_newline = NULL;
-  for (usize i = 0; i < size; i++) {
-    if (static_buf[i] == '\n') {
-      num_lines++;
-      last_newline = static_buf + i;
-      if (num_lines == max_lines)
-        break;
-    }
-  }
-
-  if (size == buf_sz && num_lines < max_lines) {
-    buf_sz *= 2;
-    buf = malloc(buf_sz);
-    memcpy(buf, static_buf, sizeof static_buf);
-    last_newline = buf + (last_newline - static_buf);
-
-    // more input
-    for (;;) {
-      usize i = size;
-      size += fread(buf + size, 1, buf_sz - size, file);
-      if (ferror(file)) {
-        log_error("fread: %s", strerror(errno));
-        goto err;
-      }
+  usize last_newline = 0; // offset one past the last newline, 0 if none
+  int ret = 0;
 
-      for (; i < size; i++) {
-        if (buf[i] == '\n') {
-          num_lines++;
-          last_newline = buf + i;
-          if (num_lines == max_lines)
-            break;
-        }
-      }
-
-      if (size < buf_sz)
-        break; // no more output
-
-      if (num_lines == max_lines)
-        break;
-
-      if (size > PREVIEW_MAX_BYTES) {
+  for (;;) {
+    if (size == capacity) {
+      if (capacity >= PREVIEW_MAX_BYTES) {
         log_debug("previewer is sending too much data, stopping here");
-        // make sure we backtrack to the last newline
-        num_lines = max_lines;
+        // backtrack to the last newline
+        if (last_newline > 0)
+          size = last_newline - 1;
+        ret = 1;
         break;
       }
-
-      buf_sz = buf_sz * 3 / 2;
-      buf = realloc(buf, buf_sz);
+      capacity = capacity ? capacity * 2 : 4096;
+      if (capacity > PREVIEW_MAX_BYTES)
+        capacity = PREVIEW_MAX_BYTES;
+      buf = xrealloc(buf, capacity);
     }
-  }
 
-  if (num_lines == max_lines)
-    size = last_newline - buf;
+    isize n = read(fd, buf + size, capacity - size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      goto err;
+    if (n == 0)
+      break; // no more output
+
+    const char *pos = buf + size;
+    const char *end = pos + n;
+    size += n;
+    while ((pos = memchr(pos, '\n', end - pos))) {
+      // an offset, buf moves when it grows
+      last_newline = pos - buf + 1;
+      if (++num_lines == max_lines)
+        break;
+      pos++;
+    }
+    if (num_lines == max_lines) {
+      size = last_newline - 1;
+      ret = 1;
+      break;
+    }
 
-  if (buf == static_buf)
-    buf = memdup(static_buf, size);
+    if (cancel_token_is_cancelled(cancel)) {
+      ret = 1;
+      break;
+    }
+  }
 
-  *data = (bytes){.buf = buf, .size = size};
-  return 0;
+  if (size == 0) {
+    xfree(buf);
+    *data = bytes_init();
+  } else {
+    // usually much less than what we allocated
+    *data = (bytes){.buf = size < capacity ? xrealloc(buf, size) : buf,
+                    .size = size};
+  }
+  return ret;
 
 err:
-  if (buf != static_buf)
-    xfree(buf);
+  xfree(buf);
   *data = bytes_init();
   return -1;
 }
@@ -261,25 +268,41 @@ Preview *preview_create_and_stat(zsview path, i32 height, i32 width) {
   return p;
 }
 
-// downscale images to fit the preview pane
-static void downscale_image(struct ncvisual *ncv, i32 y, i32 x) {
+// Scales images larger than a preview pane of `y`x`x` cells down to fit it
+// while keeping their aspect ratio, i.e. to the size NCSCALE_SCALE would blit
+// them at. Done here, on the worker, so that drawing only has to blit the
+// prepared frame. Smaller images are kept as they are and enlarged when
+// blitting, keeping an enlarged frame would waste memory in the cache.
+// Returns `true` if the image was scaled down.
+static bool scale_image(struct ncvisual *ncv, i32 y, i32 x) {
   i32 cdimy = cdims.cdimy;
   i32 cdimx = cdims.cdimx;
+  if (cdimy <= 0 || cdimx <= 0)
+    return false; // pixel geometry of the terminal unknown
 
   ncvgeom geom = {0};
   ncvisual_geom(NULL, ncv, NULL, &geom);
+  if (geom.pixy == 0 || geom.pixx == 0)
+    return false;
 
-  f64 scaley = 1.0 * geom.pixy / (y * cdimy);
-  f64 scale = 1.0 * geom.pixx / (x * cdimx);
+  f64 scaley = 1.0 * geom.pixy / ((f64)y * cdimy);
+  f64 scale = 1.0 * geom.pixx / ((f64)x * cdimx);
   if (scaley > scale) {
     scale = scaley;
   }
-  if (scale > 1.0) {
-    i32 newy = (i32)(geom.pixy / scale);
-    i32 newx = (i32)(geom.pixx / scale);
+  if (scale <= 1.0)
+    return false;
+  i32 newy = (i32)(geom.pixy / scale);
+  i32 newx = (i32)(geom.pixx / scale);
+  if (newy < 1)
+    newy = 1;
+  if (newx < 1)
+    newx = 1;
+  if (newy != (i32)geom.pixy || newx != (i32)geom.pixx) {
     log_trace("resizing: %d %d pane: %d %d", y * cdimy, x * cdimx, newy, newx);
     ncvisual_resize(ncv, newy, newx);
   }
+  return true;
 }
 
 Preview *preview_fork_previewer(zsview path, u32 width, u32 height,
@@ -346,125 +369,379 @@ Preview *preview_fork_previewer(zsview path, u32 width, u32 height,
   return p;
 }
 
-Preview *preview_read_output(Preview *p, i32 fd[2]) {
+Preview *preview_read_output(Preview *p, i32 fd[2],
+                             const cancel_token *cancel, bool *truncated) {
+  *truncated = false;
+
   struct stat statbuf;
   if (stat(cstr_str(&p->path), &statbuf)) {
     preview_error(p, "stat: %s", strerror(errno));
-    goto err;
+    goto out;
   }
   p->mtime = statbuf.st_mtime;
 
-  FILE *stdout = fdopen(fd[0], "r");
-  if (stdout == NULL) {
-    preview_error(p, "fdopen: %s", strerror(errno));
-    goto err;
+  // no need to drain the rest of the output, closing the pipe stops the
+  // previewer (or whatever it runs) the next time it writes
+  int ret = data_from_fd(&p->data, fd[0], p->height, cancel);
+  if (ret < 0)
+    preview_error(p, "read: %s", strerror(errno));
+  else
+    *truncated = ret > 0;
+
+out:
+  if (close(fd[0]))
+    log_perror("close");
+  fd[0] = -1;
+  return p;
+}
+
+static inline void set_image(Preview *p, struct ncvisual *ncv) {
+  bytes_drop(&p->data);
+  p->ncv = ncv;
+  p->draw = draw_image_preview;
+  p->update = update_image_preview;
+  p->destroy = destroy_image_preview;
+}
+
+// Replaces the contents of `p` with the image at `path`, scaled to fit the
+// preview. Returns `false` if the image can't be loaded. Sets `scaled_down`
+// (can be `NULL`) if the image is larger than the preview.
+static bool load_image(Preview *p, const char *path, bool *scaled_down) {
+  struct ncvisual *ncv = ncvisual_from_file(path);
+  if (unlikely(ncv == NULL))
+    return false;
+  bool scaled = scale_image(ncv, p->height, p->width);
+  if (scaled_down)
+    *scaled_down = scaled;
+  set_image(p, ncv);
+  return true;
+}
+
+// Serializes the (scaled) frame of an image preview for the disk cache: its
+// height and width in pixels followed by the RGBA pixels.
+static bytes frame_to_bytes(const struct ncvisual *ncv) {
+  ncvgeom geom = {0};
+  ncvisual_geom(NULL, ncv, NULL, &geom);
+  usize size = 2 * sizeof(u32) + (usize)geom.pixy * geom.pixx * 4;
+  char *buf = xmalloc(size);
+  u32 dims[2] = {geom.pixy, geom.pixx};
+  memcpy(buf, dims, sizeof dims);
+  u32 *pixels = (u32 *)(buf + sizeof dims);
+  for (u32 y = 0; y < geom.pixy; y++) {
+    for (u32 x = 0; x < geom.pixx; x++)
+      ncvisual_at_yx(ncv, y, x, &pixels[(usize)y * geom.pixx + x]);
+  }
+  return (bytes){buf, size};
+}
+
+// Inverse of `frame_to_bytes`, returns `NULL` if `data` is malformed.
+static struct ncvisual *frame_from_bytes(bytes data) {
+  u32 dims[2];
+  if (data.size < sizeof dims)
+    return NULL;
+  memcpy(dims, data.buf, sizeof dims);
+  if (dims[0] == 0 || dims[1] == 0 || dims[1] > INT_MAX / 4 ||
+      (data.size - sizeof dims) / 4 / dims[1] != dims[0] ||
+      (data.size - sizeof dims) % ((usize)dims[1] * 4) != 0)
+    return NULL;
+  return ncvisual_from_rgba(data.buf + sizeof dims, dims[0], dims[1] * 4,
+                            dims[1]);
+}
+
+static inline bool get_disk_cache_path(zsview path, const struct stat *st,
+                                       u32 width, u32 height, char *buf,
+                                       usize buflen) {
+  char dir[PATH_MAX];
+  i32 len = snprintf(dir, sizeof dir, "%s/previews", cstr_str(&cfg.cachedir));
+  if (unlikely(len < 0 || len >= (i32)sizeof dir))
+    return false;
+  return preview_cache_path(dir, path, st, width, height,
+                            cstr_zv(&cfg.previewer), cfg.preview_images, buf,
+                            buflen) >= 0;
+}
+
+// Stores the finished preview `p`, requested at `width`x`height`, in the disk
+// cache. `image` is the path of the image it shows, if any, `frame` is set if
+// the scaled frame should be stored instead of the path because the image is
+// larger than the preview and thus expensive to decode again.
+static void store_in_disk_cache(const Preview *p, u32 width, u32 height,
+                                const char *image, bool frame) {
+  static atomic_uint_fast64_t written_since_gc = 0;
+
+  if (cfg.preview_disk_cache_bytes == 0)
+    return;
+
+  // don't cache output for a file that changed while the previewer ran
+  struct stat st;
+  if (stat(cstr_str(&p->path), &st) != 0 || st.st_mtime != p->mtime)
+    return;
+
+  char cache_path[PATH_MAX];
+  if (!get_disk_cache_path(cstr_zv(&p->path), &st, width, height, cache_path,
+                           sizeof cache_path))
+    return;
+
+  struct preview_cache_entry entry = {
+      .kind = PREVIEW_CACHE_TEXT,
+      .width = p->width,
+      .height = p->height,
+      .data = p->data,
+  };
+  if (frame) {
+    entry.kind = PREVIEW_CACHE_FRAME;
+    entry.data = frame_to_bytes(p->ncv);
+  } else if (image) {
+    entry.kind = PREVIEW_CACHE_IMAGE;
+    entry.data = (bytes){(char *)image, strlen(image)};
+  }
+  isize n = preview_cache_write(cache_path, &entry);
+  if (entry.kind == PREVIEW_CACHE_FRAME)
+    bytes_drop(&entry.data);
+  if (n < 0) {
+    log_error("preview_cache_write: %s", strerror(errno));
+    return;
   }
 
-  if (data_from_stream(&p->data, stdout, p->height)) {
-    preview_error(p, "fread: %s", strerror(errno));
-    goto err1;
+  // collect garbage every once in a while, from whichever worker gets here
+  u64 threshold = cfg.preview_disk_cache_bytes / 8;
+  if (atomic_fetch_add(&written_since_gc, n) + n > threshold) {
+    atomic_store(&written_since_gc, 0);
+    char *sep = strrchr(cache_path, '/');
+    *sep = 0;
+    preview_cache_gc(cache_path, cfg.preview_disk_cache_bytes);
   }
+}
 
-  {
-    char buf[4096];
-    while (fread(buf, 1, sizeof buf, stdout) > 0) {
+Preview *preview_from_disk_cache(zsview path, u32 width, u32 height) {
+  if (cfg.preview_disk_cache_bytes == 0)
+    return NULL;
+
+  struct stat st;
+  if (stat(path.str, &st) != 0)
+    return NULL;
+
+  char cache_path[PATH_MAX];
+  if (!get_disk_cache_path(path, &st, width, height, cache_path,
+                           sizeof cache_path))
+    return NULL;
+
+  struct preview_cache_entry entry;
+  if (preview_cache_read(cache_path, &entry) != 0)
+    return NULL;
+
+  Preview *p = preview_create(path, entry.height, entry.width);
+  p->mtime = st.st_mtime;
+  if (entry.kind == PREVIEW_CACHE_IMAGE) {
+    char image[PATH_MAX];
+    bool ok = cfg.preview_images && entry.data.size < sizeof image;
+    if (ok) {
+      memcpy(image, entry.data.buf, entry.data.size);
+      image[entry.data.size] = 0;
+    }
+    bytes_drop(&entry.data);
+    // the image, e.g. written by the previewer, might be gone
+    if (!ok || !load_image(p, image, NULL)) {
+      preview_destroy(p);
+      return NULL;
     }
-    if (ferror(stdout)) {
-      preview_error(p, "fread: %s", strerror(errno));
-      goto err1;
+  } else if (entry.kind == PREVIEW_CACHE_FRAME) {
+    struct ncvisual *ncv =
+        cfg.preview_images ? frame_from_bytes(entry.data) : NULL;
+    bytes_drop(&entry.data);
+    if (ncv == NULL) {
+      preview_destroy(p);
+      return NULL;
     }
+    // already scaled when it was stored
+    set_image(p, ncv);
+  } else {
+    p->data = entry.data;
   }
-  if (fclose(stdout))
-    preview_error(p, "fclose: %s", strerror(errno));
+  return p;
+}
+
+// Finishes `p` depending on the exit code `rc` of the previewer.
+static Preview *handle_exit_code(Preview *p, i32 rc,
+                                 const cancel_token *cancel) {
+  if (cancel_token_is_cancelled(cancel))
+    return p;
+
+  // the key in the disk cache, before the previewer possibly unfixes them
+  const u32 width = p->width;
+  const u32 height = p->height;
+  const char *image = NULL;
+  bool frame = false;
+  char cache_path[PATH_MAX];
+
+  switch (rc) {
+  case PREVIEW_DISPLAY_STDOUT:
+    break;
+  case PREVIEW_NONE:
+    break; // no preview
+  case PREVIEW_FILE_CONTENTS: {
+    i32 fd = open(cstr_str(&p->path), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return preview_error(p, "open: %s", strerror(errno));
+    bytes_drop(&p->data);
+    int ret = data_from_fd(&p->data, fd, p->height, cancel);
+    close(fd);
+    if (ret < 0)
+      return preview_error(p, "read: %s", strerror(errno));
+  } break;
+  case PREVIEW_FIX_WIDTH:
+    p->width = INT_MAX;
+    break;
+  case PREVIEW_FIX_HEIGHT:
+    p->height = INT_MAX;
+    break;
+  case PREVIEW_FIX_WIDTH_AND_HEIGHT:
+    p->width = INT_MAX;
+    p->height = INT_MAX;
+    break;
+  case PREVIEW_CACHE_AS_IMAGE:
+    if (cfg.preview_images) {
+      // this is also done in p1
+      if (gen_cache_path(cstr_zv(&p->path), cache_path, sizeof cache_path) <
+          0)
+        return preview_error(p, "gen_cache_path");
+      if (!load_image(p, cache_path, &frame))
+        return preview_error(p, "ncvisual_from_file: ", strerror(errno));
+      image = cache_path;
+    }
+    break;
+  case PREVIEW_AS_IMAGE:
+    if (cfg.preview_images) {
+      if (!load_image(p, cstr_str(&p->path), &frame))
+        return preview_error(p, "ncvisual_from_file: ", strerror(errno));
+      image = cstr_str(&p->path);
+    }
+    break;
+  default:
+    return preview_error(p, "previewer returned %d", rc);
+  }
+
+  if (!cancel_token_is_cancelled(cancel))
+    store_in_disk_cache(p, width, height, image, frame);
 
-out:
-  fd[0] = -1;
   return p;
-err:
-  if (close(fd[0]))
-    log_perror("close");
-  goto out;
-err1:
-  if (fclose(stdout))
-    log_perror("fclose");
-  goto out;
 }
 
-Preview *preview_handle_exit_status(Preview *p, i32 status) {
+// Returns true if the exit code `rc` of a previewer whose output we stopped
+// reading is reliable. Writing to the closed pipe kills it or the commands it
+// runs (exit code 141 from a shell), or makes them fail so that scripts like
+// scope.sh fall through to "no preview".
+static inline bool truncated_exit_code_reliable(i32 rc) {
+  return rc != PREVIEW_NONE && rc <= PREVIEW_AS_IMAGE;
+}
 
+Preview *preview_handle_exit_status(Preview *p, i32 status, bool truncated,
+                                    const cancel_token *cancel) {
+  if (truncated &&
+      (WIFSIGNALED(status) ||
+       (WIFEXITED(status) &&
+        !truncated_exit_code_reliable(WEXITSTATUS(status))))) {
+    // show what we have read, but don't cache it
+    return p;
+  }
   // TODO: check other statuses?
-  if (likely(WIFEXITED(status))) {
-    i32 rc = WEXITSTATUS(status);
-    switch (rc) {
-    case PREVIEW_DISPLAY_STDOUT:
-      break;
-    case PREVIEW_NONE:
-      break; // no preview
-    case PREVIEW_FILE_CONTENTS: {
-      FILE *fp = fopen(cstr_str(&p->path), "r");
-      if (fp == NULL)
-        return preview_error(p, "fopen: ", strerror(errno));
-      bytes_drop(&p->data);
-      if (data_from_stream(&p->data, fp, p->height))
-        return preview_error(p, "fread: %s", strerror(errno));
-      if (fclose(fp))
-        return preview_error(p, "fclose: %s", strerror(errno));
-    } break;
-    case PREVIEW_FIX_WIDTH:
-      p->width = INT_MAX;
-      break;
-    case PREVIEW_FIX_HEIGHT:
-      p->height = INT_MAX;
-      break;
-    case PREVIEW_FIX_WIDTH_AND_HEIGHT:
-      p->width = INT_MAX;
-      p->height = INT_MAX;
-      break;
-    case PREVIEW_CACHE_AS_IMAGE:
-      if (cfg.preview_images) {
-
-        // this is also done in p1
-        char cache_path[PATH_MAX];
-        if (cfg.preview_images) {
-          if (gen_cache_path(cstr_zv(&p->path), cache_path,
-                             sizeof cache_path) != 0) {
-            return preview_error(p, "gen_cache_path");
-          }
-        } else {
-          cache_path[0] = 0;
-        }
-
-        struct ncvisual *ncv = ncvisual_from_file(cache_path);
-        if (unlikely(ncv == NULL)) {
-          return preview_error(p, "ncvisual_from_file: ", strerror(errno));
-        }
-        bytes_drop(&p->data);
-        downscale_image(ncv, p->height, p->width);
-        p->ncv = ncv;
-        p->draw = draw_image_preview;
-        p->update = update_image_preview;
-        p->destroy = destroy_image_preview;
-      }
-      break;
-    case PREVIEW_AS_IMAGE:
-      if (cfg.preview_images) {
-        struct ncvisual *ncv = ncvisual_from_file(cstr_str(&p->path));
-        if (unlikely(ncv == NULL)) {
-          return preview_error(p, "ncvisual_from_file: ", strerror(errno));
-        }
-        bytes_drop(&p->data);
-        downscale_image(ncv, p->height, p->width);
-        p->ncv = ncv;
-        p->draw = draw_image_preview;
-        p->update = update_image_preview;
-        p->destroy = destroy_image_preview;
-      }
-      break;
-    default:
-      return preview_error(p, "previewer returned %d", rc);
+  if (likely(WIFEXITED(status)))
+    return handle_exit_code(p, WEXITSTATUS(status), cancel);
+  return p;
+}
+
+Preview *preview_from_server(zsview path, u32 width, u32 height,
+                             const cancel_token *cancel) {
+  if (preview_server_count() == 0)
+    return NULL;
+
+  char cache_path[PATH_MAX];
+  if (unlikely(gen_cache_path(path, cache_path, sizeof cache_path) < 0))
+    return NULL;
+
+  // errors are reported by the forked previewer instead
+  struct stat st;
+  if (stat(path.str, &st) != 0)
+    return NULL;
+
+  struct preview_server_response res;
+  if (preview_server_request(path, width, height, cache_path,
+                             cfg.preview_images, height, PREVIEW_MAX_BYTES,
+                             cancel, &res) != 0)
+    return NULL;
+
+  Preview *p = preview_create(path, height, width);
+  p->mtime = st.st_mtime;
+  p->data = res.output;
+  return handle_exit_code(p, res.rc, cancel);
+}
+
+// Sniffs the start of a file: text has no NUL bytes or unusual control
+// characters and is valid UTF-8. A sequence cut off at the end of `buf` is
+// fine.
+static bool looks_like_text(const u8 *buf, usize len) {
+  for (usize i = 0; i < len;) {
+    u8 c = buf[i];
+    if (c < 0x20) {
+      if (c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != '\b' &&
+          c != 0x1b)
+        return false;
+      i++;
+      continue;
     }
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+    usize n;
+    if (c >= 0xc2 && c <= 0xdf)
+      n = 1;
+    else if (c >= 0xe0 && c <= 0xef)
+      n = 2;
+    else if (c >= 0xf0 && c <= 0xf4)
+      n = 3;
+    else
+      return false;
+    for (usize j = 1; j <= n; j++) {
+      if (i + j == len)
+        return true;
+      if ((buf[i + j] & 0xc0) != 0x80)
+        return false;
+    }
+    i += n + 1;
   }
+  return true;
+}
 
+Preview *preview_from_text_file(zsview path, u32 width, u32 height,
+                                const cancel_token *cancel) {
+  if (!cfg.preview_text)
+    return NULL;
+
+  i32 fd = open(path.str, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+  if (fd < 0)
+    return NULL;
+
+  // empty files are left to the previewer, it usually says what they are
+  struct stat st;
+  u8 sniff[4096];
+  isize n;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+      (n = pread(fd, sniff, sizeof sniff, 0)) <= 0 ||
+      !looks_like_text(sniff, n)) {
+    close(fd);
+    return NULL;
+  }
+
+  // read() rather than mmap(): a file truncated (or an I/O error on a network
+  // file system) while we look at it would kill us with SIGBUS
+  Preview *p = preview_create(path, height, width);
+  p->mtime = st.st_mtime;
+  int ret = data_from_fd(&p->data, fd, height, cancel);
+  close(fd);
+  if (ret < 0) {
+    preview_destroy(p);
+    return NULL;
+  }
   return p;
 }
 
@@ -506,8 +783,22 @@ static void draw_image_preview(const Preview *p, struct ncplane *n) {
 
   if (!p->ncv)
     return;
+
+  // Large images were scaled down to the pane when they were loaded and are
+  // blitted as they are. Images smaller than the pane are enlarged here, and
+  // frames are scaled again if the pane has shrunk since.
+  ncvgeom geom = {0};
+  ncvisual_geom(NULL, p->ncv, NULL, &geom);
+  u32 rows, cols;
+  ncplane_dim_yx(n, &rows, &cols);
+  u32 pixy = rows * cdims.cdimy;
+  u32 pixx = cols * cdims.cdimx;
+  bool fits = geom.pixy <= pixy && geom.pixx <= pixx;
+  // a scaled frame fills the pane in one dimension, up to rounding
+  bool fills = geom.pixy + cdims.cdimy > pixy || geom.pixx + cdims.cdimx > pixx;
+
   struct ncvisual_options vopts = {
-      .scaling = NCSCALE_SCALE,
+      .scaling = fits && fills ? NCSCALE_NONE : NCSCALE_SCALE,
       .n = n,
       .blitter = NCBLIT_PIXEL,
   };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "cancel.h"
 #include "defs.h"
 #include "loadable.h"
 #include "types/bytes.h"
@@ -39,6 +40,7 @@ typedef struct Preview {
 
   struct loadable_data loadable;
   bool is_loading;
+  u64 last_access; // loader tick of the latest lookup, for LRU eviction
 
   preview_draw_func draw;
   preview_update_func update;
@@ -48,6 +50,11 @@ typedef struct Preview {
 __lfm_nonnull()
 Preview *preview_error(Preview *p, const char *fmt, ...);
 
+// Approximate number of heap bytes held by the preview: the text, or the
+// decoded pixels of an image.
+__lfm_nonnull()
+usize preview_memory_usage(const Preview *p);
+
 __lfm_nonnull()
 Preview *preview_create_loading(zsview path, i32 height, i32 width);
 
@@ -58,11 +65,37 @@ __lfm_nonnull()
 Preview *preview_fork_previewer(zsview path, u32 width, u32 height,
                                 i32 *pid_out, i32 fd_out[2]);
 
-__lfm_nonnull()
-Preview *preview_read_output(Preview *p, i32 fd[2]);
-
-__lfm_nonnull()
-Preview *preview_handle_exit_status(Preview *p, i32 status);
+// Returns the preview of `path` at the given geometry from the disk cache,
+// `NULL` if there is none or the cache is disabled.
+Preview *preview_from_disk_cache(zsview path, u32 width, u32 height);
+
+// Loads the preview of `path` from a persistent previewer, see
+// preview_server.h. Returns `NULL` if there is none or it fails, in which case
+// the previewer should be forked instead.
+Preview *preview_from_server(zsview path, u32 width, u32 height,
+                             const cancel_token *cancel);
+
+// Previews `path` natively, without running the previewer, if it is a regular
+// file that looks like text and lfm.o.preview_text is set. Returns `NULL`
+// otherwise.
+Preview *preview_from_text_file(zsview path, u32 width, u32 height,
+                                const cancel_token *cancel);
+
+// Reads the output of the previewer from `fd[0]` and closes it. Stops reading
+// once the preview has enough lines or `cancel` (can be `NULL`) is cancelled,
+// and sets `truncated`; the previewer should then be killed if it doesn't exit
+// by itself.
+__lfm_nonnull(1, 2, 4)
+Preview *preview_read_output(Preview *p, i32 fd[2], const cancel_token *cancel,
+                             bool *truncated);
+
+// Finishes the preview depending on the exit `status` of the previewer, e.g.
+// by reading the file or an image. Does nothing once `cancel` is cancelled.
+// If `truncated` is set by `preview_read_output`, a status caused by the
+// closed pipe displays the output that was read without caching it.
+__lfm_nonnull(1)
+Preview *preview_handle_exit_status(Preview *p, i32 status, bool truncated,
+                                    const cancel_token *cancel);
 
 __lfm_nonnull()
 static inline zsview preview_path(const Preview *pv) {
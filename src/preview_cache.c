@@ -0,0 +1,243 @@
+#include "preview_cache.h"
+
+#include "log.h"
+#include "memory.h"
+#include "sha256.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/limits.h>
+#include <sys/stat.h>
+
+#define PREVIEW_CACHE_MAGIC "lfmp"
+#define PREVIEW_CACHE_VERSION 1
+
+// the data follows directly behind the header
+struct header {
+  char magic[4];
+  u8 version;
+  u8 kind;
+  u8 reserved[2];
+  u32 width;
+  u32 height;
+  u64 size; // of the data
+};
+
+static inline void hash_update_u64(SHA256_CTX *ctx, u64 val) {
+  u8 buf[8];
+  for (i32 i = 0; i < 8; i++)
+    buf[i] = val >> (8 * i);
+  sha256_update(ctx, buf, sizeof buf);
+}
+
+i32 preview_cache_path(const char *dir, zsview path, const struct stat *st,
+                       u32 width, u32 height, zsview previewer, bool images,
+                       char *buf, usize buflen) {
+  u8 hash[SHA256_BLOCK_SIZE];
+  SHA256_CTX ctx;
+  sha256_init(&ctx);
+  // include the terminating nul so that the path can't run into the numbers
+  sha256_update(&ctx, (const u8 *)path.str, path.size + 1);
+  hash_update_u64(&ctx, st->st_mtim.tv_sec);
+  hash_update_u64(&ctx, st->st_mtim.tv_nsec);
+  hash_update_u64(&ctx, st->st_size);
+  hash_update_u64(&ctx, ((u64)width << 32) | height);
+  // the same file previews differently with another previewer, or if images
+  // are disabled (an empty text entry for exit codes 6 and 7)
+  sha256_update(&ctx, (const u8 *)previewer.str, previewer.size + 1);
+  hash_update_u64(&ctx, images);
+  sha256_final(&ctx, hash);
+
+  usize len = strlen(dir);
+  if (unlikely(len + 1 + 2 * sizeof hash >= buflen))
+    return -1;
+  memcpy(buf, dir, len);
+  buf[len++] = '/';
+  static const char hex[] = "0123456789abcdef";
+  for (usize i = 0; i < sizeof hash; i++) {
+    buf[len++] = hex[hash[i] >> 4];
+    buf[len++] = hex[hash[i] & 0x0f];
+  }
+  buf[len] = 0;
+  return len;
+}
+
+static inline bool read_full(i32 fd, void *buf, usize size) {
+  char *p = buf;
+  while (size > 0) {
+    isize n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static inline bool write_full(i32 fd, const void *buf, usize size) {
+  const char *p = buf;
+  while (size > 0) {
+    isize n = write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+i32 preview_cache_read(const char *cache_path,
+                       struct preview_cache_entry *entry) {
+  i32 fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  struct header h;
+  if (fstat(fd, &st) != 0 || !read_full(fd, &h, sizeof h) ||
+      memcmp(h.magic, PREVIEW_CACHE_MAGIC, sizeof h.magic) != 0 ||
+      h.version != PREVIEW_CACHE_VERSION ||
+      h.size != (u64)st.st_size - sizeof h) {
+    close(fd);
+    return -1;
+  }
+
+  char *buf = NULL;
+  if (h.size > 0) {
+    buf = xmalloc(h.size);
+    if (unlikely(buf == NULL) || !read_full(fd, buf, h.size)) {
+      xfree(buf);
+      close(fd);
+      return -1;
+    }
+  }
+
+  // the mtime orders entries for garbage collection
+  futimens(fd, NULL);
+  close(fd);
+
+  entry->kind = h.kind;
+  entry->width = h.width;
+  entry->height = h.height;
+  entry->data = (bytes){buf, h.size};
+  return 0;
+}
+
+isize preview_cache_write(const char *cache_path,
+                          const struct preview_cache_entry *entry) {
+  char tmp[PATH_MAX];
+  i32 len = snprintf(tmp, sizeof tmp, "%s.XXXXXX", cache_path);
+  if (unlikely(len < 0 || len >= (i32)sizeof tmp)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  i32 fd = mkstemp(tmp);
+  if (fd < 0 && errno == ENOENT) {
+    char dir[PATH_MAX];
+    memcpy(dir, cache_path, strlen(cache_path) + 1);
+    char *sep = strrchr(dir, '/');
+    if (sep && sep != dir) {
+      *sep = 0;
+      mkdir_p(dir, 0700);
+    }
+    // the failed call already replaced the template characters
+    memcpy(tmp + len - 6, "XXXXXX", 6);
+    fd = mkstemp(tmp);
+  }
+  if (fd < 0)
+    return -1;
+
+  struct header h = {
+      .magic = PREVIEW_CACHE_MAGIC,
+      .version = PREVIEW_CACHE_VERSION,
+      .kind = entry->kind,
+      .width = entry->width,
+      .height = entry->height,
+      .size = entry->data.size,
+  };
+  if (!write_full(fd, &h, sizeof h) ||
+      !write_full(fd, entry->data.buf, entry->data.size)) {
+    i32 err = errno;
+    close(fd);
+    unlink(tmp);
+    errno = err;
+    return -1;
+  }
+  close(fd);
+
+  if (rename(tmp, cache_path) != 0) {
+    i32 err = errno;
+    unlink(tmp);
+    errno = err;
+    return -1;
+  }
+  return sizeof h + entry->data.size;
+}
+
+struct gc_entry {
+  struct timespec mtime;
+  u64 size;
+  char name[NAME_MAX + 1];
+};
+
+static int compare_gc_entry(const void *a, const void *b) {
+  const struct timespec *x = &((const struct gc_entry *)a)->mtime;
+  const struct timespec *y = &((const struct gc_entry *)b)->mtime;
+  if (x->tv_sec != y->tv_sec)
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+void preview_cache_gc(const char *dir, u64 max_bytes) {
+  DIR *dirp = opendir(dir);
+  if (dirp == NULL)
+    return;
+
+  struct gc_entry *entries = NULL;
+  usize num_entries = 0;
+  usize capacity = 0;
+  u64 total = 0;
+
+  struct dirent *d;
+  while ((d = readdir(dirp))) {
+    if (d->d_name[0] == '.')
+      continue;
+    struct stat st;
+    if (fstatat(dirfd(dirp), d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+        !S_ISREG(st.st_mode))
+      continue;
+    if (num_entries == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      entries = xrealloc(entries, capacity * sizeof *entries);
+    }
+    struct gc_entry *e = &entries[num_entries++];
+    e->mtime = st.st_mtim;
+    e->size = st.st_blocks * 512;
+    xstrlcpy(e->name, d->d_name, sizeof e->name);
+    total += e->size;
+  }
+
+  if (total > max_bytes) {
+    qsort(entries, num_entries, sizeof *entries, compare_gc_entry);
+    for (usize i = 0; i < num_entries && total > max_bytes; i++) {
+      if (unlinkat(dirfd(dirp), entries[i].name, 0) == 0)
+        total -= entries[i].size;
+    }
+    log_debug("preview cache gc: %llu bytes left in %s",
+              (unsigned long long)total, dir);
+  }
+
+  closedir(dirp);
+  xfree(entries);
+}
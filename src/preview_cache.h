@@ -0,0 +1,48 @@
+#pragma once
+
+// Persistent cache of rendered previews. Each entry is a file in the cache
+// directory named by the sha256 of the previewed path, its mtime and size, the
+// geometry the preview was requested with and the previewer settings, so
+// entries never need to be invalidated: a changed file simply maps to a
+// different entry. Old entries are removed by `preview_cache_gc`.
+
+#include "defs.h"
+#include "types/bytes.h"
+
+#include <stc/zsview.h>
+
+#include <sys/stat.h>
+
+enum preview_cache_kind {
+  PREVIEW_CACHE_TEXT,  // `data` is the text of the preview
+  PREVIEW_CACHE_IMAGE, // `data` is the path of an image to load
+  PREVIEW_CACHE_FRAME, // `data` is a scaled image, see preview.c
+};
+
+struct preview_cache_entry {
+  u8 kind; // enum preview_cache_kind
+  u32 width;  // geometry of the preview, INT_MAX if fixed
+  u32 height;
+  bytes data;
+};
+
+// Writes the path of the entry for the file at `path` with stat `st`, previewed
+// at `width`x`height` by `previewer` with images enabled or not, to `buf`.
+// Returns the length, -1 if `buf` is too small.
+i32 preview_cache_path(const char *dir, zsview path, const struct stat *st,
+                       u32 width, u32 height, zsview previewer, bool images,
+                       char *buf, usize buflen);
+
+// Reads the entry at `cache_path` into `entry`. Returns 0 on success, -1 if
+// there is no (valid) entry. Marks the entry as recently used.
+i32 preview_cache_read(const char *cache_path,
+                       struct preview_cache_entry *entry);
+
+// Atomically replaces the entry at `cache_path`, creating its directory if
+// needed. Returns the number of bytes written, -1 on error with errno set.
+isize preview_cache_write(const char *cache_path,
+                          const struct preview_cache_entry *entry);
+
+// Removes the least recently used entries in `dir` until they take up at most
+// `max_bytes`.
+void preview_cache_gc(const char *dir, u64 max_bytes);
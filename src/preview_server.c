@@ -0,0 +1,357 @@
+#include "preview_server.h"
+
+#include "log.h"
+#include "memory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/limits.h>
+#include <sys/wait.h>
+
+// how often waiting workers check their cancel token, in milliseconds
+#define POLL_INTERVAL 50
+
+struct server {
+  pid_t pid;      // 0 if not running
+  i32 in;         // stdin of the server
+  i32 out;        // stdout of the server
+  u32 generation; // of the configuration it was started with
+  u64 answered;   // number of requests it answered
+  bool busy;      // in use by a worker
+};
+
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t idle; // signalled whenever a server becomes idle
+  struct server servers[PREVIEW_SERVERS_MAX];
+  char previewer[PATH_MAX];
+  u32 num;
+  u32 generation; // incremented when the previewer changes
+  bool broken;    // the previewer does not speak the protocol
+} pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+};
+
+static void server_stop(struct server *s) {
+  if (s->pid == 0)
+    return;
+  close(s->in);
+  close(s->out);
+  kill(s->pid, SIGTERM);
+  // usually reaped by the event loop's SIGCHLD handler
+  waitpid(s->pid, NULL, WNOHANG);
+  s->pid = 0;
+  s->answered = 0;
+}
+
+static inline void set_cloexec(i32 fd[2]) {
+  fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+}
+
+// Called from a worker thread, the child only calls async-signal-safe
+// functions before exec.
+static bool server_start(struct server *s, const char *previewer) {
+  i32 in[2], out[2];
+  if (pipe(in) == -1) {
+    log_perror("pipe");
+    return false;
+  }
+  if (pipe(out) == -1) {
+    log_perror("pipe");
+    close(in[0]);
+    close(in[1]);
+    return false;
+  }
+  // servers that are started concurrently must not inherit each other's pipes
+  set_cloexec(in);
+  set_cloexec(out);
+
+  const char *args[3] = {previewer, "--server", NULL};
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(in[0], 0);
+    dup2(out[1], 1);
+    i32 devnull = open("/dev/null", O_WRONLY);
+    if (devnull != -1)
+      dup2(devnull, 2);
+    execv(args[0], (char **)args);
+    _exit(ENOSYS);
+  }
+
+  close(in[0]);
+  close(out[1]);
+  if (unlikely(pid < 0)) {
+    log_perror("fork");
+    close(in[1]);
+    close(out[0]);
+    return false;
+  }
+
+  log_debug("started preview server %s (pid %d)", previewer, pid);
+  s->pid = pid;
+  s->in = in[1];
+  s->out = out[0];
+  s->answered = 0;
+  return true;
+}
+
+// Returns an idle server, marked busy, `NULL` if there is none.
+static struct server *acquire(const cancel_token *cancel) {
+  pthread_mutex_lock(&pool.mutex);
+  struct server *s = NULL;
+  while (pool.num > 0 && !pool.broken) {
+    struct server *stopped = NULL;
+    for (u32 i = 0; i < pool.num; i++) {
+      struct server *t = &pool.servers[i];
+      if (t->busy)
+        continue;
+      if (t->pid != 0 && t->generation == pool.generation) {
+        s = t;
+        break;
+      }
+      if (stopped == NULL)
+        stopped = t;
+    }
+    if (s == NULL && stopped != NULL) {
+      s = stopped;
+      server_stop(s); // in case it runs an old previewer
+      s->busy = true;
+      s->generation = pool.generation;
+      char previewer[PATH_MAX];
+      memcpy(previewer, pool.previewer, sizeof previewer);
+      // don't block others while forking
+      pthread_mutex_unlock(&pool.mutex);
+      bool started = server_start(s, previewer);
+      pthread_mutex_lock(&pool.mutex);
+      if (!started) {
+        s->busy = false;
+        s = NULL;
+      }
+      break;
+    }
+    if (s) {
+      s->busy = true;
+      break;
+    }
+    if (cancel_token_is_cancelled(cancel))
+      break;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += POLL_INTERVAL * 1000 * 1000;
+    if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+    pthread_cond_timedwait(&pool.idle, &pool.mutex, &deadline);
+  }
+  pthread_mutex_unlock(&pool.mutex);
+  return s;
+}
+
+// `ok` is false if the server failed (or was interrupted) and has to be
+// restarted, `broken` if servers of this previewer should not be used at all.
+static void release(struct server *s, bool ok, bool broken) {
+  pthread_mutex_lock(&pool.mutex);
+  if (ok) {
+    s->answered++;
+  } else {
+    if (broken && s->generation == pool.generation) {
+      log_error("preview server %s failed, forking the previewer instead",
+                pool.previewer);
+      pool.broken = true;
+    }
+    server_stop(s);
+  }
+  if (s->generation != pool.generation || s - pool.servers >= pool.num)
+    server_stop(s);
+  s->busy = false;
+  pthread_cond_broadcast(&pool.idle);
+  pthread_mutex_unlock(&pool.mutex);
+}
+
+void preview_server_configure(const char *previewer, u32 num) {
+  pthread_mutex_lock(&pool.mutex);
+  if (strcmp(previewer, pool.previewer) != 0) {
+    xstrlcpy(pool.previewer, previewer, sizeof pool.previewer);
+    pool.generation++;
+  }
+  pool.num = num < PREVIEW_SERVERS_MAX ? num : PREVIEW_SERVERS_MAX;
+  pool.broken = false;
+  for (u32 i = 0; i < PREVIEW_SERVERS_MAX; i++) {
+    struct server *s = &pool.servers[i];
+    if (!s->busy && (i >= pool.num || s->generation != pool.generation))
+      server_stop(s);
+  }
+  pthread_cond_broadcast(&pool.idle);
+  pthread_mutex_unlock(&pool.mutex);
+}
+
+u32 preview_server_count(void) {
+  pthread_mutex_lock(&pool.mutex);
+  u32 num = pool.num;
+  pthread_mutex_unlock(&pool.mutex);
+  return num;
+}
+
+void preview_server_stop_all(void) {
+  pthread_mutex_lock(&pool.mutex);
+  for (u32 i = 0; i < PREVIEW_SERVERS_MAX; i++)
+    server_stop(&pool.servers[i]);
+  pthread_mutex_unlock(&pool.mutex);
+}
+
+static bool write_full(i32 fd, const char *buf, usize size) {
+  while (size > 0) {
+    isize n = write(fd, buf, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Reads up to `size` bytes, waiting for the server while checking `cancel`.
+// Returns the number of bytes read, 0 on EOF, -1 on error or cancellation.
+static isize read_some(i32 fd, char *buf, usize size,
+                       const cancel_token *cancel) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  for (;;) {
+    if (cancel_token_is_cancelled(cancel))
+      return -1;
+    i32 ret = poll(&pfd, 1, POLL_INTERVAL);
+    if (ret < 0 && errno != EINTR)
+      return -1;
+    if (ret <= 0)
+      continue;
+    isize n = read(fd, buf, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    return n;
+  }
+}
+
+// Reads "<rc> <size>\n".
+static bool read_header(i32 fd, i32 *rc, u64 *size,
+                        const cancel_token *cancel) {
+  char buf[64];
+  usize len = 0;
+  // byte by byte, so that we don't consume any of the output
+  for (;;) {
+    if (len == sizeof buf - 1 || read_some(fd, buf + len, 1, cancel) != 1)
+      return false;
+    if (buf[len] == '\n')
+      break;
+    len++;
+  }
+  buf[len] = 0;
+
+  char *end;
+  errno = 0;
+  long code = strtol(buf, &end, 10);
+  if (errno != 0 || end == buf || *end != ' ')
+    return false;
+  const char *num = end + 1;
+  unsigned long long n = strtoull(num, &end, 10);
+  if (errno != 0 || end == num || *end != 0)
+    return false;
+  *rc = code;
+  *size = n;
+  return true;
+}
+
+// Reads `size` bytes of output, keeps at most `max_lines` lines and
+// `max_bytes` bytes of it. The rest is discarded.
+static bool read_output(i32 fd, u64 size, i32 max_lines, usize max_bytes,
+                        const cancel_token *cancel, bytes *data) {
+  usize keep = size < max_bytes ? size : max_bytes;
+  char *buf = keep > 0 ? xmalloc(keep) : NULL;
+  usize len = 0;         // bytes in buf
+  i32 num_lines = 0;     // newlines in buf
+  bool full = keep == 0; // enough lines or bytes
+  char discard[4096];
+
+  while (size > 0) {
+    char *dest = full ? discard : buf + len;
+    usize n = full ? sizeof discard : keep - len;
+    if (n > size)
+      n = size;
+    isize ret = read_some(fd, dest, n, cancel);
+    if (ret <= 0) {
+      xfree(buf);
+      return false;
+    }
+    size -= ret;
+    if (full)
+      continue;
+
+    // count the lines in what we just read
+    const char *p = buf + len;
+    const char *end = buf + len + ret;
+    len += ret;
+    while ((p = memchr(p, '\n', end - p))) {
+      if (++num_lines == max_lines) {
+        len = p - buf;
+        full = true;
+        break;
+      }
+      p++;
+    }
+    if (len == keep && !full && size > 0) {
+      // too much output, cut it at the last complete line
+      const char *last = buf + len;
+      while (last > buf && last[-1] != '\n')
+        last--;
+      if (last > buf)
+        len = last - 1 - buf;
+      full = true;
+    }
+  }
+
+  *data = (bytes){buf, len};
+  return true;
+}
+
+i32 preview_server_request(zsview path, u32 width, u32 height,
+                           const char *cache_path, bool images, i32 max_lines,
+                           usize max_bytes, const cancel_token *cancel,
+                           struct preview_server_response *res) {
+  struct server *s = acquire(cancel);
+  if (s == NULL)
+    return -1;
+
+  char req[2 * PATH_MAX + 64];
+  i32 len = snprintf(req, sizeof req, "%s%c%u%c%u%c%s%c%s%c", path.str, 0,
+                     width, 0, height, 0, cache_path, 0,
+                     images ? "True" : "False", 0);
+  if (unlikely(len < 0 || len >= (i32)sizeof req)) {
+    release(s, true, false);
+    return -1;
+  }
+
+  u64 size;
+  bool ok = write_full(s->in, req, len) &&
+            read_header(s->out, &res->rc, &size, cancel) &&
+            read_output(s->out, size, max_lines, max_bytes, cancel,
+                        &res->output);
+  // a server that never answered is most likely a previewer without support
+  // for --server
+  release(s, ok,
+          !ok && s->answered == 0 && !cancel_token_is_cancelled(cancel));
+  return ok ? 0 : -1;
+}
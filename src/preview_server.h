@@ -0,0 +1,46 @@
+#pragma once
+
+// Persistent previewer processes. Instead of forking the previewer for every
+// preview, up to `preview_server_count()` instances of it are started with the
+// single argument `--server` and kept running. Each handles one request at a
+// time; requests and responses are framed:
+//
+//   request:  path \0 width \0 height \0 cache_path \0 images \0
+//   response: "<exit code> <size>\n" followed by <size> bytes of output
+//
+// where images is "True" or "False", as in the arguments to the forked
+// previewer, and the exit code has the same meaning as the exit status of the
+// forked previewer.
+
+#include "cancel.h"
+#include "defs.h"
+#include "types/bytes.h"
+
+#include <stc/zsview.h>
+
+// At most this many servers are started.
+#define PREVIEW_SERVERS_MAX 32
+
+struct preview_server_response {
+  i32 rc;       // exit code
+  bytes output; // at most `max_lines` lines and `max_bytes` bytes of it
+};
+
+// Sets the previewer and the number of servers, 0 disables them. Servers of a
+// previous previewer or beyond `num` are stopped once they are idle. Call from
+// the main thread.
+void preview_server_configure(const char *previewer, u32 num);
+
+u32 preview_server_count(void);
+
+// Sends the request to an idle server, starting it if necessary, and waits for
+// the response. Waits for a server to become idle if all are busy. Returns 0
+// on success, -1 if no server is available, failed, or `cancel` is cancelled,
+// in which case the previewer should be forked as usual.
+i32 preview_server_request(zsview path, u32 width, u32 height,
+                           const char *cache_path, bool images, i32 max_lines,
+                           usize max_bytes, const cancel_token *cancel,
+                           struct preview_server_response *res);
+
+// Stops all servers, waiting for busy ones is the caller's responsibility.
+void preview_server_stop_all(void);
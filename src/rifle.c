@@ -0,0 +1,572 @@
+#include "rifle.h"
+
+#include "log.h"
+#include "memory.h"
+#include "util.h"
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#define BUFSIZE 4096
+#define DELIM_CONDITION ","
+#define DELIM_COMMAND " = "
+
+// longest extension or mime type used as a key in the index
+#define INDEX_KEY_MAX 64
+
+static inline void condition_drop(Condition *self) {
+  if (self->re)
+    pcre2_code_free(self->re);
+  cstr_drop(&self->arg);
+}
+
+#define i_declared
+#define i_type conditions
+#define i_key Condition
+#define i_keydrop condition_drop
+#define i_no_clone
+#include <stc/vec.h>
+
+static inline void rule_drop(Rule *self) {
+  conditions_drop(&self->conditions);
+  cstr_drop(&self->label);
+  cstr_drop(&self->command);
+}
+
+#define i_declared
+#define i_type rules
+#define i_key Rule
+#define i_keydrop rule_drop
+#define i_no_clone
+#include <stc/vec.h>
+
+#define i_declared
+#define i_type hmap_rule_bucket
+#define i_keypro cstr
+#define i_val vec_int
+#define i_valdrop vec_int_drop
+#define i_no_clone
+#include <stc/hmap.h>
+
+// Rifle is only used from the main thread, one match data block suffices.
+static pcre2_match_data *match_data = NULL;
+
+static inline bool re_match(pcre2_code *re, zsview string) {
+  if (unlikely(match_data == NULL))
+    match_data = pcre2_match_data_create(1, NULL);
+  int rc = pcre2_match(re, (PCRE2_SPTR)string.str, string.size, 0, 0,
+                       match_data, NULL);
+  return rc >= 0;
+}
+
+// Returns the extension of the last component of `file`, without the dot,
+// or an empty string.
+static inline const char *file_ext(zsview file) {
+  const char *name = strrchr(file.str, '/');
+  name = name ? name + 1 : file.str;
+  const char *dot = strrchr(name, '.');
+  return dot ? dot + 1 : "";
+}
+
+// Returns a pointer to the first `c` in `s`, or to its terminating NUL.
+static inline const char *find_or_end(const char *s, char c) {
+  const char *p = strchr(s, c);
+  return p ? p : s + strlen(s);
+}
+
+static inline bool file_stat(FileInfo *info) {
+  if (info->stat_state == 0)
+    info->stat_state = stat(info->file.str, &info->stat) == 0 ? 1 : -1;
+  return info->stat_state == 1;
+}
+
+static inline Condition condition_create(check_fn *f, const char *arg,
+                                         bool negate) {
+  Condition cond = {0};
+  cond.check = f;
+  cond.arg = arg ? cstr_from(arg) : cstr_init();
+  cond.negate = negate;
+  cond.has_result = -1;
+  return cond;
+}
+
+static inline void rule_set_flags(Rule *r, const char *flags) {
+  for (const char *f = flags; *f; f++) {
+    switch (*f) {
+    case 'f':
+      r->flag_fork = true;
+      break;
+    case 't':
+      r->flag_term = true;
+      break;
+    case 'e':
+      r->flag_esc = true;
+      break;
+    case 'l':
+      r->flag_lfm = true;
+      break;
+    }
+  }
+  for (const char *f = flags; *f; f++) {
+    switch (*f) {
+    case 'F':
+      r->flag_fork = false;
+      break;
+    case 'T':
+      r->flag_term = false;
+      break;
+    case 'E':
+      r->flag_esc = false;
+      break;
+    case 'L':
+      r->flag_lfm = false;
+      break;
+    }
+  }
+}
+
+static bool check_fn_file(Condition *cond, FileInfo *info) {
+  if (!file_stat(info))
+    return cond->negate;
+  return S_ISREG(info->stat.st_mode) != cond->negate;
+}
+
+static bool check_fn_dir(Condition *cond, FileInfo *info) {
+  if (!file_stat(info))
+    return cond->negate;
+  return S_ISDIR(info->stat.st_mode) != cond->negate;
+}
+
+// not sure if this even works from within lfm
+static bool check_fn_term(Condition *cond, FileInfo *info) {
+  (void)info;
+  return (isatty(0) && isatty(1) && isatty(2)) != cond->negate;
+}
+
+static bool check_fn_env(Condition *cond, FileInfo *info) {
+  (void)info;
+  const char *val = getenv(cstr_str(&cond->arg));
+  return (val && *val) != cond->negate;
+}
+
+static bool check_fn_else(Condition *cond, FileInfo *info) {
+  (void)info;
+  return !cond->negate;
+}
+
+static bool check_fn_path(Condition *cond, FileInfo *info) {
+  return re_match(cond->re, info->path) != cond->negate;
+}
+
+static bool check_fn_mime(Condition *cond, FileInfo *info) {
+  return re_match(cond->re, info->mime) != cond->negate;
+}
+
+static bool check_fn_name(Condition *cond, FileInfo *info) {
+  const char *ptr = strrchr(info->file.str, '/');
+  if (ptr) {
+    int pos = ptr - info->file.str;
+    return re_match(cond->re, zsview_from_pos(info->file, pos)) != cond->negate;
+  } else {
+    return re_match(cond->re, info->file) != cond->negate;
+  }
+}
+
+static bool check_fn_match(Condition *cond, FileInfo *info) {
+  return re_match(cond->re, info->file) != cond->negate;
+}
+
+// `ext` with only literal alternatives, e.g. `ext png|jpg`, compares the
+// extension instead of matching `\.(png|jpg)$`.
+static bool check_fn_ext(Condition *cond, FileInfo *info) {
+  const char *ext = file_ext(info->file);
+  usize len = strlen(ext);
+  const char *alt = cstr_str(&cond->arg);
+  for (;;) {
+    const char *end = find_or_end(alt, '|');
+    if ((usize)(end - alt) == len && memcmp(alt, ext, len) == 0)
+      return !cond->negate;
+    if (*end == 0)
+      return cond->negate;
+    alt = end + 1;
+  }
+}
+
+// Looks for an executable `name` in PATH, like `command -v`.
+static bool executable_exists(const char *name) {
+  if (strchr(name, '/'))
+    return access(name, X_OK) == 0;
+
+  const char *path = getenv("PATH");
+  if (path == NULL)
+    return false;
+
+  char buf[PATH_MAX];
+  struct stat statbuf;
+  for (const char *dir = path;;) {
+    const char *end = find_or_end(dir, ':');
+    int len = end - dir;
+    // an empty component is the current directory
+    int n = len > 0 ? snprintf(buf, sizeof buf, "%.*s/%s", len, dir, name)
+                    : snprintf(buf, sizeof buf, "%s", name);
+    if (n > 0 && (usize)n < sizeof buf && stat(buf, &statbuf) == 0 &&
+        S_ISREG(statbuf.st_mode) && access(buf, X_OK) == 0)
+      return true;
+    if (*end == 0)
+      return false;
+    dir = end + 1;
+  }
+}
+
+// The result is memoized, PATH is only searched once per condition.
+static bool check_fn_has(Condition *cond, FileInfo *info) {
+  (void)info;
+  if (cond->has_result < 0)
+    cond->has_result = executable_exists(cstr_str(&cond->arg));
+  return cond->has_result != cond->negate;
+}
+
+/* TODO: log errors (on 2022-10-15) */
+static inline Condition condition_create_re(check_fn *f, const char *pattern,
+                                            bool negate) {
+  int errornumber;
+  PCRE2_SIZE erroroffset;
+  Condition c = condition_create(f, pattern, negate);
+  c.re = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, 0,
+                       &errornumber, &erroroffset, NULL);
+  if (unlikely(!c.re)) {
+    cstr_drop(&c.arg);
+    return (Condition){0};
+  }
+  // falls back to the interpreter if JIT is unavailable
+  pcre2_jit_compile(c.re, PCRE2_JIT_COMPLETE);
+  return c;
+}
+
+static inline Condition condition_create_re_name(const char *arg, bool negate) {
+  return condition_create_re(check_fn_name, arg, negate);
+}
+
+static inline Condition condition_create_re_path(const char *arg, bool negate) {
+  return condition_create_re(check_fn_path, arg, negate);
+}
+
+// Returns true if `arg` is a list of extensions like `png|jpg`.
+static inline bool is_literal_ext(const char *arg) {
+  bool empty = true; // current alternative
+  for (const char *c = arg; *c; c++) {
+    if (*c == '|') {
+      if (empty)
+        return false;
+      empty = true;
+    } else if (isalnum((unsigned char)*c) || *c == '_' || *c == '-') {
+      empty = false;
+    } else {
+      return false;
+    }
+  }
+  return !empty && strlen(arg) < BUFSIZE;
+}
+
+static inline Condition condition_create_re_ext(const char *arg, bool negate) {
+  if (is_literal_ext(arg))
+    return condition_create(check_fn_ext, arg, negate);
+  char buf[512];
+  snprintf(buf, sizeof buf - 1, "\\.(%s)$", arg);
+  Condition cond = condition_create_re(check_fn_name, buf, negate);
+  return cond;
+}
+
+static inline Condition condition_create_re_mime(const char *arg, bool negate) {
+  return condition_create_re(check_fn_mime, arg, negate);
+}
+
+static inline Condition condition_create_re_match(const char *arg,
+                                                  bool negate) {
+  return condition_create_re(check_fn_match, arg, negate);
+}
+
+static inline char *split_command(char *s) {
+  if (unlikely((s = strstr(s, DELIM_COMMAND)) == NULL))
+    return NULL;
+  *s = '\0';
+  return trim(s + 3);
+}
+
+static inline bool rule_add_condition(Rule *self, char *cond_str) {
+  if (unlikely(*cond_str == 0))
+    return true;
+
+  cond_str = rtrim(cond_str);
+
+  bool negate = false;
+  char *arg, *func = strtok_r(cond_str, " \t", &cond_str);
+  if (unlikely(func == NULL))
+    return true;
+  if (func[0] == '!') {
+    negate = true;
+    func++;
+  }
+
+  Condition cond = {0};
+
+  if (streq(func, "file")) {
+    cond = condition_create(check_fn_file, NULL, negate);
+  } else if (streq(func, "directory")) {
+    cond = condition_create(check_fn_dir, NULL, negate);
+  } else if (streq(func, "terminal")) {
+    cond = condition_create(check_fn_term, NULL, negate);
+  } else if (streq(func, "X")) {
+    cond = condition_create(check_fn_env, "DISPLAY", negate);
+  } else if (streq(func, "W")) {
+    cond = condition_create(check_fn_env, "WAYLAND_DISPLAY", negate);
+  } else if (streq(func, "else")) {
+    cond = condition_create(check_fn_else, NULL, negate);
+  } else {
+    if ((arg = strtok_r(cond_str, "\0", &cond_str)) == NULL) {
+      return false;
+    }
+
+    if (streq(func, "label")) {
+      cstr_assign(&self->label, arg);
+    } else if (streq(func, "number")) {
+      /* TODO: cant distringuish between 0 and invalid number
+       * (on 2021-07-27) */
+      self->number = atoi(arg);
+    } else if (streq(func, "flag")) {
+      rule_set_flags(self, arg);
+    } else if (streq(func, "ext")) {
+      cond = condition_create_re_ext(arg, negate);
+    } else if (streq(func, "path")) {
+      cond = condition_create_re_path(arg, negate);
+    } else if (streq(func, "mime")) {
+      cond = condition_create_re_mime(arg, negate);
+      if (!negate) {
+        self->has_mime = true;
+      }
+    } else if (streq(func, "name")) {
+      cond = condition_create_re_name(arg, negate);
+    } else if (streq(func, "match")) {
+      cond = condition_create_re_match(arg, negate);
+    } else if (streq(func, "env")) {
+      cond = condition_create(check_fn_env, arg, negate);
+    } else if (streq(func, "has")) {
+      cond = condition_create(check_fn_has, arg, negate);
+    } else {
+      return false;
+    }
+  }
+
+  if (cond.check)
+    conditions_push(&self->conditions, cond);
+
+  return true;
+}
+
+static inline int rule_init(Rule *self, char *str, const char *command) {
+  memset(self, 0, sizeof *self);
+  self->command = cstr_from(command);
+  self->number = -1;
+
+  char *cond;
+  while ((cond = strtok_r(str, DELIM_CONDITION, &str))) {
+    if (!rule_add_condition(self, cond)) {
+      rule_drop(self);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static inline bool rule_check(Rule *self, FileInfo *info) {
+  c_foreach(it, conditions, self->conditions) {
+    Condition *c = it.ref;
+    if (!c->check(c, info))
+      return false;
+  }
+  return true;
+}
+
+bool rifle_rules_add(RifleRules *self, const char *line) {
+  char buf[BUFSIZE];
+  xstrlcpy(buf, line, sizeof buf);
+
+  char *command = split_command(buf);
+  if (unlikely(!command))
+    return false;
+
+  Rule r;
+  if (unlikely(rule_init(&r, buf, command) != 0))
+    return false;
+
+  rules_push(&self->rules, r);
+  self->index.valid = false;
+  return true;
+}
+
+static void index_clear(RifleRules *self) {
+  hmap_rule_bucket_clear(&self->index.ext);
+  hmap_rule_bucket_clear(&self->index.mime);
+  vec_int_clear(&self->index.rest);
+  self->index.valid = false;
+}
+
+void rifle_rules_clear(RifleRules *self) {
+  rules_clear(&self->rules);
+  index_clear(self);
+}
+
+void rifle_rules_drop(RifleRules *self) {
+  rules_drop(&self->rules);
+  hmap_rule_bucket_drop(&self->index.ext);
+  hmap_rule_bucket_drop(&self->index.mime);
+  vec_int_drop(&self->index.rest);
+}
+
+static void bucket_push(hmap_rule_bucket *map, const char *key, i32 ind) {
+  vec_int *v = &hmap_rule_bucket_emplace(map, key, vec_int_init()).ref->second;
+  // `ext png|png` would add the rule twice
+  if (vec_int_is_empty(v) || *vec_int_back(v) != ind)
+    vec_int_push(v, ind);
+}
+
+// Buckets the rule by the extensions of its first literal `ext` condition.
+static bool index_ext(RifleRules *self, const Rule *r, i32 ind) {
+  c_foreach(it, conditions, r->conditions) {
+    const Condition *c = it.ref;
+    if (c->check != check_fn_ext || c->negate)
+      continue;
+    char key[INDEX_KEY_MAX];
+    for (const char *alt = cstr_str(&c->arg);;) {
+      const char *end = find_or_end(alt, '|');
+      int len = end - alt;
+      if (len >= INDEX_KEY_MAX)
+        return false; // can't be indexed, the rule is always checked
+      memcpy(key, alt, len);
+      key[len] = 0;
+      bucket_push(&self->index.ext, key, ind);
+      if (*end == 0)
+        return true;
+      alt = end + 1;
+    }
+  }
+  return false;
+}
+
+// Writes the type of the mimes matched by `pattern` to `type`, if they all
+// share it, e.g. "video" for "^video/(mp4|webm)". Only anchored patterns
+// without top level alternatives qualify.
+static bool mime_pattern_type(const char *pattern, char *type, usize sz) {
+  if (pattern[0] != '^' || strchr(pattern, '|'))
+    return false;
+  const char *p = pattern + 1;
+  while (isalnum((unsigned char)*p) || *p == '-' || *p == '_')
+    p++;
+  usize len = p - (pattern + 1);
+  if (*p != '/' || len == 0 || len >= sz)
+    return false;
+  // the slash could be optional, as in "^video/?"
+  if (p[1] == '?' || p[1] == '*' || p[1] == '{')
+    return false;
+  memcpy(type, pattern + 1, len);
+  type[len] = 0;
+  return true;
+}
+
+// Buckets the rule by the type of its first anchored `mime` condition.
+static bool index_mime(RifleRules *self, const Rule *r, i32 ind) {
+  c_foreach(it, conditions, r->conditions) {
+    const Condition *c = it.ref;
+    if (c->check != check_fn_mime || c->negate)
+      continue;
+    char type[INDEX_KEY_MAX];
+    if (mime_pattern_type(cstr_str(&c->arg), type, sizeof type)) {
+      bucket_push(&self->index.mime, type, ind);
+      return true;
+    }
+  }
+  return false;
+}
+
+void rifle_rules_compile(RifleRules *self) {
+  index_clear(self);
+  i32 ind = 0;
+  c_foreach(it, rules, self->rules) {
+    if (!index_ext(self, it.ref, ind) && !index_mime(self, it.ref, ind))
+      vec_int_push(&self->index.rest, ind);
+    ind++;
+  }
+  self->index.valid = true;
+  log_debug("rifle: %d rules, %d extensions, %d mime types, %d unindexed",
+            (int)rules_size(&self->rules),
+            (int)hmap_rule_bucket_size(&self->index.ext),
+            (int)hmap_rule_bucket_size(&self->index.mime),
+            (int)vec_int_size(&self->index.rest));
+}
+
+static inline const vec_int *bucket_get(const hmap_rule_bucket *map,
+                                        const char *key) {
+  const hmap_rule_bucket_value *v = hmap_rule_bucket_get(map, key);
+  return v ? &v->second : NULL;
+}
+
+void rifle_rules_match(RifleRules *self, FileInfo *info, bool mime_only,
+                       rifle_match_fn fn, void *arg) {
+  if (!self->index.valid) {
+    c_foreach(it, rules, self->rules) {
+      Rule *r = it.ref;
+      if ((!mime_only || r->has_mime) && rule_check(r, info)) {
+        if (!fn(r, arg))
+          return;
+      }
+    }
+    return;
+  }
+
+  // candidates are the rules of the buckets of the extension and the mime
+  // type, and all unindexed rules; every list is sorted and a rule is in
+  // at most one of them, merging them keeps the order of the rules
+  const vec_int *lists[3] = {&self->index.rest};
+  const char *ext = file_ext(info->file);
+  if (*ext)
+    lists[1] = bucket_get(&self->index.ext, ext);
+  const char *slash = memchr(info->mime.str, '/', info->mime.size);
+  if (slash && slash - info->mime.str < INDEX_KEY_MAX) {
+    char type[INDEX_KEY_MAX];
+    memcpy(type, info->mime.str, slash - info->mime.str);
+    type[slash - info->mime.str] = 0;
+    lists[2] = bucket_get(&self->index.mime, type);
+  }
+
+  isize pos[3] = {0};
+  for (;;) {
+    i32 next = INT32_MAX;
+    int k = -1;
+    for (int j = 0; j < 3; j++) {
+      if (lists[j] && pos[j] < vec_int_size(lists[j]) &&
+          lists[j]->data[pos[j]] < next) {
+        next = lists[j]->data[pos[j]];
+        k = j;
+      }
+    }
+    if (k < 0)
+      break;
+    pos[k]++;
+
+    Rule *r = &self->rules.data[next];
+    if ((!mime_only || r->has_mime) && rule_check(r, info)) {
+      if (!fn(r, arg))
+        return;
+    }
+  }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// Rule engine of rifle, the file opener, see lua/riflelib.c for the bindings.
+// Rules are lines of a rifle.conf, a list of conditions and a command:
+//
+//   ext png|jpe?g, has feh, X, flag f = feh -- "$@"
+//
+// Once all rules are added, `rifle_rules_compile` builds an index so that a
+// query only checks the rules that can possibly match: rules are bucketed by
+// their literal file extensions or the type of an anchored mime pattern
+// (`mime ^video/`); all others are always checked.
+
+#include "defs.h"
+#include "types/vec_int.h"
+
+#include <stc/cstr.h>
+#include <stc/zsview.h>
+
+#include <stdbool.h>
+
+#include <sys/stat.h>
+
+struct Condition;
+struct Rule;
+
+#include <stc/types.h>
+declare_vec(conditions, struct Condition);
+declare_vec(rules, struct Rule);
+declare_hmap(hmap_rule_bucket, cstr, vec_int);
+
+// What rules are matched against. The file is stat'ed on demand, at most once
+// per query.
+typedef struct FileInfo {
+  zsview file; // as passed by the user
+  zsview path; // real path
+  zsview mime;
+  struct stat stat;
+  i8 stat_state; // 0: not yet done, 1: done, -1: failed
+} FileInfo;
+
+typedef bool(check_fn)(struct Condition *, FileInfo *);
+
+typedef struct Condition {
+  bool negate;
+  i8 has_result; // memoized result of `has`, -1 if unknown
+  cstr arg;
+  struct pcre2_real_code_8 *re;
+  check_fn *check;
+} Condition;
+
+typedef struct Rule {
+  conditions conditions;
+  cstr command;
+  cstr label;
+  int number;
+  bool has_mime;
+  bool flag_fork;
+  bool flag_term;
+  bool flag_esc;
+  bool flag_lfm;
+} Rule;
+
+typedef struct RifleRules {
+  rules rules;
+  struct {
+    hmap_rule_bucket ext;  // extension -> indices of rules
+    hmap_rule_bucket mime; // type of the mime, e.g. "video" -> indices
+    vec_int rest;          // indices of rules that are always checked
+    bool valid;            // rules haven't changed since compiling
+  } index;
+} RifleRules;
+
+void rifle_rules_drop(RifleRules *self);
+
+void rifle_rules_clear(RifleRules *self);
+
+static inline isize rifle_rules_size(const RifleRules *self) {
+  return self->rules.size;
+}
+
+// Parses a line "conditions = command" of a rifle.conf and appends the rule.
+// Returns false if the line is malformed. Invalidates the index.
+bool rifle_rules_add(RifleRules *self, const char *line);
+
+// Builds the index of the rules.
+void rifle_rules_compile(RifleRules *self);
+
+// Called for every matching rule, in order. Return false to stop.
+typedef bool (*rifle_match_fn)(const Rule *rule, void *arg);
+
+// Calls `fn` for the rules matching `info`, considering only rules with a mime
+// condition if `mime_only` is set. Uses the index if it is valid, otherwise
+// checks every rule.
+void rifle_rules_match(RifleRules *self, FileInfo *info, bool mime_only,
+                       rifle_match_fn fn, void *arg);
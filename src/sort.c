@@ -1,8 +1,11 @@
 #include "sort.h"
 
 #include "file.h"
-#include "strnatcmp.h"
+#include "memory.h"
 
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
 #include <strings.h>
 
 const char *sorttype_str[NUM_SORTTYPE] = {
@@ -27,52 +30,95 @@ i64 compare_size(const void *a, const void *b) {
   i64 cmp = file_size(aa) - file_size(bb);
   if (cmp)
     return cmp;
-  return aa->lstat.st_ino - bb->lstat.st_ino;
+  return (i64)(aa->lstat.ino - bb->lstat.ino);
 }
 
 i64 compare_natural(const void *a, const void *b) {
   const File *aa = *(File **)a;
   const File *bb = *(File **)b;
-  i64 cmp = strnatcasecmp(file_name_str(aa), file_name_str(bb));
+  i64 cmp = strcmp(aa->natkey, bb->natkey);
   if (cmp)
     return cmp;
-  return aa->lstat.st_ino - bb->lstat.st_ino;
+  return (i64)(aa->lstat.ino - bb->lstat.ino);
+}
+
+// Runs of digits are encoded as DIGIT_RUN (so that they compare against other
+// characters like their first digit would), followed by either FRACTION or the
+// length of the run + 1, followed by the digits. Fractions are terminated by
+// FRACTION, which sorts them before any longer fraction they are a prefix of.
+#define DIGIT_RUN '0'
+#define FRACTION '\x01'
+
+static inline bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+usize natural_sort_key(const char *name, char *buf) {
+  usize j = 0;
+  for (const char *s = name; *s;) {
+    if (isspace((unsigned char)*s)) {
+      s++;
+    } else if (!is_digit(*s)) {
+      if (buf)
+        buf[j] = toupper((unsigned char)*s);
+      j++;
+      s++;
+    } else {
+      const char *end = s + 1;
+      while (is_digit(*end))
+        end++;
+      usize len = end - s;
+      bool fraction = *s == '0';
+      if (buf) {
+        buf[j] = DIGIT_RUN;
+        buf[j + 1] = fraction ? FRACTION : (char)(len < 255 ? len + 1 : 255);
+        memcpy(buf + j + 2, s, len);
+        if (fraction)
+          buf[j + 2 + len] = FRACTION;
+      }
+      j += 2 + len + fraction;
+      s = end;
+    }
+  }
+  if (buf)
+    buf[j] = 0;
+  return j;
 }
 
 i64 compare_ctime(const void *a, const void *b) {
   const File *aa = *(File **)a;
   const File *bb = *(File **)b;
-  i64 cmp = aa->lstat.st_ctim.tv_sec - bb->lstat.st_ctim.tv_sec;
+  i64 cmp = aa->lstat.ctime - bb->lstat.ctime;
   if (cmp)
     return cmp;
-  cmp = aa->lstat.st_ctim.tv_nsec - bb->lstat.st_ctim.tv_nsec;
+  cmp = (i64)aa->lstat.ctime_nsec - bb->lstat.ctime_nsec;
   if (cmp)
     return cmp;
-  return aa->lstat.st_ino - bb->lstat.st_ino;
+  return (i64)(aa->lstat.ino - bb->lstat.ino);
 }
 
 i64 compare_atime(const void *a, const void *b) {
   const File *aa = *(File **)a;
   const File *bb = *(File **)b;
-  i64 cmp = aa->lstat.st_atim.tv_sec - bb->lstat.st_atim.tv_sec;
+  i64 cmp = aa->lstat.atime - bb->lstat.atime;
   if (cmp)
     return cmp;
-  cmp = aa->lstat.st_atim.tv_nsec - bb->lstat.st_atim.tv_nsec;
+  cmp = (i64)aa->lstat.atime_nsec - bb->lstat.atime_nsec;
   if (cmp)
     return cmp;
-  return aa->lstat.st_ino - bb->lstat.st_ino;
+  return (i64)(aa->lstat.ino - bb->lstat.ino);
 }
 
 i64 compare_mtime(const void *a, const void *b) {
   const File *aa = *(File **)a;
   const File *bb = *(File **)b;
-  i64 cmp = aa->lstat.st_mtim.tv_sec - bb->lstat.st_mtim.tv_sec;
+  i64 cmp = aa->lstat.mtime - bb->lstat.mtime;
   if (cmp)
     return cmp;
-  cmp = aa->lstat.st_mtim.tv_nsec - bb->lstat.st_mtim.tv_nsec;
+  cmp = (i64)aa->lstat.mtime_nsec - bb->lstat.mtime_nsec;
   if (cmp)
     return cmp;
-  return aa->lstat.st_ino - bb->lstat.st_ino;
+  return (i64)(aa->lstat.ino - bb->lstat.ino);
 }
 
 i64 compare_key(const void *a, const void *b) {
@@ -81,5 +127,103 @@ i64 compare_key(const void *a, const void *b) {
   i64 cmp = aa->key - bb->key;
   if (cmp)
     return cmp;
-  return aa->lstat.st_ino - bb->lstat.st_ino;
+  return (i64)(aa->lstat.ino - bb->lstat.ino);
+}
+
+// Below this size the radix sort isn't worth clearing its histograms.
+#define RADIX_SORT_MIN 256
+
+struct sort_item {
+  u64 key;
+  u64 ino; // tie breaker, like in the comparators
+  File *file;
+};
+
+// maps signed integers to unsigned ones, keeping the order
+static inline u64 signed_key(i64 v) {
+  return (u64)v ^ (1ull << 63);
+}
+
+// nanoseconds since the epoch, absurd timestamps are clamped to avoid overflow
+static inline u64 time_key(i64 sec, u32 nsec) {
+  const i64 max_sec = INT64_MAX / 1000000000 - 1;
+  sec = sec > max_sec ? max_sec : sec < -max_sec ? -max_sec : sec;
+  return signed_key(sec * 1000000000 + nsec);
+}
+
+static inline u64 sort_key(const File *file, sorttype type) {
+  switch (type) {
+  case SORT_SIZE:
+    return signed_key(file_size(file));
+  case SORT_CTIME:
+    return time_key(file->lstat.ctime, file->lstat.ctime_nsec);
+  case SORT_ATIME:
+    return time_key(file->lstat.atime, file->lstat.atime_nsec);
+  case SORT_MTIME:
+    return time_key(file->lstat.mtime, file->lstat.mtime_nsec);
+  default:
+    return signed_key(file->key);
+  }
+}
+
+static inline u8 digit(const struct sort_item *item, u32 d) {
+  // digits 0-7 are the inode, 8-15 the key, least significant first
+  return d < 8 ? item->ino >> (8 * d) : item->key >> (8 * (d - 8));
+}
+
+// LSD radix sort by (key, ino). Digits that are the same for all items,
+// e.g. the high bytes of timestamps, are skipped. Returns either `a` or `tmp`,
+// whichever holds the result.
+static struct sort_item *radix_sort(struct sort_item *a, struct sort_item *tmp,
+                                    usize n) {
+  static _Thread_local usize counts[16][256];
+  memset(counts, 0, sizeof counts);
+  for (usize i = 0; i < n; i++) {
+    for (u32 d = 0; d < 16; d++) {
+      counts[d][digit(&a[i], d)]++;
+    }
+  }
+
+  for (u32 d = 0; d < 16; d++) {
+    usize *count = counts[d];
+    if (count[digit(&a[0], d)] == n)
+      continue;
+
+    usize sum = 0;
+    for (u32 i = 0; i < 256; i++) {
+      usize c = count[i];
+      count[i] = sum;
+      sum += c;
+    }
+    for (usize i = 0; i < n; i++) {
+      tmp[count[digit(&a[i], d)]++] = a[i];
+    }
+    struct sort_item *t = a;
+    a = tmp;
+    tmp = t;
+  }
+  return a;
+}
+
+bool files_radix_sort(File **files, usize n, sorttype type) {
+  if (n < RADIX_SORT_MIN)
+    return false;
+
+  struct sort_item *items = xmalloc(2 * n * sizeof *items);
+  if (unlikely(items == NULL))
+    return false;
+
+  for (usize i = 0; i < n; i++) {
+    items[i].key = sort_key(files[i], type);
+    items[i].ino = files[i]->lstat.ino;
+    items[i].file = files[i];
+  }
+
+  struct sort_item *sorted = radix_sort(items, items + n, n);
+  for (usize i = 0; i < n; i++) {
+    files[i] = sorted[i].file;
+  }
+
+  xfree(items);
+  return true;
 }
@@ -2,8 +2,11 @@
 
 #include "dir_settings.h" // sorttype enum and sorttype_str
 
+#include <stdbool.h>
 #include <stddef.h>
 
+typedef struct File File;
+
 i64 compare_name(const void *a, const void *b);
 
 i64 compare_size(const void *a, const void *b);
@@ -17,3 +20,19 @@ i64 compare_atime(const void *a, const void *b);
 i64 compare_mtime(const void *a, const void *b);
 
 i64 compare_key(const void *a, const void *b);
+
+// Writes the natural sort key of `name` to `buf` and returns its length
+// (without the terminating NUL). With `buf == NULL` only the length is
+// computed. Comparing keys with strcmp orders names like strnatcasecmp
+// does: whitespace is skipped, letters are folded to upper case, runs of
+// digits are prefixed with their length so that longer numbers sort after
+// shorter ones, and runs with a leading zero are compared left aligned, like
+// decimal fractions. The key is at most three times as long as `name`.
+usize natural_sort_key(const char *name, char *buf);
+
+// Sorts `files` by the numeric key of `type` (size, ctime, atime, mtime or the
+// lua/random key), ties are broken by inode like in the comparators. Dense
+// (key, inode) pairs are extracted and sorted with an LSD radix sort, then
+// `files` is permuted once. Returns false without sorting if `files` is too
+// small to benefit, the caller should fall back to a comparison sort.
+bool files_radix_sort(File **files, usize n, sorttype type);
@@ -8,6 +8,7 @@
 #include "lfm.h"
 #include "macro.h"
 #include "ui.h"
+#include "util.h"
 
 #include <curses.h>
 
@@ -40,7 +41,7 @@ void statusline_draw(Ui *ui) {
         char buf[512];
         buf[0] = 0;
         if (file_islink(file)) {
-          const char *link_target = cstr_str(file_link_target(file));
+          const char *link_target = file_link_target(file).str;
           if (cfg.linkchars_len > 0) {
             snprintf(buf, sizeof buf - 1, " %s %s", cfg.linkchars, link_target);
           } else {
@@ -106,6 +107,24 @@ void statusline_draw(Ui *ui) {
       ncplane_set_fg_default(n);
       ncplane_putchar(n, ' ');
     }
+    struct transfer_progress progress;
+    if (async_transfer_progress(&to_lfm(ui)->async, &progress)) {
+      char buf[128];
+      char bytes[32];
+      // e.g. " copying 2 files: 108 done, 1.2M "
+      i32 len = snprintf(buf, sizeof buf, " %s %u file%s: %llu done, %s ",
+                         progress.move ? "moving" : "copying", progress.files,
+                         progress.files == 1 ? "" : "s",
+                         (unsigned long long)progress.entries_done,
+                         readable_filesize(progress.bytes_done, bytes));
+      rhs_sz += len + 1;
+      ncplane_set_bg_palindex(n, 237);
+      ncplane_set_fg_palindex(n, 255);
+      ncplane_putstr_yx(n, 0, ui->x - rhs_sz, buf);
+      ncplane_set_bg_default(n);
+      ncplane_set_fg_default(n);
+      ncplane_putchar(n, ' ');
+    }
     if (macro_recording) {
       char buf[256];
       snprintf(buf, sizeof buf, "recording @%s",
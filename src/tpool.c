@@ -22,157 +22,451 @@
 
 #include "tpool.h"
 
+#include "dirio.h"
 #include "lua/thread.h"
 #include "memory.h"
 
 #include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+
+// Capacity of the deque of each worker (a power of two), jobs that don't fit
+// go to the queue of the foreground lane.
+#define DEQUE_SIZE 256
+
+// Chase-Lev deque, see "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (Lê et al., 2013). Only the owning worker pushes and takes at the
+// bottom, any thread steals from the top. Only holds foreground jobs.
+struct deque {
+  alignas(64) atomic_llong top;
+  alignas(64) atomic_llong bottom;
+  _Atomic(struct tpool_job *) buf[DEQUE_SIZE];
+};
 
-struct tpool_work {
-  thread_func_t func;
-  void *arg;
-  struct tpool_work *next;
+struct worker {
+  tpool_t *tm;
+  struct deque deque;
+  atomic_bool active; // a thread owns this worker
+  u64 rng;            // to pick victims
+};
+
+// Queued jobs of a lane that are not on a deque, e.g. submitted from outside
+// the pool.
+struct lane {
+  pthread_mutex_t mutex;
+  struct tpool_job *first;
+  struct tpool_job *last;
+  atomic_size_t queued;
+  atomic_size_t running; // not counted for the foreground
 };
-typedef struct tpool_work tpool_work_t;
 
 struct tpool {
-  tpool_work_t *work_first;
-  tpool_work_t *work_last;
+  struct lane lanes[TPOOL_NUM_LANES];
+  atomic_size_t background_running; // jobs running outside the foreground
+
+  // protects sleeping workers, thread_cnt and waiting for completion
   pthread_mutex_t work_mutex;
   pthread_cond_t work_cond;
   pthread_cond_t working_cond;
-  usize working_cnt;
-  usize thread_cnt;
-  usize kill_cnt;
-  bool stop;
+  atomic_size_t sleeping_cnt;
+  atomic_size_t pending_cnt; // queued or running jobs
+  atomic_size_t thread_cnt;
+  atomic_size_t kill_cnt;
+  atomic_bool stop;
+
+  // never freed before the pool so that thieves can always access them
+  _Atomic(struct worker *) workers[TPOOL_MAX_THREADS];
+  atomic_size_t num_workers; // slots in use, including inactive workers
 };
 
-static tpool_work_t *tpool_work_create(thread_func_t func, void *arg) {
-  tpool_work_t *work;
+// job node allocated by tpool_add_work
+struct owned_job {
+  struct tpool_job job;
+  thread_func_t func;
+  void *arg;
+};
 
-  if (func == NULL)
-    return NULL;
+static _Thread_local struct worker *current_worker = NULL;
 
-  work = xmalloc(sizeof *work);
-  work->func = func;
-  work->arg = arg;
-  work->next = NULL;
-  return work;
+static bool deque_push(struct deque *q, struct tpool_job *job) {
+  long long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  long long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  if (b - t >= DEQUE_SIZE)
+    return false;
+  atomic_store_explicit(&q->buf[b & (DEQUE_SIZE - 1)], job,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  return true;
 }
 
-static void tpool_work_destroy(tpool_work_t *work) {
-  if (work == NULL)
-    return;
-  xfree(work);
+static struct tpool_job *deque_take(struct deque *q) {
+  long long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+  struct tpool_job *job = NULL;
+  if (t <= b) {
+    job = atomic_load_explicit(&q->buf[b & (DEQUE_SIZE - 1)],
+                               memory_order_relaxed);
+    if (t == b) {
+      // last job, race against thieves
+      if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                   memory_order_seq_cst,
+                                                   memory_order_relaxed))
+        job = NULL;
+      atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+  } else {
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  }
+  return job;
 }
 
-static tpool_work_t *tpool_work_get(tpool_t *tm) {
-  tpool_work_t *work;
-
-  if (tm == NULL)
+// Returns NULL if the deque is empty or we lost a race, `*retry` is set in the
+// latter case.
+static struct tpool_job *deque_steal(struct deque *q, bool *retry) {
+  long long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+  if (t >= b)
     return NULL;
-
-  work = tm->work_first;
-  if (work == NULL)
+  struct tpool_job *job =
+      atomic_load_explicit(&q->buf[t & (DEQUE_SIZE - 1)], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(
+          &q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+    *retry = true;
     return NULL;
+  }
+  return job;
+}
+
+static inline bool deque_is_empty(struct deque *q) {
+  long long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  long long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+  return t >= b;
+}
 
-  if (work->next == NULL) {
-    tm->work_first = NULL;
-    tm->work_last = NULL;
+static void lane_push(tpool_t *tm, struct tpool_job *job) {
+  struct lane *lane = &tm->lanes[job->lane];
+  pthread_mutex_lock(&lane->mutex);
+  job->next = NULL;
+  if (lane->first == NULL) {
+    lane->first = job;
+    lane->last = job;
+  } else if (job->lane <= TPOOL_PREVIEW) {
+    job->next = lane->first;
+    lane->first = job;
   } else {
-    tm->work_first = work->next;
+    lane->last->next = job;
+    lane->last = job;
+  }
+  atomic_fetch_add_explicit(&lane->queued, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&lane->mutex);
+}
+
+static struct tpool_job *lane_pop(struct lane *lane) {
+  // don't bother locking if there is nothing to take
+  if (atomic_load_explicit(&lane->queued, memory_order_relaxed) == 0)
+    return NULL;
+
+  pthread_mutex_lock(&lane->mutex);
+  struct tpool_job *job = lane->first;
+  if (job) {
+    lane->first = job->next;
+    if (lane->first == NULL)
+      lane->last = NULL;
+    atomic_fetch_sub_explicit(&lane->queued, 1, memory_order_relaxed);
   }
+  pthread_mutex_unlock(&lane->mutex);
+  return job;
+}
 
-  return work;
+// Number of workers that may run jobs outside of the foreground lane. One is
+// always kept free for the foreground.
+static inline usize background_limit(const tpool_t *tm) {
+  usize n = atomic_load_explicit(&tm->thread_cnt, memory_order_relaxed);
+  return n > 1 ? n - 1 : 1;
 }
 
-static void *tpool_worker(void *arg) {
-  tpool_t *tm = arg;
-  tpool_work_t *work;
+// Number of workers that may run jobs of `lane` at once.
+static inline usize lane_limit(const tpool_t *tm, enum tpool_lane lane) {
+  usize n = background_limit(tm);
+  switch (lane) {
+  case TPOOL_BACKGROUND:
+    return n > 1 ? n / 2 : 1;
+  case TPOOL_PROBE:
+  case TPOOL_TRANSFER:
+  case TPOOL_LUA:
+    return n > 3 ? n / 4 : 1;
+  default:
+    return n;
+  }
+}
 
-  while (1) {
-    pthread_mutex_lock(&(tm->work_mutex));
+static inline bool lane_has_capacity(tpool_t *tm, enum tpool_lane lane) {
+  return atomic_load(&tm->lanes[lane].running) < lane_limit(tm, lane) &&
+         atomic_load(&tm->background_running) < background_limit(tm);
+}
 
-    while (tm->work_first == NULL && !tm->stop && tm->kill_cnt == 0)
-      pthread_cond_wait(&(tm->work_cond), &(tm->work_mutex));
+// Reserves a worker for a job of the non-foreground `lane`.
+static bool lane_acquire(tpool_t *tm, enum tpool_lane lane) {
+  struct lane *l = &tm->lanes[lane];
+  if (atomic_fetch_add(&l->running, 1) >= lane_limit(tm, lane)) {
+    atomic_fetch_sub(&l->running, 1);
+    return false;
+  }
+  if (atomic_fetch_add(&tm->background_running, 1) >= background_limit(tm)) {
+    atomic_fetch_sub(&tm->background_running, 1);
+    atomic_fetch_sub(&l->running, 1);
+    return false;
+  }
+  return true;
+}
 
-    if (tm->stop)
-      break;
+static void lane_release(tpool_t *tm, enum tpool_lane lane) {
+  atomic_fetch_sub(&tm->background_running, 1);
+  atomic_fetch_sub(&tm->lanes[lane].running, 1);
+}
 
-    if (tm->kill_cnt) {
-      tm->kill_cnt--;
-      break;
+static inline u64 next_rng(struct worker *w) {
+  w->rng ^= w->rng << 13;
+  w->rng ^= w->rng >> 7;
+  w->rng ^= w->rng << 17;
+  return w->rng;
+}
+
+// Tries every other worker, starting at a random one.
+static struct tpool_job *steal(tpool_t *tm, struct worker *self) {
+  usize n = atomic_load_explicit(&tm->num_workers, memory_order_acquire);
+  if (n <= 1)
+    return NULL;
+  bool retry;
+  do {
+    retry = false;
+    usize start = next_rng(self) % n;
+    for (usize i = 0; i < n; i++) {
+      struct worker *w = atomic_load_explicit(&tm->workers[(start + i) % n],
+                                              memory_order_acquire);
+      if (w == NULL || w == self)
+        continue;
+      struct tpool_job *job = deque_steal(&w->deque, &retry);
+      if (job)
+        return job;
     }
+  } while (retry);
+  return NULL;
+}
 
-    work = tpool_work_get(tm);
-    tm->working_cnt++;
-    pthread_mutex_unlock(&(tm->work_mutex));
+static struct tpool_job *find_job(tpool_t *tm, struct worker *self) {
+  struct tpool_job *job = deque_take(&self->deque);
+  if (job)
+    return job;
+  job = lane_pop(&tm->lanes[TPOOL_FOREGROUND]);
+  if (job)
+    return job;
+  job = steal(tm, self);
+  if (job)
+    return job;
+  for (u32 lane = TPOOL_FOREGROUND + 1; lane < TPOOL_NUM_LANES; lane++) {
+    if (atomic_load_explicit(&tm->lanes[lane].queued, memory_order_relaxed) ==
+            0 ||
+        !lane_acquire(tm, lane))
+      continue;
+    job = lane_pop(&tm->lanes[lane]);
+    if (job)
+      return job;
+    lane_release(tm, lane);
+  }
+  return NULL;
+}
+
+// Is there a job that an idle worker could run?
+static bool has_work(tpool_t *tm) {
+  if (atomic_load(&tm->lanes[TPOOL_FOREGROUND].queued) > 0)
+    return true;
+  usize n = atomic_load_explicit(&tm->num_workers, memory_order_acquire);
+  for (usize i = 0; i < n; i++) {
+    struct worker *w =
+        atomic_load_explicit(&tm->workers[i], memory_order_acquire);
+    if (w && !deque_is_empty(&w->deque))
+      return true;
+  }
+  for (u32 lane = TPOOL_FOREGROUND + 1; lane < TPOOL_NUM_LANES; lane++) {
+    if (atomic_load(&tm->lanes[lane].queued) > 0 &&
+        lane_has_capacity(tm, lane))
+      return true;
+  }
+  return false;
+}
 
-    if (work != NULL) {
-      work->func(work->arg);
-      tpool_work_destroy(work);
+// Wakes a single sleeping worker, if any.
+static void wake_one(tpool_t *tm) {
+  // pairs with the fence in tpool_worker: either we see the sleeping worker,
+  // or it sees the job we just queued
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&tm->sleeping_cnt, memory_order_relaxed) == 0)
+    return;
+  pthread_mutex_lock(&tm->work_mutex);
+  pthread_cond_signal(&tm->work_cond);
+  pthread_mutex_unlock(&tm->work_mutex);
+}
+
+static void run_job(tpool_t *tm, struct tpool_job *job) {
+  // the job might be freed by func
+  enum tpool_lane lane = job->lane;
+  job->func(job->arg);
+  if (lane != TPOOL_FOREGROUND)
+    lane_release(tm, lane);
+
+  if (atomic_fetch_sub(&tm->pending_cnt, 1) == 1) {
+    pthread_mutex_lock(&tm->work_mutex);
+    pthread_cond_broadcast(&tm->working_cond);
+    pthread_mutex_unlock(&tm->work_mutex);
+  }
+}
+
+static bool should_exit(tpool_t *tm) {
+  usize kill = atomic_load(&tm->kill_cnt);
+  while (kill > 0) {
+    if (atomic_compare_exchange_weak(&tm->kill_cnt, &kill, kill - 1))
+      return true;
+  }
+  return false;
+}
+
+static void *tpool_worker(void *arg) {
+  struct worker *w = arg;
+  tpool_t *tm = w->tm;
+  current_worker = w;
+
+  while (!atomic_load(&tm->stop)) {
+    if (should_exit(tm)) {
+      // leave our jobs to the others
+      struct tpool_job *job;
+      while ((job = deque_take(&w->deque)))
+        lane_push(tm, job);
+      if (atomic_load(&tm->lanes[TPOOL_FOREGROUND].queued) > 0)
+        wake_one(tm);
+      break;
     }
 
-    pthread_mutex_lock(&(tm->work_mutex));
-    tm->working_cnt--;
-    if (!tm->stop && tm->working_cnt == 0 && tm->work_first == NULL)
-      pthread_cond_signal(&(tm->working_cond));
-    pthread_mutex_unlock(&(tm->work_mutex));
+    struct tpool_job *job = find_job(tm, w);
+    if (job) {
+      run_job(tm, job);
+      continue;
+    }
+
+    pthread_mutex_lock(&tm->work_mutex);
+    atomic_fetch_add(&tm->sleeping_cnt, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!atomic_load(&tm->stop) && atomic_load(&tm->kill_cnt) == 0 &&
+           !has_work(tm))
+      pthread_cond_wait(&tm->work_cond, &tm->work_mutex);
+    atomic_fetch_sub(&tm->sleeping_cnt, 1);
+    pthread_mutex_unlock(&tm->work_mutex);
   }
 
+  current_worker = NULL;
+  atomic_store(&w->active, false);
+
+  pthread_mutex_lock(&tm->work_mutex);
   tm->thread_cnt--;
-  pthread_cond_signal(&(tm->working_cond));
-  pthread_mutex_unlock(&(tm->work_mutex));
+  pthread_cond_broadcast(&tm->working_cond);
+  pthread_mutex_unlock(&tm->work_mutex);
 
   L_thread_destroy();
+  dirio_thread_destroy();
   return NULL;
 }
 
+// Starts a thread, reusing the worker of a thread that exited. Called with
+// `work_mutex` held.
+static bool start_thread(tpool_t *tm) {
+  usize n = atomic_load(&tm->num_workers);
+  struct worker *w = NULL;
+  for (usize i = 0; i < n; i++) {
+    struct worker *v = atomic_load(&tm->workers[i]);
+    if (!atomic_load(&v->active)) {
+      w = v;
+      break;
+    }
+  }
+  if (w == NULL) {
+    if (n == TPOOL_MAX_THREADS)
+      return false;
+    w = xcalloc(1, sizeof *w);
+    w->tm = tm;
+    w->rng = 0x9e3779b97f4a7c15u * (n + 1);
+    atomic_store(&tm->workers[n], w);
+    atomic_store(&tm->num_workers, n + 1);
+  }
+  atomic_store(&w->active, true);
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, tpool_worker, w) != 0) {
+    atomic_store(&w->active, false);
+    return false;
+  }
+  pthread_detach(thread);
+  tm->thread_cnt++;
+  return true;
+}
+
 tpool_t *tpool_create(usize num) {
   tpool_t *tm;
-  pthread_t thread;
   usize i;
 
   if (num == 0)
     num = 2;
+  if (num > TPOOL_MAX_THREADS)
+    num = TPOOL_MAX_THREADS;
 
   tm = xcalloc(1, sizeof *tm);
-  tm->thread_cnt = num;
 
+  for (usize i = 0; i < TPOOL_NUM_LANES; i++)
+    pthread_mutex_init(&(tm->lanes[i].mutex), NULL);
   pthread_mutex_init(&(tm->work_mutex), NULL);
   pthread_cond_init(&(tm->work_cond), NULL);
   pthread_cond_init(&(tm->working_cond), NULL);
 
-  tm->work_first = NULL;
-  tm->work_last = NULL;
-
-  for (i = 0; i < num; i++) {
-    pthread_create(&thread, NULL, tpool_worker, tm);
-    pthread_detach(thread);
-  }
+  pthread_mutex_lock(&(tm->work_mutex));
+  for (i = 0; i < num; i++)
+    start_thread(tm);
+  pthread_mutex_unlock(&(tm->work_mutex));
 
   return tm;
 }
 
-void tpool_destroy(tpool_t *tm) {
-  tpool_work_t *work;
-  tpool_work_t *work2;
+static void drop_job(struct tpool_job *job);
 
+void tpool_destroy(tpool_t *tm) {
   if (tm == NULL)
     return;
 
+  atomic_store(&tm->stop, true);
   pthread_mutex_lock(&(tm->work_mutex));
-  work = tm->work_first;
-  while (work != NULL) {
-    work2 = work->next;
-    tpool_work_destroy(work);
-    work = work2;
-  }
-  tm->stop = true;
   pthread_cond_broadcast(&(tm->work_cond));
   pthread_mutex_unlock(&(tm->work_mutex));
 
   tpool_wait(tm);
 
+  // jobs that didn't run
+  struct tpool_job *job;
+  for (usize i = 0; i < TPOOL_NUM_LANES; i++) {
+    while ((job = lane_pop(&tm->lanes[i])))
+      drop_job(job);
+  }
+  usize n = atomic_load(&tm->num_workers);
+  for (usize i = 0; i < n; i++) {
+    struct worker *w = atomic_load(&tm->workers[i]);
+    while ((job = deque_take(&w->deque)))
+      drop_job(job);
+    xfree(w);
+  }
+
+  for (usize i = 0; i < TPOOL_NUM_LANES; i++)
+    pthread_mutex_destroy(&(tm->lanes[i].mutex));
   pthread_mutex_destroy(&(tm->work_mutex));
   pthread_cond_destroy(&(tm->work_cond));
   pthread_cond_destroy(&(tm->working_cond));
@@ -180,30 +474,48 @@ void tpool_destroy(tpool_t *tm) {
   xfree(tm);
 }
 
-bool tpool_add_work(tpool_t *tm, thread_func_t func, void *arg, bool priority) {
-  tpool_work_t *work;
+static void run_owned_job(void *arg) {
+  struct owned_job *owned = arg;
+  thread_func_t func = owned->func;
+  arg = owned->arg;
+  xfree(owned);
+  func(arg);
+}
 
-  if (tm == NULL)
+static void drop_job(struct tpool_job *job) {
+  if (job->func == run_owned_job)
+    xfree(job->arg);
+}
+
+bool tpool_add_work(tpool_t *tm, thread_func_t func, void *arg,
+                    enum tpool_lane lane) {
+  if (tm == NULL || func == NULL)
     return false;
 
-  work = tpool_work_create(func, arg);
-  if (work == NULL)
+  struct owned_job *owned = xmalloc(sizeof *owned);
+  if (owned == NULL)
     return false;
+  owned->func = func;
+  owned->arg = arg;
+  return tpool_add_job(tm, &owned->job, run_owned_job, owned, lane);
+}
 
-  pthread_mutex_lock(&(tm->work_mutex));
-  if (tm->work_first == NULL) {
-    tm->work_first = work;
-    tm->work_last = tm->work_first;
-  } else if (priority) {
-    work->next = tm->work_first;
-    tm->work_first = work;
-  } else {
-    tm->work_last->next = work;
-    tm->work_last = work;
-  }
+bool tpool_add_job(tpool_t *tm, struct tpool_job *job, thread_func_t func,
+                   void *arg, enum tpool_lane lane) {
+  if (tm == NULL || func == NULL || lane >= TPOOL_NUM_LANES)
+    return false;
 
-  pthread_cond_broadcast(&(tm->work_cond));
-  pthread_mutex_unlock(&(tm->work_mutex));
+  job->func = func;
+  job->arg = arg;
+  job->next = NULL;
+  job->lane = lane;
+
+  atomic_fetch_add(&tm->pending_cnt, 1);
+  struct worker *w = current_worker;
+  if (!(lane == TPOOL_FOREGROUND && w && w->tm == tm &&
+        deque_push(&w->deque, job)))
+    lane_push(tm, job);
+  wake_one(tm);
 
   return true;
 }
@@ -214,8 +526,9 @@ void tpool_wait(tpool_t *tm) {
 
   pthread_mutex_lock(&(tm->work_mutex));
   while (1) {
-    if ((!tm->stop && tm->working_cnt != 0) ||
-        (tm->stop && tm->thread_cnt != 0)) {
+    bool stop = atomic_load(&tm->stop);
+    if ((!stop && atomic_load(&tm->pending_cnt) != 0) ||
+        (stop && tm->thread_cnt != 0)) {
       pthread_cond_wait(&(tm->working_cond), &(tm->work_mutex));
     } else {
       break;
@@ -231,6 +544,13 @@ usize tpool_size(const tpool_t *tm) {
   return tm->thread_cnt;
 }
 
+usize tpool_lane_limit(const tpool_t *tm, enum tpool_lane lane) {
+  if (tm == NULL)
+    return 0;
+
+  return lane == TPOOL_FOREGROUND ? tm->thread_cnt : lane_limit(tm, lane);
+}
+
 void tpool_resize(tpool_t *tm, usize num) {
   if (tm == NULL)
     return;
@@ -238,18 +558,18 @@ void tpool_resize(tpool_t *tm, usize num) {
   if (num == 0) {
     num = 2;
   }
+  if (num > TPOOL_MAX_THREADS)
+    num = TPOOL_MAX_THREADS;
 
   pthread_mutex_lock(&(tm->work_mutex));
-  if (num >= tm->thread_cnt) {
-    pthread_t thread;
-    for (; tm->thread_cnt < num; tm->thread_cnt++) {
-      pthread_create(&thread, NULL, tpool_worker, tm);
-      pthread_detach(thread);
-    }
-    tm->thread_cnt = num;
-    tm->kill_cnt = 0;
+  // threads that are about to exit are still counted
+  usize alive = tm->thread_cnt - atomic_load(&tm->kill_cnt);
+  if (num >= alive) {
+    atomic_store(&tm->kill_cnt, 0);
+    for (usize i = tm->thread_cnt; i < num; i++)
+      start_thread(tm);
   } else {
-    tm->kill_cnt = tm->thread_cnt - num;
+    atomic_store(&tm->kill_cnt, tm->thread_cnt - num);
   }
   pthread_cond_broadcast(&(tm->work_cond));
   pthread_mutex_unlock(&(tm->work_mutex));
@@ -27,19 +27,63 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+// Work is queued on the deque of the worker that submits it, or, if
+// submitted from outside the pool, on a shared injection queue. Idle workers
+// steal from the other deques before going to sleep, only one of them is
+// woken per submitted job.
+//
+// Jobs belong to a lane. Workers always look for foreground work first. Other
+// lanes have their own queues, and each may only occupy part of the workers,
+// so that a flood of slow background jobs can not delay the foreground.
+
 struct tpool;
 typedef struct tpool tpool_t;
 
 typedef void (*thread_func_t)(void *arg);
 
+// Queue node of a job, usually embedded in the struct passed as `arg`. The
+// pool doesn't touch it anymore once `func` is called.
+struct tpool_job {
+  struct tpool_job *next; // used by the pool
+  thread_func_t func;
+  void *arg;
+  u8 lane; // enum tpool_lane
+};
+
+// Lanes, in the order in which workers look for jobs.
+enum tpool_lane {
+  TPOOL_FOREGROUND, // loading the directories that are visible
+  TPOOL_PREVIEW,    // loading and checking previews
+  TPOOL_PROBE,      // quick checks that might block, e.g. on network mounts
+  TPOOL_BACKGROUND, // dircounts, fileinfo, directories that are not visible
+  TPOOL_TRANSFER,   // copying and moving files, long running
+  TPOOL_LUA,        // user lua code
+  TPOOL_NUM_LANES,
+};
+
+// At most this many threads are created.
+#define TPOOL_MAX_THREADS 256
+
 tpool_t *tpool_create(usize num);
 
 void tpool_destroy(tpool_t *tm);
 
-bool tpool_add_work(tpool_t *tm, thread_func_t func, void *arg, bool priority);
+// Runs `func(arg)` on the pool, in `lane`. Within the foreground and preview
+// lanes, the most recent job runs first, the others are first in, first out.
+// Allocates a job node, see `tpool_add_job`.
+bool tpool_add_work(tpool_t *tm, thread_func_t func, void *arg,
+                    enum tpool_lane lane);
+
+// Like `tpool_add_work`, but queues the caller provided `job`, which must not
+// be queued already.
+bool tpool_add_job(tpool_t *tm, struct tpool_job *job, thread_func_t func,
+                   void *arg, enum tpool_lane lane);
 
 void tpool_wait(tpool_t *tm);
 
 usize tpool_size(const tpool_t *tm);
 
+// Number of jobs of `lane` that may run at once. Jobs beyond that are queued.
+usize tpool_lane_limit(const tpool_t *tm, enum tpool_lane lane);
+
 void tpool_resize(tpool_t *tm, usize num);
@@ -0,0 +1,576 @@
+#define _GNU_SOURCE // copy_file_range, renameat2
+#include "transfer.h"
+
+#include "log.h"
+#include "memory.h"
+
+#include <stc/cstr.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <linux/fs.h>
+#include <linux/limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// bytes per copy_file_range call, bounds the latency of cancelling
+#define TRANSFER_CHUNK (8 << 20)
+
+// buffer for the read/write fallback
+#define TRANSFER_BUFSIZE (128 << 10)
+
+// flags of the pasted files, accessed with the mutex held
+#define ITEM_FAILED 1        // don't remove the source
+#define ITEM_REMOVE_SOURCE 2 // moved across filesystems by copying
+
+struct transfer_task {
+  cstr src;
+  cstr dst; // empty for the pasted files, their name is picked on pasting
+  u32 item; // index of the pasted file the task belongs to
+};
+
+// A directory that was created with more permissions than the source, or
+// whose times are restored because it was moved.
+struct transfer_dir {
+  cstr path;
+  mode_t clear; // permissions to take away once it is filled
+  struct timespec times[2]; // atime and mtime of the source
+};
+
+static inline void transfer_task_drop(struct transfer_task *self) {
+  cstr_drop(&self->src);
+  cstr_drop(&self->dst);
+}
+
+static inline void transfer_dir_drop(struct transfer_dir *self) {
+  cstr_drop(&self->path);
+}
+
+#define i_declared
+#define i_type vec_transfer_task
+#define i_key struct transfer_task
+#define i_keydrop transfer_task_drop
+#define i_no_clone
+#include <stc/vec.h>
+
+#define i_declared
+#define i_type vec_transfer_dir
+#define i_key struct transfer_dir
+#define i_keydrop transfer_dir_drop
+#define i_no_clone
+#include <stc/vec.h>
+
+static void finish(struct transfer *t);
+
+void transfer_init(struct transfer *t, vec_cstr files, zsview dest, bool move,
+                   u32 max_workers) {
+  memset(t, 0, sizeof *t);
+  t->files = files;
+  t->dest = cstr_from_zv(dest);
+  t->move = move;
+  t->max_workers = max_workers > 0 ? max_workers : 1;
+  atomic_init(&t->entries_done, 0);
+  atomic_init(&t->bytes_done, 0);
+  pthread_mutex_init(&t->mutex, NULL);
+
+  u32 num = vec_cstr_size(&files);
+  t->item_flags = xcalloc(num > 0 ? num : 1, 1);
+  // the stack is worked on from the back, start with the first file
+  vec_transfer_task_reserve(&t->tasks, num);
+  for (u32 i = num; i > 0; i--) {
+    struct transfer_task task = {
+        .src = cstr_clone(files.data[i - 1]),
+        .item = i - 1,
+    };
+    vec_transfer_task_push(&t->tasks, task);
+  }
+}
+
+void transfer_deinit(struct transfer *t) {
+  vec_cstr_drop(&t->files);
+  cstr_drop(&t->dest);
+  cstr_drop(&t->error);
+  vec_transfer_task_drop(&t->tasks);
+  vec_transfer_dir_drop(&t->dirs);
+  xfree(t->item_flags);
+  pthread_mutex_destroy(&t->mutex);
+}
+
+// Records the error of the pasted file `item`, only the first message is
+// kept. Cancelling is not an error.
+static void fail(struct transfer *t, u32 item, const char *path, int err) {
+  pthread_mutex_lock(&t->mutex);
+  t->item_flags[item] |= ITEM_FAILED;
+  if (err != ECANCELED) {
+    if (t->errors++ == 0) {
+      t->error = cstr_from(path);
+      cstr_append(&t->error, ": ");
+      cstr_append(&t->error, strerror(err));
+    }
+  }
+  pthread_mutex_unlock(&t->mutex);
+}
+
+static inline bool is_cancelled(const struct transfer *t) {
+  return cancel_token_is_cancelled(t->cancel);
+}
+
+static inline void worker_exit(struct transfer *t) {
+  pthread_mutex_lock(&t->mutex);
+  bool last = --t->workers == 0;
+  pthread_mutex_unlock(&t->mutex);
+  if (last)
+    finish(t);
+}
+
+// Spawns workers for pending tasks, at most `max_workers` run at once. The
+// calling worker keeps the count from dropping to zero.
+static void spawn_workers(struct transfer *t) {
+  pthread_mutex_lock(&t->mutex);
+  u32 n = 0;
+  while (t->workers + n < t->max_workers &&
+         n < (u32)vec_transfer_task_size(&t->tasks))
+    n++;
+  t->workers += n;
+  pthread_mutex_unlock(&t->mutex);
+  for (u32 i = 0; i < n; i++) {
+    if (unlikely(!t->spawn(t)))
+      worker_exit(t);
+  }
+}
+
+void transfer_start(struct transfer *t) {
+  pthread_mutex_lock(&t->mutex);
+  u32 n = vec_transfer_task_size(&t->tasks);
+  if (n > t->max_workers)
+    n = t->max_workers;
+  // we hold a count while spawning, `done` is called on this thread if no
+  // worker could be spawned
+  t->workers = n + 1;
+  pthread_mutex_unlock(&t->mutex);
+  for (u32 i = 0; i < n; i++) {
+    if (unlikely(!t->spawn(t)))
+      worker_exit(t);
+  }
+  worker_exit(t);
+}
+
+// Writes the target of the pasted file `name` in `dir` to `buf`, with a
+// backup suffix for `n > 0`.
+static bool target_path(char *buf, usize bufsz, const cstr *dir,
+                        const char *name, u32 n) {
+  const char *sep = cstr_ends_with(dir, "/") ? "" : "/";
+  int len;
+  if (n == 0)
+    len = snprintf(buf, bufsz, "%s%s%s", cstr_str(dir), sep, name);
+  else
+    len = snprintf(buf, bufsz, "%s%s%s.~%u~", cstr_str(dir), sep, name, n);
+  return len > 0 && (usize)len < bufsz;
+}
+
+// Returns true if `path` is `dir` or inside it.
+static inline bool is_within(const char *path, const char *dir) {
+  usize len = strlen(dir);
+  while (len > 1 && dir[len - 1] == '/')
+    len--;
+  return strncmp(path, dir, len) == 0 &&
+         (path[len] == 0 || path[len] == '/' || (len == 1 && dir[0] == '/'));
+}
+
+// Returns true if `path` is directly in `dir`.
+static inline bool is_child(const char *path, const char *dir) {
+  const char *sep = strrchr(path, '/');
+  if (sep == NULL)
+    return false;
+  usize len = strlen(dir);
+  while (len > 1 && dir[len - 1] == '/')
+    len--;
+  usize parent_len = sep == path ? 1 : (usize)(sep - path);
+  return parent_len == len && strncmp(path, dir, len) == 0;
+}
+
+static i32 write_full(int fd, const char *buf, usize len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static i32 copy_data_rw(struct transfer *t, int in, int out) {
+  char *buf = xmalloc(TRANSFER_BUFSIZE);
+  i32 rc = 0;
+  for (;;) {
+    if (unlikely(is_cancelled(t))) {
+      errno = ECANCELED;
+      rc = -1;
+      break;
+    }
+    ssize_t n = read(in, buf, TRANSFER_BUFSIZE);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      rc = -1;
+      break;
+    }
+    if (n == 0)
+      break;
+    if (write_full(out, buf, n) != 0) {
+      rc = -1;
+      break;
+    }
+    atomic_fetch_add_explicit(&t->bytes_done, n, memory_order_relaxed);
+  }
+  xfree(buf);
+  return rc;
+}
+
+// Copies the contents of `in` to the empty file `out`.
+static i32 copy_data(struct transfer *t, int in, int out, off_t size) {
+  // shares the extents, only on the same filesystem, e.g. btrfs or xfs
+  if (size > 0 && ioctl(out, FICLONE, in) == 0) {
+    atomic_fetch_add_explicit(&t->bytes_done, size, memory_order_relaxed);
+    return 0;
+  }
+
+  u64 copied = 0;
+  for (;;) {
+    if (unlikely(is_cancelled(t))) {
+      errno = ECANCELED;
+      return -1;
+    }
+    ssize_t n = copy_file_range(in, NULL, out, NULL, TRANSFER_CHUNK, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      // unsupported for this pair of files
+      if (copied == 0 && (errno == EXDEV || errno == EINVAL ||
+                          errno == ENOSYS || errno == EOPNOTSUPP ||
+                          errno == EBADF || errno == EPERM))
+        return copy_data_rw(t, in, out);
+      return -1;
+    }
+    if (n == 0) {
+      // files in e.g. /proc report a size of 0 but have contents
+      if (copied == 0)
+        return copy_data_rw(t, in, out);
+      return 0;
+    }
+    copied += n;
+    atomic_fetch_add_explicit(&t->bytes_done, n, memory_order_relaxed);
+  }
+}
+
+// Permissions of a copy of `st`. Copies lose setuid, setgid and the sticky
+// bit like with `cp -r`, moves keep them.
+static inline mode_t copy_mode(const struct transfer *t,
+                               const struct stat *st) {
+  return st->st_mode & (t->move ? 07777 : 0777);
+}
+
+// Gives `path` the owner and group of `st` as far as we are permitted to, and
+// returns the permissions it should get. Like `mv`, setuid and setgid are
+// dropped if the owner or group can't be kept.
+static mode_t preserve_owner(const char *path, const struct stat *st) {
+  mode_t mode = st->st_mode & 07777;
+  if (fchownat(AT_FDCWD, path, st->st_uid, st->st_gid, AT_SYMLINK_NOFOLLOW) !=
+      0) {
+    mode &= ~S_ISUID;
+    if (fchownat(AT_FDCWD, path, -1, st->st_gid, AT_SYMLINK_NOFOLLOW) != 0)
+      mode &= ~S_ISGID;
+  }
+  return mode;
+}
+
+// Gives the copy `path` of a moved file the owner, permissions and times of
+// `st`. Errors are ignored, like `mv` does.
+static void preserve_metadata(const char *path, const struct stat *st) {
+  mode_t mode = preserve_owner(path, st);
+  // also after chown, which clears setuid and setgid
+  if (!S_ISLNK(st->st_mode) && chmod(path, mode) != 0)
+    log_debug("chmod: %s: %s", path, strerror(errno));
+  struct timespec times[2] = {st->st_atim, st->st_mtim};
+  if (utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW) != 0)
+    log_debug("utimensat: %s: %s", path, strerror(errno));
+}
+
+static i32 copy_regular(struct transfer *t, const char *src,
+                        const struct stat *st, const char *dst) {
+  int in = open(src, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (in < 0)
+    return -1;
+  int out =
+      open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, copy_mode(t, st));
+  if (out < 0) {
+    int err = errno;
+    close(in);
+    errno = err;
+    return -1;
+  }
+  i32 rc = copy_data(t, in, out, st->st_size);
+  int err = errno;
+  close(in);
+  if (close(out) != 0 && rc == 0) {
+    rc = -1;
+    err = errno;
+  }
+  if (rc != 0) {
+    unlink(dst); // don't leave a partial copy
+    errno = err;
+  } else if (t->move) {
+    preserve_metadata(dst, st);
+  }
+  return rc;
+}
+
+static i32 copy_symlink(const char *src, const char *dst) {
+  char target[PATH_MAX + 1];
+  ssize_t len = readlink(src, target, sizeof target - 1);
+  if (len < 0)
+    return -1;
+  target[len] = 0;
+  return symlink(target, dst);
+}
+
+static inline cstr path_join(const char *dir, const char *name) {
+  cstr path = cstr_with_capacity(strlen(dir) + 1 + strlen(name));
+  cstr_append(&path, dir);
+  cstr_append(&path, "/");
+  cstr_append(&path, name);
+  return path;
+}
+
+static void push_child(vec_transfer_task *tasks, const char *src,
+                       const char *dst, const char *name, u32 item) {
+  struct transfer_task task = {
+      .src = path_join(src, name),
+      .dst = path_join(dst, name),
+      .item = item,
+  };
+  vec_transfer_task_push(tasks, task);
+}
+
+// Creates `dst` and queues the entries of `src`.
+static i32 copy_dir(struct transfer *t, u32 item, const char *src,
+                    const struct stat *st, const char *dst) {
+  // we need to be able to create the entries
+  mode_t mode = copy_mode(t, st);
+  if (mkdir(dst, mode | S_IRWXU) != 0)
+    return -1;
+  if (t->move) {
+    // the times are restored once the directory is filled
+    mode = preserve_owner(dst, st);
+    if (chmod(dst, mode | S_IRWXU) != 0)
+      log_debug("chmod: %s: %s", dst, strerror(errno));
+  }
+  mode_t clear = S_IRWXU & ~mode;
+  if (clear || t->move) {
+    pthread_mutex_lock(&t->mutex);
+    struct transfer_dir dir = {
+        .path = cstr_from(dst),
+        .clear = clear,
+        .times = {st->st_atim, st->st_mtim},
+    };
+    vec_transfer_dir_push(&t->dirs, dir);
+    pthread_mutex_unlock(&t->mutex);
+  }
+
+  DIR *dirp = opendir(src);
+  if (dirp == NULL)
+    return -1;
+  vec_transfer_task children = vec_transfer_task_init();
+  struct dirent *entry;
+  while ((entry = readdir(dirp)) != NULL) {
+    if (entry->d_name[0] == '.' &&
+        (entry->d_name[1] == 0 ||
+         (entry->d_name[1] == '.' && entry->d_name[2] == 0)))
+      continue;
+    push_child(&children, src, dst, entry->d_name, item);
+  }
+  closedir(dirp);
+
+  if (!vec_transfer_task_is_empty(&children)) {
+    pthread_mutex_lock(&t->mutex);
+    c_foreach(it, vec_transfer_task, children) {
+      vec_transfer_task_push(&t->tasks, *it.ref);
+    }
+    pthread_mutex_unlock(&t->mutex);
+    children.size = 0; // moved
+    spawn_workers(t);
+  }
+  vec_transfer_task_drop(&children);
+  return 0;
+}
+
+static i32 copy_entry(struct transfer *t, u32 item, const char *src,
+                      const struct stat *st, const char *dst) {
+  i32 rc;
+  switch (st->st_mode & S_IFMT) {
+  case S_IFDIR:
+    rc = copy_dir(t, item, src, st, dst);
+    break;
+  case S_IFREG:
+    rc = copy_regular(t, src, st, dst);
+    break;
+  case S_IFLNK:
+    rc = copy_symlink(src, dst);
+    if (rc == 0 && t->move)
+      preserve_metadata(dst, st);
+    break;
+  default: // fifos, sockets and devices, like cp -r
+    rc = mknod(dst, (st->st_mode & S_IFMT) | copy_mode(t, st), st->st_rdev);
+    if (rc == 0 && t->move)
+      preserve_metadata(dst, st);
+    break;
+  }
+  if (rc == 0)
+    atomic_fetch_add_explicit(&t->entries_done, 1, memory_order_relaxed);
+  return rc;
+}
+
+// Like rename, but fails with EEXIST instead of replacing `dst`.
+static i32 rename_noreplace(const char *src, const char *dst) {
+  if (renameat2(AT_FDCWD, src, AT_FDCWD, dst, RENAME_NOREPLACE) == 0)
+    return 0;
+  if (errno != EINVAL && errno != ENOSYS)
+    return -1;
+  // the filesystem might not support the flag, e.g. some network filesystems
+  struct stat st;
+  if (lstat(dst, &st) == 0) {
+    errno = EEXIST;
+    return -1;
+  }
+  return rename(src, dst);
+}
+
+static void paste_item(struct transfer *t, const struct transfer_task *task,
+                       const struct stat *st) {
+  const char *src = cstr_str(&task->src);
+  const char *dest = cstr_str(&t->dest);
+  const char *name = strrchr(src, '/');
+  name = name ? name + 1 : src;
+
+  if (t->move && is_child(src, dest)) {
+    // already there
+    atomic_fetch_add_explicit(&t->entries_done, 1, memory_order_relaxed);
+    return;
+  }
+  if (S_ISDIR(st->st_mode) && !t->move && is_within(dest, src)) {
+    fail(t, task->item, src, EINVAL);
+    return;
+  }
+
+  bool try_rename = t->move;
+  char dst[PATH_MAX + 1];
+  for (u32 n = 0;; n++) {
+    if (!target_path(dst, sizeof dst, &t->dest, name, n)) {
+      fail(t, task->item, src, ENAMETOOLONG);
+      return;
+    }
+    if (try_rename) {
+      if (rename_noreplace(src, dst) == 0) {
+        atomic_fetch_add_explicit(&t->entries_done, 1, memory_order_relaxed);
+        return;
+      }
+      if (errno == EEXIST)
+        continue;
+      if (errno != EXDEV) {
+        fail(t, task->item, src, errno);
+        return;
+      }
+      // different filesystem, copy and remove the source once done
+      try_rename = false;
+      pthread_mutex_lock(&t->mutex);
+      t->item_flags[task->item] |= ITEM_REMOVE_SOURCE;
+      pthread_mutex_unlock(&t->mutex);
+    }
+    if (copy_entry(t, task->item, src, st, dst) == 0)
+      return;
+    if (errno != EEXIST) {
+      fail(t, task->item, src, errno);
+      return;
+    }
+  }
+}
+
+static void run_task(struct transfer *t, const struct transfer_task *task) {
+  const char *src = cstr_str(&task->src);
+  struct stat st;
+  if (lstat(src, &st) != 0) {
+    fail(t, task->item, src, errno);
+    return;
+  }
+  if (cstr_is_empty(&task->dst)) {
+    paste_item(t, task, &st);
+  } else if (copy_entry(t, task->item, src, &st, cstr_str(&task->dst)) != 0) {
+    fail(t, task->item, src, errno);
+  }
+}
+
+void transfer_work(struct transfer *t) {
+  pthread_mutex_lock(&t->mutex);
+  for (;;) {
+    if (unlikely(is_cancelled(t)))
+      vec_transfer_task_clear(&t->tasks);
+    if (vec_transfer_task_is_empty(&t->tasks))
+      break;
+    struct transfer_task task = vec_transfer_task_pull(&t->tasks);
+    pthread_mutex_unlock(&t->mutex);
+    run_task(t, &task);
+    transfer_task_drop(&task);
+    pthread_mutex_lock(&t->mutex);
+  }
+  bool last = --t->workers == 0;
+  pthread_mutex_unlock(&t->mutex);
+  if (last)
+    finish(t);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+// Called by the last worker, no other thread touches `t` anymore.
+static void finish(struct transfer *t) {
+  vec_transfer_task_clear(&t->tasks); // left over if spawning failed
+
+  // children first, a parent might not be searchable afterwards
+  for (isize i = vec_transfer_dir_size(&t->dirs) - 1; i >= 0; i--) {
+    const char *path = cstr_str(&t->dirs.data[i].path);
+    struct stat st;
+    if (t->dirs.data[i].clear && stat(path, &st) == 0)
+      chmod(path, st.st_mode & 07777 & ~t->dirs.data[i].clear);
+    if (t->move && utimensat(AT_FDCWD, path, t->dirs.data[i].times, 0) != 0)
+      log_debug("utimensat: %s: %s", path, strerror(errno));
+  }
+
+  if (t->move && !is_cancelled(t)) {
+    for (u32 i = 0; i < vec_cstr_size(&t->files); i++) {
+      if ((t->item_flags[i] & (ITEM_REMOVE_SOURCE | ITEM_FAILED)) !=
+          ITEM_REMOVE_SOURCE)
+        continue;
+      const char *path = cstr_str(&t->files.data[i]);
+      if (nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS) != 0)
+        fail(t, i, path, errno);
+    }
+  }
+
+  t->done(t);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+// Copying and moving files into a directory, the engine behind pasting.
+// Behaves like `cp -r` and `mv` with backups: a file that exists in the
+// destination is never overwritten, the copy is named `name.~N~` instead.
+//
+// The work is spread over up to `max_workers` threads: every file and
+// directory in the copied trees is a task on a shared stack, directories push
+// their entries when they are created. File contents are cloned (FICLONE) if
+// the filesystem supports reflinks, otherwise copied in the kernel with
+// copy_file_range, falling back to read/write. Moves on the same filesystem
+// are a single renameat2, moves across filesystems copy, keeping the owner,
+// permissions and times like `mv`, and then remove the source. The engine is
+// independent of the thread pool, the caller provides the threads via `spawn`.
+
+#include "cancel.h"
+#include "defs.h"
+
+#include <stc/cstr.h>
+#include <stc/zsview.h>
+
+#include "types/vec_cstr.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+struct transfer_task;
+struct transfer_dir;
+
+#include <stc/types.h>
+declare_vec(vec_transfer_task, struct transfer_task);
+declare_vec(vec_transfer_dir, struct transfer_dir);
+
+struct transfer {
+  // set up by the caller, see `transfer_init`
+  vec_cstr files; // absolute paths
+  cstr dest;      // directory the files are pasted into
+  bool move;
+  u32 max_workers;
+  cancel_token *cancel; // can be NULL, not owned
+  // Runs `transfer_work` on another thread. Returns false if that's not
+  // possible.
+  bool (*spawn)(struct transfer *);
+  // Called once by the last worker to finish, all others have returned.
+  void (*done)(struct transfer *);
+
+  // progress, can be read from any thread
+  _Atomic(u64) entries_done; // files, directories, links
+  _Atomic(u64) bytes_done;
+
+  // results, read them once `done` is called
+  u32 errors;
+  cstr error; // the first one, e.g. "/a/b: Permission denied"
+
+  pthread_mutex_t mutex;
+  vec_transfer_task tasks; // pending
+  vec_transfer_dir dirs;   // created directories whose mode is restored
+  u32 workers;             // running or spawned
+  u8 *item_flags;          // per file, see transfer.c
+};
+
+// Initializes a transfer of `files` into `dest`. Takes ownership of `files`.
+void transfer_init(struct transfer *t, vec_cstr files, zsview dest, bool move,
+                   u32 max_workers);
+
+void transfer_deinit(struct transfer *t);
+
+// Starts the transfer by spawning the first workers. If no worker can be
+// spawned, `done` is called before returning.
+void transfer_start(struct transfer *t);
+
+// Works on the transfer until no tasks are left. Called on the threads
+// created by `spawn`.
+void transfer_work(struct transfer *t);
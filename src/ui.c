@@ -719,15 +719,18 @@ static void draw_file(struct ncplane *n, const File *file, bool iscurrent,
       }
       break;
     case INFO_ATIME: {
-      struct tm *tm = localtime(&file->stat.st_atim.tv_sec);
+      time_t t = file_stat(file)->atime;
+      struct tm *tm = localtime(&t);
       strftime(info, sizeof info, cstr_str(&cfg.timefmt), tm);
     } break;
     case INFO_CTIME: {
-      struct tm *tm = localtime(&file->stat.st_ctim.tv_sec);
+      time_t t = file_stat(file)->ctime;
+      struct tm *tm = localtime(&t);
       strftime(info, sizeof info, cstr_str(&cfg.timefmt), tm);
     } break;
     case INFO_MTIME: {
-      struct tm *tm = localtime(&file->stat.st_mtim.tv_sec);
+      time_t t = file_stat(file)->mtime;
+      struct tm *tm = localtime(&t);
       strftime(info, sizeof info, cstr_str(&cfg.timefmt), tm);
     } break;
     case NUM_FILEINFO:
@@ -954,12 +957,15 @@ static void on_cursor_resting(EV_P_ ev_timer *w, i32 revents) {
     if (revents != 0) { // called by libev, need to check/load here
       if (preview->status == PV_DELAYED) {
         async_preview_load(&lfm->async, preview);
-      } else {
+      } else if (!preview->is_loading) {
         async_preview_check(&lfm->async, preview);
       }
     }
   }
   ui->preview.hidden = false;
+
+  if (ui->num_columns > 1)
+    loader_preview_prefetch(&lfm->loader, fm_current_dir(&lfm->fm));
   ui_redraw(&lfm->ui, REDRAW_FM);
 }
 
@@ -978,9 +984,13 @@ void ui_on_cursor_moved(Ui *ui, bool immediate) {
   // currently only deals with preview logic (both here and in fm.c)
   if (!cfg.preview) {
     remove_preview(ui);
+    loader_preview_prefetch_cancel(&to_lfm(ui)->loader);
     return;
   }
 
+  loader_preview_prefetch_update(&to_lfm(ui)->loader,
+                                 fm_current_dir(&to_lfm(ui)->fm));
+
   immediate |= cfg.preview_delay == 0;
 
   static u64 last_time_called = 0;
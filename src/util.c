@@ -4,8 +4,6 @@
 #include "defs.h"
 #include "log.h"
 
-#include <magic.h>
-
 #include <ctype.h>
 #include <errno.h>
 #include <stdbool.h>
@@ -137,23 +135,6 @@ i32 make_dirs(zsview path, __mode_t mode) {
   return mkdir_p(dirname(buf), mode);
 }
 
-// https://stackoverflow.com/questions/9152978/include-unix-utility-file-in-c-program
-bool get_mimetype(const char *path, char *dest, usize sz) {
-  bool ret = true;
-  magic_t magic = magic_open(MAGIC_MIME_TYPE);
-  magic_load(magic, NULL);
-  const char *mime = magic_file(magic, path);
-  if (mime == 0 ||
-      strncmp(mime, "cannot open", sizeof "cannot open" - 1) == 0) {
-    ret = false;
-    *dest = 0;
-  } else {
-    strncpy(dest, mime, sz);
-  }
-  magic_close(magic);
-  return ret;
-}
-
 bool valgrind_active(void) {
   char *preload = getenv("LD_PRELOAD");
   if (!preload)
@@ -49,10 +49,6 @@ i32 mkdir_p(char *path, __mode_t mode);
 // make all directory components of the file at path
 i32 make_dirs(zsview path, __mode_t mode);
 
-// Writes the mimetype of the file at PATH into the buffer dest of length sz.
-// Returns true on success, false on failure with *dest == '\0'
-bool get_mimetype(const char *path, char *dest, usize sz);
-
 bool valgrind_active(void);
 
 static inline zsview getenv_zv(const char *name) {
@@ -0,0 +1,98 @@
+#include "arena.c"
+#include "unity.h"
+
+#include <stdint.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_alloc_aligned(void) {
+  struct arena a = arena_init();
+  for (int i = 1; i < 100; i++) {
+    char *p = arena_alloc(&a, i);
+    TEST_ASSERT_NOT_NULL(p);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)p % alignof(max_align_t));
+    memset(p, 0xff, i);
+  }
+  arena_drop(&a);
+  TEST_ASSERT_NULL(a.head);
+}
+
+void test_strndup(void) {
+  struct arena a = arena_init();
+  char *s = arena_strndup(&a, "hello world", 5);
+  TEST_ASSERT_EQUAL_STRING("hello", s);
+  arena_drop(&a);
+}
+
+void test_calloc(void) {
+  struct arena a = arena_init();
+  memset(arena_alloc(&a, 64), 0xff, 64);
+  arena_drop(&a);
+  char *p = arena_calloc(&a, 64);
+  for (int i = 0; i < 64; i++)
+    TEST_ASSERT_EQUAL(0, p[i]);
+  arena_drop(&a);
+}
+
+void test_blocks(void) {
+  struct arena_stats before = arena_get_stats();
+  struct arena a = arena_init();
+  // fills more than one block
+  for (int i = 0; i < 2 * ARENA_BLOCK_SIZE / 64; i++)
+    arena_alloc(&a, 64);
+  TEST_ASSERT_EQUAL(2 * ARENA_BLOCK_SIZE, a.bytes);
+
+  // oversized allocations don't replace the current block
+  struct arena_block *head = a.head;
+  char *big = arena_alloc(&a, ARENA_BLOCK_SIZE);
+  TEST_ASSERT_NOT_NULL(big);
+  TEST_ASSERT_EQUAL_PTR(head, a.head);
+  TEST_ASSERT_EQUAL(3 * ARENA_BLOCK_SIZE, a.bytes);
+
+  arena_drop(&a);
+  struct arena_stats after = arena_get_stats();
+  TEST_ASSERT_EQUAL(3, after.blocks - before.blocks);
+  TEST_ASSERT_EQUAL(3, after.blocks_freed - before.blocks_freed);
+  TEST_ASSERT_EQUAL(2 * ARENA_BLOCK_SIZE / 64 + 1,
+                    after.allocs - before.allocs);
+}
+
+void test_merge(void) {
+  struct arena a = arena_init();
+  struct arena b = arena_init();
+  char *s = arena_strndup(&a, "a", 1);
+  char *t = arena_strndup(&b, "b", 1);
+  arena_alloc(&b, ARENA_BLOCK_SIZE); // second block in b
+
+  struct arena_block *head = a.head;
+  arena_merge(&a, &b);
+  TEST_ASSERT_NULL(b.head);
+  TEST_ASSERT_EQUAL(0, b.bytes);
+  TEST_ASSERT_EQUAL_PTR(head, a.head);
+  TEST_ASSERT_EQUAL(3 * ARENA_BLOCK_SIZE, a.bytes);
+  TEST_ASSERT_EQUAL_STRING("a", s);
+  TEST_ASSERT_EQUAL_STRING("b", t);
+
+  int n = 0;
+  for (struct arena_block *blk = a.head; blk; blk = blk->prev)
+    n++;
+  TEST_ASSERT_EQUAL(3, n);
+
+  // merging into an empty arena
+  struct arena c = arena_init();
+  arena_merge(&c, &a);
+  TEST_ASSERT_NULL(a.head);
+  TEST_ASSERT_EQUAL_PTR(head, c.head);
+  arena_drop(&c);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_alloc_aligned);
+  RUN_TEST(test_strndup);
+  RUN_TEST(test_calloc);
+  RUN_TEST(test_blocks);
+  RUN_TEST(test_merge);
+  return UNITY_END();
+}
@@ -0,0 +1,171 @@
+// Compares the readdir/fstatat directory loader with the getdents64/statx one
+// (synchronous and batched via io_uring) on a generated directory.
+//
+// usage: dir_load_bench [num_files] [iterations]
+
+#define i_implement
+#include <stc/cstr.h>
+
+#include "arena.h"
+#include "dirio.h"
+#include "file.h"
+#include "path.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static u64 now_micros(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((u64)tv.tv_sec) * 1000 * 1000 + tv.tv_usec;
+}
+
+// every 10th entry is a directory, every 20th a symlink
+static void generate_tree(const char *root, u32 n) {
+  char buf[PATH_MAX];
+  for (u32 i = 0; i < n; i++) {
+    snprintf(buf, sizeof buf, "%s/file_%07u", root, i);
+    if (i % 10 == 0) {
+      mkdir(buf, 0755);
+    } else if (i % 20 == 5) {
+      symlink("file_0000001", buf);
+    } else {
+      int fd = open(buf, O_CREAT | O_WRONLY, 0644);
+      if (fd >= 0) {
+        if (write(fd, buf, i % 64) < 0)
+          perror("write");
+        close(fd);
+      }
+    }
+  }
+}
+
+static void remove_tree(const char *root) {
+  char cmd[PATH_MAX + 16];
+  snprintf(cmd, sizeof cmd, "rm -rf '%s'", root);
+  if (system(cmd) != 0)
+    fprintf(stderr, "could not remove %s\n", root);
+}
+
+static u32 load_readdir(const char *path) {
+  u32 n = 0;
+  struct arena arena = arena_init();
+  DIR *dirp = opendir(path);
+  int fd = open(path, O_RDONLY);
+  struct dirent *entry;
+  while ((entry = readdir(dirp))) {
+    if (path_is_dot_or_dotdot(entry->d_name))
+      continue;
+    File *file = file_create(&arena, path, entry->d_name, fd, true);
+    if (file)
+      n++;
+  }
+  arena_drop(&arena);
+  closedir(dirp);
+  close(fd);
+  return n;
+}
+
+static u32 load_getdents(const char *path) {
+  u32 n = 0;
+  struct arena arena = arena_init();
+  int fd = open(path, O_RDONLY | O_DIRECTORY);
+  struct getdents_reader *r = malloc(sizeof *r);
+  struct getdents_entry entry;
+  getdents_reader_init(r, fd);
+  while (getdents_reader_fill(r) > 0) {
+    while (getdents_reader_next(r, &entry)) {
+      File *file =
+          file_create_statx(&arena, path, entry.name, entry.type, fd, true);
+      if (file)
+        n++;
+    }
+  }
+  arena_drop(&arena);
+  free(r);
+  close(fd);
+  return n;
+}
+
+static u32 load_batched(const char *path) {
+  u32 n = 0;
+  struct arena arena = arena_init();
+  int fd = open(path, O_RDONLY | O_DIRECTORY);
+  struct getdents_reader *r = malloc(sizeof *r);
+  struct getdents_entry entry;
+  const char *names[GETDENTS_BUFSZ / 24];
+  u8 types[GETDENTS_BUFSZ / 24];
+  struct stat *stats = malloc(sizeof(struct stat) * (GETDENTS_BUFSZ / 24));
+  i32 errs[GETDENTS_BUFSZ / 24];
+  getdents_reader_init(r, fd);
+  while (getdents_reader_fill(r) > 0) {
+    u32 num = 0;
+    while (getdents_reader_next(r, &entry)) {
+      names[num] = entry.name;
+      types[num] = entry.type;
+      num++;
+    }
+    statx_batch(fd, names, num, false, stats, errs);
+    for (u32 i = 0; i < num; i++) {
+      File *file = file_create_from_lstat(&arena, path, names[i], types[i],
+                                          &stats[i], errs[i], fd, true);
+      if (file)
+        n++;
+    }
+  }
+  arena_drop(&arena);
+  free(stats);
+  free(r);
+  close(fd);
+  return n;
+}
+
+static void bench(const char *name, u32 (*fn)(const char *), const char *path,
+                  u32 iterations) {
+  u64 best = UINT64_MAX;
+  u32 n = 0;
+  for (u32 i = 0; i < iterations; i++) {
+    u64 t0 = now_micros();
+    n = fn(path);
+    u64 t = now_micros() - t0;
+    if (t < best)
+      best = t;
+  }
+  printf("%-10s %8u files  best %8.2f ms  %6.1f ns/file\n", name, n,
+         best / 1000.0, 1000.0 * best / (n ? n : 1));
+}
+
+int main(int argc, char **argv) {
+  u32 num_files = argc > 1 ? atoi(argv[1]) : 100000;
+  u32 iterations = argc > 2 ? atoi(argv[2]) : 5;
+
+  char root[] = "/tmp/lfm-bench-XXXXXX";
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  printf("generating %u entries in %s\n", num_files, root);
+  generate_tree(root, num_files);
+
+  bench("readdir", load_readdir, root, iterations);
+  bench("getdents", load_getdents, root, iterations);
+  bench("io_uring", load_batched, root, iterations);
+  if (!statx_uring_supported())
+    printf("(io_uring not available, batched statx fell back to sync)\n");
+
+  struct arena_stats st = arena_get_stats();
+  printf("arena: %llu allocations in %llu heap blocks (%llu freed)\n",
+         (unsigned long long)st.allocs, (unsigned long long)st.blocks,
+         (unsigned long long)st.blocks_freed);
+
+  remove_tree(root);
+  return 0;
+}
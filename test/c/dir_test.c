@@ -0,0 +1,301 @@
+#define i_implement
+#include <stc/cstr.h>
+#define i_implement
+#include "types/vec_cstr.h"
+#define i_implement
+#include "types/vec_int.h"
+
+// dirio.c is built separately, it needs _GNU_SOURCE which conflicts with
+// util.h
+#include "arena.c"
+#include "dir.c"
+#include "file.c"
+#include "getpwd.c"
+#include "memory.c"
+#include "path.c"
+#include "sha256.c"
+#include "sort.c"
+#include "strnatcmp.c"
+#include "tpool.c"
+#include "unity.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+// dir.c only logs
+void log_log(i32 level, const char *file, i32 line, const char *fmt, ...) {
+  (void)level;
+  (void)file;
+  (void)line;
+  (void)fmt;
+}
+
+void L_thread_destroy() {}
+
+// no filters are set in these tests
+bool filter_match(const Filter *filter, const File *file) {
+  (void)filter;
+  (void)file;
+  return true;
+}
+
+__compar_fn_t filter_cmp(const Filter *filter) {
+  (void)filter;
+  return NULL;
+}
+
+void filter_destroy(Filter *filter) {
+  (void)filter;
+}
+
+// enough files that a few changes stay below the RESORT_MAX_FRACTION limit
+#define NUM_FILES 32
+
+static char root[] = "/tmp/lfm_dir_test.XXXXXX";
+
+static const char *at(const char *name) {
+  static char path[PATH_MAX];
+  snprintf(path, sizeof path, "%s/%s", root, name);
+  return path;
+}
+
+static void rename_file(const char *from, const char *to) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof path, "%s", at(from));
+  TEST_ASSERT_EQUAL(0, rename(path, at(to)));
+}
+
+static void write_file(const char *name, const char *content) {
+  FILE *fp = fopen(at(name), "w");
+  TEST_ASSERT_NOT_NULL(fp);
+  fputs(content, fp);
+  fclose(fp);
+}
+
+static Dir *load(void) {
+  return dir_load(zsview_from(root), map_str_int_init(), true,
+                  (struct dir_load_parallel){0}, NULL);
+}
+
+// A loaded directory, as dir_update_with expects it.
+static Dir *load_sorted(void) {
+  Dir *dir = load();
+  dir_sort(dir, true);
+  return dir;
+}
+
+static File *find(const vec_file *files, const char *name) {
+  c_foreach(it, vec_file, *files) {
+    if (streq(file_name_str(*it.ref), name))
+      return *it.ref;
+  }
+  return NULL;
+}
+
+// Checks that the files of `dir` are sorted by name and that all views agree.
+static void assert_sorted(const Dir *dir, usize n) {
+  TEST_ASSERT_EQUAL(n, dir->files_all.size);
+  TEST_ASSERT_EQUAL(n, dir->files_loaded.size);
+  TEST_ASSERT_EQUAL(n, dir->files_sorted.size);
+  TEST_ASSERT_EQUAL(n, dir->files.size);
+  for (usize i = 1; i < n; i++) {
+    TEST_ASSERT_TRUE(strcmp(file_name_str(dir->files_all.data[i - 1]),
+                            file_name_str(dir->files_all.data[i])) < 0);
+  }
+  TEST_ASSERT_EQUAL_MEMORY(dir->files_all.data, dir->files.data,
+                           n * sizeof(File *));
+}
+
+void setUp(void) {
+  TEST_ASSERT_NOT_NULL(mkdtemp(root));
+  char name[8];
+  for (int i = 0; i < NUM_FILES; i++) {
+    snprintf(name, sizeof name, "f%02d", i);
+    write_file(name, "");
+  }
+}
+
+void tearDown(void) {
+  char cmd[PATH_MAX + 16];
+  snprintf(cmd, sizeof cmd, "rm -rf %s", root);
+  system(cmd);
+  memcpy(root + sizeof root - 7, "XXXXXX", 6);
+}
+
+// Files that did not change are kept, nothing is reported.
+void test_update_unchanged(void) {
+  Dir *dir = load_sorted();
+  File *file = find(&dir->files_all, "f05");
+
+  struct dir_delta delta;
+  dir_update_with(dir, load(), &delta);
+  TEST_ASSERT_FALSE(delta.full);
+  TEST_ASSERT_EQUAL(0, delta.added.size);
+  TEST_ASSERT_EQUAL(0, delta.removed.size);
+  TEST_ASSERT_EQUAL_PTR(file, find(&dir->files_all, "f05"));
+  assert_sorted(dir, NUM_FILES);
+
+  dir_delta_drop(&delta);
+  dir_destroy(dir);
+}
+
+// A rename is reported as a removal and an addition, other files are kept.
+void test_update_changes(void) {
+  Dir *dir = load_sorted();
+  File *file = find(&dir->files_all, "f05");
+
+  rename_file("f01", "g01");
+  unlink(at("f02"));
+  write_file("h", "");
+
+  struct dir_delta delta;
+  dir_update_with(dir, load(), &delta);
+  TEST_ASSERT_FALSE(delta.full);
+  TEST_ASSERT_EQUAL(2, delta.added.size);
+  TEST_ASSERT_NOT_NULL(find(&delta.added, "g01"));
+  TEST_ASSERT_NOT_NULL(find(&delta.added, "h"));
+  TEST_ASSERT_EQUAL(2, delta.removed.size);
+  TEST_ASSERT_NOT_NULL(find(&delta.removed, "f01"));
+  TEST_ASSERT_NOT_NULL(find(&delta.removed, "f02"));
+  TEST_ASSERT_EQUAL_PTR(file, find(&dir->files_all, "f05"));
+  TEST_ASSERT_NULL(find(&dir->files_all, "f01"));
+  assert_sorted(dir, NUM_FILES);
+
+  dir_delta_drop(&delta);
+  dir_destroy(dir);
+}
+
+// A modified file is replaced by its new version.
+void test_update_modified(void) {
+  Dir *dir = load_sorted();
+  File *file = find(&dir->files_all, "f03");
+
+  write_file("f03", "content");
+
+  struct dir_delta delta;
+  dir_update_with(dir, load(), &delta);
+  TEST_ASSERT_FALSE(delta.full);
+  TEST_ASSERT_EQUAL(1, delta.added.size);
+  TEST_ASSERT_EQUAL_PTR(file, delta.removed.data[0]);
+  TEST_ASSERT_EQUAL(7, find(&dir->files_all, "f03")->lstat.size);
+  assert_sorted(dir, NUM_FILES);
+
+  dir_delta_drop(&delta);
+  dir_destroy(dir);
+}
+
+// Files read in a different order than before are matched beyond
+// MERGE_WINDOW.
+void test_update_reordered(void) {
+  Dir *dir = load_sorted();
+  Dir *update = load();
+  // the order the files were read in is kept
+  ino_t last = update->files_all.data[NUM_FILES - 1]->lstat.ino;
+  reverse(update->files_all.data, update->files_all.size);
+
+  struct dir_delta delta;
+  dir_update_with(dir, update, &delta);
+  TEST_ASSERT_FALSE(delta.full);
+  TEST_ASSERT_EQUAL(0, delta.added.size);
+  TEST_ASSERT_EQUAL(0, delta.removed.size);
+  TEST_ASSERT_EQUAL(last, dir->files_loaded.data[0]->lstat.ino);
+  assert_sorted(dir, NUM_FILES);
+
+  dir_delta_drop(&delta);
+  dir_destroy(dir);
+}
+
+// Too many changes replace all files instead.
+void test_update_full(void) {
+  Dir *dir = load_sorted();
+
+  char name[8];
+  for (int i = 0; i < NUM_FILES / 4; i++) {
+    snprintf(name, sizeof name, "f%02d", i);
+    write_file(name, "content");
+  }
+
+  struct dir_delta delta;
+  dir_update_with(dir, load(), &delta);
+  TEST_ASSERT_TRUE(delta.full);
+  TEST_ASSERT_EQUAL(0, delta.added.size);
+  TEST_ASSERT_EQUAL(0, delta.removed.size);
+  TEST_ASSERT_EQUAL(7, find(&dir->files_all, "f00")->lstat.size);
+  assert_sorted(dir, NUM_FILES);
+
+  dir_delta_drop(&delta);
+  dir_destroy(dir);
+}
+
+// Only the named files are touched, NULL removes a file.
+void test_update_files(void) {
+  Dir *dir = load_sorted();
+  File *file = find(&dir->files_all, "f05");
+
+  rename_file("f01", "g01");
+  write_file("f03", "content");
+  Dir *update = load();
+
+  cstr names[] = {cstr_from("f01"), cstr_from("g01"), cstr_from("f03"),
+                  cstr_from("f04")};
+  File *files[] = {NULL, find(&update->files_all, "g01"),
+                   find(&update->files_all, "f03"),
+                   find(&update->files_all, "f04")};
+  struct dir_delta delta;
+  dir_update_files(dir, names, files, 4, &delta);
+  TEST_ASSERT_EQUAL(2, delta.added.size);
+  TEST_ASSERT_NOT_NULL(find(&delta.added, "g01"));
+  TEST_ASSERT_NOT_NULL(find(&delta.added, "f03"));
+  TEST_ASSERT_EQUAL(2, delta.removed.size);
+  TEST_ASSERT_NOT_NULL(find(&delta.removed, "f01"));
+  TEST_ASSERT_NOT_NULL(find(&delta.removed, "f03"));
+  TEST_ASSERT_EQUAL_PTR(file, find(&dir->files_all, "f05"));
+  assert_sorted(dir, NUM_FILES);
+
+  dir_delta_drop(&delta);
+  dir_destroy(update);
+  for (int i = 0; i < 4; i++)
+    cstr_drop(&names[i]);
+  dir_destroy(dir);
+}
+
+// Merging two sorted runs gives the same order as sorting them together.
+void test_insert_files(void) {
+  Dir *dir = load_sorted();
+  struct file_order order = {.cmp = sort_cmp[SORT_NATURAL]};
+
+  vec_file odd = vec_file_init();
+  vec_file even = vec_file_init();
+  c_foreach(it, vec_file, dir->files_all) {
+    vec_file_push(vec_file_size(&odd) == vec_file_size(&even) ? &even : &odd,
+                  *it.ref);
+  }
+  insert_files(&odd, even.data, even.size, &order);
+  TEST_ASSERT_EQUAL(NUM_FILES, odd.size);
+  TEST_ASSERT_EQUAL_MEMORY(dir->files_all.data, odd.data,
+                           NUM_FILES * sizeof(File *));
+
+  // at both ends
+  vec_file_clear(&odd);
+  vec_file_push(&odd, dir->files_all.data[1]);
+  File *ends[] = {dir->files_all.data[0], dir->files_all.data[2]};
+  insert_files(&odd, ends, 2, &order);
+  TEST_ASSERT_EQUAL(3, odd.size);
+  TEST_ASSERT_EQUAL_MEMORY(dir->files_all.data, odd.data, 3 * sizeof(File *));
+
+  vec_file_drop(&odd);
+  vec_file_drop(&even);
+  dir_destroy(dir);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_update_unchanged);
+  RUN_TEST(test_update_changes);
+  RUN_TEST(test_update_modified);
+  RUN_TEST(test_update_reordered);
+  RUN_TEST(test_update_full);
+  RUN_TEST(test_update_files);
+  RUN_TEST(test_insert_files);
+  return UNITY_END();
+}
@@ -0,0 +1,122 @@
+#define i_implement
+#include <stc/cstr.h>
+
+#include "memory.c"
+#include "mime.c"
+#include "unity.h"
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// mime.c only logs
+void log_log(i32 level, const char *file, i32 line, const char *fmt, ...) {
+  (void)level;
+  (void)file;
+  (void)line;
+  (void)fmt;
+}
+
+static char dir[] = "/tmp/lfm_mime_test.XXXXXX";
+
+static void write_file(const char *path, const char *content) {
+  FILE *fp = fopen(path, "w");
+  TEST_ASSERT_NOT_NULL(fp);
+  fputs(content, fp);
+  fclose(fp);
+}
+
+void setUp(void) {
+  mime_cache_clear();
+}
+
+void tearDown(void) {}
+
+void test_mimetype(void) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof path, "%s/a.txt", dir);
+  write_file(path, "hello\n");
+
+  char mime[256];
+  TEST_ASSERT_TRUE(get_mimetype(path, mime, sizeof mime));
+  TEST_ASSERT_EQUAL_STRING("text/plain", mime);
+  TEST_ASSERT_EQUAL(1, hmap_mime_size(&cache.map));
+
+  // served from the cache
+  TEST_ASSERT_TRUE(get_mimetype(path, mime, sizeof mime));
+  TEST_ASSERT_EQUAL_STRING("text/plain", mime);
+  TEST_ASSERT_EQUAL(1, hmap_mime_size(&cache.map));
+
+  // truncated to the buffer
+  char small[5];
+  TEST_ASSERT_TRUE(get_mimetype(path, small, sizeof small));
+  TEST_ASSERT_EQUAL_STRING("text", small);
+}
+
+void test_changed_file(void) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof path, "%s/b", dir);
+  write_file(path, "hello\n");
+
+  char mime[256];
+  TEST_ASSERT_TRUE(get_mimetype(path, mime, sizeof mime));
+  TEST_ASSERT_EQUAL_STRING("text/plain", mime);
+
+  write_file(path, "%PDF-1.4\n");
+  TEST_ASSERT_TRUE(get_mimetype(path, mime, sizeof mime));
+  TEST_ASSERT_EQUAL_STRING("application/pdf", mime);
+}
+
+void test_missing_file(void) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof path, "%s/missing", dir);
+  char mime[256] = "x";
+  TEST_ASSERT_FALSE(get_mimetype(path, mime, sizeof mime));
+  TEST_ASSERT_EQUAL_STRING("", mime);
+  TEST_ASSERT_EQUAL(0, hmap_mime_size(&cache.map));
+}
+
+void test_eviction(void) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof path, "%s/c", dir);
+  write_file(path, "hello\n");
+  char mime[256];
+  TEST_ASSERT_TRUE(get_mimetype(path, mime, sizeof mime));
+
+  // fill the cache with fake entries, as if many files were looked up
+  for (u64 i = 0; i < MIME_CACHE_ENTRIES; i++) {
+    struct mime_key key = {.dev = 1, .ino = i};
+    struct mime_entry entry = {cstr_from("x/y"), ++cache.tick};
+    hmap_mime_insert(&cache.map, key, entry);
+  }
+  TEST_ASSERT_EQUAL(MIME_CACHE_ENTRIES + 1, hmap_mime_size(&cache.map));
+
+  // inserting d keeps only the entries used in the last half of the lookups
+  snprintf(path, sizeof path, "%s/d", dir);
+  write_file(path, "hello\n");
+  TEST_ASSERT_TRUE(get_mimetype(path, mime, sizeof mime));
+  TEST_ASSERT_EQUAL(MIME_CACHE_ENTRIES / 2 + 1 + 1,
+                    hmap_mime_size(&cache.map));
+  struct stat st;
+  snprintf(path, sizeof path, "%s/c", dir);
+  lstat(path, &st);
+  struct mime_key key = {st.st_dev, st.st_ino, st.st_mtim.tv_sec,
+                         st.st_mtim.tv_nsec, st.st_size};
+  TEST_ASSERT_FALSE(hmap_mime_contains(&cache.map, key));
+}
+
+int main(void) {
+  if (mkdtemp(dir) == NULL)
+    return 1;
+  UNITY_BEGIN();
+  RUN_TEST(test_mimetype);
+  RUN_TEST(test_changed_file);
+  RUN_TEST(test_missing_file);
+  RUN_TEST(test_eviction);
+  i32 res = UNITY_END();
+  char cmd[64];
+  snprintf(cmd, sizeof cmd, "rm -rf %s", dir);
+  res |= system(cmd);
+  return res;
+}
@@ -0,0 +1,168 @@
+#include "memory.c"
+#include "preview_cache.c"
+#include "sha256.c"
+#include "unity.h"
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+// preview_cache.c only logs and creates its directory
+void log_log(i32 level, const char *file, i32 line, const char *fmt, ...) {
+  (void)level;
+  (void)file;
+  (void)line;
+  (void)fmt;
+}
+
+i32 mkdir_p(char *path, __mode_t mode) {
+  return mkdir(path, mode) && errno != EEXIST;
+}
+
+static char root[] = "/tmp/lfm_preview_cache_test.XXXXXX";
+static char dir[PATH_MAX];
+// the previewer, part of the key
+static const zsview pv = c_zv("/usr/bin/previewer");
+
+void setUp(void) {
+  TEST_ASSERT_NOT_NULL(mkdtemp(root));
+  snprintf(dir, sizeof dir, "%s/previews", root);
+}
+
+void tearDown(void) {
+  preview_cache_gc(dir, 0);
+  rmdir(dir);
+  rmdir(root);
+  memcpy(root + sizeof root - 7, "XXXXXX", 6);
+}
+
+static struct stat make_stat(time_t mtime, off_t size) {
+  struct stat st = {0};
+  st.st_mtim.tv_sec = mtime;
+  st.st_size = size;
+  return st;
+}
+
+void test_path_depends_on_key(void) {
+  char a[PATH_MAX], b[PATH_MAX];
+  struct stat st = make_stat(1000, 42);
+  zsview path = zsview_from("/some/file.pdf");
+  TEST_ASSERT_GREATER_THAN(0, preview_cache_path(dir, path, &st, 80, 24, pv,
+                                                 true, a, sizeof a));
+  TEST_ASSERT_EQUAL_INT(0, strncmp(a, dir, strlen(dir)));
+
+  preview_cache_path(dir, path, &st, 80, 24, pv, true, b, sizeof b);
+  TEST_ASSERT_EQUAL_STRING(a, b);
+
+  preview_cache_path(dir, path, &st, 81, 24, pv, true, b, sizeof b);
+  TEST_ASSERT_NOT_EQUAL(0, strcmp(a, b));
+
+  struct stat st2 = make_stat(1001, 42);
+  preview_cache_path(dir, path, &st2, 80, 24, pv, true, b, sizeof b);
+  TEST_ASSERT_NOT_EQUAL(0, strcmp(a, b));
+
+  st2 = make_stat(1000, 43);
+  preview_cache_path(dir, path, &st2, 80, 24, pv, true, b, sizeof b);
+  TEST_ASSERT_NOT_EQUAL(0, strcmp(a, b));
+
+  preview_cache_path(dir, path, &st, 80, 24, zsview_from("/bin/other"), true,
+                     b, sizeof b);
+  TEST_ASSERT_NOT_EQUAL(0, strcmp(a, b));
+
+  preview_cache_path(dir, path, &st, 80, 24, pv, false, b, sizeof b);
+  TEST_ASSERT_NOT_EQUAL(0, strcmp(a, b));
+
+  TEST_ASSERT_EQUAL(
+      -1, preview_cache_path(dir, path, &st, 80, 24, pv, true, b, 16));
+}
+
+void test_write_read(void) {
+  char cache_path[PATH_MAX];
+  struct stat st = make_stat(1000, 42);
+  preview_cache_path(dir, zsview_from("/a"), &st, 80, 24, pv, true,
+                     cache_path, sizeof cache_path);
+
+  struct preview_cache_entry entry;
+  TEST_ASSERT_EQUAL(-1, preview_cache_read(cache_path, &entry));
+
+  const char text[] = "line 1\nline 2\n";
+  struct preview_cache_entry written = {
+      .kind = PREVIEW_CACHE_TEXT,
+      .width = 80,
+      .height = INT_MAX,
+      .data = {(char *)text, sizeof text - 1},
+  };
+  TEST_ASSERT_GREATER_THAN((isize)sizeof text - 1,
+                           preview_cache_write(cache_path, &written));
+
+  TEST_ASSERT_EQUAL(0, preview_cache_read(cache_path, &entry));
+  TEST_ASSERT_EQUAL(PREVIEW_CACHE_TEXT, entry.kind);
+  TEST_ASSERT_EQUAL(80, entry.width);
+  TEST_ASSERT_EQUAL(INT_MAX, entry.height);
+  TEST_ASSERT_EQUAL(sizeof text - 1, entry.data.size);
+  TEST_ASSERT_EQUAL_MEMORY(text, entry.data.buf, entry.data.size);
+  bytes_drop(&entry.data);
+
+  // empty previews are valid entries, too
+  written.data = bytes_init();
+  preview_cache_write(cache_path, &written);
+  TEST_ASSERT_EQUAL(0, preview_cache_read(cache_path, &entry));
+  TEST_ASSERT_EQUAL(0, entry.data.size);
+}
+
+void test_truncated_entry(void) {
+  char cache_path[PATH_MAX];
+  struct stat st = make_stat(1000, 42);
+  preview_cache_path(dir, zsview_from("/a"), &st, 80, 24, pv, true,
+                     cache_path, sizeof cache_path);
+  char text[] = "abcdef";
+  struct preview_cache_entry written = {
+      .kind = PREVIEW_CACHE_TEXT,
+      .data = {text, sizeof text - 1},
+  };
+  isize n = preview_cache_write(cache_path, &written);
+  TEST_ASSERT_EQUAL(0, truncate(cache_path, n - 1));
+
+  struct preview_cache_entry entry;
+  TEST_ASSERT_EQUAL(-1, preview_cache_read(cache_path, &entry));
+}
+
+void test_gc(void) {
+  char paths[8][PATH_MAX];
+  char data[4096] = {0};
+  for (int i = 0; i < 8; i++) {
+    struct stat st = make_stat(i, 0);
+    preview_cache_path(dir, zsview_from("/a"), &st, 80, 24, pv, true,
+                       paths[i], sizeof paths[i]);
+    struct preview_cache_entry entry = {.data = {data, sizeof data}};
+    preview_cache_write(paths[i], &entry);
+    // order the entries by age
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1000 + i, 0}};
+    utimensat(AT_FDCWD, paths[i], times, 0);
+  }
+  // reading marks entry 0 as recently used
+  struct preview_cache_entry entry;
+  TEST_ASSERT_EQUAL(0, preview_cache_read(paths[0], &entry));
+  bytes_drop(&entry.data);
+
+  struct stat st;
+  stat(paths[0], &st);
+  u64 entry_size = st.st_blocks * 512;
+  preview_cache_gc(dir, 4 * entry_size);
+
+  TEST_ASSERT_EQUAL(0, access(paths[0], F_OK));
+  for (int i = 1; i < 5; i++)
+    TEST_ASSERT_NOT_EQUAL(0, access(paths[i], F_OK));
+  for (int i = 5; i < 8; i++)
+    TEST_ASSERT_EQUAL(0, access(paths[i], F_OK));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_path_depends_on_key);
+  RUN_TEST(test_write_read);
+  RUN_TEST(test_truncated_entry);
+  RUN_TEST(test_gc);
+  return UNITY_END();
+}
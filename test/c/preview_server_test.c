@@ -0,0 +1,142 @@
+#include "memory.c"
+#include "preview_server.c"
+#include "unity.h"
+
+#include <stdarg.h>
+#include <sys/stat.h>
+
+// preview_server.c only logs
+void log_log(i32 level, const char *file, i32 line, const char *fmt, ...) {
+  (void)level;
+  (void)file;
+  (void)line;
+  (void)fmt;
+}
+
+// Answers every request with exit code 3 and n lines "<width> <height> <i>",
+// where n is the last component of the path; sleeps first if it is "sleep".
+static const char server_script[] =
+    "#!/usr/bin/env bash\n"
+    "[ \"$1\" = --server ] || exit 1\n"
+    "while IFS= read -r -d '' path && IFS= read -r -d '' width &&\n"
+    "    IFS= read -r -d '' height && IFS= read -r -d '' cache &&\n"
+    "    IFS= read -r -d '' images; do\n"
+    "  [ \"$path\" = sleep ] && sleep 10\n"
+    "  out=$(for ((i = 0; i < ${path##*/}; i++)); do\n"
+    "    echo \"$width $height $i\"; done; printf x)\n"
+    "  out=${out%x}\n"
+    "  printf '3 %d\\n%s' \"${#out}\" \"$out\"\n"
+    "done\n";
+
+// A previewer that does not know about --server.
+static const char plain_script[] = "#!/bin/sh\necho $1\nexit 3\n";
+
+static char server_path[] = "/tmp/lfm_preview_server_test.XXXXXX";
+static char plain_path[] = "/tmp/lfm_preview_server_test.XXXXXX";
+
+static void write_script(char *path, const char *script) {
+  i32 fd = mkstemp(path);
+  TEST_ASSERT_NOT_EQUAL(-1, fd);
+  TEST_ASSERT_TRUE(write_full(fd, script, strlen(script)));
+  fchmod(fd, 0700);
+  close(fd);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {
+  preview_server_configure("", 0);
+  preview_server_stop_all();
+}
+
+static i32 request(const char *path, i32 max_lines, usize max_bytes,
+                   const cancel_token *cancel,
+                   struct preview_server_response *res) {
+  return preview_server_request(zsview_from(path), 80, 24, "/tmp/cache",
+                                false, max_lines, max_bytes, cancel, res);
+}
+
+void test_disabled(void) {
+  struct preview_server_response res;
+  TEST_ASSERT_EQUAL(-1, request("/2", 10, 4096, NULL, &res));
+}
+
+void test_request(void) {
+  preview_server_configure(server_path, 2);
+  struct preview_server_response res;
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL(0, request("/2", 10, 4096, NULL, &res));
+    TEST_ASSERT_EQUAL(3, res.rc);
+    TEST_ASSERT_EQUAL(16, res.output.size);
+    TEST_ASSERT_EQUAL_MEMORY("80 24 0\n80 24 1\n", res.output.buf, 16);
+    bytes_drop(&res.output);
+  }
+  // the same server answered every time
+  TEST_ASSERT_EQUAL(3, pool.servers[0].answered);
+  TEST_ASSERT_EQUAL(0, pool.servers[1].pid);
+
+  TEST_ASSERT_EQUAL(0, request("/0", 10, 4096, NULL, &res));
+  TEST_ASSERT_EQUAL(0, res.output.size);
+  bytes_drop(&res.output);
+}
+
+void test_truncate(void) {
+  preview_server_configure(server_path, 1);
+  struct preview_server_response res;
+  // the rest of the output is skipped, the next response is intact
+  TEST_ASSERT_EQUAL(0, request("/100", 3, 4096, NULL, &res));
+  TEST_ASSERT_EQUAL(3 * 8 - 1, res.output.size);
+  bytes_drop(&res.output);
+
+  TEST_ASSERT_EQUAL(0, request("/100", 1000, 20, NULL, &res));
+  TEST_ASSERT_EQUAL(2 * 8 - 1, res.output.size);
+  bytes_drop(&res.output);
+
+  TEST_ASSERT_EQUAL(0, request("/1", 10, 4096, NULL, &res));
+  TEST_ASSERT_EQUAL_MEMORY("80 24 0\n", res.output.buf, 8);
+  bytes_drop(&res.output);
+}
+
+void test_cancel(void) {
+  preview_server_configure(server_path, 1);
+  cancel_token *cancel = cancel_token_create(NULL);
+  cancel_token_cancel(cancel);
+  struct preview_server_response res;
+  TEST_ASSERT_EQUAL(-1, request("sleep", 10, 4096, cancel, &res));
+  cancel_token_unref(cancel);
+
+  // the interrupted server is replaced
+  TEST_ASSERT_EQUAL(0, request("/1", 10, 4096, NULL, &res));
+  bytes_drop(&res.output);
+}
+
+void test_unsupported(void) {
+  preview_server_configure(plain_path, 1);
+  struct preview_server_response res;
+  TEST_ASSERT_EQUAL(-1, request("/1", 10, 4096, NULL, &res));
+  TEST_ASSERT_TRUE(pool.broken);
+  TEST_ASSERT_EQUAL(-1, request("/1", 10, 4096, NULL, &res));
+  TEST_ASSERT_EQUAL(0, pool.servers[0].pid);
+
+  // a new previewer is tried again
+  preview_server_configure(server_path, 1);
+  TEST_ASSERT_EQUAL(0, request("/1", 10, 4096, NULL, &res));
+  bytes_drop(&res.output);
+}
+
+int main(void) {
+  // writes to servers that exited must not kill us
+  signal(SIGPIPE, SIG_IGN);
+  write_script(server_path, server_script);
+  write_script(plain_path, plain_script);
+  UNITY_BEGIN();
+  RUN_TEST(test_disabled);
+  RUN_TEST(test_request);
+  RUN_TEST(test_truncate);
+  RUN_TEST(test_cancel);
+  RUN_TEST(test_unsupported);
+  i32 res = UNITY_END();
+  unlink(server_path);
+  unlink(plain_path);
+  return res;
+}
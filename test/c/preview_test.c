@@ -0,0 +1,141 @@
+#define STC_CSTR_IO
+#define i_implement
+#include <stc/cstr.h>
+
+// preview_cache.c and preview_server.c are built separately, both define
+// write_full
+#include "memory.c"
+#include "preview.c"
+#include "sha256.c"
+#include "unity.h"
+
+#include <stdarg.h>
+#include <sys/wait.h>
+
+Config cfg;
+struct cdims cdims;
+
+// preview.c and the caches only log
+void log_log(i32 level, const char *file, i32 line, const char *fmt, ...) {
+  (void)level;
+  (void)file;
+  (void)line;
+  (void)fmt;
+}
+
+i32 mkdir_p(char *path, __mode_t mode) {
+  return mkdir(path, mode) && errno != EEXIST;
+}
+
+static char root[] = "/tmp/lfm_preview_test.XXXXXX";
+
+static const char *at(const char *rel) {
+  static char path[PATH_MAX];
+  snprintf(path, sizeof path, "%s/%s", root, rel);
+  return path;
+}
+
+static void write_file(const char *rel, const char *content, mode_t mode) {
+  FILE *fp = fopen(at(rel), "w");
+  TEST_ASSERT_NOT_NULL(fp);
+  fputs(content, fp);
+  fclose(fp);
+  chmod(at(rel), mode);
+}
+
+// Runs the previewer on `rel` like async/preview_load.c does.
+static Preview *run_previewer(const char *rel, u32 height) {
+  i32 pid = 0;
+  i32 fd[2];
+  Preview *p = preview_fork_previewer(zsview_from(at(rel)), 80, height, &pid,
+                                      fd);
+  TEST_ASSERT_GREATER_THAN(0, pid);
+  bool truncated;
+  preview_read_output(p, fd, NULL, &truncated);
+  i32 status;
+  TEST_ASSERT_EQUAL(pid, waitpid(pid, &status, 0));
+  return preview_handle_exit_status(p, status, truncated, NULL);
+}
+
+void setUp(void) {
+  cfg.previewer = cstr_init();
+  cfg.cachedir = cstr_from(root);
+  cfg.preview_disk_cache_bytes = 1024 * 1024;
+}
+
+void tearDown(void) {
+  cstr_drop(&cfg.previewer);
+  cstr_drop(&cfg.cachedir);
+}
+
+// The previewer dies of SIGPIPE (or its shell exits with 141) once we stop
+// reading, its output is shown anyway.
+void test_cat_truncated(void) {
+  write_file("cat.sh", "#!/bin/sh\ncat \"$1\"\n", 0700);
+  cfg.previewer = cstr_from(at("cat.sh"));
+  // large enough to fill the pipe buffer after we close it
+  FILE *fp = fopen(at("long"), "w");
+  TEST_ASSERT_NOT_NULL(fp);
+  for (int i = 0; i < 100000; i++)
+    fprintf(fp, "line %d\n", i);
+  fclose(fp);
+
+  Preview *p = run_previewer("long", 3);
+  TEST_ASSERT_EQUAL(20, p->data.size);
+  TEST_ASSERT_EQUAL_MEMORY("line 0\nline 1\nline 2", p->data.buf, 20);
+  preview_destroy(p);
+
+  // a preview from a broken pipe is not cached
+  TEST_ASSERT_NULL(preview_from_disk_cache(zsview_from(at("long")), 80, 3));
+}
+
+// Exit codes are kept if the previewer is done before we stop reading.
+void test_exit_code(void) {
+  write_file("fix.sh", "#!/bin/sh\necho a\necho b\nexit 4\n", 0700);
+  cfg.previewer = cstr_from(at("fix.sh"));
+  write_file("short", "", 0600);
+
+  Preview *p = run_previewer("short", 10);
+  TEST_ASSERT_EQUAL(4, p->data.size);
+  TEST_ASSERT_EQUAL_MEMORY("a\nb\n", p->data.buf, 4);
+  TEST_ASSERT_EQUAL(INT_MAX, p->height);
+  preview_destroy(p);
+
+  p = preview_from_disk_cache(zsview_from(at("short")), 80, 10);
+  TEST_ASSERT_NOT_NULL(p);
+  TEST_ASSERT_EQUAL(INT_MAX, p->height);
+  preview_destroy(p);
+}
+
+// Output over PREVIEW_MAX_BYTES is cut at the last newline, even if it was
+// read before the buffer grew.
+void test_long_line(void) {
+  FILE *fp = fopen(at("line"), "w");
+  TEST_ASSERT_NOT_NULL(fp);
+  fputs("0123456789\n", fp);
+  for (int i = 0; i < 1024 * 1024; i++)
+    fputc('x', fp);
+  fclose(fp);
+
+  i32 fd = open(at("line"), O_RDONLY);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, fd);
+  bytes data;
+  TEST_ASSERT_EQUAL(1, data_from_fd(&data, fd, 50, NULL));
+  close(fd);
+  TEST_ASSERT_EQUAL(10, data.size);
+  TEST_ASSERT_EQUAL_MEMORY("0123456789", data.buf, 10);
+  bytes_drop(&data);
+}
+
+int main(void) {
+  if (mkdtemp(root) == NULL)
+    return 1;
+  UNITY_BEGIN();
+  RUN_TEST(test_cat_truncated);
+  RUN_TEST(test_exit_code);
+  RUN_TEST(test_long_line);
+  char cmd[PATH_MAX + 16];
+  snprintf(cmd, sizeof cmd, "rm -rf %s", root);
+  system(cmd);
+  return UNITY_END();
+}
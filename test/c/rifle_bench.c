@@ -0,0 +1,188 @@
+// Compares checking every rule of a large generated rifle.conf against the
+// compiled rule index, which only checks the rules bucketed under the
+// extension and mime type of the file, plus the unindexed ones.
+//
+// usage: rifle_bench [num_rules] [num_queries] [iterations]
+
+#define i_implement
+#include <stc/cstr.h>
+#define i_implement
+#include "types/vec_int.h"
+
+#include "rifle.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// util.c depends on the config, rifle.c only trims
+char *rtrim(char *s) {
+  char *end = s + strlen(s);
+  while (end > s && isspace(end[-1]))
+    end--;
+  *end = 0;
+  return s;
+}
+
+char *ltrim(char *s) {
+  while (isspace(*s))
+    s++;
+  return s;
+}
+
+static u64 now_micros(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((u64)tv.tv_sec) * 1000 * 1000 + tv.tv_usec;
+}
+
+static u64 rng_state = 42;
+
+static u64 rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// 40% literal extensions, 40% anchored mime types, 20% unindexed rules
+static void generate_config(const char *path, u32 n) {
+  FILE *fp = fopen(path, "w");
+  for (u32 i = 0; i < n; i++) {
+    switch (i % 5) {
+    case 0:
+      fprintf(fp, "ext e%u|x%u, has sh = cmd%u \"$@\"\n", i % 500, i % 300,
+              i);
+      break;
+    case 1:
+      fprintf(fp, "ext e%u, !has lfm-rifle-bench-missing, flag f = cmd%u\n",
+              i % 500, i);
+      break;
+    case 2:
+      fprintf(fp, "mime ^t%u/s%u$, X = cmd%u \"$@\"\n", i % 50, i % 20, i);
+      break;
+    case 3:
+      fprintf(fp, "mime ^t%u/, has sh, label l%u = cmd%u\n", i % 50, i, i);
+      break;
+    default:
+      fprintf(fp, "# generated rule %u\nname ^/f%u\\.e[0-9]+$ = cmd%u\n", i,
+              i % 1000, i);
+      break;
+    }
+  }
+  fprintf(fp, "else = fallback\n");
+  fclose(fp);
+}
+
+// like load_rules in lua/riflelib.c
+static void load_config(RifleRules *rules, const char *path) {
+  FILE *fp = fopen(path, "r");
+  char buf[4096];
+  while (fgets(buf, sizeof buf, fp) != NULL) {
+    if (buf[0] == '#')
+      continue;
+    if (!rifle_rules_add(rules, buf))
+      fprintf(stderr, "malformed rule: %s", buf);
+  }
+  fclose(fp);
+}
+
+static bool count_match(const Rule *rule, void *arg) {
+  (void)rule;
+  (*(u64 *)arg)++;
+  return true;
+}
+
+static u64 run_queries(RifleRules *rules, char (*files)[64],
+                       char (*mimes)[64], u32 n, u64 *matches) {
+  u64 t0 = now_micros();
+  for (u32 i = 0; i < n; i++) {
+    FileInfo info = {
+        .file = zsview_from(files[i]),
+        .path = zsview_from(files[i]),
+        .mime = zsview_from(mimes[i]),
+    };
+    rifle_rules_match(rules, &info, false, count_match, matches);
+  }
+  return now_micros() - t0;
+}
+
+static void report(const char *name, u64 best, u32 n, u64 matches) {
+  printf("%-10s %8u queries  best %8.2f ms  %8.2f us/query  %llu matches\n",
+         name, n, best / 1000.0, (double)best / n,
+         (unsigned long long)matches);
+}
+
+int main(int argc, char **argv) {
+  u32 num_rules = argc > 1 ? atoi(argv[1]) : 10000;
+  u32 num_queries = argc > 2 ? atoi(argv[2]) : 1000;
+  u32 iterations = argc > 3 ? atoi(argv[3]) : 5;
+  if (num_queries < 1)
+    num_queries = 1;
+
+  char path[] = "/tmp/lfm-rifle-bench-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  generate_config(path, num_rules);
+
+  RifleRules rules = {0};
+  u64 t0 = now_micros();
+  load_config(&rules, path);
+  u64 t_load = now_micros() - t0;
+  t0 = now_micros();
+  rifle_rules_compile(&rules);
+  u64 t_compile = now_micros() - t0;
+  printf("%lld rules, load %.2f ms, compile %.2f ms\n",
+         (long long)rifle_rules_size(&rules), t_load / 1000.0,
+         t_compile / 1000.0);
+  printf("index: %lld extensions, %lld mime types, %lld unindexed rules\n",
+         (long long)rules.index.ext.size,
+         (long long)rules.index.mime.size,
+         (long long)vec_int_size(&rules.index.rest));
+
+  // some files match indexed rules, some don't
+  char(*files)[64] = malloc(num_queries * sizeof *files);
+  char(*mimes)[64] = malloc(num_queries * sizeof *mimes);
+  for (u32 i = 0; i < num_queries; i++) {
+    snprintf(files[i], sizeof files[i], "/home/user/f%u.e%u",
+             (u32)(rng() % 2000), (u32)(rng() % 600));
+    snprintf(mimes[i], sizeof mimes[i], "t%u/s%u", (u32)(rng() % 60),
+             (u32)(rng() % 20));
+  }
+
+  u64 best_linear = UINT64_MAX;
+  u64 best_indexed = UINT64_MAX;
+  u64 matches_linear = 0;
+  u64 matches_indexed = 0;
+  for (u32 i = 0; i < iterations; i++) {
+    matches_linear = matches_indexed = 0;
+
+    rules.index.valid = false;
+    u64 t = run_queries(&rules, files, mimes, num_queries, &matches_linear);
+    if (t < best_linear)
+      best_linear = t;
+
+    rules.index.valid = true;
+    t = run_queries(&rules, files, mimes, num_queries, &matches_indexed);
+    if (t < best_indexed)
+      best_indexed = t;
+  }
+  report("linear", best_linear, num_queries, matches_linear);
+  report("indexed", best_indexed, num_queries, matches_indexed);
+  if (matches_linear != matches_indexed)
+    fprintf(stderr, "results differ!\n");
+
+  free(files);
+  free(mimes);
+  rifle_rules_drop(&rules);
+  unlink(path);
+  return matches_linear != matches_indexed;
+}
@@ -0,0 +1,168 @@
+#define i_implement
+#include <stc/cstr.h>
+#define i_implement
+#include "types/vec_int.h"
+
+#include "memory.c"
+#include "rifle.c"
+#include "unity.h"
+
+#include <stdarg.h>
+
+// rifle.c only logs
+void log_log(i32 level, const char *file, i32 line, const char *fmt, ...) {
+  (void)level;
+  (void)file;
+  (void)line;
+  (void)fmt;
+}
+
+// util.c depends on the config, rifle.c only trims
+char *rtrim(char *s) {
+  char *end = s + strlen(s);
+  while (end > s && isspace(end[-1]))
+    end--;
+  *end = 0;
+  return s;
+}
+
+char *ltrim(char *s) {
+  while (isspace(*s))
+    s++;
+  return s;
+}
+
+static RifleRules rifle;
+
+static const char *const config[] = {
+    "ext txt|md, has sh = text",
+    "mime ^image/, !ext svg = image",
+    "ext png = png",
+    "name ^/READ = readme",
+    "ext tar\\.gz|tgz = archive",
+    "mime ^video/|^audio/ = media",
+    "ext pdf, has lfm-rifle-test-missing = missing",
+    "directory = dir",
+    "mime ^text = any text",
+    "ext txt, label second = text2",
+    "else = fallback",
+};
+
+void setUp(void) {
+  for (usize i = 0; i < c_arraylen(config); i++)
+    TEST_ASSERT_TRUE(rifle_rules_add(&rifle, config[i]));
+}
+
+void tearDown(void) {
+  rifle_rules_drop(&rifle);
+  memset(&rifle, 0, sizeof rifle);
+}
+
+static bool collect(const Rule *rule, void *arg) {
+  cstr *out = arg;
+  if (!cstr_is_empty(out))
+    cstr_append(out, ",");
+  cstr_append_s(out, rule->command);
+  return true;
+}
+
+static cstr matches(const char *file, const char *mime) {
+  FileInfo info = {.file = zsview_from(file),
+                   .path = zsview_from(file),
+                   .mime = zsview_from(mime)};
+  cstr out = cstr_init();
+  rifle_rules_match(&rifle, &info, false, collect, &out);
+  return out;
+}
+
+// The index must not change the result.
+static void assert_matches(const char *expected, const char *file,
+                           const char *mime) {
+  cstr linear = matches(file, mime);
+  rifle_rules_compile(&rifle);
+  cstr indexed = matches(file, mime);
+  TEST_ASSERT_EQUAL_STRING(expected, cstr_str(&linear));
+  TEST_ASSERT_EQUAL_STRING(expected, cstr_str(&indexed));
+  cstr_drop(&linear);
+  cstr_drop(&indexed);
+  rifle.index.valid = false;
+}
+
+void test_match(void) {
+  assert_matches("text,any text,text2,fallback", "/x/a.txt", "text/plain");
+  assert_matches("image,png,fallback", "/x/a.png", "image/png");
+  assert_matches("fallback", "/x/a.svg", "image/svg+xml");
+  assert_matches("readme,fallback", "/x/README", "");
+  assert_matches("archive,fallback", "/x/a.tar.gz", "application/gzip");
+  assert_matches("archive,fallback", "a.tgz", "application/gzip");
+  assert_matches("media,fallback", "/x/a.mp3", "audio/mpeg");
+  assert_matches("fallback", "/x/a.pdf", "application/pdf");
+  assert_matches("dir,fallback", "/tmp", "inode/directory");
+  assert_matches("fallback", "/x/txt", "");
+  assert_matches("fallback", "/x/a.TXT", "");
+}
+
+void test_index(void) {
+  rifle_rules_compile(&rifle);
+  TEST_ASSERT_TRUE(rifle.index.valid);
+  // txt, md, png, pdf
+  TEST_ASSERT_EQUAL(4, hmap_rule_bucket_size(&rifle.index.ext));
+  // image
+  TEST_ASSERT_EQUAL(1, hmap_rule_bucket_size(&rifle.index.mime));
+  // readme, archive, media, dir, any text, fallback
+  TEST_ASSERT_EQUAL(6, vec_int_size(&rifle.index.rest));
+
+  // adding a rule invalidates the index
+  TEST_ASSERT_TRUE(rifle_rules_add(&rifle, "ext txt = new"));
+  TEST_ASSERT_FALSE(rifle.index.valid);
+}
+
+void test_mime_pattern_type(void) {
+  char type[16];
+  TEST_ASSERT_TRUE(mime_pattern_type("^video/", type, sizeof type));
+  TEST_ASSERT_EQUAL_STRING("video", type);
+  TEST_ASSERT_TRUE(mime_pattern_type("^x-foo/", type, sizeof type));
+  TEST_ASSERT_EQUAL_STRING("x-foo", type);
+  // alternatives aren't analyzed
+  TEST_ASSERT_FALSE(mime_pattern_type("^x-foo/(a|b)$", type, sizeof type));
+  TEST_ASSERT_FALSE(mime_pattern_type("video/", type, sizeof type));
+  TEST_ASSERT_FALSE(mime_pattern_type("^videos?/", type, sizeof type));
+  TEST_ASSERT_FALSE(mime_pattern_type("^video/?", type, sizeof type));
+  TEST_ASSERT_FALSE(mime_pattern_type("^vid.o/", type, sizeof type));
+  TEST_ASSERT_FALSE(mime_pattern_type("^/", type, sizeof type));
+  TEST_ASSERT_FALSE(
+      mime_pattern_type("^averyveryverylongtype/", type, sizeof type));
+}
+
+void test_has(void) {
+  Condition cond = condition_create(check_fn_has, "sh", false);
+  FileInfo info = {0};
+  TEST_ASSERT_TRUE(check_fn_has(&cond, &info));
+  TEST_ASSERT_EQUAL(1, cond.has_result);
+  cstr_drop(&cond.arg);
+
+  cond = condition_create(check_fn_has, "lfm-rifle-test-missing", true);
+  TEST_ASSERT_TRUE(check_fn_has(&cond, &info));
+  TEST_ASSERT_EQUAL(0, cond.has_result);
+  cstr_drop(&cond.arg);
+
+  cond = condition_create(check_fn_has, "/bin/sh", false);
+  TEST_ASSERT_TRUE(check_fn_has(&cond, &info));
+  cstr_drop(&cond.arg);
+}
+
+void test_malformed(void) {
+  TEST_ASSERT_FALSE(rifle_rules_add(&rifle, "ext png"));
+  TEST_ASSERT_FALSE(rifle_rules_add(&rifle, "foo bar = cmd"));
+  TEST_ASSERT_EQUAL(c_arraylen(config), rifle_rules_size(&rifle));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_match);
+  RUN_TEST(test_index);
+  RUN_TEST(test_mime_pattern_type);
+  RUN_TEST(test_has);
+  RUN_TEST(test_malformed);
+  return UNITY_END();
+}
@@ -0,0 +1,194 @@
+// Compares the comparison sorts used by dir_sort with the radix sort, and
+// natural sorting via strnatcasecmp with the precomputed natural sort keys, on
+// synthetic files.
+//
+// usage: sort_bench [num_files] [iterations]
+
+#define i_implement
+#include <stc/cstr.h>
+
+#include "file.h"
+#include "sort.h"
+#include "strnatcmp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define i_type files_size, File *
+#define i_cmp compare_size
+#include <stc/sort.h>
+
+#define i_type files_mtime, File *
+#define i_cmp compare_mtime
+#include <stc/sort.h>
+
+#define i_type files_natural, File *
+#define i_cmp compare_natural
+#include <stc/sort.h>
+
+// how compare_natural worked before natural sort keys
+static i64 compare_strnatcasecmp(const void *a, const void *b) {
+  const File *aa = *(File **)a;
+  const File *bb = *(File **)b;
+  i64 cmp = strnatcasecmp(file_name_str(aa), file_name_str(bb));
+  if (cmp)
+    return cmp;
+  return (i64)(aa->lstat.ino - bb->lstat.ino);
+}
+
+#define i_type files_strnat, File *
+#define i_cmp compare_strnatcasecmp
+#include <stc/sort.h>
+
+static u64 now_micros(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((u64)tv.tv_sec) * 1000 * 1000 + tv.tv_usec;
+}
+
+static u64 rng_state = 42;
+
+static u64 rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static void shuffle(File **files, u32 n) {
+  for (u32 i = n - 1; i > 0; i--) {
+    u32 j = rng() % (i + 1);
+    File *t = files[i];
+    files[i] = files[j];
+    files[j] = t;
+  }
+}
+
+static u32 generate_name(char *buf, u32 i) {
+  switch (rng() % 4) {
+  case 0:
+    return sprintf(buf, "IMG_%04u.jpg", i);
+  case 1:
+    return sprintf(buf, "%02u - Track %u.flac", (u32)(rng() % 100), i);
+  case 2:
+    return sprintf(buf, "report-v%u.%u-final.PDF", i, (u32)(rng() % 20));
+  default:
+    return sprintf(buf, "file%u", (u32)rng());
+  }
+}
+
+// Files are allocated individually and shuffled before each run, like in a
+// real directory the pointers are not ordered in memory.
+static File **generate_files(u32 n) {
+  File **files = malloc(n * sizeof *files);
+  for (u32 i = 0; i < n; i++) {
+    char name[64];
+    u32 len = generate_name(name, i);
+    usize keylen = natural_sort_key(name, NULL);
+    File *f = calloc(1, sizeof *f + len + 1 + keylen + 1);
+    char *str = (char *)(f + 1);
+    memcpy(str, name, len + 1);
+    f->name = (zsview){str, len};
+    f->natkey = str + len + 1;
+    natural_sort_key(name, (char *)f->natkey);
+    f->lstat.ino = i + 1;
+    f->lstat.mode = S_IFREG | 0644;
+    f->lstat.size = rng() % (1 << 24);
+    f->lstat.mtime = 1600000000 + rng() % (1 << 27);
+    f->lstat.mtime_nsec = rng() % 1000000000;
+    files[i] = f;
+  }
+  return files;
+}
+
+static void report(const char *name, u64 best, u32 n) {
+  printf("%-14s %8u files  best %8.2f ms  %6.1f ns/file\n", name, n,
+         best / 1000.0, 1000.0 * best / n);
+}
+
+int main(int argc, char **argv) {
+  u32 n = argc > 1 ? atoi(argv[1]) : 1000000;
+  u32 iterations = argc > 2 ? atoi(argv[2]) : 5;
+  if (n < 2)
+    n = 2;
+
+  File **files = generate_files(n);
+
+  u64 best_cmp = UINT64_MAX;
+  u64 best_radix = UINT64_MAX;
+  for (u32 i = 0; i < iterations; i++) {
+    shuffle(files, n);
+    u64 t0 = now_micros();
+    files_mtime_sort(files, n);
+    u64 t = now_micros() - t0;
+    if (t < best_cmp)
+      best_cmp = t;
+
+    shuffle(files, n);
+    t0 = now_micros();
+    files_radix_sort(files, n, SORT_MTIME);
+    t = now_micros() - t0;
+    if (t < best_radix)
+      best_radix = t;
+  }
+  report("mtime cmp", best_cmp, n);
+  report("mtime radix", best_radix, n);
+
+  best_cmp = best_radix = UINT64_MAX;
+  for (u32 i = 0; i < iterations; i++) {
+    shuffle(files, n);
+    u64 t0 = now_micros();
+    files_size_sort(files, n);
+    u64 t = now_micros() - t0;
+    if (t < best_cmp)
+      best_cmp = t;
+
+    shuffle(files, n);
+    t0 = now_micros();
+    files_radix_sort(files, n, SORT_SIZE);
+    t = now_micros() - t0;
+    if (t < best_radix)
+      best_radix = t;
+  }
+  report("size cmp", best_cmp, n);
+  report("size radix", best_radix, n);
+
+  // building the keys happens once per load, on the loader thread
+  char key[256];
+  u64 best_keys = UINT64_MAX;
+  for (u32 i = 0; i < iterations; i++) {
+    u64 t0 = now_micros();
+    for (u32 j = 0; j < n; j++)
+      natural_sort_key(file_name_str(files[j]), key);
+    u64 t = now_micros() - t0;
+    if (t < best_keys)
+      best_keys = t;
+  }
+  report("natural keys", best_keys, n);
+
+  best_cmp = best_radix = UINT64_MAX;
+  for (u32 i = 0; i < iterations; i++) {
+    shuffle(files, n);
+    u64 t0 = now_micros();
+    files_strnat_sort(files, n);
+    u64 t = now_micros() - t0;
+    if (t < best_cmp)
+      best_cmp = t;
+
+    shuffle(files, n);
+    t0 = now_micros();
+    files_natural_sort(files, n);
+    t = now_micros() - t0;
+    if (t < best_radix)
+      best_radix = t;
+  }
+  report("strnatcasecmp", best_cmp, n);
+  report("natural key", best_radix, n);
+
+  for (u32 i = 0; i < n; i++)
+    free(files[i]);
+  free(files);
+  return 0;
+}
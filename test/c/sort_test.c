@@ -0,0 +1,132 @@
+#define i_implement
+#include <stc/cstr.h>
+
+#include "sort.c"
+#include "strnatcmp.c"
+#include "unity.h"
+
+#define i_type files_size, File *
+#define i_cmp compare_size
+#include <stc/sort.h>
+
+#define i_type files_mtime, File *
+#define i_cmp compare_mtime
+#include <stc/sort.h>
+
+#define i_type files_key, File *
+#define i_cmp compare_key
+#include <stc/sort.h>
+
+#define NUM_FILES 5000
+
+static File files[NUM_FILES];
+static File *a[NUM_FILES];
+static File *b[NUM_FILES];
+
+static u64 rng_state = 42;
+
+static u64 rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+void setUp(void) {
+  for (u32 i = 0; i < NUM_FILES; i++) {
+    File *f = &files[i];
+    memset(f, 0, sizeof *f);
+    f->lstat.ino = (u64)i * 2654435761u % 4294967291u; // unique, shuffled
+    f->lstat.mode = S_IFREG | 0644;
+    // few distinct values to exercise the tie breaker
+    f->lstat.size = rng() % 100;
+    f->lstat.mtime = 1700000000 + rng() % 50;
+    f->lstat.mtime_nsec = rng() % 3;
+    f->key = (i64)(rng() % 1000) - 500; // negative keys as well
+    a[i] = b[i] = f;
+  }
+}
+
+void tearDown(void) {}
+
+void test_radix_sort_size(void) {
+  TEST_ASSERT_TRUE(files_radix_sort(a, NUM_FILES, SORT_SIZE));
+  files_size_sort(b, NUM_FILES);
+  TEST_ASSERT_EQUAL_MEMORY(b, a, sizeof a);
+}
+
+void test_radix_sort_mtime(void) {
+  TEST_ASSERT_TRUE(files_radix_sort(a, NUM_FILES, SORT_MTIME));
+  files_mtime_sort(b, NUM_FILES);
+  TEST_ASSERT_EQUAL_MEMORY(b, a, sizeof a);
+}
+
+void test_radix_sort_key(void) {
+  TEST_ASSERT_TRUE(files_radix_sort(a, NUM_FILES, SORT_RAND));
+  files_key_sort(b, NUM_FILES);
+  TEST_ASSERT_EQUAL_MEMORY(b, a, sizeof a);
+}
+
+static i32 sign(i64 x) {
+  return (x > 0) - (x < 0);
+}
+
+static i32 natcmp_keys(const char *a, const char *b) {
+  char ka[64], kb[64];
+  natural_sort_key(a, ka);
+  natural_sort_key(b, kb);
+  return sign(strcmp(ka, kb));
+}
+
+void test_natural_key(void) {
+  TEST_ASSERT_EQUAL(-1, natcmp_keys("file2", "file10"));
+  TEST_ASSERT_EQUAL(-1, natcmp_keys("File2", "file10"));
+  TEST_ASSERT_EQUAL(-1, natcmp_keys("x9", "x10"));
+  TEST_ASSERT_EQUAL(-1, natcmp_keys("1.05", "1.5"));
+  TEST_ASSERT_EQUAL(-1, natcmp_keys("01", "1"));
+  TEST_ASSERT_EQUAL(-1, natcmp_keys("a", "a1"));
+  TEST_ASSERT_EQUAL(-1, natcmp_keys("a1", "aa"));
+  TEST_ASSERT_EQUAL(0, natcmp_keys("a b", "ab"));
+  TEST_ASSERT_EQUAL(0, natcmp_keys("ABC", "abc"));
+
+  char key[64];
+  TEST_ASSERT_EQUAL(0, natural_sort_key("", key));
+  usize len = natural_sort_key("a12b007", key);
+  TEST_ASSERT_EQUAL(strlen(key), len);
+  TEST_ASSERT_EQUAL(len, natural_sort_key("a12b007", NULL));
+}
+
+void test_natural_key_matches_strnatcasecmp(void) {
+  // small alphabet so that digit runs, case and whitespace collide often
+  static const char alphabet[] = "aAbZ0019 ._-";
+  char names[1000][8];
+  for (u32 i = 0; i < 1000; i++) {
+    u32 len = rng() % (sizeof names[i] - 1);
+    for (u32 j = 0; j < len; j++)
+      names[i][j] = alphabet[rng() % (sizeof alphabet - 1)];
+    names[i][len] = 0;
+  }
+  for (u32 i = 0; i < 1000; i++) {
+    for (u32 j = 0; j < 1000; j++) {
+      TEST_ASSERT_EQUAL_INT_MESSAGE(sign(strnatcasecmp(names[i], names[j])),
+                                    natcmp_keys(names[i], names[j]),
+                                    names[i]);
+    }
+  }
+}
+
+void test_radix_sort_small(void) {
+  // small inputs are left to the comparison sort
+  TEST_ASSERT_FALSE(files_radix_sort(a, 10, SORT_SIZE));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_radix_sort_size);
+  RUN_TEST(test_radix_sort_mtime);
+  RUN_TEST(test_radix_sort_key);
+  RUN_TEST(test_radix_sort_small);
+  RUN_TEST(test_natural_key);
+  RUN_TEST(test_natural_key_matches_strnatcasecmp);
+  return UNITY_END();
+}
@@ -0,0 +1,253 @@
+// Compares the work-stealing thread pool with the previous design (a single
+// mutex protected queue, every worker woken on each job) under contention:
+// tiny jobs submitted by several threads at once, and jobs that fan out from
+// inside the pool.
+//
+// usage: tpool_bench [num_jobs] [num_threads] [num_producers]
+
+#include "tpool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+// tpool.c calls these when a worker exits
+void L_thread_destroy() {}
+void dirio_thread_destroy(void) {}
+
+static u64 now_micros(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((u64)tv.tv_sec) * 1000 * 1000 + tv.tv_usec;
+}
+
+// The previous tpool: one list, one mutex, broadcast on every job.
+struct legacy_work {
+  thread_func_t func;
+  void *arg;
+  struct legacy_work *next;
+};
+
+struct legacy_pool {
+  struct legacy_work *first;
+  struct legacy_work *last;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;
+  pthread_cond_t working_cond;
+  usize working_cnt;
+  usize thread_cnt;
+  bool stop;
+};
+
+static void *legacy_worker(void *arg) {
+  struct legacy_pool *tm = arg;
+  pthread_mutex_lock(&tm->mutex);
+  while (1) {
+    while (tm->first == NULL && !tm->stop)
+      pthread_cond_wait(&tm->work_cond, &tm->mutex);
+    if (tm->stop)
+      break;
+    struct legacy_work *work = tm->first;
+    tm->first = work->next;
+    if (tm->first == NULL)
+      tm->last = NULL;
+    tm->working_cnt++;
+    pthread_mutex_unlock(&tm->mutex);
+
+    work->func(work->arg);
+    free(work);
+
+    pthread_mutex_lock(&tm->mutex);
+    tm->working_cnt--;
+    if (tm->working_cnt == 0 && tm->first == NULL)
+      pthread_cond_signal(&tm->working_cond);
+  }
+  tm->thread_cnt--;
+  pthread_cond_signal(&tm->working_cond);
+  pthread_mutex_unlock(&tm->mutex);
+  return NULL;
+}
+
+static struct legacy_pool *legacy_create(usize num) {
+  struct legacy_pool *tm = calloc(1, sizeof *tm);
+  pthread_mutex_init(&tm->mutex, NULL);
+  pthread_cond_init(&tm->work_cond, NULL);
+  pthread_cond_init(&tm->working_cond, NULL);
+  tm->thread_cnt = num;
+  for (usize i = 0; i < num; i++) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, legacy_worker, tm);
+    pthread_detach(thread);
+  }
+  return tm;
+}
+
+static void legacy_add_work(struct legacy_pool *tm, thread_func_t func,
+                            void *arg) {
+  struct legacy_work *work = malloc(sizeof *work);
+  work->func = func;
+  work->arg = arg;
+  work->next = NULL;
+  pthread_mutex_lock(&tm->mutex);
+  if (tm->first == NULL) {
+    tm->first = work;
+    tm->last = work;
+  } else {
+    work->next = tm->first;
+    tm->first = work;
+  }
+  pthread_cond_broadcast(&tm->work_cond);
+  pthread_mutex_unlock(&tm->mutex);
+}
+
+static void legacy_wait(struct legacy_pool *tm) {
+  pthread_mutex_lock(&tm->mutex);
+  while ((!tm->stop && (tm->working_cnt != 0 || tm->first != NULL)) ||
+         (tm->stop && tm->thread_cnt != 0))
+    pthread_cond_wait(&tm->working_cond, &tm->mutex);
+  pthread_mutex_unlock(&tm->mutex);
+}
+
+static void legacy_destroy(struct legacy_pool *tm) {
+  pthread_mutex_lock(&tm->mutex);
+  tm->stop = true;
+  pthread_cond_broadcast(&tm->work_cond);
+  pthread_mutex_unlock(&tm->mutex);
+  legacy_wait(tm);
+  pthread_mutex_destroy(&tm->mutex);
+  pthread_cond_destroy(&tm->work_cond);
+  pthread_cond_destroy(&tm->working_cond);
+  free(tm);
+}
+
+// Both pools behind the same interface.
+struct pool {
+  const char *name;
+  void *(*create)(usize num);
+  void (*add)(void *tm, thread_func_t func, void *arg);
+  void (*wait)(void *tm);
+  void (*destroy)(void *tm);
+};
+
+static void *tpool_create_(usize num) {
+  return tpool_create(num);
+}
+static void tpool_add_(void *tm, thread_func_t func, void *arg) {
+  tpool_add_work(tm, func, arg, TPOOL_FOREGROUND);
+}
+static void tpool_wait_(void *tm) {
+  tpool_wait(tm);
+}
+static void tpool_destroy_(void *tm) {
+  tpool_destroy(tm);
+}
+
+static void *legacy_create_(usize num) {
+  return legacy_create(num);
+}
+static void legacy_add_(void *tm, thread_func_t func, void *arg) {
+  legacy_add_work(tm, func, arg);
+}
+static void legacy_wait_(void *tm) {
+  legacy_wait(tm);
+}
+static void legacy_destroy_(void *tm) {
+  legacy_destroy(tm);
+}
+
+static const struct pool pools[] = {
+    {"mutex queue", legacy_create_, legacy_add_, legacy_wait_,
+     legacy_destroy_},
+    {"work stealing", tpool_create_, tpool_add_, tpool_wait_, tpool_destroy_},
+};
+
+static atomic_ulong sink;
+
+// roughly the cost of a cheap stat
+static void tiny_job(void *arg) {
+  u64 x = (uintptr_t)arg;
+  for (int i = 0; i < 200; i++)
+    x = x * 6364136223846793005u + 1442695040888963407u;
+  atomic_fetch_add_explicit(&sink, x & 1, memory_order_relaxed);
+}
+
+struct producer {
+  const struct pool *pool;
+  void *tm;
+  u32 n;
+};
+
+static void *produce(void *arg) {
+  struct producer *p = arg;
+  for (u32 i = 0; i < p->n; i++)
+    p->pool->add(p->tm, tiny_job, (void *)(uintptr_t)i);
+  return NULL;
+}
+
+static const struct pool *fan_out_pool;
+static void *fan_out_tm;
+
+// like dir_load fanning out to helpers from a worker
+static void fan_out(void *arg) {
+  uintptr_t depth = (uintptr_t)arg;
+  tiny_job(arg);
+  if (depth > 0) {
+    fan_out_pool->add(fan_out_tm, fan_out, (void *)(depth - 1));
+    fan_out_pool->add(fan_out_tm, fan_out, (void *)(depth - 1));
+  }
+}
+
+int main(int argc, char **argv) {
+  u32 n = argc > 1 ? atoi(argv[1]) : 200000;
+  u32 num_threads = argc > 2 ? atoi(argv[2]) : 8;
+  u32 num_producers = argc > 3 ? atoi(argv[3]) : 4;
+  if (num_producers == 0)
+    num_producers = 1;
+
+  u32 depth = 0;
+  while ((2u << depth) - 1 < n)
+    depth++;
+
+  for (usize k = 0; k < sizeof pools / sizeof *pools; k++) {
+    const struct pool *pool = &pools[k];
+    void *tm = pool->create(num_threads);
+
+    u64 t0 = now_micros();
+    struct producer p = {pool, tm, n};
+    produce(&p);
+    pool->wait(tm);
+    u64 t_single = now_micros() - t0;
+
+    pthread_t *threads = malloc(num_producers * sizeof *threads);
+    struct producer *ps = malloc(num_producers * sizeof *ps);
+    t0 = now_micros();
+    for (u32 i = 0; i < num_producers; i++) {
+      ps[i] = (struct producer){pool, tm, n / num_producers};
+      pthread_create(&threads[i], NULL, produce, &ps[i]);
+    }
+    for (u32 i = 0; i < num_producers; i++)
+      pthread_join(threads[i], NULL);
+    pool->wait(tm);
+    u64 t_multi = now_micros() - t0;
+    free(threads);
+    free(ps);
+
+    fan_out_pool = pool;
+    fan_out_tm = tm;
+    t0 = now_micros();
+    pool->add(tm, fan_out, (void *)(uintptr_t)depth);
+    pool->wait(tm);
+    u64 t_nested = now_micros() - t0;
+
+    pool->destroy(tm);
+
+    printf("%-14s %u threads  1 producer %8.2f ms  %u producers %8.2f ms  "
+           "nested %8.2f ms (%u jobs)\n",
+           pool->name, num_threads, t_single / 1000.0, num_producers,
+           t_multi / 1000.0, t_nested / 1000.0, (2u << depth) - 1);
+  }
+  return 0;
+}
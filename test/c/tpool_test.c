@@ -0,0 +1,182 @@
+#include "tpool.c"
+#include "unity.h"
+
+#include <time.h>
+
+// tpool.c calls these when a worker exits
+_Thread_local lua_State *L_thread = NULL;
+void L_thread_destroy() {}
+void dirio_thread_destroy(void) {}
+
+static atomic_uint counter;
+
+void setUp(void) {
+  atomic_store(&counter, 0);
+}
+
+void tearDown(void) {}
+
+static void increment(void *arg) {
+  (void)arg;
+  atomic_fetch_add(&counter, 1);
+}
+
+void test_add_work(void) {
+  tpool_t *tm = tpool_create(4);
+  TEST_ASSERT_EQUAL(4, tpool_size(tm));
+  for (int i = 0; i < 10000; i++)
+    TEST_ASSERT_TRUE(
+        tpool_add_work(tm, increment, NULL, i % TPOOL_NUM_LANES));
+  tpool_wait(tm);
+  TEST_ASSERT_EQUAL(10000, atomic_load(&counter));
+  tpool_destroy(tm);
+}
+
+void test_add_job(void) {
+  static struct tpool_job jobs[1000];
+  tpool_t *tm = tpool_create(3);
+  for (int i = 0; i < 1000; i++)
+    TEST_ASSERT_TRUE(
+        tpool_add_job(tm, &jobs[i], increment, NULL, TPOOL_FOREGROUND));
+  tpool_wait(tm);
+  TEST_ASSERT_EQUAL(1000, atomic_load(&counter));
+
+  // nodes can be queued again once they ran
+  for (int i = 0; i < 1000; i++)
+    tpool_add_job(tm, &jobs[i], increment, NULL, TPOOL_BACKGROUND);
+  tpool_wait(tm);
+  TEST_ASSERT_EQUAL(2000, atomic_load(&counter));
+  tpool_destroy(tm);
+}
+
+static tpool_t *nested_pool;
+
+// Spawns two children until depth reaches 0, from inside the pool, so that
+// jobs are pushed to the deques of the workers and have to be stolen.
+static void fan_out(void *arg) {
+  uintptr_t depth = (uintptr_t)arg;
+  atomic_fetch_add(&counter, 1);
+  if (depth > 0) {
+    void *arg = (void *)(depth - 1);
+    tpool_add_work(nested_pool, fan_out, arg, TPOOL_FOREGROUND);
+    tpool_add_work(nested_pool, fan_out, arg, TPOOL_FOREGROUND);
+  }
+}
+
+void test_nested(void) {
+  nested_pool = tpool_create(4);
+  tpool_add_work(nested_pool, fan_out, (void *)12, TPOOL_FOREGROUND);
+  tpool_wait(nested_pool);
+  TEST_ASSERT_EQUAL((1 << 13) - 1, atomic_load(&counter));
+  tpool_destroy(nested_pool);
+}
+
+static void spawn_many(void *arg) {
+  (void)arg;
+  for (int i = 0; i < 4 * DEQUE_SIZE; i++)
+    tpool_add_work(nested_pool, increment, NULL, TPOOL_FOREGROUND);
+}
+
+void test_deque_overflow(void) {
+  // jobs that don't fit into the deque end up in the injection queue
+  nested_pool = tpool_create(1);
+  tpool_add_work(nested_pool, spawn_many, NULL, TPOOL_FOREGROUND);
+  tpool_wait(nested_pool);
+  TEST_ASSERT_EQUAL(4 * DEQUE_SIZE, atomic_load(&counter));
+  tpool_destroy(nested_pool);
+}
+
+void test_resize(void) {
+  tpool_t *tm = tpool_create(4);
+  tpool_resize(tm, 1);
+  for (int i = 0; i < 1000; i++)
+    tpool_add_work(tm, increment, NULL, TPOOL_FOREGROUND);
+  tpool_wait(tm);
+  TEST_ASSERT_EQUAL(1000, atomic_load(&counter));
+  // idle workers notice the resize and exit
+  for (int i = 0; i < 100 && tpool_size(tm) != 1; i++)
+    nanosleep(&(struct timespec){0, 1000 * 1000}, NULL);
+  TEST_ASSERT_EQUAL(1, tpool_size(tm));
+
+  tpool_resize(tm, 6);
+  TEST_ASSERT_EQUAL(6, tpool_size(tm));
+  for (int i = 0; i < 1000; i++)
+    tpool_add_work(tm, increment, NULL, TPOOL_FOREGROUND);
+  tpool_wait(tm);
+  TEST_ASSERT_EQUAL(2000, atomic_load(&counter));
+  tpool_destroy(tm);
+}
+
+static atomic_bool release;
+static atomic_uint blocked;
+
+static void block(void *arg) {
+  (void)arg;
+  atomic_fetch_add(&blocked, 1);
+  while (!atomic_load(&release))
+    nanosleep(&(struct timespec){0, 100 * 1000}, NULL);
+  atomic_fetch_add(&counter, 1);
+}
+
+void test_lanes(void) {
+  // background jobs never occupy every worker, foreground work gets through
+  // while they are stuck
+  tpool_t *tm = tpool_create(2);
+  atomic_store(&release, false);
+  atomic_store(&blocked, 0);
+  for (int i = 0; i < 16; i++) {
+    tpool_add_work(tm, block, NULL, TPOOL_BACKGROUND);
+    tpool_add_work(tm, block, NULL, TPOOL_PROBE);
+  }
+  for (int i = 0; i < 1000 && atomic_load(&blocked) == 0; i++)
+    nanosleep(&(struct timespec){0, 1000 * 1000}, NULL);
+
+  tpool_add_work(tm, increment, NULL, TPOOL_FOREGROUND);
+  for (int i = 0; i < 1000 && atomic_load(&counter) == 0; i++)
+    nanosleep(&(struct timespec){0, 1000 * 1000}, NULL);
+  TEST_ASSERT_EQUAL(1, atomic_load(&counter));
+  TEST_ASSERT_EQUAL(1, atomic_load(&blocked));
+
+  atomic_store(&release, true);
+  tpool_wait(tm);
+  TEST_ASSERT_EQUAL(33, atomic_load(&counter));
+  tpool_destroy(tm);
+}
+
+void test_transfer_lane(void) {
+  // long running transfers leave the background lane alone
+  tpool_t *tm = tpool_create(9);
+  atomic_store(&release, false);
+  atomic_store(&blocked, 0);
+  atomic_store(&counter, 0);
+  TEST_ASSERT_EQUAL(4, tpool_lane_limit(tm, TPOOL_BACKGROUND));
+  TEST_ASSERT_EQUAL(2, tpool_lane_limit(tm, TPOOL_TRANSFER));
+  for (int i = 0; i < 16; i++)
+    tpool_add_work(tm, block, NULL, TPOOL_TRANSFER);
+  for (int i = 0; i < 1000 && atomic_load(&blocked) < 2; i++)
+    nanosleep(&(struct timespec){0, 1000 * 1000}, NULL);
+
+  for (int i = 0; i < 4; i++)
+    tpool_add_work(tm, increment, NULL, TPOOL_BACKGROUND);
+  for (int i = 0; i < 1000 && atomic_load(&counter) < 4; i++)
+    nanosleep(&(struct timespec){0, 1000 * 1000}, NULL);
+  TEST_ASSERT_EQUAL(4, atomic_load(&counter));
+  TEST_ASSERT_EQUAL(2, atomic_load(&blocked));
+
+  atomic_store(&release, true);
+  tpool_wait(tm);
+  TEST_ASSERT_EQUAL(20, atomic_load(&counter));
+  tpool_destroy(tm);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_add_work);
+  RUN_TEST(test_add_job);
+  RUN_TEST(test_nested);
+  RUN_TEST(test_deque_overflow);
+  RUN_TEST(test_resize);
+  RUN_TEST(test_lanes);
+  RUN_TEST(test_transfer_lane);
+  return UNITY_END();
+}
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE // for transfer.c
+#define i_implement
+#include <stc/cstr.h>
+#define i_implement
+#include "types/vec_cstr.h"
+
+#include "memory.c"
+#include "transfer.c"
+#include "unity.h"
+
+#include <semaphore.h>
+#include <stdarg.h>
+
+// transfer.c only logs
+void log_log(i32 level, const char *file, i32 line, const char *fmt, ...) {
+  (void)level;
+  (void)file;
+  (void)line;
+  (void)fmt;
+}
+
+static char root[] = "/tmp/lfm_transfer_test.XXXXXX";
+static char path[PATH_MAX];
+
+static sem_t done;
+
+static void *run_worker(void *arg) {
+  transfer_work(arg);
+  return NULL;
+}
+
+static bool spawn_thread(struct transfer *t) {
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, run_worker, t) != 0)
+    return false;
+  pthread_detach(thread);
+  return true;
+}
+
+static void on_done(struct transfer *t) {
+  (void)t;
+  sem_post(&done);
+}
+
+static const char *at(const char *rel) {
+  snprintf(path, sizeof path, "%s/%s", root, rel);
+  return path;
+}
+
+static void write_file(const char *rel, const char *content) {
+  FILE *fp = fopen(at(rel), "w");
+  TEST_ASSERT_NOT_NULL(fp);
+  fputs(content, fp);
+  fclose(fp);
+}
+
+static void assert_content(const char *rel, const char *content) {
+  char buf[256] = {0};
+  FILE *fp = fopen(at(rel), "r");
+  TEST_ASSERT_NOT_NULL(fp);
+  TEST_ASSERT_TRUE(fread(buf, 1, sizeof buf - 1, fp) < sizeof buf - 1);
+  fclose(fp);
+  TEST_ASSERT_EQUAL_STRING(content, buf);
+}
+
+static bool exists(const char *rel) {
+  struct stat st;
+  return lstat(at(rel), &st) == 0;
+}
+
+// Pastes the files, relative to root, into `dest` and waits for it.
+static void paste(struct transfer *t, const char *dest, bool move,
+                  cancel_token *cancel, const char **files, u32 num) {
+  vec_cstr paths = vec_cstr_init();
+  for (u32 i = 0; i < num; i++)
+    vec_cstr_push(&paths, cstr_from(at(files[i])));
+  transfer_init(t, paths, zsview_from(at(dest)), move, 4);
+  t->cancel = cancel;
+  t->spawn = spawn_thread;
+  t->done = on_done;
+  transfer_start(t);
+  sem_wait(&done);
+}
+
+void setUp(void) {
+  mkdir(at("src"), 0755);
+  mkdir(at("dst"), 0755);
+}
+
+void tearDown(void) {
+  char cmd[PATH_MAX + 16];
+  snprintf(cmd, sizeof cmd, "chmod -R u+rwx %s/*; rm -rf %s/*", root, root);
+  TEST_ASSERT_EQUAL(0, system(cmd));
+}
+
+void test_copy_tree(void) {
+  mkdir(at("src/tree"), 0755);
+  mkdir(at("src/tree/sub"), 0755);
+  write_file("src/tree/a", "a");
+  write_file("src/tree/sub/b", "bb");
+  TEST_ASSERT_EQUAL(0, symlink("sub/b", at("src/tree/link")));
+  for (int i = 0; i < 100; i++) {
+    char name[32];
+    snprintf(name, sizeof name, "src/tree/sub/%d", i);
+    write_file(name, name);
+  }
+  mkdir(at("src/tree/ro"), 0755);
+  write_file("src/tree/ro/c", "c");
+  chmod(at("src/tree/ro"), 0555);
+  write_file("src/file", "file");
+
+  struct transfer t;
+  const char *files[] = {"src/tree", "src/file"};
+  paste(&t, "dst", false, NULL, files, 2);
+  TEST_ASSERT_EQUAL_STRING("", cstr_str(&t.error));
+  TEST_ASSERT_EQUAL(0, t.errors);
+  // 3 directories, 104 files, 1 link
+  TEST_ASSERT_EQUAL(108, t.entries_done);
+  TEST_ASSERT_EQUAL(1 + 2 + 10 * 14 + 90 * 15 + 1 + 4, t.bytes_done);
+  transfer_deinit(&t);
+
+  assert_content("dst/tree/a", "a");
+  assert_content("dst/tree/sub/b", "bb");
+  assert_content("dst/tree/sub/42", "src/tree/sub/42");
+  assert_content("dst/tree/ro/c", "c");
+  assert_content("dst/file", "file");
+  char target[64] = {0};
+  TEST_ASSERT_EQUAL(5, readlink(at("dst/tree/link"), target, sizeof target));
+  TEST_ASSERT_EQUAL_STRING("sub/b", target);
+  struct stat st;
+  TEST_ASSERT_EQUAL(0, stat(at("dst/tree/ro"), &st));
+  TEST_ASSERT_EQUAL(0, st.st_mode & S_IWUSR);
+  // the sources are untouched
+  assert_content("src/tree/a", "a");
+}
+
+void test_backup(void) {
+  write_file("src/a", "new");
+  write_file("dst/a", "old");
+  write_file("dst/a.~1~", "older");
+
+  struct transfer t;
+  const char *files[] = {"src/a"};
+  paste(&t, "dst", false, NULL, files, 1);
+  TEST_ASSERT_EQUAL(0, t.errors);
+  transfer_deinit(&t);
+
+  assert_content("dst/a", "old");
+  assert_content("dst/a.~1~", "older");
+  assert_content("dst/a.~2~", "new");
+}
+
+void test_move(void) {
+  mkdir(at("src/dir"), 0755);
+  write_file("src/dir/a", "a");
+  write_file("src/b", "b");
+  write_file("dst/b", "old");
+
+  struct transfer t;
+  const char *files[] = {"src/dir", "src/b"};
+  paste(&t, "dst", true, NULL, files, 2);
+  TEST_ASSERT_EQUAL(0, t.errors);
+  TEST_ASSERT_EQUAL(2, t.entries_done);
+  transfer_deinit(&t);
+
+  assert_content("dst/dir/a", "a");
+  assert_content("dst/b", "old");
+  assert_content("dst/b.~1~", "b");
+  TEST_ASSERT_FALSE(exists("src/dir"));
+  TEST_ASSERT_FALSE(exists("src/b"));
+}
+
+void test_copy_strips_setuid(void) {
+  write_file("src/a", "a");
+  chmod(at("src/a"), 04755);
+
+  struct transfer t;
+  const char *files[] = {"src/a"};
+  paste(&t, "dst", false, NULL, files, 1);
+  TEST_ASSERT_EQUAL(0, t.errors);
+  transfer_deinit(&t);
+
+  struct stat st;
+  TEST_ASSERT_EQUAL(0, stat(at("dst/a"), &st));
+  TEST_ASSERT_EQUAL(0, st.st_mode & S_ISUID);
+}
+
+// Moves across filesystems copy, which has to keep the metadata like mv.
+// Copies the entries directly, the test can't rely on a second filesystem.
+void test_move_copy_keeps_metadata(void) {
+  mkdir(at("src/dir"), 0750);
+  write_file("src/a", "a");
+  chmod(at("src/a"), 04700);
+  struct timespec times[2] = {{1000000000, 0}, {1000000000, 0}};
+  TEST_ASSERT_EQUAL(0, utimensat(AT_FDCWD, at("src/a"), times, 0));
+  TEST_ASSERT_EQUAL(0, utimensat(AT_FDCWD, at("src/dir"), times, 0));
+
+  struct transfer t;
+  transfer_init(&t, vec_cstr_init(), zsview_from(at("dst")), true, 1);
+  t.done = on_done;
+  const char *names[] = {"a", "dir"};
+  for (int i = 0; i < 2; i++) {
+    char src[PATH_MAX];
+    char dst[PATH_MAX];
+    snprintf(src, sizeof src, "%s/src/%s", root, names[i]);
+    snprintf(dst, sizeof dst, "%s/dst/%s", root, names[i]);
+    struct stat st;
+    TEST_ASSERT_EQUAL(0, lstat(src, &st));
+    TEST_ASSERT_EQUAL(0, copy_entry(&t, 0, src, &st, dst));
+  }
+  finish(&t); // restores the times of the directory
+  sem_wait(&done);
+  transfer_deinit(&t);
+
+  struct stat st;
+  TEST_ASSERT_EQUAL(0, stat(at("dst/a"), &st));
+  TEST_ASSERT_EQUAL(04700, st.st_mode & 07777);
+  TEST_ASSERT_EQUAL(1000000000, st.st_mtim.tv_sec);
+  TEST_ASSERT_EQUAL(0, stat(at("dst/dir"), &st));
+  TEST_ASSERT_EQUAL(0750, st.st_mode & 07777);
+  TEST_ASSERT_EQUAL(1000000000, st.st_mtim.tv_sec);
+}
+
+void test_move_in_place(void) {
+  write_file("src/a", "a");
+
+  struct transfer t;
+  const char *files[] = {"src/a"};
+  paste(&t, "src", true, NULL, files, 1);
+  TEST_ASSERT_EQUAL(0, t.errors);
+  transfer_deinit(&t);
+
+  assert_content("src/a", "a");
+  TEST_ASSERT_FALSE(exists("src/a.~1~"));
+}
+
+void test_copy_into_itself(void) {
+  mkdir(at("src/dir"), 0755);
+
+  struct transfer t;
+  const char *files[] = {"src/dir"};
+  paste(&t, "src/dir", false, NULL, files, 1);
+  TEST_ASSERT_EQUAL(1, t.errors);
+  transfer_deinit(&t);
+
+  TEST_ASSERT_FALSE(exists("src/dir/dir"));
+}
+
+void test_errors(void) {
+  write_file("src/a", "a");
+
+  struct transfer t;
+  const char *files[] = {"src/missing", "src/a", "src/missing2"};
+  paste(&t, "dst", false, NULL, files, 3);
+  TEST_ASSERT_EQUAL(2, t.errors);
+  char expected[PATH_MAX + 64];
+  snprintf(expected, sizeof expected, "%s: %s", at("src/missing"),
+           strerror(ENOENT));
+  TEST_ASSERT_EQUAL_STRING(expected, cstr_str(&t.error));
+  transfer_deinit(&t);
+
+  assert_content("dst/a", "a");
+}
+
+void test_cancel(void) {
+  write_file("src/a", "a");
+  mkdir(at("src/dir"), 0755);
+
+  cancel_token *cancel = cancel_token_create(NULL);
+  cancel_token_cancel(cancel);
+  struct transfer t;
+  const char *files[] = {"src/a", "src/dir"};
+  paste(&t, "dst", true, cancel, files, 2);
+  TEST_ASSERT_EQUAL(0, t.errors);
+  TEST_ASSERT_EQUAL(0, t.entries_done);
+  transfer_deinit(&t);
+  cancel_token_unref(cancel);
+
+  TEST_ASSERT_FALSE(exists("dst/a"));
+  TEST_ASSERT_TRUE(exists("src/a"));
+}
+
+void test_nothing(void) {
+  struct transfer t;
+  paste(&t, "dst", false, NULL, NULL, 0);
+  TEST_ASSERT_EQUAL(0, t.errors);
+  transfer_deinit(&t);
+}
+
+int main(void) {
+  if (mkdtemp(root) == NULL)
+    return 1;
+  sem_init(&done, 0, 0);
+  UNITY_BEGIN();
+  RUN_TEST(test_copy_tree);
+  RUN_TEST(test_backup);
+  RUN_TEST(test_move);
+  RUN_TEST(test_copy_strips_setuid);
+  RUN_TEST(test_move_copy_keeps_metadata);
+  RUN_TEST(test_move_in_place);
+  RUN_TEST(test_copy_into_itself);
+  RUN_TEST(test_errors);
+  RUN_TEST(test_cancel);
+  RUN_TEST(test_nothing);
+  i32 res = UNITY_END();
+  rmdir(root);
+  return res;
+}